@@ -0,0 +1,246 @@
+/*
+ * GStreamer dreamrtspserver
+ * Copyright 2015-2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * Alternatively, this program may be distributed and executed on
+ * hardware which is licensed by Dream Property GmbH.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#include "dreamring.h"
+
+GST_DEBUG_CATEGORY_EXTERN (dreamrtspserver_debug);
+#define GST_CAT_DEFAULT dreamrtspserver_debug
+
+#define RING_INDEX(ring, seq) ((guint) ((seq) % (ring)->size))
+
+static void _ring_drop_tail (DreamRing *ring)
+{
+	guint i = RING_INDEX (ring, ring->tail);
+	gst_sample_unref (ring->samples[i]);
+	ring->samples[i] = NULL;
+	ring->tail++;
+}
+
+static void _ring_flush (DreamRing *ring)
+{
+	while (ring->tail < ring->head)
+		_ring_drop_tail (ring);
+	ring->last_time = GST_CLOCK_TIME_NONE;
+	if (ring->mark)
+		gst_structure_free (ring->mark);
+	ring->mark = NULL;
+}
+
+/* whether the sample at seq is more than max_lag older than the newest one */
+static gboolean _ring_is_late (DreamRing *ring, guint64 seq, GstClockTime max_lag)
+{
+	GstClockTime time = ring->times[RING_INDEX (ring, seq)];
+	if (!GST_CLOCK_TIME_IS_VALID (time) || !GST_CLOCK_TIME_IS_VALID (ring->last_time))
+		return FALSE;
+	return time + max_lag < ring->last_time;
+}
+
+static guint64 _ring_find_keyframe (DreamRing *ring, guint64 seq, GstClockTime max_lag)
+{
+	for (; seq < ring->head; seq++)
+		if (ring->keyframes[RING_INDEX (ring, seq)] && !_ring_is_late (ring, seq, max_lag))
+			break;
+	return seq;
+}
+
+static void _ring_push (DreamRing *ring, GstBuffer *buffer)
+{
+	if (ring->head - ring->tail == ring->size)
+	{
+		ring->overruns++;
+		_ring_drop_tail (ring);
+	}
+
+	guint i = RING_INDEX (ring, ring->head);
+	GstClockTime time = GST_BUFFER_DTS_OR_PTS (buffer);
+	ring->samples[i] = gst_sample_new (buffer, ring->caps, NULL, ring->mark);
+	ring->mark = NULL;
+	ring->times[i] = time;
+	ring->keyframes[i] = !GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+	if (GST_CLOCK_TIME_IS_VALID (time))
+		ring->last_time = time;
+	ring->head++;
+}
+
+static void _ring_dispatch (DreamRing *ring, DreamRingConsumer *c)
+{
+	if (c->cursor < ring->tail)
+	{
+		c->skipped += ring->tail - c->cursor;
+		c->cursor = ring->tail;
+		c->synced = FALSE;
+	}
+	else if (c->synced && c->cursor < ring->head && _ring_is_late (ring, c->cursor, c->max_lag))
+		c->synced = FALSE;
+
+	if (!c->synced)
+	{
+		guint64 seq = _ring_find_keyframe (ring, c->cursor, c->max_lag);
+		c->skipped += seq - c->cursor;
+		c->cursor = seq;
+		if (seq == ring->head)
+			return;
+		GST_DEBUG_OBJECT (ring->pad, "%s consumer %p (re)starts at keyframe #%" G_GUINT64_FORMAT ", %" G_GUINT64_FORMAT " samples skipped so far", ring->name, c, seq, c->skipped);
+		c->synced = TRUE;
+	}
+
+	while (c->cursor < ring->head)
+	{
+		if (!c->func (c, ring->samples[RING_INDEX (ring, c->cursor)], c->user_data))
+			break;
+		c->cursor++;
+	}
+}
+
+/* drops what every consumer has taken and anything older than max_lag */
+static void _ring_trim (DreamRing *ring)
+{
+	guint64 oldest = ring->head;
+	GList *l;
+	for (l = ring->consumers; l; l = l->next)
+		oldest = MIN (oldest, ((DreamRingConsumer *) l->data)->cursor);
+	while (ring->tail < oldest)
+		_ring_drop_tail (ring);
+	while (ring->tail < ring->head && _ring_is_late (ring, ring->tail, ring->max_lag))
+		_ring_drop_tail (ring);
+}
+
+static GstPadProbeReturn _ring_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+	DreamRing *ring = user_data;
+
+	g_mutex_lock (&ring->lock);
+	if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM)
+	{
+		GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+		if (GST_EVENT_TYPE (event) == GST_EVENT_CAPS)
+		{
+			GstCaps *caps;
+			gst_event_parse_caps (event, &caps);
+			gst_caps_replace (&ring->caps, caps);
+		}
+		else if (GST_EVENT_TYPE (event) == GST_EVENT_CUSTOM_DOWNSTREAM && gst_event_get_structure (event))
+		{
+			if (ring->mark)
+				gst_structure_free (ring->mark);
+			ring->mark = gst_structure_copy (gst_event_get_structure (event));
+		}
+		g_mutex_unlock (&ring->lock);
+		return GST_PAD_PROBE_OK;
+	}
+
+	if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER)
+		_ring_push (ring, GST_PAD_PROBE_INFO_BUFFER (info));
+	else if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER_LIST)
+	{
+		GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST (info);
+		guint i, len = gst_buffer_list_length (list);
+		for (i = 0; i < len; i++)
+			_ring_push (ring, gst_buffer_list_get (list, i));
+	}
+
+	GList *l;
+	for (l = ring->consumers; l; l = l->next)
+		_ring_dispatch (ring, l->data);
+	_ring_trim (ring);
+	g_mutex_unlock (&ring->lock);
+
+	return GST_PAD_PROBE_OK;
+}
+
+DreamRing *dream_ring_new (const gchar *name, GstPad *pad, guint size, GstClockTime max_lag)
+{
+	DreamRing *ring = g_new0 (DreamRing, 1);
+	ring->name = g_strdup (name);
+	ring->pad = gst_object_ref (pad);
+	g_mutex_init (&ring->lock);
+	ring->size = size;
+	ring->samples = g_new0 (GstSample *, size);
+	ring->times = g_new0 (GstClockTime, size);
+	ring->keyframes = g_new0 (gboolean, size);
+	ring->max_lag = max_lag;
+	ring->last_time = GST_CLOCK_TIME_NONE;
+	return ring;
+}
+
+void dream_ring_free (DreamRing *ring)
+{
+	if (!ring)
+		return;
+	if (ring->probe_id)
+		gst_pad_remove_probe (ring->pad, ring->probe_id);
+	g_list_free_full (ring->consumers, g_free);
+	_ring_flush (ring);
+	gst_caps_replace (&ring->caps, NULL);
+	gst_object_unref (ring->pad);
+	g_free (ring->samples);
+	g_free (ring->times);
+	g_free (ring->keyframes);
+	g_mutex_clear (&ring->lock);
+	g_free (ring->name);
+	g_free (ring);
+}
+
+DreamRingConsumer *dream_ring_add_consumer (DreamRing *ring, GstClockTime max_lag, DreamRingPushFunc func, gpointer user_data)
+{
+	DreamRingConsumer *c = g_new0 (DreamRingConsumer, 1);
+	c->max_lag = (max_lag && max_lag < ring->max_lag) ? max_lag : ring->max_lag;
+	c->func = func;
+	c->user_data = user_data;
+
+	g_mutex_lock (&ring->lock);
+	c->cursor = ring->head;
+	ring->consumers = g_list_append (ring->consumers, c);
+	if (!ring->probe_id)
+	{
+		/* the caps event went by before the probe was there */
+		GstCaps *caps = gst_pad_get_current_caps (ring->pad);
+		gst_caps_replace (&ring->caps, caps);
+		if (caps)
+			gst_caps_unref (caps);
+		ring->probe_id = gst_pad_add_probe (ring->pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, _ring_probe, ring, NULL);
+	}
+	g_mutex_unlock (&ring->lock);
+
+	GST_DEBUG_OBJECT (ring->pad, "%s consumer %p added (max lag %" GST_TIME_FORMAT ")", ring->name, c, GST_TIME_ARGS (c->max_lag));
+	return c;
+}
+
+void dream_ring_remove_consumer (DreamRing *ring, DreamRingConsumer *consumer)
+{
+	g_mutex_lock (&ring->lock);
+	ring->consumers = g_list_remove (ring->consumers, consumer);
+	if (!ring->consumers && ring->probe_id)
+	{
+		gst_pad_remove_probe (ring->pad, ring->probe_id);
+		ring->probe_id = 0;
+		_ring_flush (ring);
+	}
+	else
+		_ring_trim (ring);
+	g_mutex_unlock (&ring->lock);
+
+	GST_DEBUG_OBJECT (ring->pad, "%s consumer %p removed, %" G_GUINT64_FORMAT " samples skipped, %" G_GUINT64_FORMAT " ring overruns", ring->name, consumer, consumer->skipped, ring->overruns);
+	g_free (consumer);
+}
+
+gboolean dream_ring_send_upstream (DreamRing *ring, GstEvent *event)
+{
+	GST_LOG_OBJECT (ring->pad, "%s consumer sends %" GST_PTR_FORMAT " upstream", ring->name, event);
+	return gst_pad_push_event (ring->pad, event);
+}
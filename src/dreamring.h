@@ -0,0 +1,83 @@
+/*
+ * GStreamer dreamrtspserver
+ * Copyright 2015-2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * Alternatively, this program may be distributed and executed on
+ * hardware which is licensed by Dream Property GmbH.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifndef __DREAMRING_H__
+#define __DREAMRING_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef struct _DreamRing DreamRing;
+typedef struct _DreamRingConsumer DreamRingConsumer;
+
+/* hands a sample to a consumer. returns FALSE if the consumer can't take it
+ * right now, it's offered again with the next buffer the producer pushes.
+ * called from the producer's streaming thread with the ring locked, so it
+ * must not take locks that are held around dream_ring_add/remove_consumer */
+typedef gboolean (*DreamRingPushFunc) (DreamRingConsumer *consumer, GstSample *sample, gpointer user_data);
+
+/* single producer / multi consumer ring fed by a buffer probe on pad. it only
+ * holds the samples the slowest consumer hasn't taken yet, at most size of
+ * them and at most max_lag worth of stream time. the probe is only installed
+ * while there are consumers. custom downstream events (the GstForceKeyUnit
+ * in front of an idr) aren't kept, their structure comes with the next
+ * sample as its info instead */
+struct _DreamRing {
+	gchar *name;
+	GstPad *pad;
+	gulong probe_id;
+	GMutex lock;
+
+	GstSample **samples;
+	GstClockTime *times;
+	gboolean *keyframes;
+	guint size;
+	guint64 head, tail;
+	GstClockTime max_lag, last_time;
+	GstCaps *caps;
+	GstStructure *mark;
+
+	GList *consumers;
+	guint64 overruns;
+};
+
+/* a read cursor. a consumer starts out and resumes after lagging behind by
+ * more than its max_lag (or falling off the ring) at a keyframe */
+struct _DreamRingConsumer {
+	guint64 cursor;
+	gboolean synced;
+	GstClockTime max_lag;
+	DreamRingPushFunc func;
+	gpointer user_data;
+	guint64 skipped;
+};
+
+DreamRing *dream_ring_new (const gchar *name, GstPad *pad, guint size, GstClockTime max_lag);
+/* like g_free it takes NULL */
+void dream_ring_free (DreamRing *ring);
+
+DreamRingConsumer *dream_ring_add_consumer (DreamRing *ring, GstClockTime max_lag, DreamRingPushFunc func, gpointer user_data);
+void dream_ring_remove_consumer (DreamRing *ring, DreamRingConsumer *consumer);
+
+/* sends an upstream event (a consumer's key unit request) to the producer */
+gboolean dream_ring_send_upstream (DreamRing *ring, GstEvent *event);
+
+G_END_DECLS
+
+#endif /* __DREAMRING_H__ */
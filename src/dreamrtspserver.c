@@ -18,21 +18,18 @@
 
 #include "dreamrtspserver.h"
 #include "gstdreamrtsp.h"
+#include "gstdreamtsmux.h"
 
 #define QUEUE_DEBUG \
-		guint cur_bytes, cur_buf; \
-		guint64 cur_time; \
-		g_object_get (t->tstcpq, "current-level-bytes", &cur_bytes, NULL); \
-		g_object_get (t->tstcpq, "current-level-buffers", &cur_buf, NULL); \
-		g_object_get (t->tstcpq, "current-level-time", &cur_time, NULL);
+		guint64 cur_bytes = t->tssrc ? gst_app_src_get_current_level_bytes (GST_APP_SRC (t->tssrc)) : 0;
 
 
 static void send_signal (App *app, const gchar *signal_name, GVariant *parameters)
 {
-	if (app->dbus_connection)
+	if (app->daemon->dbus_connection)
 	{
-		GST_DEBUG ("sending signal name=%s parameters=%s", signal_name, parameters?g_variant_print (parameters, TRUE):"[not given]");
-		g_dbus_connection_emit_signal (app->dbus_connection, NULL, object_name, service, signal_name, parameters, NULL);
+		GST_DEBUG ("sending signal name=%s parameters=%s on %s", signal_name, parameters?g_variant_print (parameters, TRUE):"[not given]", app->object_path);
+		g_dbus_connection_emit_signal (app->daemon->dbus_connection, NULL, app->object_path, service, signal_name, parameters, NULL);
 	}
 	else
 		GST_DEBUG ("no dbus connection, can't send signal %s", signal_name);
@@ -46,8 +43,17 @@ static gboolean gst_set_inputmode(App *app, inputMode input_mode)
 	    !GST_IS_ELEMENT(app->vsrc))
 		return FALSE;
 
+	input_switch_begin (app, input_mode);
 	g_object_set (G_OBJECT (app->asrc), "input_mode", input_mode, NULL);
 	g_object_set (G_OBJECT (app->vsrc), "input_mode", input_mode, NULL);
+	if (app->source_state == SOURCE_STATE_RUNNING)
+		force_key_unit (app);
+
+	if (app->tcp_upstream && app->tcp_upstream->encoder_active == UPSTREAM_ENCODER_DEDICATED)
+	{
+		g_object_set (G_OBJECT (app->tcp_upstream->encoder_atarget), "input_mode", input_mode, NULL);
+		g_object_set (G_OBJECT (app->tcp_upstream->encoder_vtarget), "input_mode", input_mode, NULL);
+	}
 
 	inputMode ret1, ret2;
 	g_object_get (G_OBJECT (app->asrc), "input_mode", &ret1, NULL);
@@ -60,7 +66,140 @@ static gboolean gst_set_inputmode(App *app, inputMode input_mode)
 	return TRUE;
 }
 
-static gboolean gst_set_framerate(App *app, int value)
+/* arms both streams for the timestamp step and the video for the idr that
+ * follow an input switch of the running sources */
+static void input_switch_begin(App *app, inputMode input_mode)
+{
+	DreamInputSwitch *sw = app->input_switch;
+	if (!sw)
+	{
+		sw = app->input_switch = g_new0 (DreamInputSwitch, 1);
+		sw->app = app;
+		g_mutex_init (&sw->lock);
+		sw->audio.sw = sw->video.sw = sw;
+		sw->video.video = TRUE;
+		sw->audio.last = sw->video.last = GST_CLOCK_TIME_NONE;
+	}
+
+	g_mutex_lock (&sw->lock);
+	sw->mode = input_mode;
+	sw->start = g_get_monotonic_time ();
+	sw->jump_known = FALSE;
+	if (app->source_state == SOURCE_STATE_RUNNING)
+	{
+		sw->audio.armed = sw->video.armed = TRUE;
+		sw->video.wait_idr = TRUE;
+	}
+	g_mutex_unlock (&sw->lock);
+
+	/* the probes stay once there, the offset they apply outlives the switch */
+	GstPad *pad;
+	if (!sw->audio.probe_id)
+	{
+		pad = gst_element_get_static_pad (app->aparse, "src");
+		sw->audio.probe_id = gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, input_switch_probe, &sw->audio, NULL);
+		gst_object_unref (pad);
+	}
+	if (!sw->video.probe_id)
+	{
+		pad = gst_element_get_static_pad (app->vparse, "src");
+		sw->video.probe_id = gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, input_switch_probe, &sw->video, NULL);
+		gst_object_unref (pad);
+	}
+
+	if (app->source_state != SOURCE_STATE_RUNNING)
+		input_switch_done (sw);
+}
+
+/* for new parsers, the probes go with the pads */
+static void input_switch_reset(App *app)
+{
+	DreamInputSwitch *sw = app->input_switch;
+	if (!sw)
+		return;
+	g_mutex_lock (&sw->lock);
+	sw->audio.probe_id = sw->video.probe_id = 0;
+	sw->audio.offset = sw->video.offset = 0;
+	sw->audio.armed = sw->video.armed = sw->video.wait_idr = FALSE;
+	sw->audio.last = sw->video.last = GST_CLOCK_TIME_NONE;
+	g_mutex_unlock (&sw->lock);
+}
+
+static void input_switch_done(DreamInputSwitch *sw)
+{
+	sw->switch_ms = (g_get_monotonic_time () - sw->start) / 1000;
+	GST_INFO_OBJECT (sw->app, "input mode %i after %i ms, audio offset %" GST_STIME_FORMAT " video offset %" GST_STIME_FORMAT, sw->mode, sw->switch_ms, GST_STIME_ARGS (sw->audio.offset), GST_STIME_ARGS (sw->video.offset));
+	send_signal (sw->app, "inputModeChanged", g_variant_new("(ii)", sw->mode, sw->switch_ms));
+}
+
+static GstPadProbeReturn input_switch_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+	DreamInputStream *s = user_data;
+	DreamInputSwitch *sw = s->sw;
+	GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+	GstClockTime ts = GST_BUFFER_DTS_OR_PTS (buffer);
+	gboolean timeout, done = FALSE;
+
+	g_mutex_lock (&sw->lock);
+	timeout = g_get_monotonic_time () - sw->start > INPUT_SWITCH_TIMEOUT * 1000;
+	if (s->armed && GST_CLOCK_TIME_IS_VALID (ts))
+	{
+		GstClockTime expected = GST_CLOCK_TIME_NONE;
+		if (GST_CLOCK_TIME_IS_VALID (s->last) && GST_CLOCK_TIME_IS_VALID (s->duration))
+			expected = s->last + s->duration;
+		GstClockTimeDiff step = GST_CLOCK_TIME_IS_VALID (expected) ? GST_CLOCK_DIFF (expected, (GstClockTime) (ts + s->offset)) : 0;
+		if (GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DISCONT) || ABS (step) > INPUT_SWITCH_MAX_JUMP)
+		{
+			if (!sw->jump_known && GST_CLOCK_TIME_IS_VALID (expected))
+			{
+				sw->jump_offset = GST_CLOCK_DIFF (ts, expected);
+				sw->jump_known = TRUE;
+			}
+			if (sw->jump_known)
+				s->offset = sw->jump_offset;
+			GST_DEBUG_OBJECT (pad, "input switch stepped by %" GST_STIME_FORMAT ", offset now %" GST_STIME_FORMAT, GST_STIME_ARGS (step), GST_STIME_ARGS (s->offset));
+			s->armed = FALSE;
+		}
+		else if (timeout)
+			s->armed = FALSE;
+	}
+	if (s->wait_idr)
+	{
+		if (GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT) && !timeout)
+		{
+			g_mutex_unlock (&sw->lock);
+			return GST_PAD_PROBE_DROP;
+		}
+		s->wait_idr = FALSE;
+		done = TRUE;
+	}
+
+	if (s->offset)
+	{
+		buffer = gst_buffer_make_writable (buffer);
+		if (GST_BUFFER_PTS_IS_VALID (buffer))
+			GST_BUFFER_PTS (buffer) = MAX ((GstClockTimeDiff) GST_BUFFER_PTS (buffer) + s->offset, 0);
+		if (GST_BUFFER_DTS_IS_VALID (buffer))
+			GST_BUFFER_DTS (buffer) = MAX ((GstClockTimeDiff) GST_BUFFER_DTS (buffer) + s->offset, 0);
+		GST_PAD_PROBE_INFO_DATA (info) = buffer;
+		ts = GST_BUFFER_DTS_OR_PTS (buffer);
+	}
+	if (GST_CLOCK_TIME_IS_VALID (ts))
+	{
+		if (GST_BUFFER_DURATION_IS_VALID (buffer))
+			s->duration = GST_BUFFER_DURATION (buffer);
+		else if (GST_CLOCK_TIME_IS_VALID (s->last) && ts > s->last)
+			s->duration = ts - s->last;
+		s->last = ts;
+	}
+	g_mutex_unlock (&sw->lock);
+
+	if (done)
+		input_switch_done (sw);
+	return GST_PAD_PROBE_OK;
+}
+
+static gboolean gst_set_framerate(App *app, GstElement *source, int value)
 {
 	GstCaps *oldcaps = NULL;
 	GstCaps *newcaps = NULL;
@@ -69,14 +208,15 @@ static gboolean gst_set_framerate(App *app, int value)
 
 	if (!app->pipeline)
 		return FALSE;
-	if (!GST_IS_ELEMENT(app->vsrc))
+	if (!GST_IS_ELEMENT(source))
 		return FALSE;
 
-	g_object_get (G_OBJECT (app->vsrc), "caps", &oldcaps, NULL);
+	g_object_get (G_OBJECT (source), "caps", &oldcaps, NULL);
 	if (!GST_IS_CAPS(oldcaps))
 		return FALSE;
 
 	GST_DEBUG("set framerate %d fps... old caps %" GST_PTR_FORMAT, value, oldcaps);
+	video_switch_begin (app, source, 0, 0, value);
 
 	newcaps = gst_caps_make_writable(oldcaps);
 	structure = gst_caps_steal_structure (newcaps, 0);
@@ -88,7 +228,7 @@ static gboolean gst_set_framerate(App *app, int value)
 
 	gst_caps_append_structure (newcaps, structure);
 	GST_INFO("new caps %" GST_PTR_FORMAT, newcaps);
-	g_object_set (G_OBJECT (app->vsrc), "caps", newcaps, NULL);
+	g_object_set (G_OBJECT (source), "caps", newcaps, NULL);
 	ret = TRUE;
 
 out:
@@ -99,7 +239,7 @@ out:
 	return ret;
 }
 
-static gboolean gst_set_resolution(App *app, int width, int height)
+static gboolean gst_set_resolution(App *app, GstElement *source, int width, int height)
 {
 	GstCaps *oldcaps = NULL;
 	GstCaps *newcaps = NULL;
@@ -108,14 +248,15 @@ static gboolean gst_set_resolution(App *app, int width, int height)
 
 	if (!app->pipeline)
 		return FALSE;
-	if (!GST_IS_ELEMENT(app->vsrc))
+	if (!GST_IS_ELEMENT(source))
 		return FALSE;
 
-	g_object_get (G_OBJECT (app->vsrc), "caps", &oldcaps, NULL);
+	g_object_get (G_OBJECT (source), "caps", &oldcaps, NULL);
 	if (!GST_IS_CAPS(oldcaps))
 		return FALSE;
 
 	GST_DEBUG("set new resolution %ix%i... old caps %" GST_PTR_FORMAT, width, height, oldcaps);
+	video_switch_begin (app, source, width, height, 0);
 
 	newcaps = gst_caps_make_writable(oldcaps);
 	structure = gst_caps_steal_structure (newcaps, 0);
@@ -129,7 +270,7 @@ static gboolean gst_set_resolution(App *app, int width, int height)
 	}
 	gst_caps_append_structure (newcaps, structure);
 	GST_INFO("new caps %" GST_PTR_FORMAT, newcaps);
-	g_object_set (G_OBJECT (app->vsrc), "caps", newcaps, NULL);
+	g_object_set (G_OBJECT (source), "caps", newcaps, NULL);
 	ret = TRUE;
 
 out:
@@ -140,6 +281,120 @@ out:
 	return ret;
 }
 
+/* lets a new format of the running video source take effect at an idr, so
+ * that no output has to cope with frames referring to the old one */
+static void video_switch_begin(App *app, GstElement *source, gint width, gint height, gint framerate)
+{
+	/* the previous switch times itself out on the next buffer, unless none came */
+	if (app->id_video_switch && g_get_monotonic_time () - app->video_switch_start > VIDEO_SWITCH_TIMEOUT * 1000)
+	{
+		GstPad *pad = gst_element_get_static_pad (app->vparse, "src");
+		GST_INFO_OBJECT (app, "previous video switch got no buffers within %i ms, removing it", VIDEO_SWITCH_TIMEOUT);
+		gst_pad_remove_probe (pad, app->id_video_switch);
+		gst_object_unref (pad);
+	}
+	if (source != app->vsrc || app->source_state != SOURCE_STATE_RUNNING || app->id_video_switch)
+		return;
+
+	GstPad *pad = gst_element_get_static_pad (app->vparse, "src");
+	GstCaps *caps = gst_pad_get_current_caps (pad);
+	if (!caps)
+	{
+		gst_object_unref (pad);
+		return;
+	}
+
+	GstStructure *structure = gst_caps_get_structure (caps, 0);
+	gint w = 0, h = 0, num = 0, den = 1;
+	gst_structure_get_int (structure, "width", &w);
+	gst_structure_get_int (structure, "height", &h);
+	gst_structure_get_fraction (structure, "framerate", &num, &den);
+	if ((!width || width == w) && (!height || height == h) && (!framerate || (den && framerate == num / den)))
+	{
+		gst_caps_unref (caps);
+		gst_object_unref (pad);
+		return;
+	}
+
+	DreamVideoSwitch *sw = g_new0 (DreamVideoSwitch, 1);
+	sw->app = app;
+	sw->caps = caps;
+	sw->start = app->video_switch_start = g_get_monotonic_time ();
+	app->id_video_switch = gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, video_switch_probe, sw, video_switch_free);
+	gst_object_unref (pad);
+}
+
+static GstPadProbeReturn video_switch_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+	DreamVideoSwitch *sw = user_data;
+	App *app = sw->app;
+
+	if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM)
+	{
+		GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+		if (GST_EVENT_TYPE (event) == GST_EVENT_CAPS && !sw->switched)
+		{
+			GstCaps *caps;
+			gst_event_parse_caps (event, &caps);
+			if (!gst_caps_is_equal (caps, sw->caps))
+			{
+				GST_INFO_OBJECT (app, "video switches to %" GST_PTR_FORMAT ", holding frames back until the next idr", caps);
+				sw->switched = TRUE;
+				force_key_unit (app);
+			}
+		}
+		return GST_PAD_PROBE_OK;
+	}
+
+	gboolean timeout = g_get_monotonic_time () - sw->start > VIDEO_SWITCH_TIMEOUT * 1000;
+	if (!sw->switched)
+	{
+		if (!timeout)
+			return GST_PAD_PROBE_OK;
+		GST_INFO_OBJECT (app, "video caps didn't change within %i ms, video switch given up", VIDEO_SWITCH_TIMEOUT);
+		return GST_PAD_PROBE_REMOVE;
+	}
+
+	GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+	if (GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT))
+	{
+		if (timeout)
+		{
+			GST_WARNING_OBJECT (app, "no idr within %i ms after the video switch, %u frames dropped, letting the rest through", VIDEO_SWITCH_TIMEOUT, sw->dropped);
+			return GST_PAD_PROBE_REMOVE;
+		}
+		sw->dropped++;
+		return GST_PAD_PROBE_DROP;
+	}
+
+	video_cut (app, pad, buffer);
+	GST_INFO_OBJECT (app, "video switch done after %" G_GINT64_FORMAT " ms, %u frames dropped waiting for the idr", (g_get_monotonic_time () - sw->start) / 1000, sw->dropped);
+	return GST_PAD_PROBE_REMOVE;
+}
+
+static void video_switch_free (gpointer user_data)
+{
+	DreamVideoSwitch *sw = user_data;
+	sw->app->id_video_switch = 0;
+	gst_caps_unref (sw->caps);
+	g_free (sw);
+}
+
+/* goes out on pad in front of the idr buffer where the video changes. tsmux
+ * passes it on with the idr, so hlssink starts a new fragment */
+static void video_cut(App *app, GstPad *pad, GstBuffer *buffer)
+{
+	if (app->hls_server->state == HLS_STATE_RUNNING)
+		g_atomic_int_set (&app->hls_server->cut_pending, TRUE);
+	GstStructure *s = gst_structure_new ("GstForceKeyUnit",
+		"timestamp", G_TYPE_UINT64, GST_BUFFER_PTS (buffer),
+		"stream-time", G_TYPE_UINT64, GST_BUFFER_PTS (buffer),
+		"running-time", G_TYPE_UINT64, GST_CLOCK_TIME_NONE,
+		"all-headers", G_TYPE_BOOLEAN, TRUE,
+		"count", G_TYPE_UINT, 0, NULL);
+	gst_pad_push_event (pad, gst_event_new_custom (GST_EVENT_CUSTOM_DOWNSTREAM, s));
+}
+
 static gboolean gst_set_profile(App *app, int value)
 {
 	GstCaps *oldcaps = NULL;
@@ -250,6 +505,8 @@ static void get_source_properties (App *app)
 	if (GST_IS_ELEMENT(app->vsrc))
 	{
 		g_object_get (G_OBJECT (app->vsrc), "bitrate", &p->videoBitrate, NULL);
+		if (app->standby_active && app->standby == STANDBY_RUNNING)
+			p->videoBitrate = app->standby_vbitrate;
 		g_object_get (G_OBJECT (app->vsrc), "gop-length", &p->gopLength, NULL);
 		g_object_get (G_OBJECT (app->vsrc), "gop-scene", &p->gopOnSceneChange, NULL);
 		g_object_get (G_OBJECT (app->vsrc), "open-gop", &p->openGop, NULL);
@@ -287,9 +544,9 @@ static void apply_source_properties (App *app)
 		g_object_set (G_OBJECT (app->vsrc), "level", p->level, NULL);
 
 		if (p->framerate)
-			gst_set_framerate(app, p->framerate);
+			gst_set_framerate(app, app->vsrc, p->framerate);
 		if (p->width && p->height)
-			gst_set_resolution(app,  p->width, p->height);
+			gst_set_resolution(app, app->vsrc, p->width, p->height);
 		gst_set_profile(app, p->profile);
 	}
 }
@@ -399,18 +656,61 @@ static GVariant *handle_get_property (GDBusConnection  *connection,
 
 	if (g_strcmp0 (property_name, "sourceState") == 0)
 	{
-		if (app->pipeline)
-		{
-			GstState state = GST_STATE_VOID_PENDING;
-			gst_element_get_state (GST_ELEMENT(app->pipeline), &state, NULL, 1*GST_USECOND);
-			return g_variant_new_int32 ((int)state);
-		}
+		return g_variant_new_int32 (app->source_state);
+	}
+	else if (g_strcmp0 (property_name, "sourceTransitionTime") == 0)
+	{
+		return g_variant_new_int32 (app->source_transition_ms);
+	}
+	else if (g_strcmp0 (property_name, "inputSwitchTime") == 0)
+	{
+		return g_variant_new_int32 (app->input_switch ? app->input_switch->switch_ms : 0);
 	}
 	else if (g_strcmp0 (property_name, "upstreamState") == 0)
 	{
 		if (app->tcp_upstream)
 			return g_variant_new_int32 (app->tcp_upstream->state);
 	}
+	else if (g_strcmp0 (property_name, "upstreamLatency") == 0)
+	{
+		if (app->tcp_upstream)
+			return g_variant_new_int32 (app->tcp_upstream->latency);
+	}
+	else if (g_strcmp0 (property_name, "upstreamBatchSize") == 0)
+	{
+		if (app->tcp_upstream)
+			return g_variant_new_int32 (app->tcp_upstream->batch_size);
+	}
+	else if (g_strcmp0 (property_name, "upstreamPaceBurst") == 0)
+	{
+		if (app->tcp_upstream)
+			return g_variant_new_int32 (app->tcp_upstream->pace_burst);
+	}
+	else if (g_strcmp0 (property_name, "upstreamSpool") == 0)
+	{
+		if (app->tcp_upstream)
+			return g_variant_new_int32 (app->tcp_upstream->spool);
+	}
+	else if (g_strcmp0 (property_name, "upstreamSpoolLimit") == 0)
+	{
+		if (app->tcp_upstream)
+			return g_variant_new_int32 (app->tcp_upstream->spool_limit);
+	}
+	else if (g_strcmp0 (property_name, "upstreamEncoder") == 0)
+	{
+		if (app->tcp_upstream)
+			return g_variant_new_int32 (app->tcp_upstream->encoder);
+	}
+	else if (g_strcmp0 (property_name, "upstreamLadder") == 0)
+	{
+		if (app->tcp_upstream)
+			return g_variant_new_string (app->tcp_upstream->ladder_spec ? app->tcp_upstream->ladder_spec : "");
+	}
+	else if (g_strcmp0 (property_name, "upstreamRung") == 0)
+	{
+		if (app->tcp_upstream)
+			return g_variant_new_int32 (app->tcp_upstream->rung);
+	}
 	else if (g_strcmp0 (property_name, "hlsState") == 0)
 	{
 		if (app->hls_server)
@@ -447,6 +747,8 @@ static GVariant *handle_get_property (GDBusConnection  *connection,
 	else if (g_strcmp0 (property_name, "videoBitrate") == 0)
 	{
 		gint rate = 0;
+		if (app->standby_active && app->standby == STANDBY_RUNNING)
+			return g_variant_new_int32 (app->standby_vbitrate);
 		if (GST_IS_ELEMENT(app->vsrc))
 		{
 			g_object_get (G_OBJECT (app->vsrc), "bitrate", &rate, NULL);
@@ -528,6 +830,34 @@ static GVariant *handle_get_property (GDBusConnection  *connection,
 		if (app->tcp_upstream)
 			return g_variant_new_boolean(app->tcp_upstream->auto_bitrate);
 	}
+	else if (g_strcmp0 (property_name, "standby") == 0)
+	{
+		return g_variant_new_int32 (app->standby);
+	}
+	else if (g_strcmp0 (property_name, "channels") == 0)
+	{
+		return g_variant_new_int32 (app->daemon->n_channels);
+	}
+	else if (g_strcmp0 (property_name, "substream") == 0)
+	{
+		return g_variant_new_boolean (app->substream->enabled);
+	}
+	else if (g_strcmp0 (property_name, "substreamBitrate") == 0)
+	{
+		return g_variant_new_int32 (app->substream->bitrate);
+	}
+	else if (g_strcmp0 (property_name, "substreamWidth") == 0)
+	{
+		return g_variant_new_int32 (app->substream->width);
+	}
+	else if (g_strcmp0 (property_name, "substreamHeight") == 0)
+	{
+		return g_variant_new_int32 (app->substream->height);
+	}
+	else if (g_strcmp0 (property_name, "slate") == 0)
+	{
+		return g_variant_new_boolean (app->slate && app->slate->active);
+	}
 	else if (g_strcmp0 (property_name, "path") == 0)
 	{
 		if (app->rtsp_server)
@@ -570,6 +900,12 @@ static gboolean handle_set_property (GDBusConnection  *connection,
 	}
 	else if (g_strcmp0 (property_name, "videoBitrate") == 0)
 	{
+		/* the encoder idles at the standby rate, this is what it wakes up to */
+		if (app->standby_active && app->standby == STANDBY_RUNNING && g_variant_get_int32 (value) > 0)
+		{
+			app->standby_vbitrate = g_variant_get_int32 (value);
+			return 1;
+		}
 		if (gst_set_bitrate (app, app->vsrc, g_variant_get_int32 (value)))
 			return 1;
 	}
@@ -610,7 +946,7 @@ static gboolean handle_set_property (GDBusConnection  *connection,
 	}
 	else if (g_strcmp0 (property_name, "framerate") == 0)
 	{
-		if (gst_set_framerate(app, g_variant_get_int32 (value)))
+		if (gst_set_framerate(app, app->vsrc, g_variant_get_int32 (value)))
 			return 1;
 		g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "[RTSPserver] can't set property '%s' to %d", property_name, g_variant_get_int32 (value));
 		return 0;
@@ -622,6 +958,108 @@ static gboolean handle_set_property (GDBusConnection  *connection,
 		g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "[RTSPserver] can't set property '%s' to %d", property_name, g_variant_get_int32 (value));
 		return 0;
 	}
+	else if (g_strcmp0 (property_name, "upstreamLatency") == 0)
+	{
+		gint latency = g_variant_get_int32 (value);
+		if (app->tcp_upstream && latency > 0)
+		{
+			app->tcp_upstream->latency = latency;
+			if (app->tcp_upstream->state != UPSTREAM_STATE_DISABLED)
+				upstream_tune_queue (app, app->tcp_upstream->bitrate_avg);
+			return 1;
+		}
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "[RTSPserver] can't set property '%s' to %d", property_name, latency);
+		return 0;
+	}
+	else if (g_strcmp0 (property_name, "upstreamBatchSize") == 0)
+	{
+		gint batch_size = g_variant_get_int32 (value);
+		if (app->tcp_upstream && batch_size >= 0)
+		{
+			app->tcp_upstream->batch_size = batch_size;
+			if (app->tcp_upstream->tcpsink)
+				g_object_set (app->tcp_upstream->tcpsink, "batch-size", app->tcp_upstream->batch_size, NULL);
+			return 1;
+		}
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "[RTSPserver] can't set property '%s' to %d", property_name, batch_size);
+		return 0;
+	}
+	else if (g_strcmp0 (property_name, "upstreamPaceBurst") == 0)
+	{
+		gint pace_burst = g_variant_get_int32 (value);
+		if (app->tcp_upstream && pace_burst >= 0 && pace_burst <= MAX_UPSTREAM_PACE_BURST)
+		{
+			app->tcp_upstream->pace_burst = pace_burst;
+			if (app->tcp_upstream->tcpsink)
+				upstream_set_pacing (app);
+			return 1;
+		}
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "[RTSPserver] can't set property '%s' to %d", property_name, pace_burst);
+		return 0;
+	}
+	else if (g_strcmp0 (property_name, "upstreamSpool") == 0)
+	{
+		gint spool = g_variant_get_int32 (value);
+		if (app->tcp_upstream && spool >= DREAM_TCP_SINK_SPOOL_NONE && spool <= DREAM_TCP_SINK_SPOOL_DISK)
+		{
+			/* the sink sets up its spool when it connects, so this applies to the next enableUpstream */
+			app->tcp_upstream->spool = spool;
+			return 1;
+		}
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "[RTSPserver] can't set property '%s' to %d", property_name, spool);
+		return 0;
+	}
+	else if (g_strcmp0 (property_name, "upstreamSpoolLimit") == 0)
+	{
+		gint spool_limit = g_variant_get_int32 (value);
+		if (app->tcp_upstream && spool_limit >= 1 && spool_limit <= 1024)
+		{
+			app->tcp_upstream->spool_limit = spool_limit;
+			return 1;
+		}
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "[RTSPserver] can't set property '%s' to %d", property_name, spool_limit);
+		return 0;
+	}
+	else if (g_strcmp0 (property_name, "upstreamEncoder") == 0)
+	{
+		gint encoder = g_variant_get_int32 (value);
+		DreamTCPupstream *t = app->tcp_upstream;
+		if (t && t->state == UPSTREAM_STATE_DISABLED && encoder >= UPSTREAM_ENCODER_SHARED && encoder <= UPSTREAM_ENCODER_SOFTWARE)
+		{
+			t->encoder = encoder;
+			/* the previous session's bin may still wait to be taken out of the pipeline */
+			if (t->id_encoder_remove)
+			{
+				g_source_remove (t->id_encoder_remove);
+				remove_upstream_encoder (app);
+			}
+			if (t->encoder_bin)
+			{
+				gst_object_unref (t->encoder_bin);
+				t->encoder_bin = NULL;
+			}
+			dream_ring_free (t->tsring);
+			t->tsring = NULL;
+			if (app->pipeline)
+				create_upstream_encoder (app);
+			return 1;
+		}
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "[RTSPserver] can't set property '%s' to %d", property_name, encoder);
+		return 0;
+	}
+	else if (g_strcmp0 (property_name, "upstreamLadder") == 0)
+	{
+		const gchar *spec = g_variant_get_string (value, NULL);
+		DreamTCPupstream *t = app->tcp_upstream;
+		if (t && upstream_ladder_parse (t, spec))
+		{
+			/* start over at the top of the new ladder */
+			upstream_ladder_reset (app);
+			return 1;
+		}
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "[RTSPserver] can't set property '%s' to '%s'", property_name, spec);
+		return 0;
+	}
 	else if (g_strcmp0 (property_name, "autoBitrate") == 0)
 	{
 		if (app->tcp_upstream)
@@ -633,6 +1071,47 @@ static gboolean handle_set_property (GDBusConnection  *connection,
 			return 1;
 		}
 	}
+	else if (g_strcmp0 (property_name, "standby") == 0)
+	{
+		gint32 mode = g_variant_get_int32 (value);
+		if (mode < STANDBY_OFF || mode > STANDBY_RUNNING)
+		{
+			g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "[RTSPserver] can't set property '%s' to %d", property_name, mode);
+			return 0;
+		}
+		if ((standbyMode) mode != app->standby)
+		{
+			/* leave the old mode and settle in the new one if nobody's streaming */
+			gboolean unused = app->pipeline && sources_unused (app);
+			if (unused)
+				wake_source_pipeline (app);
+			app->standby = mode;
+			if (unused && (app->standby != STANDBY_OFF || app->source_state > SOURCE_STATE_SUSPENDED))
+				idle_source_pipeline (app);
+		}
+		return 1;
+	}
+	else if (g_strcmp0 (property_name, "substream") == 0)
+	{
+		gboolean enable = g_variant_get_boolean (value);
+		if (substream_set_enabled (app, enable))
+			return 1;
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "[RTSPserver] can't set property '%s' to %d", property_name, enable);
+		return 0;
+	}
+	else if (g_strcmp0 (property_name, "substreamBitrate") == 0)
+	{
+		gint bitrate = g_variant_get_int32 (value);
+		if (bitrate > 0)
+		{
+			app->substream->bitrate = bitrate;
+			if (app->substream->vsrc)
+				g_object_set (G_OBJECT (app->substream->vsrc), "bitrate", bitrate, NULL);
+			return 1;
+		}
+		g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "[RTSPserver] can't set property '%s' to %d", property_name, bitrate);
+		return 0;
+	}
 	else
 	{
 		g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "[RTSPserver] Invalid property: '%s'", property_name);
@@ -659,7 +1138,7 @@ static void handle_method_call (GDBusConnection       *connection,
 	if (g_strcmp0 (method_name, "enableRTSP") == 0)
 	{
 		gboolean result = FALSE;
-		if (app->pipeline)
+		if (assert_source_pipeline (app))
 		{
 			gboolean state;
 			guint32 port;
@@ -685,7 +1164,7 @@ static void handle_method_call (GDBusConnection       *connection,
 	else if (g_strcmp0 (method_name, "enableHLS") == 0)
 	{
 		gboolean result = FALSE;
-		if (app->pipeline)
+		if (assert_source_pipeline (app))
 		{
 			gboolean state;
 			guint32 port;
@@ -711,7 +1190,7 @@ static void handle_method_call (GDBusConnection       *connection,
 	else if (g_strcmp0 (method_name, "enableUpstream") == 0)
 	{
 		gboolean result = FALSE;
-		if (app->pipeline)
+		if (assert_source_pipeline (app))
 		{
 			gboolean state;
 			const gchar *upstream_host, *token;
@@ -738,11 +1217,25 @@ static void handle_method_call (GDBusConnection       *connection,
 	{
 		int width, height;
 		g_variant_get (parameters, "(ii)", &width, &height);
-		if (gst_set_resolution(app, width, height))
+		if (gst_set_resolution(app, app->vsrc, width, height))
 			g_dbus_method_invocation_return_value (invocation, NULL);
 		else
 			g_dbus_method_invocation_return_error (invocation, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "[RTSPserver] can't set resolution %dx%d", width, height);
 	}
+	else if (g_strcmp0 (method_name, "setSubstreamResolution") == 0)
+	{
+		/* a running substream keeps its resolution until its viewers are gone */
+		int width, height;
+		g_variant_get (parameters, "(ii)", &width, &height);
+		if (width > 0 && height > 0 && width % 2 == 0 && height % 2 == 0)
+		{
+			app->substream->width = width;
+			app->substream->height = height;
+			g_dbus_method_invocation_return_value (invocation, NULL);
+		}
+		else
+			g_dbus_method_invocation_return_error (invocation, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "[RTSPserver] can't set substream resolution %dx%d", width, height);
+	}
 	// Default: No such method
 	else
 	{
@@ -762,30 +1255,46 @@ static void on_bus_acquired (GDBusConnection *connection,
 		{ 0, }
 	};
 
-	GError *error = NULL;
+	DreamDaemon *daemon = user_data;
+	guint i;
 	GST_DEBUG ("aquired dbus (\"%s\" @ %p)", name, connection);
-	g_dbus_connection_register_object (connection, object_name, introspection_data->interfaces[0], &interface_vtable, user_data, NULL, &error);
+	/* one object per channel, the first one where there always was one */
+	for (i = 0; i < daemon->n_channels; i++)
+	{
+		GError *error = NULL;
+		if (!g_dbus_connection_register_object (connection, daemon->channels[i]->object_path, introspection_data->interfaces[0], &interface_vtable, daemon->channels[i], NULL, &error))
+		{
+			GST_ERROR ("can't register %s: %s", daemon->channels[i]->object_path, error->message);
+			g_error_free (error);
+		}
+	}
 } // on_bus_acquired
 
 static void on_name_acquired (GDBusConnection *connection,
 			      const gchar     *name,
 			      gpointer         user_data)
 {
-	App *app = user_data;
-	app->dbus_connection = connection;
+	DreamDaemon *daemon = user_data;
+	guint i;
+	daemon->dbus_connection = connection;
 	GST_DEBUG ("aquired dbus name (\"%s\")", name);
-	if (gst_element_set_state (app->pipeline, GST_STATE_READY) != GST_STATE_CHANGE_SUCCESS)
-		GST_ERROR ("Failed to bring state of source pipeline to READY");
+	for (i = 0; i < daemon->n_channels; i++)
+	{
+		App *app = daemon->channels[i];
+		if (app->pipeline && !source_set_state (app, SOURCE_STATE_SUSPENDED))
+			GST_ERROR ("Failed to bring state of source pipeline of channel %u to READY", i);
+	}
+	startup_phase (daemon->channels[0], "dbus");
 } // on_name_acquired
 
 static void on_name_lost (GDBusConnection *connection,
 			  const gchar     *name,
 			  gpointer         user_data)
 	{
-	App *app = user_data;
-	app->dbus_connection = NULL;
+	DreamDaemon *daemon = user_data;
+	daemon->dbus_connection = NULL;
 	GST_WARNING ("lost dbus name (\"%s\" @ %p)", name, connection);
-	//  g_main_loop_quit (app->loop);
+	//  g_main_loop_quit (daemon->loop);
 } // on_name_lost
 
 static gboolean message_cb (GstBus * bus, GstMessage * message, gpointer user_data)
@@ -803,10 +1312,7 @@ static gboolean message_cb (GstBus * bus, GstMessage * message, gpointer user_da
 				break;
 
 			if (GST_MESSAGE_SRC(message) == GST_OBJECT(app->pipeline))
-			{
 				GST_DEBUG_OBJECT(app, "state transition %s -> %s", gst_element_state_get_name(old_state), gst_element_state_get_name(new_state));
-				send_signal (app, "sourceStateChanged", g_variant_new("(i)", (int) new_state));
-			}
 			break;
 		}
 		case GST_MESSAGE_ERROR:
@@ -817,13 +1323,20 @@ static gboolean message_cb (GstBus * bus, GstMessage * message, gpointer user_da
 			gst_message_parse_error (message, &err, &debug);
 			if (err->domain == GST_RESOURCE_ERROR)
 			{
-				if (err->code == GST_RESOURCE_ERROR_READ)
+				if (err->code == GST_RESOURCE_ERROR_READ && !gst_object_has_as_ancestor (message->src, GST_OBJECT (app->pipeline)))
+					GST_DEBUG ("element %s was swapped out already: %s", name, err->message);
+				else if (err->code == GST_RESOURCE_ERROR_READ)
 				{
 					GST_INFO ("element %s: %s", name, err->message);
 					send_signal (app, "encoderError", NULL);
-// 					DREAMRTSPSERVER_UNLOCK (app);
-					disable_tcp_upstream(app);
-					destroy_pipeline(app);
+					/* sources that fail are swapped for new ones behind the outputs */
+					gboolean source = gst_object_has_as_ancestor (message->src, GST_OBJECT (app->asrc)) || gst_object_has_as_ancestor (message->src, GST_OBJECT (app->vsrc));
+					if (!source || !source_swap_begin (app))
+					{
+// 						DREAMRTSPSERVER_UNLOCK (app);
+						disable_tcp_upstream(app);
+						destroy_pipeline(app);
+					}
 				}
 				if (err->code == GST_RESOURCE_ERROR_WRITE)
 				{
@@ -861,11 +1374,14 @@ static gboolean message_cb (GstBus * bus, GstMessage * message, gpointer user_da
 			if (debug != NULL)
 				GST_WARNING ("Additional debug info: %s", debug);
 #if 1
-			if (err->domain == GST_STREAM_ERROR && err->code == GST_STREAM_ERROR_ENCODE)
+			if (err->domain == GST_STREAM_ERROR && err->code == GST_STREAM_ERROR_ENCODE && gst_object_has_as_ancestor (message->src, GST_OBJECT (app->pipeline)))
 			{
 				GST_DEBUG_BIN_TO_DOT_FILE(GST_BIN(app->pipeline),GST_DEBUG_GRAPH_SHOW_ALL,"dreamrtspserver-encode-error");
-				g_main_loop_quit (app->loop);
-				return FALSE;
+				if (!source_swap_begin (app))
+				{
+					g_main_loop_quit (app->daemon->loop);
+					return FALSE;
+				}
 			}
 #endif
 			g_error_free (err);
@@ -876,7 +1392,7 @@ static gboolean message_cb (GstBus * bus, GstMessage * message, gpointer user_da
 		case GST_MESSAGE_EOS:
 			g_print ("Got EOS\n");
 // 			DREAMRTSPSERVER_UNLOCK (app);
-			g_main_loop_quit (app->loop);
+			g_main_loop_quit (app->daemon->loop);
 			return FALSE;
 		default:
 			break;
@@ -889,23 +1405,51 @@ static void media_unprepare (GstRTSPMedia * media, gpointer user_data)
 {
 	App *app = user_data;
 	DreamRTSPserver *r = app->rtsp_server;
+	DreamSubstream *s = app->substream;
 	GST_INFO("no more clients -> media unprepared!");
 
 // 	DREAMRTSPSERVER_LOCK (app);
+	/* the consumers go first, once they're removed handover_payload no longer
+	 * touches the appsrcs and the refs taken in media_configure can go */
 	if (media == r->es_media)
 	{
 		r->es_media = NULL;
-		r->es_aappsrc = r->es_vappsrc = NULL;
+		rtsp_detach_consumer (app, app->aring, &r->aconsumer);
+		rtsp_detach_consumer (app, app->vring, &r->vconsumer);
+		timeline_free (&r->es_timeline);
+		g_clear_object (&r->es_aappsrc);
+		g_clear_object (&r->es_vappsrc);
 	}
 	else if (media == r->ts_media)
 	{
 		r->ts_media = NULL;
-		r->ts_appsrc = NULL;
+		rtsp_detach_consumer (app, app->tsring, &r->tsconsumer);
+		timeline_free (&r->ts_timeline);
+		g_clear_object (&r->ts_appsrc);
+	}
+	else if (media == s->es_media)
+	{
+		s->es_media = NULL;
+		rtsp_detach_consumer (app, app->aring, &s->aconsumer);
+		rtsp_detach_consumer (app, s->vring, &s->vconsumer);
+		timeline_free (&s->es_timeline);
+		g_clear_object (&s->es_aappsrc);
+		g_clear_object (&s->es_vappsrc);
 	}
-	if (!r->es_media && !r->ts_media)
+	else if (media == s->ts_media)
+	{
+		s->ts_media = NULL;
+		rtsp_detach_consumer (app, s->tsring, &s->tsconsumer);
+		timeline_free (&s->ts_timeline);
+		g_clear_object (&s->ts_appsrc);
+	}
+	release_substream(app);
+	if (sources_unused (app))
+		idle_source_pipeline(app);
+	else
+		release_tsmux(app);
+	if (!rtsp_has_media (app))
 	{
-		if (app->tcp_upstream->state == UPSTREAM_STATE_DISABLED && app->hls_server->state == HLS_STATE_DISABLED)
-			halt_source_pipeline(app);
 		if (r->state == RTSP_STATE_RUNNING)
 		{
 			GST_DEBUG ("set RTSP_STATE_IDLE");
@@ -940,8 +1484,11 @@ static void media_configure (GstRTSPMediaFactory * factory, GstRTSPMedia * media
 {
 	App *app = user_data;
 	DreamRTSPserver *r = app->rtsp_server;
+	DreamSubstream *s = app->substream;
 	DREAMRTSPSERVER_LOCK (app);
 
+	/* the appsrcs are kept with the ref gst_bin_get_by_name_recurse_up
+	 * returns, media_unprepare drops it */
 	if (GST_DREAM_RTSP_MEDIA_FACTORY (factory) == r->es_factory)
 	{
 		r->es_media = media;
@@ -952,23 +1499,56 @@ static void media_configure (GstRTSPMediaFactory * factory, GstRTSPMedia * media
 		g_signal_connect (media, "unprepared", (GCallback) media_unprepare, app);
 		g_object_set (r->es_aappsrc, "format", GST_FORMAT_TIME, NULL);
 		g_object_set (r->es_vappsrc, "format", GST_FORMAT_TIME, NULL);
+		r->es_timeline = timeline_new (r->es_vappsrc, r->es_aappsrc);
 	}
 	else if (GST_DREAM_RTSP_MEDIA_FACTORY (factory) == r->ts_factory)
 	{
 		r->ts_media = media;
 		GstElement *element = gst_rtsp_media_get_element (media);
 		r->ts_appsrc = gst_bin_get_by_name_recurse_up (GST_BIN (element), TS_APPSRC);
-		r->ts_appsrc = gst_bin_get_by_name_recurse_up (GST_BIN (element), TS_APPSRC);
 		gst_object_unref(element);
 		g_signal_connect (media, "unprepared", (GCallback) media_unprepare, app);
 		g_object_set (r->ts_appsrc, "format", GST_FORMAT_TIME, NULL);
+		r->ts_timeline = timeline_new (r->ts_appsrc, NULL);
+	}
+	else if (GST_DREAM_RTSP_MEDIA_FACTORY (factory) == s->es_factory)
+	{
+		s->es_media = media;
+		GstElement *element = gst_rtsp_media_get_element (media);
+		s->es_aappsrc = gst_bin_get_by_name_recurse_up (GST_BIN (element), ES_AAPPSRC);
+		s->es_vappsrc = gst_bin_get_by_name_recurse_up (GST_BIN (element), ES_VAPPSRC);
+		gst_object_unref(element);
+		g_signal_connect (media, "unprepared", (GCallback) media_unprepare, app);
+		g_object_set (s->es_aappsrc, "format", GST_FORMAT_TIME, NULL);
+		g_object_set (s->es_vappsrc, "format", GST_FORMAT_TIME, NULL);
+		s->es_timeline = timeline_new (s->es_vappsrc, s->es_aappsrc);
+	}
+	else if (GST_DREAM_RTSP_MEDIA_FACTORY (factory) == s->ts_factory)
+	{
+		s->ts_media = media;
+		GstElement *element = gst_rtsp_media_get_element (media);
+		s->ts_appsrc = gst_bin_get_by_name_recurse_up (GST_BIN (element), TS_APPSRC);
+		gst_object_unref(element);
+		g_signal_connect (media, "unprepared", (GCallback) media_unprepare, app);
+		g_object_set (s->ts_appsrc, "format", GST_FORMAT_TIME, NULL);
+		s->ts_timeline = timeline_new (s->ts_appsrc, NULL);
 	}
-	r->rtsp_start_pts = r->rtsp_start_dts = GST_CLOCK_TIME_NONE;
 	r->state = RTSP_STATE_RUNNING;
 	send_signal (app, "rtspStateChanged", g_variant_new("(i)", RTSP_STATE_RUNNING));
 	GST_DEBUG ("set RTSP_STATE_RUNNING");
 	start_rtsp_pipeline(app);
 	DREAMRTSPSERVER_UNLOCK (app);
+
+	/* handover_payload runs with the ring locked, so consumers are added without the server lock */
+	if (media == r->es_media)
+	{
+		rtsp_attach_consumer (app, app->aring, &r->aconsumer);
+		rtsp_attach_consumer (app, app->vring, &r->vconsumer);
+	}
+	else if (media == r->ts_media)
+		rtsp_attach_consumer (app, app->tsring, &r->tsconsumer);
+	else
+		substream_serve (app);
 }
 
 static void uri_parametrized (GstDreamRTSPMediaFactory * factory, gchar *parameters, gpointer user_data)
@@ -987,16 +1567,14 @@ static GstPadProbeReturn cancel_waiting_probe (GstPad * sinkpad, GstPadProbeInfo
 	     ((info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) && gst_buffer_list_length(GST_PAD_PROBE_INFO_BUFFER_LIST(info))))
 	{
 		QUEUE_DEBUG;
-		GST_LOG_OBJECT (app, "cancel upstream_set_waiting timeout because data flow was restored! queue properties current-level-bytes=%d current-level-buffers=%d current-level-time=%" GST_TIME_FORMAT "",
-				  cur_bytes, cur_buf, GST_TIME_ARGS(cur_time));
+		GST_LOG_OBJECT (app, "cancel upstream_set_waiting timeout because data flow was restored! queue current-level-bytes=%" G_GUINT64_FORMAT, cur_bytes);
 		if (t->id_signal_waiting)
 			g_source_remove (t->id_signal_waiting);
 		t->id_signal_waiting = 0;
 		if (t->id_signal_keepalive)
 			g_source_remove (t->id_signal_keepalive);
 		t->id_signal_keepalive = 0;
-		if (t->id_signal_overrun == 0)
-			t->id_signal_overrun = g_signal_connect (t->tstcpq, "overrun", G_CALLBACK (queue_overrun), app);
+		t->overrun_armed = TRUE;
 		t->id_resume = 0;
 		return GST_PAD_PROBE_REMOVE;
 	}
@@ -1028,47 +1606,117 @@ static GstPadProbeReturn bitrate_measure_probe (GstPad * sinkpad, GstPadProbeInf
 		idx++;
 	} while (idx < num_buffers);
 
-	QUEUE_DEBUG;
-	GST_TRACE_OBJECT(app, "probetype=%i num_buffers=%i data=%" GST_PTR_FORMAT " size was=%zu bitrate_sum=%zu now=%" GST_TIME_FORMAT " avg at %" GST_TIME_FORMAT " queue properties current-level-bytes=%d current-level-buffers=%d current-level-time=%" GST_TIME_FORMAT "",
-			info->type, num_buffers, info->data, gst_buffer_get_size (buffer), t->bitrate_sum, GST_TIME_ARGS(now), GST_TIME_ARGS(t->measure_start+BITRATE_AVG_PERIOD), cur_bytes, cur_buf, GST_TIME_ARGS(cur_time));
+	/* this runs for every buffer, so the queue levels are only looked at once per period */
 	if (now > t->measure_start+BITRATE_AVG_PERIOD)
 	{
+		QUEUE_DEBUG;
+		GST_TRACE_OBJECT(app, "probetype=%i num_buffers=%i bitrate_sum=%zu now=%" GST_TIME_FORMAT " queue current-level-bytes=%" G_GUINT64_FORMAT,
+				info->type, num_buffers, t->bitrate_sum, GST_TIME_ARGS(now), cur_bytes);
 		gint bitrate = t->bitrate_sum*8/GST_TIME_AS_MSECONDS(BITRATE_AVG_PERIOD);
 		t->bitrate_avg ? (t->bitrate_avg = (t->bitrate_avg+bitrate)/2) : (t->bitrate_avg = bitrate);
 		send_signal (app, "tcpBitrate", g_variant_new("(i)", bitrate));
+		upstream_tune_queue (app, t->bitrate_avg);
+		if (t->ladder_len && t->rung)
+			upstream_idle_add (app, &t->id_ladder_climb, (GSourceFunc) upstream_ladder_climb_idle);
 		t->measure_start = now;
 		t->bitrate_sum = 0;
 	}
 	return GST_PAD_PROBE_OK;
 }
 
-gboolean upstream_keep_alive (App *app)
+/* runs for every buffer. the appsrc is only limited in bytes and only
+ * upstream_tune_queue sets that limit, so it's taken from there */
+static guint upstream_queue_fill (DreamTCPupstream *t)
 {
-	GstBuffer *buf = gst_buffer_new_allocate (NULL, TS_PACK_SIZE, NULL);
-	gst_buffer_memset (buf, 0, 0x00, TS_PACK_SIZE);
-	GstPad * srcpad = gst_element_get_static_pad (app->tcp_upstream->tstcpq, "src");
-
-	GstState state;
-	gst_element_get_state (app->tcp_upstream->tcpsink, &state, NULL, 10*GST_SECOND);
-	GST_INFO_OBJECT(app, "tcpsink's state=%s", gst_element_state_get_name (state));
-	gst_element_get_state (app->tcp_upstream->tstcpq, &state, NULL, 10*GST_SECOND);
-	GST_INFO_OBJECT(app, "tstcpq's state=%s", gst_element_state_get_name (state));
+	if (!t->queue_max_bytes)
+		return 0;
+	return gst_app_src_get_current_level_bytes (GST_APP_SRC (t->tssrc))*100/t->queue_max_bytes;
+}
 
-	if ( state == GST_STATE_PAUSED )
+/* returns the part of buffer that goes out at the current fill level, a
+ * new reference or NULL */
+static GstBuffer *upstream_drop_frames(App *app, GstBuffer *buffer)
+{
+	DreamTCPupstream *t = app->tcp_upstream;
+	gboolean gop_dropped = FALSE;
+	guint fill = upstream_queue_fill (t);
+	tsDropLevel level = t->drop_level;
+
+	if (t->state < UPSTREAM_STATE_TRANSMITTING)
+		level = TS_DROP_NONE;
+	else if (t->audio_only)
+		level = TS_DROP_VIDEO;
+	else if (fill >= DROP_GOP_LEVEL)
+		level = TS_DROP_GOP;
+	else if (fill >= DROP_NONREF_LEVEL)
+		level = MAX (level, TS_DROP_NONREF);
+	else if (fill < DROP_RESUME_LEVEL)
+		level = TS_DROP_NONE;
+
+	if (level != t->drop_level)
 	{
-		GstStateChangeReturn sret = gst_element_set_state (app->tcp_upstream->tcpsink, GST_STATE_PLAYING);
-		GST_DEBUG_OBJECT(app, "gst_element_set_state (tcpsink, GST_STATE_PLAYING) = %i", sret);
-		sret = gst_element_set_state (app->tcp_upstream->tstcpq, GST_STATE_PLAYING);
-		GST_DEBUG_OBJECT(app, "gst_element_set_state (tstcpq, GST_STATE_PLAYING) = %i", sret);
-		GST_INFO ("injecting keepalive %" GST_PTR_FORMAT " on pad %s:%s", buf, GST_DEBUG_PAD_NAME (srcpad));
-		gst_pad_push (srcpad, gst_buffer_ref(buf));
-		sret = gst_element_set_state (app->tcp_upstream->tcpsink, GST_STATE_PAUSED);
-		GST_DEBUG_OBJECT(app, "gst_element_set_state (tcpsink, GST_STATE_PAUSED) = %i", sret);
-		sret = gst_element_set_state (app->tcp_upstream->tstcpq, GST_STATE_PAUSED);
-		GST_DEBUG_OBJECT(app, "gst_element_set_state (tstcpq, GST_STATE_PAUSED) = %i", sret);
+		GST_INFO_OBJECT (app, "upstream queue filled to %u%%, drop level %i -> %i (dropped frames=%" G_GUINT64_FORMAT " gops=%" G_GUINT64_FORMAT " packets=%" G_GUINT64_FORMAT ")",
+				 fill, t->drop_level, level, t->dropper.dropped_frames, t->dropper.dropped_gops, t->dropper.dropped_packets);
+		t->drop_level = level;
 	}
 
-	return G_SOURCE_REMOVE;
+	GstBuffer *outbuf = dream_ts_dropper_process (&t->dropper, buffer, level, &gop_dropped);
+	if (outbuf == buffer)
+		gst_buffer_ref (outbuf);
+
+	/* a dropped GOP is what an overrun used to be, so let the overload handling know */
+	if (gop_dropped)
+		upstream_idle_add (app, &t->id_gop_dropped, (GSourceFunc) upstream_gop_dropped);
+
+	return outbuf;
+}
+
+/* the upstream's consumer of the ts ring. a full appsrc leaves the samples
+ * in the ring, it's what the queue's overrun signal used to report */
+static gboolean upstream_handover (DreamRingConsumer *consumer, GstSample *sample, gpointer user_data)
+{
+	App *app = user_data;
+	DreamTCPupstream *t = app->tcp_upstream;
+
+	if (t->queue_max_bytes && gst_app_src_get_current_level_bytes (GST_APP_SRC (t->tssrc)) >= t->queue_max_bytes)
+	{
+		if (t->overrun_armed)
+			upstream_idle_add (app, &t->id_overrun, (GSourceFunc) upstream_overrun_idle);
+		return FALSE;
+	}
+
+	GstBuffer *buffer = upstream_drop_frames (app, gst_sample_get_buffer (sample));
+	if (buffer)
+		branch_appsrc_push (GST_APP_SRC (t->tssrc), sample, buffer);
+	return TRUE;
+}
+
+/* keeps the mediator connection alive while the sources are paused by pushing
+ * transport stream null packets through the keepalive appsrc which is funneled
+ * in between tssrc and tcpsink. the appsrc has its own streaming thread, so a
+ * stalled connection can never block the main loop */
+gboolean upstream_keep_alive (App *app)
+{
+	DreamTCPupstream *t = app->tcp_upstream;
+	if (t->state != UPSTREAM_STATE_WAITING || !t->keepalive)
+	{
+		GST_DEBUG_OBJECT (app, "no longer waiting, stop sending keepalives");
+		t->id_signal_keepalive = 0;
+		return G_SOURCE_REMOVE;
+	}
+
+	guint64 pending = 0;
+	g_object_get (t->keepalive, "current-level-bytes", &pending, NULL);
+	if (pending)
+	{
+		GST_DEBUG_OBJECT (app, "previous keepalive still pending (%" G_GUINT64_FORMAT " bytes), connection stalled?", pending);
+		return G_SOURCE_CONTINUE;
+	}
+
+	GstBuffer *buf = dream_ts_null_packets_new (KEEPALIVE_PACKETS);
+	GST_LOG_OBJECT (app, "injecting keepalive %" GST_PTR_FORMAT, buf);
+	gst_app_src_push_buffer (GST_APP_SRC (t->keepalive), buf);
+	return G_SOURCE_CONTINUE;
 }
 
 gboolean upstream_set_waiting (App *app)
@@ -1080,7 +1728,8 @@ gboolean upstream_set_waiting (App *app)
 	t->state = UPSTREAM_STATE_WAITING;
 	g_object_set (t->tcpsink, "max-lateness", G_GINT64_CONSTANT(1)*GST_SECOND, NULL);
 	send_signal (app, "upstreamStateChanged", g_variant_new("(i)", UPSTREAM_STATE_WAITING));
-	g_signal_connect (t->tstcpq, "underrun", G_CALLBACK (queue_underrun), app);
+	g_signal_connect (t->tssrc, "need-data", G_CALLBACK (upstream_need_data), app);
+	g_signal_connect (t->tcpsink, "decongested", G_CALLBACK (upstream_decongested), app);
 	GstPad *sinkpad = gst_element_get_static_pad (t->tcpsink, "sink");
 	if (t->id_resume)
 	{
@@ -1096,26 +1745,115 @@ gboolean upstream_set_waiting (App *app)
 	gst_object_unref (sinkpad);
 	pause_source_pipeline(app);
 	t->id_signal_waiting = 0;
-	t->id_signal_keepalive = g_timeout_add_seconds (5, (GSourceFunc) upstream_keep_alive, app);
+	if (!t->id_signal_keepalive)
+		t->id_signal_keepalive = g_timeout_add_seconds (KEEPALIVE_INTERVAL, (GSourceFunc) upstream_keep_alive, app);
 	DREAMRTSPSERVER_UNLOCK (app);
 	return G_SOURCE_REMOVE;
 }
 
+/* the tcp sink signals from its streaming thread or from the clock thread
+ * while it holds its batch lock, and the gop dropper runs in a pad probe.
+ * the overload handling takes the server lock, so it's run from the main loop.
+ * each kind is queued once and its id is kept, so disable_tcp_upstream can
+ * drop what's still pending before the branch goes away */
+static void upstream_idle_add (App *app, guint *id, GSourceFunc func)
+{
+	DreamTCPupstream *t = app->tcp_upstream;
+	g_mutex_lock (&t->idle_lock);
+	if (!*id && !t->idle_closed)
+		*id = g_idle_add (func, app);
+	g_mutex_unlock (&t->idle_lock);
+}
+
+static void upstream_idle_done (App *app, guint *id)
+{
+	DreamTCPupstream *t = app->tcp_upstream;
+	g_mutex_lock (&t->idle_lock);
+	*id = 0;
+	g_mutex_unlock (&t->idle_lock);
+}
+
+static void upstream_idle_remove (App *app)
+{
+	DreamTCPupstream *t = app->tcp_upstream;
+	guint *ids[] = { &t->id_gop_dropped, &t->id_overrun, &t->id_congested, &t->id_decongested, &t->id_ladder_climb };
+	guint i;
+	g_mutex_lock (&t->idle_lock);
+	/* the probes and signal handlers go with the branch, until then they queue nothing */
+	t->idle_closed = TRUE;
+	for (i = 0; i < G_N_ELEMENTS (ids); i++)
+	{
+		if (*ids[i])
+			g_source_remove (*ids[i]);
+		*ids[i] = 0;
+	}
+	g_mutex_unlock (&t->idle_lock);
+}
+
+static gboolean upstream_gop_dropped (App *app)
+{
+	DreamTCPupstream *t = app->tcp_upstream;
+	upstream_idle_done (app, &t->id_gop_dropped);
+	if (t->tssrc)
+		queue_overrun (t->tssrc, app);
+	return G_SOURCE_REMOVE;
+}
+
+/* the appsrc ran full while overruns were looked for, see upstream_handover */
+static gboolean upstream_overrun_idle (App *app)
+{
+	DreamTCPupstream *t = app->tcp_upstream;
+	upstream_idle_done (app, &t->id_overrun);
+	if (t->tssrc && t->overrun_armed)
+		queue_overrun (t->tssrc, app);
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean upstream_congested_idle (App *app)
+{
+	DreamTCPupstream *t = app->tcp_upstream;
+	upstream_idle_done (app, &t->id_congested);
+	if (t->tcpsink)
+		queue_overrun (t->tcpsink, app);
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean upstream_decongested_idle (App *app)
+{
+	DreamTCPupstream *t = app->tcp_upstream;
+	upstream_idle_done (app, &t->id_decongested);
+	if (t->tcpsink)
+		queue_underrun (t->tcpsink, app);
+	return G_SOURCE_REMOVE;
+}
+
+static void upstream_congested (GstElement * sink, gpointer user_data)
+{
+	App *app = user_data;
+	upstream_idle_add (app, &app->tcp_upstream->id_congested, (GSourceFunc) upstream_congested_idle);
+}
+
+static void upstream_decongested (GstElement * sink, gpointer user_data)
+{
+	App *app = user_data;
+	upstream_idle_add (app, &app->tcp_upstream->id_decongested, (GSourceFunc) upstream_decongested_idle);
+}
+
 static void queue_underrun (GstElement * queue, gpointer user_data)
 {
 	App *app = user_data;
 	DreamTCPupstream *t = app->tcp_upstream;
 	QUEUE_DEBUG;
-	GST_DEBUG_OBJECT (app, "queue underrun! properties: current-level-bytes=%d current-level-buffers=%d current-level-time=%" GST_TIME_FORMAT "", cur_bytes, cur_buf, GST_TIME_ARGS(cur_time));
-	if (queue == t->tstcpq && app->rtsp_server->state != RTSP_STATE_RUNNING)
+	GST_DEBUG_OBJECT (app, "queue underrun! current-level-bytes=%" G_GUINT64_FORMAT, cur_bytes);
+	if ((queue == t->tssrc || queue == t->tcpsink) && t->state == UPSTREAM_STATE_WAITING && app->rtsp_server->state != RTSP_STATE_RUNNING)
 	{
 		if (unpause_source_pipeline(app))
 		{
 			DREAMRTSPSERVER_LOCK (app);
-// 			g_object_set (G_OBJECT (t->tstcpq), "leaky", 2, "max-size-buffers", 0, "max-size-bytes", 0, "max-size-time", G_GINT64_CONSTANT(5)*GST_SECOND, NULL);
 			g_object_set (t->tcpsink, "max-lateness", G_GINT64_CONSTANT(-1), NULL);
-			g_signal_handlers_disconnect_by_func (queue, G_CALLBACK (queue_underrun), app);
-			t->id_signal_overrun = g_signal_connect (queue, "overrun", G_CALLBACK (queue_overrun), app);
+			g_signal_handlers_disconnect_by_func (t->tssrc, G_CALLBACK (upstream_need_data), app);
+			g_signal_handlers_disconnect_by_func (t->tcpsink, G_CALLBACK (upstream_decongested), app);
+			t->overrun_armed = TRUE;
 			t->state = UPSTREAM_STATE_TRANSMITTING;
 			send_signal (app, "upstreamStateChanged", g_variant_new("(i)", UPSTREAM_STATE_TRANSMITTING));
 			if (t->id_bitrate_measure == 0)
@@ -1133,32 +1871,41 @@ static void queue_underrun (GstElement * queue, gpointer user_data)
 	}
 }
 
+/* the appsrc running dry is what the queue's underrun signal used to report */
+static void upstream_need_data (GstElement * appsrc, guint length, gpointer user_data)
+{
+	queue_underrun (appsrc, user_data);
+}
+
 static void queue_overrun (GstElement * queue, gpointer user_data)
 {
 	App *app = user_data;
 	DreamTCPupstream *t = app->tcp_upstream;
 	DREAMRTSPSERVER_LOCK (app);
-	if (queue == t->tstcpq/* && app->rtsp_server->state != RTSP_STATE_IDLE*/) //!!!TODO
+	if (queue == t->tssrc || queue == t->tcpsink/* && app->rtsp_server->state != RTSP_STATE_IDLE*/) //!!!TODO
 	{
 		QUEUE_DEBUG;
-		GST_DEBUG_OBJECT(app, "%" GST_PTR_FORMAT " overrun! properties: current-level-bytes=%d current-level-buffers=%d current-level-time=%" GST_TIME_FORMAT " rtsp_server->state=%i", queue, cur_bytes, cur_buf, GST_TIME_ARGS(cur_time), app->rtsp_server->state);
+		GST_DEBUG_OBJECT(app, "%" GST_PTR_FORMAT " overrun! current-level-bytes=%" G_GUINT64_FORMAT " rtsp_server->state=%i", queue, cur_bytes, app->rtsp_server->state);
 		GstClockTime now = gst_clock_get_time (app->clock);
 		if (t->state == UPSTREAM_STATE_CONNECTING)
 		{
 			GST_DEBUG_OBJECT (queue, "initial queue overrun after connect");
-// 			g_object_set (G_OBJECT (t->tstcpq), "leaky", 0, "max-size-buffers", 0, "max-size-bytes", 0, "max-size-time", G_GINT64_CONSTANT(5)*GST_SECOND, "min-threshold-buffers", 0, NULL);
-			g_signal_handlers_disconnect_by_func(t->tstcpq, G_CALLBACK (queue_overrun), app);
-			t->id_signal_overrun = 0;
+			t->overrun_armed = FALSE;
 			DREAMRTSPSERVER_UNLOCK (app);
 			upstream_set_waiting (app);
 			return;
 		}
 		else if (t->state == UPSTREAM_STATE_TRANSMITTING)
 		{
+			if (t->spool != DREAM_TCP_SINK_SPOOL_NONE && queue == t->tcpsink)
+			{
+				GST_DEBUG_OBJECT (queue, "congested while transmitting, the spool keeps the stream complete");
+				DREAMRTSPSERVER_UNLOCK (app);
+				return;
+			}
 			if (t->id_signal_waiting)
 			{
-				g_signal_handlers_disconnect_by_func(t->tstcpq, G_CALLBACK (queue_overrun), app);
-				t->id_signal_overrun = 0;
+				t->overrun_armed = FALSE;
 				GST_DEBUG_OBJECT (queue, "disconnect overrun callback and wait for timeout or for buffer flow!");
 				DREAMRTSPSERVER_UNLOCK (app);
 				return;
@@ -1232,114 +1979,722 @@ static void queue_overrun (GstElement * queue, gpointer user_data)
 	DREAMRTSPSERVER_UNLOCK (app);
 }
 
+/* parses "WIDTHxHEIGHT@FPS:KBPS,...[,audio]" from best to worst quality. an
+ * empty spec disables the ladder, so overloads only cut the bitrate */
+static gboolean upstream_ladder_parse(DreamTCPupstream *t, const gchar *spec)
+{
+	UpstreamRung ladder[MAX_LADDER_RUNGS];
+	gchar **rungs = g_strsplit (spec, ",", -1);
+	guint i, len = 0;
+	gboolean ret = TRUE;
+
+	for (i = 0; rungs[i] && ret; i++)
+	{
+		UpstreamRung *r = &ladder[len];
+		gchar *rung = g_strstrip (rungs[i]);
+		if (!*rung)
+			continue;
+		if (len == MAX_LADDER_RUNGS || (len && ladder[len-1].kbps == 0))
+			ret = FALSE;
+		else if (g_strcmp0 (rung, "audio") == 0)
+		{
+			memset (r, 0, sizeof(UpstreamRung));
+			len++;
+		}
+		else if (sscanf (rung, "%ux%u@%u:%d", &r->width, &r->height, &r->framerate, &r->kbps) == 4 && r->kbps > 0 && (!len || r->kbps < ladder[len-1].kbps))
+			len++;
+		else
+			ret = FALSE;
+	}
+	g_strfreev (rungs);
+	if (!ret)
+		return FALSE;
+
+	memcpy (t->ladder, ladder, len*sizeof(UpstreamRung));
+	t->ladder_len = len;
+	g_free (t->ladder_spec);
+	t->ladder_spec = g_strdup (spec);
+	return TRUE;
+}
+
+/* the dreamvideosource whose caps the ladder may change. a software upstream
+ * encoder only gets bitrate and audio only steps */
+static GstElement *upstream_video_source(App *app)
+{
+	DreamTCPupstream *t = app->tcp_upstream;
+	if (t->encoder_active == UPSTREAM_ENCODER_DEDICATED)
+		return t->encoder_vtarget;
+	if (t->encoder_active == UPSTREAM_ENCODER_SHARED)
+		return app->vsrc;
+	return NULL;
+}
+
+static void upstream_ladder_apply(App *app, guint rung, GstClockTime now)
+{
+	DreamTCPupstream *t = app->tcp_upstream;
+	UpstreamRung *r = &t->ladder[rung];
+	SourceProperties *c = &t->configured;
+	GstElement *vsrc = upstream_video_source (app);
+
+	GST_INFO_OBJECT (app, "quality ladder: rung %u -> %u (%ux%u@%u needs %i kbit/s, measured %i kbit/s)", t->rung, rung, r->width, r->height, r->framerate, r->kbps, t->bitrate_avg);
+	t->rung_climbed = rung < t->rung;
+	t->rung = rung;
+	t->rung_time = now;
+	if (t->tcpsink)
+		gst_dream_tcp_sink_get_link_rate (GST_DREAM_TCP_SINK (t->tcpsink), &t->link_samples);
+	t->audio_only = r->kbps == 0;
+	send_signal (app, "upstreamRungChanged", g_variant_new("(i)", rung));
+	if (t->audio_only || !vsrc)
+		return;
+
+	/* never go above what's configured for the source */
+	if (c->width && c->height && r->width * r->height > c->width * c->height)
+		gst_set_resolution (app, vsrc, c->width, c->height);
+	else
+		gst_set_resolution (app, vsrc, r->width, r->height);
+	gst_set_framerate (app, vsrc, c->framerate ? MIN (r->framerate, c->framerate) : r->framerate);
+}
+
+/* undoes what the ladder changed, when upstream goes away or gets a new ladder */
+static void upstream_ladder_reset(App *app)
+{
+	DreamTCPupstream *t = app->tcp_upstream;
+	SourceProperties *c = &t->configured;
+	GstElement *vsrc = upstream_video_source (app);
+
+	if (t->rung && vsrc)
+	{
+		GST_INFO_OBJECT (app, "quality ladder: back from rung %u to the configured quality", t->rung);
+		if (c->width && c->height)
+			gst_set_resolution (app, vsrc, c->width, c->height);
+		if (c->framerate)
+			gst_set_framerate (app, vsrc, c->framerate);
+	}
+	t->rung = 0;
+	t->rung_climbed = t->audio_only = FALSE;
+	t->ladder_hold = LADDER_HOLD;
+	t->rung_time = t->overload_time = 0;
+	t->link_samples = 0;
+}
+
+/* steps down as far as the measured bandwidth requires. falling back right
+ * after a climb means the link sits near that threshold, so the next climb
+ * has to wait twice as long */
+static void upstream_ladder_step_down(App *app, GstClockTime now)
+{
+	DreamTCPupstream *t = app->tcp_upstream;
+	guint rung = t->rung;
+
+	t->overload_time = now;
+	/* without a measurement there's nothing to tell how far down is enough */
+	if (!t->bitrate_avg)
+	{
+		if (rung+1 < t->ladder_len)
+			rung++;
+	}
+	else
+	{
+		while (rung+1 < t->ladder_len && t->bitrate_avg < t->ladder[rung].kbps)
+			rung++;
+	}
+	if (rung == t->rung)
+		return;
+	if (t->rung_climbed && now < t->rung_time + t->ladder_hold)
+		t->ladder_hold = MIN (t->ladder_hold*2, LADDER_HOLD_MAX);
+	else
+		t->ladder_hold = LADDER_HOLD;
+	upstream_ladder_apply (app, rung, now);
+}
+
+/* the measurement runs in the tcp sink's streaming thread, the encoder
+ * changes are made from the main loop with the server locked */
+static gboolean upstream_ladder_climb_idle(App *app)
+{
+	upstream_idle_done (app, &app->tcp_upstream->id_ladder_climb);
+	DREAMRTSPSERVER_LOCK (app);
+	upstream_ladder_climb (app, gst_clock_get_time (app->clock));
+	DREAMRTSPSERVER_UNLOCK (app);
+	return G_SOURCE_REMOVE;
+}
+
+/* whether the link has room for the next rung. nothing may be queued, and
+ * if the sink's send queue backed up since the last rung change, the rate
+ * it drained at has to cover what the climb starts with. when it never
+ * backed up, even the key frame bursts left right away */
+static gboolean upstream_ladder_headroom(App *app)
+{
+	DreamTCPupstream *t = app->tcp_upstream;
+	GstDreamTCPSink *sink = GST_DREAM_TCP_SINK (t->tcpsink);
+	guint samples, link = gst_dream_tcp_sink_get_link_rate (sink, &samples);
+	guint fill = upstream_queue_fill (t);
+	guint unsent = gst_dream_tcp_sink_get_unsent_bytes (sink);
+	gint need = t->ladder[t->rung-1].kbps * LADDER_CLIMB_MARGIN;
+
+	if (fill >= DROP_RESUME_LEVEL || unsent > sink->decongestion_threshold)
+	{
+		GST_DEBUG_OBJECT (app, "quality ladder: not climbing, queue at %u%% and %u bytes unsent", fill, unsent);
+		return FALSE;
+	}
+	if (samples != t->link_samples && (gint) link < need)
+	{
+		GST_DEBUG_OBJECT (app, "quality ladder: not climbing, link carries %u kbit/s and rung %u needs %i kbit/s", link, t->rung-1, need);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* climbs one rung once the upstream went ladder_hold without an overload and
+ * the link has room for it, starting a bit above what the new rung needs */
+static void upstream_ladder_climb(App *app, GstClockTime now)
+{
+	DreamTCPupstream *t = app->tcp_upstream;
+	SourceProperties *c = &t->configured;
+	GstElement *venc;
+	gint audioBitrate = c->audioBitrate, videoBitrate;
+
+	if (!t->ladder_len || !t->rung || t->state != UPSTREAM_STATE_TRANSMITTING || now < MAX (t->rung_time, t->overload_time) + t->ladder_hold)
+		return;
+	if (!t->tcpsink || !upstream_ladder_headroom (app))
+		return;
+
+	upstream_ladder_apply (app, t->rung-1, now);
+
+	venc = t->encoder_vtarget ? t->encoder_vtarget : app->vsrc;
+	if (t->encoder_atarget)
+		g_object_get (G_OBJECT (t->encoder_atarget), "bitrate", &audioBitrate, NULL);
+	videoBitrate = t->ladder[t->rung].kbps * LADDER_CLIMB_MARGIN - audioBitrate;
+	if (c->videoBitrate && (!t->rung || videoBitrate > c->videoBitrate))
+		videoBitrate = c->videoBitrate;
+	if (videoBitrate > 0 && GST_IS_ELEMENT (venc))
+	{
+		g_object_set (G_OBJECT (venc), "bitrate", videoBitrate, NULL);
+		if (venc == app->vsrc)
+			app->source_properties.videoBitrate = videoBitrate;
+		upstream_tune_queue (app, audioBitrate+videoBitrate);
+	}
+}
+
 static void auto_adjust_bitrate(App *app)
 {
 	DreamTCPupstream *t = app->tcp_upstream;
-	get_source_properties (app);
-	SourceProperties *p = &app->source_properties;
-	GST_DEBUG_OBJECT (app, "auto overload handling: reduce bitrate from audioBitrate=%i videoBitrate=%i to fit network bandwidth=%i kbit/s", p->audioBitrate, p->videoBitrate, t->bitrate_avg);
-	if (p->audioBitrate > 96)
-		p->audioBitrate = p->audioBitrate*0.8;
-	p->videoBitrate = (t->bitrate_avg - p->audioBitrate) * 0.8;
-	GST_INFO_OBJECT (app, "auto overload handling: newAudioBitrate=%i newVideoBitrate=%i newTotalBitrate~%i kbit/s", p->audioBitrate, p->videoBitrate, p->audioBitrate+p->videoBitrate);
-	apply_source_properties(app);
+	if (t->ladder_len)
+		upstream_ladder_step_down (app, gst_clock_get_time (app->clock));
+	if (t->audio_only)
+	{
+		GST_INFO_OBJECT (app, "auto overload handling: upstream is down to audio only");
+	}
+	else if (t->encoder_active != UPSTREAM_ENCODER_SHARED)
+	{
+		/* upstream has an encoder of its own, the local outputs keep their quality */
+		gint audioBitrate = app->source_properties.audioBitrate, videoBitrate = 0;
+		if (t->encoder_atarget)
+			g_object_get (G_OBJECT (t->encoder_atarget), "bitrate", &audioBitrate, NULL);
+		g_object_get (G_OBJECT (t->encoder_vtarget), "bitrate", &videoBitrate, NULL);
+		GST_DEBUG_OBJECT (app, "auto overload handling: reduce upstream encoder bitrate from audioBitrate=%i videoBitrate=%i to fit network bandwidth=%i kbit/s", audioBitrate, videoBitrate, t->bitrate_avg);
+		if (t->encoder_atarget && audioBitrate > 96)
+		{
+			audioBitrate = audioBitrate*0.8;
+			g_object_set (G_OBJECT (t->encoder_atarget), "bitrate", audioBitrate, NULL);
+		}
+		videoBitrate = (t->bitrate_avg - audioBitrate) * 0.8;
+		g_object_set (G_OBJECT (t->encoder_vtarget), "bitrate", videoBitrate, NULL);
+		GST_INFO_OBJECT (app, "auto overload handling: upstream newAudioBitrate=%i newVideoBitrate=%i newTotalBitrate~%i kbit/s", audioBitrate, videoBitrate, audioBitrate+videoBitrate);
+		upstream_tune_queue (app, audioBitrate+videoBitrate);
+	}
+	else
+	{
+		get_source_properties (app);
+		SourceProperties *p = &app->source_properties;
+		GST_DEBUG_OBJECT (app, "auto overload handling: reduce bitrate from audioBitrate=%i videoBitrate=%i to fit network bandwidth=%i kbit/s", p->audioBitrate, p->videoBitrate, t->bitrate_avg);
+		if (p->audioBitrate > 96)
+			p->audioBitrate = p->audioBitrate*0.8;
+		p->videoBitrate = (t->bitrate_avg - p->audioBitrate) * 0.8;
+		GST_INFO_OBJECT (app, "auto overload handling: newAudioBitrate=%i newVideoBitrate=%i newTotalBitrate~%i kbit/s", p->audioBitrate, p->videoBitrate, p->audioBitrate+p->videoBitrate);
+		apply_source_properties(app);
+		upstream_tune_queue (app, p->audioBitrate+p->videoBitrate);
+	}
 	if (t->id_signal_waiting)
 		g_source_remove (t->id_signal_waiting);
 	t->id_signal_waiting = g_timeout_add_seconds (RESUME_DELAY, (GSourceFunc) upstream_resume_transmitting, app);
 	t->overrun_counter = 0;
 }
 
-static GstFlowReturn handover_payload (GstElement * appsink, gpointer user_data)
+/* the queue limit is expressed in bytes derived from the latency budget, so it
+ * holds the same amount of time regardless of the current bitrate */
+static void upstream_tune_queue(App *app, gint bitrate)
 {
-	App *app = user_data;
-	DreamRTSPserver *r = app->rtsp_server;
+	DreamTCPupstream *t = app->tcp_upstream;
+	if (!t->tssrc)
+		return;
+	if (bitrate <= 0)
+	{
+		gint audioBitrate = app->source_properties.audioBitrate, videoBitrate = app->source_properties.videoBitrate;
+		if (t->encoder_atarget)
+			g_object_get (G_OBJECT (t->encoder_atarget), "bitrate", &audioBitrate, NULL);
+		if (t->encoder_vtarget)
+			g_object_get (G_OBJECT (t->encoder_vtarget), "bitrate", &videoBitrate, NULL);
+		bitrate = audioBitrate + videoBitrate;
+	}
 
-	GstAppSrc *appsrc = NULL;
-	if ( appsink == r->vappsink )
-		appsrc = GST_APP_SRC(r->es_vappsrc);
-	else if ( appsink == r->aappsink )
-		appsrc = GST_APP_SRC(r->es_aappsrc);
-	else if ( appsink == r->tsappsink )
-		appsrc = GST_APP_SRC(r->ts_appsrc);
+	guint max_bytes = MAX ((guint64) bitrate * t->latency / 8, MIN_UPSTREAM_QUEUE_BYTES);
+	guint cur_max_bytes = t->queue_max_bytes;
+	if (cur_max_bytes && ABS ((gint) max_bytes - (gint) cur_max_bytes) < cur_max_bytes / 10)
+		return;
 
-	GstSample *sample = gst_app_sink_pull_sample (GST_APP_SINK (appsink));
-	if (appsrc && g_list_length(r->clients_list) > 0) {
-		GstBuffer *buffer = gst_sample_get_buffer (sample);
-		GstCaps *caps = gst_sample_get_caps (sample);
+	GST_INFO_OBJECT (app, "latency budget %u ms at %i kbit/s -> upstream queue max-bytes=%u (was %u)", t->latency, bitrate, max_bytes, cur_max_bytes);
+	g_object_set (G_OBJECT (t->tssrc), "max-bytes", (guint64) max_bytes, NULL);
+	t->queue_max_bytes = max_bytes;
+}
 
-		GST_LOG_OBJECT(appsink, "%" GST_PTR_FORMAT" @ %" GST_PTR_FORMAT, buffer, appsrc);
-		if (r->rtsp_start_pts == GST_CLOCK_TIME_NONE) {
-			if (GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT))
-			{
-				GST_LOG("GST_BUFFER_FLAG_DELTA_UNIT dropping!");
-				gst_sample_unref(sample);
-//				DREAMRTSPSERVER_UNLOCK (app);
-				return GST_FLOW_OK;
-			}
-			else if (appsink == r->vappsink || appsink == r->tsappsink)
-			{
-				DREAMRTSPSERVER_LOCK (app);
-				r->rtsp_start_pts = GST_BUFFER_PTS (buffer);
-				r->rtsp_start_dts = GST_BUFFER_DTS (buffer);
-				GST_LOG_OBJECT(appsink, "frame is IFRAME! set rtsp_start_pts=%" GST_TIME_FORMAT " rtsp_start_dts=%" GST_TIME_FORMAT " @ %"GST_PTR_FORMAT"", GST_TIME_ARGS (GST_BUFFER_PTS (buffer)), GST_TIME_ARGS (GST_BUFFER_DTS (buffer)), appsrc);
-				DREAMRTSPSERVER_UNLOCK (app);
-			}
-		}
-		if (GST_BUFFER_PTS (buffer) < r->rtsp_start_pts)
-			GST_BUFFER_PTS (buffer) = 0;
-		else
-			GST_BUFFER_PTS (buffer) -= r->rtsp_start_pts;
-		GST_BUFFER_DTS (buffer) -= r->rtsp_start_dts;
-		//    GST_LOG("new PTS %" GST_TIME_FORMAT " DTS %" GST_TIME_FORMAT "", GST_TIME_ARGS (GST_BUFFER_PTS (buffer)), GST_TIME_ARGS (GST_BUFFER_DTS (buffer)));
+/* the sink spreads the mux output over time at the rate it derives from the
+ * PCRs, so I-frame bursts don't overflow the uplink and fake an overload */
+static void upstream_set_pacing(App *app)
+{
+	DreamTCPupstream *t = app->tcp_upstream;
+	GST_DEBUG_OBJECT (app, "upstream pacing %s, burst allowance %u KiB", t->pace_burst ? "on" : "off", t->pace_burst);
+	if (t->pace_burst)
+		g_object_set (t->tcpsink, "pace", TRUE, "pace-burst", t->pace_burst*1024, NULL);
+	else
+		g_object_set (t->tcpsink, "pace", FALSE, NULL);
+}
 
-		GstCaps *oldcaps;
+/* the muxer's sink pads are fixed, a caps based pick could hook a queue that
+ * isn't linked upstream yet to the wrong one */
+static gboolean tsmux_link(GstElement *aq, GstElement *vq, GstElement *tsmux)
+{
+	return gst_element_link_pads (aq, "src", tsmux, "audio") && gst_element_link_pads (vq, "src", tsmux, "video");
+}
 
-		oldcaps = gst_app_src_get_caps (appsrc);
-		if (!oldcaps || !gst_caps_is_equal (oldcaps, caps))
+static GstElement *upstream_encoder_element (GstElement *bin, const gchar *factory, const gchar *name)
+{
+	GstElement *element = gst_element_factory_make (factory, name);
+	if (element)
+		gst_bin_add (GST_BIN (bin), element);
+	else
+		GST_WARNING ("upstream encoder: couldn't create %s", factory);
+	return element;
+}
+
+/* builds a bin which feeds the upstream from an encoder of its own, either a
+ * second hardware instance or a software transcode of the local stream, so
+ * auto_adjust_bitrate() doesn't degrade RTSP and HLS. the bin isn't put into
+ * the pipeline before enable_tcp_upstream(). when the requested mode can't be
+ * set up, upstream keeps sharing the local tsmux */
+static gboolean create_upstream_encoder(App *app)
+{
+	DreamTCPupstream *t = app->tcp_upstream;
+	GstElement *bin, *asrc = NULL, *aparse = NULL, *vsrc = NULL, *vdec = NULL, *venc = NULL;
+	GstElement *aq, *vq, *vparse, *tsmux, *tssink;
+	GstPad *pad;
+
+	if (t->encoder_bin)
+		return TRUE;
+	t->encoder_active = UPSTREAM_ENCODER_SHARED;
+	t->encoder_atarget = t->encoder_vtarget = NULL;
+	if (t->encoder == UPSTREAM_ENCODER_SHARED)
+		return TRUE;
+
+	bin = gst_object_ref_sink (gst_bin_new ("upstreamencoder"));
+	aq = upstream_encoder_element (bin, "queue", "upstreamaqueue");
+	vq = upstream_encoder_element (bin, "queue", "upstreamvqueue");
+	vparse = upstream_encoder_element (bin, "h264parse", NULL);
+	tsmux = g_object_new (GST_TYPE_DREAM_TS_MUX, "name", "upstreamtsmux", NULL);
+	gst_bin_add (GST_BIN (bin), tsmux);
+	if (t->encoder == UPSTREAM_ENCODER_DEDICATED)
+	{
+		if ((asrc = create_source_element (app, DREAM_SOFT_SOURCE_AUDIO, app->daemon->n_channels + app->channel)))
+			gst_bin_add (GST_BIN (bin), asrc);
+		if ((vsrc = create_source_element (app, DREAM_SOFT_SOURCE_VIDEO, app->daemon->n_channels + app->channel)))
+			gst_bin_add (GST_BIN (bin), vsrc);
+		aparse = upstream_encoder_element (bin, "aacparse", NULL);
+	}
+	else
+	{
+		vdec = upstream_encoder_element (bin, "avdec_h264", NULL);
+		venc = upstream_encoder_element (bin, "x264enc", NULL);
+	}
+	if (!(aq && vq && vparse && ((asrc && vsrc && aparse) || (vdec && venc))))
+		goto fail;
+
+	if (t->encoder == UPSTREAM_ENCODER_DEDICATED)
+	{
+		/* only boxes with an encoder instance left over by the channels can open it */
+		if (gst_element_set_state (vsrc, GST_STATE_READY) == GST_STATE_CHANGE_FAILURE || gst_element_set_state (asrc, GST_STATE_READY) == GST_STATE_CHANGE_FAILURE)
 		{
-			GST_DEBUG("CAPS changed! %" GST_PTR_FORMAT " to %" GST_PTR_FORMAT, oldcaps, caps);
-			gst_app_src_set_caps (appsrc, caps);
+			GST_WARNING_OBJECT (app, "no spare encoder instance available");
+			gst_element_set_state (bin, GST_STATE_NULL);
+			goto fail;
+		}
+		gst_element_set_state (bin, GST_STATE_NULL);
+		if (!gst_element_link_many (asrc, aparse, aq, NULL) || !gst_element_link_many (vsrc, vparse, vq, NULL) || !tsmux_link (aq, vq, tsmux))
+			goto fail;
+
+		if (GST_IS_ELEMENT (app->vsrc))
+		{
+			GstCaps *caps = NULL;
+			inputMode input_mode;
+			g_object_get (G_OBJECT (app->vsrc), "caps", &caps, "input_mode", &input_mode, NULL);
+			if (GST_IS_CAPS (caps))
+			{
+				g_object_set (G_OBJECT (vsrc), "caps", caps, NULL);
+				gst_caps_unref (caps);
+			}
+			g_object_set (G_OBJECT (vsrc), "input_mode", input_mode, NULL);
+			g_object_set (G_OBJECT (asrc), "input_mode", input_mode, NULL);
 		}
-		gst_app_src_push_buffer (appsrc, gst_buffer_ref(buffer));
+		SourceProperties *p = &app->source_properties;
+		g_object_set (G_OBJECT (vsrc), "gop-length", p->gopLength, "gop-scene", p->gopOnSceneChange, "open-gop", p->openGop, "bframes", p->bFrames, "pframes", p->pFrames, "slices", p->slices, "level", p->level, NULL);
+		t->encoder_atarget = asrc;
+		t->encoder_vtarget = vsrc;
 	}
 	else
 	{
-		if ( gst_debug_category_get_threshold (dreamrtspserver_debug) >= GST_LEVEL_LOG)
-			GST_TRACE_OBJECT(appsink, "no rtsp clients, discard payload!");
-// 		else
-// 			g_print (".");
+		/* a slow software encoder must never hold back the shared vtee */
+		g_object_set (G_OBJECT (vq), "leaky", 2, "max-size-buffers", 0, "max-size-bytes", 0, "max-size-time", G_GINT64_CONSTANT(1)*GST_SECOND, NULL);
+		gst_util_set_object_arg (G_OBJECT (venc), "tune", "zerolatency");
+		gst_util_set_object_arg (G_OBJECT (venc), "speed-preset", "ultrafast");
+		if (!gst_element_link_many (vq, vdec, venc, vparse, NULL) || !gst_element_link_pads (vparse, "src", tsmux, "video") || !gst_element_link_pads (aq, "src", tsmux, "audio"))
+			goto fail;
+
+		pad = gst_element_get_static_pad (aq, "sink");
+		gst_element_add_pad (bin, gst_ghost_pad_new ("audio", pad));
+		gst_object_unref (pad);
+		pad = gst_element_get_static_pad (vq, "sink");
+		gst_element_add_pad (bin, gst_ghost_pad_new ("video", pad));
+		gst_object_unref (pad);
+		t->encoder_vtarget = venc;
 	}
-	gst_sample_unref (sample);
 
-	return GST_FLOW_OK;
+	/* upstream reads off a ring on the muxer's output like it does with the
+	 * local one, the fakesink only keeps the muxer going */
+	tssink = upstream_encoder_element (bin, "fakesink", "upstreamtssink");
+	if (!tssink || !gst_element_link (tsmux, tssink))
+		goto fail;
+	g_object_set (G_OBJECT (tssink), "sync", FALSE, "async", FALSE, NULL);
+	pad = gst_element_get_static_pad (tsmux, "src");
+	t->tsring = dream_ring_new ("upstream ts", pad, TS_RING_SIZE, RING_MAX_LAG);
+	gst_object_unref (pad);
+
+	t->encoder_bin = bin;
+	t->encoder_active = t->encoder;
+	GST_INFO_OBJECT (app, "upstream is fed by its own %s encoder", t->encoder_active == UPSTREAM_ENCODER_DEDICATED ? "hardware" : "software");
+	return TRUE;
+
+fail:
+	GST_WARNING_OBJECT (app, "upstream encoder mode %i isn't available, upstream shares the local encoder", t->encoder);
+	gst_object_unref (bin);
+	t->encoder_atarget = t->encoder_vtarget = NULL;
+	return FALSE;
 }
 
-gboolean assert_state(App *app, GstElement *element, GstState state)
+static gboolean link_upstream_encoder(App *app)
 {
-	GstStateChangeReturn sret;
-	GST_DEBUG_OBJECT(app, "setting %" GST_PTR_FORMAT"'s state to %s", element, gst_element_state_get_name (state));
-	GstState pipeline_state, current_state;
-	sret = gst_element_set_state (element, state);
-	gchar *elementname = gst_element_get_name(element);
-	gchar *dotfilename = g_strdup_printf ("assert_state_%s_to_%s_%i", elementname,gst_element_state_get_name (state), sret);
-	GST_DEBUG_BIN_TO_DOT_FILE(GST_BIN(app->pipeline), GST_DEBUG_GRAPH_SHOW_ALL, dotfilename);
-	g_free (elementname);
-	switch (sret) {
-		case GST_STATE_CHANGE_SUCCESS:
-		{
-			GST_DEBUG_OBJECT(app, "GST_STATE_CHANGE_SUCCESS on setting %" GST_PTR_FORMAT"'s state to %s ", element, gst_element_state_get_name (state));
-			return TRUE;
-		}
-		case GST_STATE_CHANGE_FAILURE:
-		{
-			GST_ERROR_OBJECT (app, "GST_STATE_CHANGE_FAILURE when trying to change %" GST_PTR_FORMAT"'s state to %s", element, gst_element_state_get_name (state));
-			return FALSE;
-		}
-		case GST_STATE_CHANGE_ASYNC:
-		{
-			watchdog_ping (app);
-			gboolean fail = FALSE;
-			GST_LOG_OBJECT(app, "GST_STATE_CHANGE_ASYNC %" GST_PTR_FORMAT"", element);
+	DreamTCPupstream *t = app->tcp_upstream;
+	SourceProperties *p = &app->source_properties;
+	GstPad *teepad, *sinkpad;
+
+	if (t->id_encoder_remove)
+	{
+		g_source_remove (t->id_encoder_remove);
+		remove_upstream_encoder (app);
+	}
+
+	/* every upstream session starts out at the configured quality */
+	if (t->encoder_atarget && p->audioBitrate)
+		g_object_set (G_OBJECT (t->encoder_atarget), "bitrate", p->audioBitrate, NULL);
+	if (p->videoBitrate)
+		g_object_set (G_OBJECT (t->encoder_vtarget), "bitrate", p->videoBitrate, NULL);
+
+	gst_bin_add (GST_BIN (app->pipeline), t->encoder_bin);
+	if (!branch_attach (app, NULL, t->tssrc, t->keepalive, t->funnel, t->tcpsink, NULL))
+		return FALSE;
+	if (pipeline_running (app))
+		gst_element_sync_state_with_parent (t->encoder_bin);
+	if (t->encoder_active == UPSTREAM_ENCODER_SOFTWARE)
+	{
+		t->encoder_apad = gst_element_get_request_pad (app->atee, "src_%u");
+		sinkpad = gst_element_get_static_pad (t->encoder_bin, "audio");
+		branch_link (app, t->encoder_apad, sinkpad);
+		gst_object_unref (sinkpad);
+		t->encoder_vpad = teepad = gst_element_get_request_pad (app->vtee, "src_%u");
+		sinkpad = gst_element_get_static_pad (t->encoder_bin, "video");
+		branch_link (app, teepad, sinkpad);
+		gst_object_unref (sinkpad);
+	}
+	return TRUE;
+}
+
+/* runs from the main loop because the bin can't be shut down from its own streaming thread */
+static gboolean remove_upstream_encoder(App *app)
+{
+	DreamTCPupstream *t = app->tcp_upstream;
+	t->id_encoder_remove = 0;
+	if (t->encoder_apad)
+	{
+		gst_element_release_request_pad (app->atee, t->encoder_apad);
+		gst_object_unref (t->encoder_apad);
+		t->encoder_apad = NULL;
+	}
+	if (t->encoder_vpad)
+	{
+		gst_element_release_request_pad (app->vtee, t->encoder_vpad);
+		gst_object_unref (t->encoder_vpad);
+		t->encoder_vpad = NULL;
+	}
+	gst_element_set_state (t->encoder_bin, GST_STATE_NULL);
+	if (GST_OBJECT_PARENT (t->encoder_bin))
+		gst_bin_remove (GST_BIN (GST_OBJECT_PARENT (t->encoder_bin)), t->encoder_bin);
+	GST_DEBUG_OBJECT (app, "upstream encoder removed from pipeline");
+	return G_SOURCE_REMOVE;
+}
+
+DreamTimeline *timeline_new(GstElement *leader, GstElement *follower)
+{
+	DreamTimeline *tl = g_new0 (DreamTimeline, 1);
+	GstElement *appsrcs[] = { leader, follower };
+	guint i;
+
+	g_mutex_init (&tl->lock);
+	tl->base = GST_CLOCK_TIME_NONE;
+	for (i = 0; i < G_N_ELEMENTS (appsrcs) && appsrcs[i]; i++)
+	{
+		DreamTimelineStream *st = &tl->streams[tl->n_streams++];
+		st->appsrc = gst_object_ref (appsrcs[i]);
+		st->pad = gst_element_get_static_pad (appsrcs[i], "src");
+		st->last = G_MININT64;
+	}
+	return tl;
+}
+
+void timeline_free(DreamTimeline **tl)
+{
+	DreamTimeline *t = *tl;
+	guint i;
+
+	if (!t)
+		return;
+	*tl = NULL;
+	for (i = 0; i < t->n_streams; i++)
+	{
+		gst_object_unref (t->streams[i].pad);
+		gst_object_unref (t->streams[i].appsrc);
+	}
+	g_mutex_clear (&t->lock);
+	g_free (t);
+}
+
+/* the media pipeline's running time, GST_CLOCK_TIME_NONE while it has no clock */
+static GstClockTime timeline_clock_time(DreamTimeline *tl)
+{
+	GstElement *appsrc = tl->streams[0].appsrc;
+	GstClock *clock = gst_element_get_clock (appsrc);
+	GstClockTime now, base_time;
+
+	if (!clock)
+		return GST_CLOCK_TIME_NONE;
+	now = gst_clock_get_time (clock);
+	base_time = gst_element_get_base_time (appsrc);
+	gst_object_unref (clock);
+	return now > base_time ? now - base_time : 0;
+}
+
+/* the same offset on every appsrc pad keeps audio and video in sync, the
+ * buffers themselves stay untouched */
+static void timeline_apply(DreamTimeline *tl)
+{
+	gint64 offset = - (gint64) tl->base - tl->correction;
+	guint i;
+	for (i = 0; i < tl->n_streams; i++)
+		gst_pad_set_offset (tl->streams[i].pad, offset);
+}
+
+/* the leader's stream time is compared against the pipeline clock. the
+ * encoder's clock drifts against it over long uptimes, the correction
+ * follows the averaged drift a step at a time */
+static void timeline_track_drift(DreamTimeline *tl, GstClockTime ts)
+{
+	GstClockTime now = timeline_clock_time (tl);
+	GstClockTimeDiff elapsed = ts - tl->base, deviation;
+
+	if (!GST_CLOCK_TIME_IS_VALID (now))
+		return;
+	if (!tl->clocked)
+	{
+		tl->origin = (GstClockTimeDiff) now - elapsed;
+		tl->clocked = TRUE;
+		return;
+	}
+
+	deviation = elapsed - ((GstClockTimeDiff) now - tl->origin);
+	if (ABS (deviation - tl->drift) > RTSP_MAX_LAG)
+	{
+		GST_INFO_OBJECT (tl->streams[0].appsrc, "stream time jumped by %" GST_STIME_FORMAT, GST_STIME_ARGS (deviation - tl->drift));
+		tl->correction += deviation - tl->drift;
+		tl->drift = deviation;
+		timeline_apply (tl);
+		return;
+	}
+
+	tl->drift += (deviation - tl->drift) / TIMELINE_DRIFT_SMOOTHING;
+	if (ABS (tl->drift - tl->correction) >= TIMELINE_DRIFT_STEP)
+	{
+		tl->correction += tl->drift > tl->correction ? TIMELINE_DRIFT_STEP : -TIMELINE_DRIFT_STEP;
+		GST_DEBUG_OBJECT (tl->streams[0].appsrc, "encoder clock drift %" GST_STIME_FORMAT ", correction %" GST_STIME_FORMAT, GST_STIME_ARGS (tl->drift), GST_STIME_ARGS (tl->correction));
+		timeline_apply (tl);
+	}
+}
+
+/* returns a reference to the buffer to push into appsrc, or NULL to drop it
+ * while the media waits for the leader's first keyframe. the buffer is
+ * shared with the ring and the other branches, only a timestamp which would
+ * go backwards in running time is moved, on a copy of the metadata */
+GstBuffer *timeline_map(DreamTimeline *tl, GstElement *appsrc, GstBuffer *buffer)
+{
+	GstClockTime ts = GST_BUFFER_DTS_OR_PTS (buffer);
+	DreamTimelineStream *st = NULL;
+	GstClockTimeDiff running;
+	guint i;
+
+	for (i = 0; i < tl->n_streams; i++)
+		if (tl->streams[i].appsrc == appsrc)
+			st = &tl->streams[i];
+	if (!st || !GST_CLOCK_TIME_IS_VALID (ts))
+		return NULL;
+
+	g_mutex_lock (&tl->lock);
+	if (!GST_CLOCK_TIME_IS_VALID (tl->base))
+	{
+		if (st != &tl->streams[0] || GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT))
+		{
+			g_mutex_unlock (&tl->lock);
+			return NULL;
+		}
+		tl->base = ts;
+		GST_DEBUG_OBJECT (appsrc, "media starts at keyframe %" GST_TIME_FORMAT, GST_TIME_ARGS (ts));
+		timeline_apply (tl);
+	}
+	if (st == &tl->streams[0])
+		timeline_track_drift (tl, ts);
+
+	running = (GstClockTimeDiff) (ts - tl->base) - tl->correction;
+	if (running < 0)
+	{
+		g_mutex_unlock (&tl->lock);
+		return NULL;
+	}
+
+	buffer = gst_buffer_ref (buffer);
+	if (running < st->last && st->last - running <= RTSP_MAX_LAG)
+	{
+		GstClockTimeDiff shift = st->last - running;
+		GST_LOG_OBJECT (appsrc, "%" GST_TIME_FORMAT " would go back by %" GST_STIME_FORMAT ", moved", GST_TIME_ARGS (ts), GST_STIME_ARGS (shift));
+		buffer = gst_buffer_make_writable (buffer);
+		if (GST_BUFFER_PTS_IS_VALID (buffer))
+			GST_BUFFER_PTS (buffer) += shift;
+		if (GST_BUFFER_DTS_IS_VALID (buffer))
+			GST_BUFFER_DTS (buffer) += shift;
+		running = st->last;
+	}
+	st->last = running;
+	g_mutex_unlock (&tl->lock);
+	return buffer;
+}
+
+/* ring consumer for the rtsp appsrcs. runs in the producing streaming thread
+ * with the ring locked, so it mustn't take the server lock. returns FALSE
+ * to leave the sample in the ring while the appsrc is full */
+static gboolean handover_payload (DreamRingConsumer *consumer, GstSample *sample, gpointer user_data)
+{
+	App *app = user_data;
+	DreamRTSPserver *r = app->rtsp_server;
+	DreamSubstream *s = app->substream;
+
+	GstAppSrc *appsrc = NULL;
+	if ( consumer == r->vconsumer )
+		appsrc = GST_APP_SRC(r->es_vappsrc);
+	else if ( consumer == r->aconsumer )
+		appsrc = GST_APP_SRC(r->es_aappsrc);
+	else if ( consumer == r->tsconsumer )
+		appsrc = GST_APP_SRC(r->ts_appsrc);
+	else if ( consumer == s->vconsumer )
+		appsrc = GST_APP_SRC(s->es_vappsrc);
+	else if ( consumer == s->aconsumer )
+		appsrc = GST_APP_SRC(s->es_aappsrc);
+	else if ( consumer == s->tsconsumer )
+		appsrc = GST_APP_SRC(s->ts_appsrc);
+
+	DreamTimeline *timeline = NULL;
+	if (consumer == r->vconsumer || consumer == r->aconsumer)
+		timeline = r->es_timeline;
+	else if (consumer == r->tsconsumer)
+		timeline = r->ts_timeline;
+	else if (consumer == s->vconsumer || consumer == s->aconsumer)
+		timeline = s->es_timeline;
+	else if (consumer == s->tsconsumer)
+		timeline = s->ts_timeline;
+
+	if (appsrc && timeline) {
+		if (gst_app_src_get_current_level_bytes (appsrc) >= gst_app_src_get_max_bytes (appsrc))
+			return FALSE;
+
+		GstBuffer *buffer = timeline_map (timeline, GST_ELEMENT (appsrc), gst_sample_get_buffer (sample));
+		GstCaps *caps = gst_sample_get_caps (sample);
+		if (!buffer)
+		{
+			GST_LOG_OBJECT (appsrc, "waiting for a keyframe, dropping");
+			return TRUE;
+		}
+		GST_LOG_OBJECT(appsrc, "%" GST_PTR_FORMAT, buffer);
+
+		GstCaps *oldcaps;
+
+		oldcaps = gst_app_src_get_caps (appsrc);
+		if (!oldcaps || !gst_caps_is_equal (oldcaps, caps))
+		{
+			GST_DEBUG("CAPS changed! %" GST_PTR_FORMAT " to %" GST_PTR_FORMAT, oldcaps, caps);
+			gst_app_src_set_caps (appsrc, caps);
+		}
+		if (oldcaps)
+			gst_caps_unref (oldcaps);
+		gst_app_src_push_buffer (appsrc, buffer);
+	}
+	else
+	{
+		if ( gst_debug_category_get_threshold (dreamrtspserver_debug) >= GST_LEVEL_LOG)
+			GST_TRACE("no rtsp clients, discard payload!");
+// 		else
+// 			g_print (".");
+	}
+
+	return TRUE;
+}
+
+gboolean assert_state(App *app, GstElement *element, GstState state)
+{
+	GstStateChangeReturn sret;
+	GST_DEBUG_OBJECT(app, "setting %" GST_PTR_FORMAT"'s state to %s", element, gst_element_state_get_name (state));
+	GstState pipeline_state, current_state;
+	sret = gst_element_set_state (element, state);
+	gchar *elementname = gst_element_get_name(element);
+	gchar *dotfilename = g_strdup_printf ("assert_state_%s_to_%s_%i", elementname,gst_element_state_get_name (state), sret);
+	GST_DEBUG_BIN_TO_DOT_FILE(GST_BIN(app->pipeline), GST_DEBUG_GRAPH_SHOW_ALL, dotfilename);
+	g_free (elementname);
+	switch (sret) {
+		case GST_STATE_CHANGE_SUCCESS:
+		{
+			GST_DEBUG_OBJECT(app, "GST_STATE_CHANGE_SUCCESS on setting %" GST_PTR_FORMAT"'s state to %s ", element, gst_element_state_get_name (state));
+			return TRUE;
+		}
+		case GST_STATE_CHANGE_FAILURE:
+		{
+			GST_ERROR_OBJECT (app, "GST_STATE_CHANGE_FAILURE when trying to change %" GST_PTR_FORMAT"'s state to %s", element, gst_element_state_get_name (state));
+			return FALSE;
+		}
+		case GST_STATE_CHANGE_ASYNC:
+		{
+			watchdog_ping (app);
+			gboolean fail = FALSE;
+			GST_LOG_OBJECT(app, "GST_STATE_CHANGE_ASYNC %" GST_PTR_FORMAT"", element);
 			GstClockTime timeout = /*(element == app->pipeline) ?*/ 4 * GST_SECOND/* : GST_MSECOND*/;
 			if (element == GST_ELEMENT(app->pipeline))
 			{
@@ -1400,161 +2755,1263 @@ gboolean assert_state(App *app, GstElement *element, GstState state)
 	return TRUE;
 }
 
+/* whether the pipeline is (going) PLAYING, so a new branch only has to catch up with it */
+static gboolean pipeline_running(App *app)
+{
+	return GST_STATE_TARGET (app->pipeline) == GST_STATE_PLAYING;
+}
+
+/* the link itself is atomic to the streaming thread and the sticky events
+ * follow on the first buffer, so a running srcpad doesn't need to be blocked */
+static gboolean branch_link(App *app, GstPad *srcpad, GstPad *sinkpad)
+{
+	if (gst_pad_link (srcpad, sinkpad) != GST_PAD_LINK_OK)
+	{
+		GST_ERROR_OBJECT (app, "couldn't link %" GST_PTR_FORMAT " ! %" GST_PTR_FORMAT "", srcpad, sinkpad);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* a sink that joins a running pipeline would post ASYNC_START and take the
+ * pipeline back to prerolling, which stalls all the other outputs */
+static void branch_set_sync(GstElement *element)
+{
+	if (GST_IS_BIN (element))
+	{
+		GValue item = G_VALUE_INIT;
+		GstIterator *iter = gst_bin_iterate_sinks (GST_BIN (element));
+		while (gst_iterator_next (iter, &item) == GST_ITERATOR_OK)
+		{
+			branch_set_sync (g_value_get_object (&item));
+			g_value_reset (&item);
+		}
+		g_value_unset (&item);
+		gst_iterator_free (iter);
+	}
+	else if (GST_IS_BASE_SINK (element))
+		g_object_set (element, "async", FALSE, NULL);
+}
+
+/* hot-plugs a branch whose elements are already in the pipeline and linked
+ * among themselves, given in stream order starting with head. they catch up
+ * with the pipeline's state downstream first before head is linked to
+ * srcpad, so the other outputs never see a state change. only the first
+ * output has to start the pipeline. a branch headed by an appsrc reading
+ * off a ring has no srcpad */
+static gboolean branch_attach(App *app, GstPad *srcpad, GstElement *head, ...)
+{
+	GList *elements = NULL, *l;
+	GstElement *element;
+	gboolean ret = TRUE;
+	va_list args;
+
+	va_start (args, head);
+	for (element = head; element; element = va_arg (args, GstElement *))
+		elements = g_list_prepend (elements, element);
+	va_end (args);
+
+	if (pipeline_running (app))
+	{
+		for (l = elements; l && ret; l = l->next)
+		{
+			branch_set_sync (l->data);
+			if (!gst_element_sync_state_with_parent (l->data))
+			{
+				GST_ERROR_OBJECT (app, "couldn't bring %" GST_PTR_FORMAT " to the pipeline's state", l->data);
+				ret = FALSE;
+			}
+		}
+	}
+	g_list_free (elements);
+	if (!ret)
+		return FALSE;
+
+	if (srcpad)
+	{
+		GstPad *sinkpad = gst_element_get_static_pad (head, "sink");
+		ret = branch_link (app, srcpad, sinkpad);
+		gst_object_unref (sinkpad);
+		if (!ret)
+			return FALSE;
+	}
+
+	if (!pipeline_running (app) && !source_set_state (app, SOURCE_STATE_RUNNING))
+		return FALSE;
+
+	GST_DEBUG_OBJECT (app, "attached branch %" GST_PTR_FORMAT " to %" GST_PTR_FORMAT, head, srcpad);
+	return TRUE;
+}
+
+static gboolean branch_dispose(gpointer user_data)
+{
+	DreamBranch *b = user_data;
+	GList *l;
+	for (l = b->elements; l; l = l->next)
+	{
+		GstElement *element = l->data;
+		gst_element_set_state (element, GST_STATE_NULL);
+		if (GST_OBJECT_PARENT (element))
+			gst_bin_remove (GST_BIN (GST_OBJECT_PARENT (element)), element);
+	}
+	g_list_free_full (b->elements, gst_object_unref);
+	if (b->done)
+		b->done (b->app);
+	g_free (b);
+	return G_SOURCE_REMOVE;
+}
+
+static GstPadProbeReturn branch_unlink_cb (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+	DreamBranch *b = user_data;
+
+	GstPad *sinkpad = gst_pad_get_peer (pad);
+	if (sinkpad)
+	{
+		gst_pad_unlink (pad, sinkpad);
+		gst_object_unref (sinkpad);
+	}
+	GstPadTemplate *templ = GST_PAD_PAD_TEMPLATE (pad);
+	if (templ && GST_PAD_TEMPLATE_PRESENCE (templ) == GST_PAD_REQUEST)
+	{
+		GstElement *parent = gst_pad_get_parent_element (pad);
+		gst_element_release_request_pad (parent, pad);
+		gst_object_unref (parent);
+	}
+	GST_DEBUG_OBJECT (pad, "branch unlinked");
+	g_idle_add (branch_dispose, b);
+	return GST_PAD_PROBE_REMOVE;
+}
+
+/* unhooks a branch as soon as the pad feeding head is idle. the streaming
+ * thread only unlinks, shutting the elements down and removing them is left
+ * to the main loop, which calls done afterwards */
+static void branch_detach(App *app, BranchDoneFunc done, GstElement *head, ...)
+{
+	DreamBranch *b = g_new0 (DreamBranch, 1);
+	GstElement *element;
+	va_list args;
+
+	b->app = app;
+	b->done = done;
+	va_start (args, head);
+	for (element = head; element; element = va_arg (args, GstElement *))
+		b->elements = g_list_append (b->elements, gst_object_ref (element));
+	va_end (args);
+
+	GstPad *srcpad = NULL, *sinkpad = gst_element_get_static_pad (head, "sink");
+	if (sinkpad)
+	{
+		srcpad = gst_pad_get_peer (sinkpad);
+		gst_object_unref (sinkpad);
+	}
+	if (srcpad)
+	{
+		gst_pad_add_probe (srcpad, GST_PAD_PROBE_TYPE_IDLE, branch_unlink_cb, b, NULL);
+		gst_object_unref (srcpad);
+	}
+	else
+		g_idle_add (branch_dispose, b);
+}
+
+/* the head of a branch fed by a ring consumer instead of a tee pad. upstream
+ * events of the branch, like hlssink's key unit requests, are passed on to
+ * the ring's producer if there is one */
+static GstElement *branch_appsrc_new(const gchar *name, guint64 max_bytes, DreamRing **ring)
+{
+	GstElement *appsrc = gst_element_factory_make ("appsrc", name);
+	if (!appsrc)
+		return NULL;
+	g_object_set (G_OBJECT (appsrc), "is-live", TRUE, "format", GST_FORMAT_TIME, "block", FALSE, "max-bytes", max_bytes, NULL);
+	if (ring)
+	{
+		GstPad *srcpad = gst_element_get_static_pad (appsrc, "src");
+		gst_pad_add_probe (srcpad, GST_PAD_PROBE_TYPE_EVENT_UPSTREAM, branch_upstream_probe, ring, NULL);
+		gst_object_unref (srcpad);
+	}
+	return appsrc;
+}
+
+/* takes buffer. a cut (see video_cut) travels in the ring as the info of
+ * the sample behind it and goes out in front of the buffer again */
+static void branch_appsrc_push(GstAppSrc *appsrc, GstSample *sample, GstBuffer *buffer)
+{
+	GstCaps *caps = gst_sample_get_caps (sample);
+	GstCaps *oldcaps = gst_app_src_get_caps (appsrc);
+	if (caps && (!oldcaps || !gst_caps_is_equal (oldcaps, caps)))
+		gst_app_src_set_caps (appsrc, caps);
+	if (oldcaps)
+		gst_caps_unref (oldcaps);
+
+	const GstStructure *info = gst_sample_get_info (sample);
+	if (info)
+		gst_element_send_event (GST_ELEMENT (appsrc), gst_event_new_custom (GST_EVENT_CUSTOM_DOWNSTREAM, gst_structure_copy (info)));
+	gst_app_src_push_buffer (appsrc, buffer);
+}
+
+/* user_data is the appsrc. when it's full the samples wait in the ring */
+static gboolean branch_handover (DreamRingConsumer *consumer, GstSample *sample, gpointer user_data)
+{
+	GstAppSrc *appsrc = GST_APP_SRC (user_data);
+	if (gst_app_src_get_current_level_bytes (appsrc) >= gst_app_src_get_max_bytes (appsrc))
+		return FALSE;
+	branch_appsrc_push (appsrc, sample, gst_buffer_ref (gst_sample_get_buffer (sample)));
+	return TRUE;
+}
+
+/* user_data points to the ring, which may be gone by now */
+static GstPadProbeReturn branch_upstream_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+	DreamRing **ring = user_data;
+	GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+	if (GST_EVENT_TYPE (event) != GST_EVENT_CUSTOM_UPSTREAM || !*ring)
+		return GST_PAD_PROBE_OK;
+	dream_ring_send_upstream (*ring, gst_event_ref (event));
+	return GST_PAD_PROBE_DROP;
+}
+
+/* requests a pad from tee and links it to element's sink pad unless that's linked already */
+static gboolean tee_link_branch(App *app, GstElement *tee, GstElement *element)
+{
+	GstPad *teepad, *sinkpad;
+	gboolean ret;
+
+	sinkpad = gst_element_get_static_pad (element, "sink");
+	if (gst_pad_is_linked (sinkpad))
+	{
+		gst_object_unref (sinkpad);
+		return TRUE;
+	}
+	teepad = gst_element_get_request_pad (tee, "src_%u");
+	ret = branch_link (app, teepad, sinkpad);
+	if (!ret)
+		gst_element_release_request_pad (tee, teepad);
+	gst_object_unref (teepad);
+	gst_object_unref (sinkpad);
+	return ret;
+}
+
+/* the hls server stays in HLS_STATE_IDLE until its first fragment is there,
+ * but its sink runs from the first playlist request on */
+static gboolean hls_active(App *app)
+{
+	return app->hls_server->state == HLS_STATE_RUNNING || app->hls_server->id_starting;
+}
+
+/* the muxer only runs while someone consumes transport stream: a /stream
+ * rtsp media, a running hls sink or an upstream sharing the local encoder */
+static gboolean tsmux_needed(App *app)
+{
+	if (app->rtsp_server->ts_media || hls_active (app))
+		return TRUE;
+	if (app->tcp_upstream->state != UPSTREAM_STATE_DISABLED && !app->tcp_upstream->encoder_bin)
+		return TRUE;
+	return FALSE;
+}
+
 void assert_tsmux(App *app)
 {
-	if (app->tsmux)
+	if (!app->tsmux)
+	{
+		GST_DEBUG_OBJECT (app, "inserting tsmux");
+
+		/* the 7 packet alignment goes to every consumer of the ts ring, not only
+		 * upstream. it's what rtpmp2tpay puts into one rtp packet anyway and
+		 * hlssink only looks at the key units the muxer flushes on */
+		app->tsmux = g_object_new (GST_TYPE_DREAM_TS_MUX, "alignment", TS_PER_FRAME, NULL);
+		gst_bin_add (GST_BIN (app->pipeline), app->tsmux);
+		gst_element_sync_state_with_parent (app->tsmux);
+
+		if (!tsmux_link (app->aq, app->vq, app->tsmux))
+			g_error ("couldn't link %" GST_PTR_FORMAT " and %" GST_PTR_FORMAT " to %" GST_PTR_FORMAT "", app->aq, app->vq, app->tsmux);
+		if (!gst_element_link (app->tsmux, app->tstee))
+			g_error ("couldn't link %" GST_PTR_FORMAT " ! %" GST_PTR_FORMAT "", app->tsmux, app->tstee);
+	}
+
+	if (!tee_link_branch (app, app->atee, app->aq) || !tee_link_branch (app, app->vtee, app->vq))
+		g_error ("couldn't hook up tsmux inputs");
+}
+
+static GstPadProbeReturn tsmux_unhook_probe_cb (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+	App *app = user_data;
+
+	if (tsmux_needed (app))
+	{
+		GST_DEBUG_OBJECT (pad, "tsmux got a consumer again, keep it hooked up");
+		return GST_PAD_PROBE_REMOVE;
+	}
+
+	GstPad *teepad = gst_pad_get_peer (pad);
+	if (teepad)
+	{
+		GstElement *tee = gst_pad_get_parent_element (teepad);
+		gst_pad_unlink (teepad, pad);
+		gst_element_release_request_pad (tee, teepad);
+		gst_object_unref (tee);
+		gst_object_unref (teepad);
+	}
+	GST_DEBUG_OBJECT (pad, "unhooked from es tee");
+	return GST_PAD_PROBE_REMOVE;
+}
+
+/* unhooks the muxer's queues from the es tees once the last ts consumer is
+ * gone while es consumers keep the sources running. the muxer itself stays
+ * in the bin idle, halt_source_pipeline removes it */
+void release_tsmux(App *app)
+{
+	if (!app->tsmux || tsmux_needed (app))
+		return;
+
+	GST_DEBUG_OBJECT (app, "no more ts consumers, unhooking tsmux");
+
+	GstPad *sinkpad;
+	sinkpad = gst_element_get_static_pad (app->aq, "sink");
+	gst_pad_add_probe (sinkpad, GST_PAD_PROBE_TYPE_IDLE, tsmux_unhook_probe_cb, app, NULL);
+	gst_object_unref (sinkpad);
+	sinkpad = gst_element_get_static_pad (app->vq, "sink");
+	gst_pad_add_probe (sinkpad, GST_PAD_PROBE_TYPE_IDLE, tsmux_unhook_probe_cb, app, NULL);
+	gst_object_unref (sinkpad);
+}
+
+DreamSubstream *create_substream(App *app)
+{
+	DreamSubstream *s = g_new0 (DreamSubstream, 1);
+	s->enabled = FALSE;
+	s->width = DEFAULT_SUBSTREAM_WIDTH;
+	s->height = DEFAULT_SUBSTREAM_HEIGHT;
+	s->bitrate = DEFAULT_SUBSTREAM_BITRATE;
+	return s;
+}
+
+/* the substream takes an encoder instance of its own, or the software
+ * encoder in test. a replayed capture isn't encoded, there's nothing to scale */
+static gboolean substream_available(App *app)
+{
+	return app->substream->enabled && app->source_backend != SOURCE_BACKEND_FILE;
+}
+
+/* rtsp media on the substream mounts, or a running hls server */
+static gboolean substream_needed(App *app)
+{
+	DreamSubstream *s = app->substream;
+	if (s->es_media || s->ts_media || s->hlssink)
+		return TRUE;
+	return app->hls_server->hlssink && substream_available (app);
+}
+
+static gboolean substream_set_enabled(App *app, gboolean enabled)
+{
+	DreamSubstream *s = app->substream;
+	if (enabled && app->source_backend == SOURCE_BACKEND_FILE)
+	{
+		GST_WARNING_OBJECT (app, "a replayed capture has no substream");
+		return FALSE;
+	}
+	if (enabled == s->enabled)
+		return TRUE;
+	s->enabled = enabled;
+	GST_INFO_OBJECT (app, "substream %s (%ix%i @ %i kbit/s)", enabled ? "enabled" : "disabled", s->width, s->height, s->bitrate);
+	/* viewers already on the substream keep it until they leave */
+	if (enabled)
+	{
+		rtsp_substream_mount (app);
+		if (app->hls_server->hlssink)
+			hls_substream_attach (app);
+	}
+	else
+	{
+		rtsp_substream_unmount (app);
+		hls_substream_detach (app);
+	}
+	return TRUE;
+}
+
+/* inserts the substream: a video encoder of its own at the substream's
+ * resolution and bitrate, muxed with the main stream's audio. it's hooked up
+ * to the audio tee like a branch, the encoder is started along with it */
+static gboolean assert_substream(App *app)
+{
+	DreamSubstream *s = app->substream;
+	if (s->tsmux)
+		return TRUE;
+	if (s->removing || !app->pipeline || !substream_available (app))
+		return FALSE;
+
+	GST_DEBUG_OBJECT (app, "inserting substream");
+
+	/* numbered after the channels' encoders and their upstream encoders */
+	s->vsrc = create_source_element (app, DREAM_SOFT_SOURCE_VIDEO, 2 * app->daemon->n_channels + app->channel);
+	s->vparse = gst_element_factory_make ("h264parse", NULL);
+	s->vtee = gst_element_factory_make ("tee", NULL);
+	s->vq = gst_element_factory_make ("queue", NULL);
+	s->aq = gst_element_factory_make ("queue", NULL);
+	s->tsmux = g_object_new (GST_TYPE_DREAM_TS_MUX, NULL);
+	s->tstee = gst_element_factory_make ("tee", NULL);
+	if (!(s->vsrc && s->vparse && s->vtee && s->vq && s->aq && s->tstee))
+	{
+		GST_WARNING_OBJECT (app, "couldn't create the substream's elements");
+		goto fail;
+	}
+
+	/* the main stream's settings, scaled down */
+	GstCaps *caps = NULL;
+	inputMode input_mode = 0;
+	if (GST_IS_ELEMENT (app->vsrc))
+		g_object_get (G_OBJECT (app->vsrc), "caps", &caps, "input_mode", &input_mode, NULL);
+	if (GST_IS_CAPS (caps) && !gst_caps_is_empty (caps))
+	{
+		caps = gst_caps_make_writable (caps);
+		gst_caps_set_simple (caps, "width", G_TYPE_INT, s->width, "height", G_TYPE_INT, s->height, NULL);
+		g_object_set (G_OBJECT (s->vsrc), "caps", caps, NULL);
+	}
+	if (GST_IS_CAPS (caps))
+		gst_caps_unref (caps);
+	SourceProperties *p = &app->source_properties;
+	g_object_set (G_OBJECT (s->vsrc), "input_mode", input_mode, "bitrate", s->bitrate, NULL);
+	/* the same gop as the main stream, its scene cuts come in through substream_key_probe */
+	g_object_set (G_OBJECT (s->vsrc), "gop-length", p->gopLength, "gop-scene", FALSE, "open-gop", p->openGop, "bframes", p->bFrames, "pframes", p->pFrames, NULL);
+
+	/* only boxes with an encoder instance left over can open it */
+	if (gst_element_set_state (s->vsrc, GST_STATE_READY) == GST_STATE_CHANGE_FAILURE)
+	{
+		GST_WARNING_OBJECT (app, "no spare encoder instance for the substream");
+		gst_element_set_state (s->vsrc, GST_STATE_NULL);
+		goto fail;
+	}
+
+	g_object_set (s->vtee, "allow-not-linked", TRUE, NULL);
+	g_object_set (s->tstee, "allow-not-linked", TRUE, NULL);
+	gst_bin_add_many (GST_BIN (app->pipeline), s->vsrc, s->vparse, s->vtee, s->vq, s->aq, s->tsmux, s->tstee, NULL);
+	if (!gst_element_link_many (s->vsrc, s->vparse, s->vtee, s->vq, NULL) || !tsmux_link (s->aq, s->vq, s->tsmux) || !gst_element_link (s->tsmux, s->tstee))
+	{
+		GST_WARNING_OBJECT (app, "couldn't link the substream");
+		goto remove;
+	}
+
+	GstPad *pad;
+	pad = gst_element_get_static_pad (s->vtee, "sink");
+	s->vring = dream_ring_new ("substream video", pad, ES_RING_SIZE, RING_MAX_LAG);
+	gst_object_unref (pad);
+	pad = gst_element_get_static_pad (s->tstee, "sink");
+	s->tsring = dream_ring_new ("substream ts", pad, TS_RING_SIZE, RING_MAX_LAG);
+	gst_object_unref (pad);
+
+	/* in this order the encoder is the last one to come up */
+	GstPad *teepad = gst_element_get_request_pad (app->atee, "src_%u");
+	gboolean ret = branch_attach (app, teepad, s->aq, s->vsrc, s->vparse, s->vtee, s->vq, s->tsmux, s->tstee, NULL);
+	if (!ret)
+		gst_element_release_request_pad (app->atee, teepad);
+	gst_object_unref (teepad);
+	if (!ret)
+	{
+		dream_ring_free (s->vring);
+		dream_ring_free (s->tsring);
+		s->vring = s->tsring = NULL;
+		goto remove;
+	}
+	/* both start on the same idr and stay on the same gop from there */
+	pad = gst_element_get_static_pad (app->vparse, "src");
+	s->id_key_probe = gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, substream_key_probe, gst_element_get_static_pad (s->vparse, "src"), gst_object_unref);
+	gst_object_unref (pad);
+	force_key_unit (app);
+	GST_INFO_OBJECT (app, "substream running at %ix%i @ %i kbit/s", s->width, s->height, s->bitrate);
+	return TRUE;
+
+remove:
+	{
+		GstElement *elements[] = { s->vsrc, s->vparse, s->vtee, s->vq, s->aq, s->tsmux, s->tstee };
+		guint i;
+		for (i = 0; i < G_N_ELEMENTS (elements); i++)
+		{
+			gst_element_set_state (elements[i], GST_STATE_NULL);
+			gst_bin_remove (GST_BIN (app->pipeline), elements[i]);
+		}
+		s->vsrc = s->vparse = s->vtee = s->vq = s->aq = s->tsmux = s->tstee = NULL;
+		return FALSE;
+	}
+
+fail:
+	g_clear_object (&s->vsrc);
+	g_clear_object (&s->vparse);
+	g_clear_object (&s->vtee);
+	g_clear_object (&s->vq);
+	g_clear_object (&s->aq);
+	g_clear_object (&s->tsmux);
+	g_clear_object (&s->tstee);
+	return FALSE;
+}
+
+/* takes the substream out once the last of its consumers is gone. the rings
+ * are freed once its elements are shut down, see substream_removed */
+void release_substream(App *app)
+{
+	DreamSubstream *s = app->substream;
+	if (!s->tsmux || s->removing || substream_needed (app))
+		return;
+
+	GST_DEBUG_OBJECT (app, "no more substream consumers, removing it");
+	s->removing = TRUE;
+	if (s->id_key_probe)
+	{
+		GstPad *pad = gst_element_get_static_pad (app->vparse, "src");
+		gst_pad_remove_probe (pad, s->id_key_probe);
+		gst_object_unref (pad);
+		s->id_key_probe = 0;
+	}
+	branch_detach (app, substream_removed, s->aq, s->tsmux, s->tstee, s->vq, s->vtee, s->vparse, s->vsrc, NULL);
+	s->vsrc = s->vparse = s->vtee = s->vq = s->aq = s->tsmux = s->tstee = NULL;
+}
+
+static void substream_removed(App *app)
+{
+	DreamSubstream *s = app->substream;
+	dream_ring_free (s->vring);
+	dream_ring_free (s->tsring);
+	s->vring = s->tsring = NULL;
+	s->removing = FALSE;
+	GST_INFO_OBJECT (app, "substream removed");
+	/* somebody asked for it while it was going */
+	substream_serve (app);
+}
+
+/* brings the substream up for the consumers waiting for it */
+static void substream_serve(App *app)
+{
+	DreamSubstream *s = app->substream;
+	if (!substream_needed (app) || !assert_substream (app))
+		return;
+	if (s->es_media)
+	{
+		rtsp_attach_consumer (app, app->aring, &s->aconsumer);
+		rtsp_attach_consumer (app, s->vring, &s->vconsumer);
+	}
+	if (s->ts_media)
+		rtsp_attach_consumer (app, s->tsring, &s->tsconsumer);
+	if (app->hls_server->hlssink && !s->hlssink)
+		hls_substream_attach (app);
+}
+
+/* --source=dream|test|file:<capture> */
+static gboolean parse_source_backend(App *app, const gchar *source)
+{
+	if (!source || g_strcmp0 (source, "dream") == 0)
+		app->source_backend = SOURCE_BACKEND_DREAM;
+	else if (g_strcmp0 (source, "test") == 0)
+		app->source_backend = SOURCE_BACKEND_TEST;
+	else if (g_str_has_prefix (source, "file:") && g_file_test (source + 5, G_FILE_TEST_IS_REGULAR))
+	{
+		app->source_backend = SOURCE_BACKEND_FILE;
+		app->source_location = g_strdup (source + 5);
+	}
+	else
+		return FALSE;
+	return TRUE;
+}
+
+/* the hardware encoder, or the software stand-in for boxes without one. the
+ * channel's encoder is the one its sources are numbered after */
+static GstElement *create_source_element(App *app, GstDreamSoftSourceKind kind, guint instance)
+{
+	const gchar *factory = kind == DREAM_SOFT_SOURCE_VIDEO ? "dreamvideosource" : "dreamaudiosource";
+	gchar *name = g_strdup_printf ("%s%u", factory, instance);
+	GstElement *source;
+	if (app->source_backend == SOURCE_BACKEND_DREAM)
+		source = gst_element_factory_make (factory, name);
+	else
+		source = gst_dream_soft_source_new (kind, name, app->source_backend == SOURCE_BACKEND_FILE ? app->source_location : NULL);
+	g_free (name);
+	return source;
+}
+
+/* links a source through its parser into a new input of the selector, which
+ * becomes the live input the slate stream hands back to */
+static void source_chain_link(App *app, GstElement *source, GstElement *parser, GstElement *selector, DreamSlateStream *st)
+{
+	gst_element_link (source, parser);
+	GstPad *srcpad = gst_element_get_static_pad (parser, "src");
+	GstPad *sinkpad = gst_element_get_request_pad (selector, "sink_%u");
+	if (gst_pad_link (srcpad, sinkpad) != GST_PAD_LINK_OK)
+		GST_WARNING_OBJECT (app, "can't link %" GST_PTR_FORMAT " to %" GST_PTR_FORMAT, parser, selector);
+	gst_object_unref (srcpad);
+	st->livepad = sinkpad;
+	gst_pad_add_probe (sinkpad, GST_PAD_PROBE_TYPE_BUFFER, slate_live_probe, st, NULL);
+}
+
+gboolean create_source_pipeline(App *app)
+{
+	GST_INFO_OBJECT(app, "create_source_pipeline");
+	DREAMRTSPSERVER_LOCK (app);
+	gchar *pipeline_name = g_strdup_printf ("dreamrtspserver_source_pipeline%u", app->channel);
+	app->pipeline = gst_pipeline_new (pipeline_name);
+	g_free (pipeline_name);
+
+	GstBus *bus = gst_pipeline_get_bus (GST_PIPELINE (app->pipeline));
+	gst_bus_add_signal_watch (bus);
+	g_signal_connect (G_OBJECT (bus), "message", G_CALLBACK (message_cb), app);
+	gst_object_unref (GST_OBJECT (bus));
+
+	app->asrc = create_source_element (app, DREAM_SOFT_SOURCE_AUDIO, app->channel);
+	app->vsrc = create_source_element (app, DREAM_SOFT_SOURCE_VIDEO, app->channel);
+
+	app->aparse = gst_element_factory_make ("aacparse", NULL);
+	app->vparse = gst_element_factory_make ("h264parse", NULL);
+
+	/* the second input of the selectors is the slate */
+	app->asel = gst_element_factory_make ("input-selector", "aselector");
+	app->vsel = gst_element_factory_make ("input-selector", "vselector");
+
+	app->atee = gst_element_factory_make ("tee", "atee");
+	app->vtee = gst_element_factory_make ("tee", "vtee");
+	app->tstee = gst_element_factory_make ("tee", "tstee");
+
+	app->aq = gst_element_factory_make ("queue", "aqueue");
+	app->vq = gst_element_factory_make ("queue", "vqueue");
+
+	if (!(app->asrc && app->vsrc && app->aparse && app->vparse && app->asel && app->vsel && app->aq && app->vq && app->atee && app->vtee && app->tstee))
+	{
+		g_error ("Failed to create source pipeline element(s):%s%s%s%s%s%s%s%s%s%s%s", app->asrc?"":" dreamaudiosource", app->vsrc?"":" dreamvideosource", app->aparse?"":" aacparse",
+			app->vparse?"":" h264parse", app->asel?"":" aselector", app->vsel?"":" vselector", app->aq?"":" aqueue", app->vq?"":" vqueue", app->atee?"":" atee", app->vtee?"":" vtee", app->tstee?"":" tstee");
+	}
+
+	/* branches come and go with their consumers */
+	g_object_set (app->atee, "allow-not-linked", TRUE, NULL);
+	g_object_set (app->vtee, "allow-not-linked", TRUE, NULL);
+	g_object_set (app->tstee, "allow-not-linked", TRUE, NULL);
+	g_object_set (app->asel, "sync-streams", FALSE, NULL);
+	g_object_set (app->vsel, "sync-streams", FALSE, NULL);
+
+	if (!app->slate)
+	{
+		DreamSlate *slate = app->slate = g_new0 (DreamSlate, 1);
+		slate->app = app;
+		g_mutex_init (&slate->lock);
+		slate->audio.slate = slate->video.slate = slate;
+		slate->video.video = TRUE;
+		slate->audio.end = slate->video.end = GST_CLOCK_TIME_NONE;
+	}
+
+	gst_bin_add_many (GST_BIN (app->pipeline), app->asrc, app->aparse, app->asel, app->atee, app->aq, NULL);
+	gst_bin_add_many (GST_BIN (app->pipeline), app->vsrc, app->vparse, app->vsel, app->vtee, app->vq, NULL);
+	gst_bin_add (GST_BIN (app->pipeline), app->tstee);
+	source_chain_link (app, app->asrc, app->aparse, app->asel, &app->slate->audio);
+	source_chain_link (app, app->vsrc, app->vparse, app->vsel, &app->slate->video);
+	gst_element_link (app->asel, app->atee);
+	gst_element_link (app->vsel, app->vtee);
+
+	/* whatever the selectors let through, live, slate or swapped in sources */
+	GstPad *pad;
+	pad = gst_element_get_static_pad (app->asel, "src");
+	gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, slate_out_probe, &app->slate->audio, NULL);
+	gst_object_unref (pad);
+	pad = gst_element_get_static_pad (app->vsel, "src");
+	gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, slate_out_probe, &app->slate->video, NULL);
+	gst_object_unref (pad);
+
+	/* rtsp consumers read straight off the streams going into the tees */
+	pad = gst_element_get_static_pad (app->atee, "sink");
+	app->aring = dream_ring_new ("audio", pad, ES_RING_SIZE, RING_MAX_LAG);
+	gst_object_unref (pad);
+	pad = gst_element_get_static_pad (app->vtee, "sink");
+	app->vring = dream_ring_new ("video", pad, ES_RING_SIZE, RING_MAX_LAG);
+	gst_object_unref (pad);
+	pad = gst_element_get_static_pad (app->tstee, "sink");
+	app->tsring = dream_ring_new ("ts", pad, TS_RING_SIZE, RING_MAX_LAG);
+	gst_object_unref (pad);
+
+	app->clock = gst_system_clock_obtain();
+	gst_pipeline_use_clock(GST_PIPELINE (app->pipeline), app->clock);
+
+	apply_source_properties(app);
+
+	g_signal_connect (app->asrc, "signal-lost", G_CALLBACK (encoder_signal_lost), app);
+	/* a replayed capture can fail on the video side alone */
+	if (GST_IS_DREAM_SOFT_SOURCE (app->vsrc))
+		g_signal_connect (app->vsrc, "signal-lost", G_CALLBACK (encoder_signal_lost), app);
+
+	/* the slate is linked in once it's there, it's not needed to get going */
+	app->slate->id_prepare = g_idle_add_full (G_PRIORITY_LOW, slate_prepare, app, NULL);
+
+	GST_DEBUG_BIN_TO_DOT_FILE(GST_BIN(app->pipeline),GST_DEBUG_GRAPH_SHOW_ALL,"create_source_pipeline");
+	DREAMRTSPSERVER_UNLOCK (app);
+	return TRUE;
+}
+
+/* looks the factories up in the registry, which neither loads plugins nor
+ * instantiates anything. soft sources check theirs when they're created */
+static void check_plugins(App *app)
+{
+	static const gchar *required[] = { "aacparse", "h264parse", "tee", "queue", "input-selector", "appsrc", "rtph264pay", "rtpmp4apay", "rtpmp2tpay", "udpsrc", NULL };
+	static const gchar *dream[] = { "dreamaudiosource", "dreamvideosource", NULL };
+	GstRegistry *registry = gst_registry_get ();
+	GString *missing = g_string_new (NULL);
+	const gchar **name;
+
+	for (name = required; *name; name++)
+	{
+		GstPluginFeature *feature = gst_registry_find_feature (registry, *name, GST_TYPE_ELEMENT_FACTORY);
+		if (feature)
+			gst_object_unref (feature);
+		else
+			g_string_append_printf (missing, " %s", *name);
+	}
+	for (name = dream; app->source_backend == SOURCE_BACKEND_DREAM && *name; name++)
+	{
+		GstPluginFeature *feature = gst_registry_find_feature (registry, *name, GST_TYPE_ELEMENT_FACTORY);
+		if (feature)
+			gst_object_unref (feature);
+		else
+			g_string_append_printf (missing, " %s", *name);
+	}
+
+	if (missing->len)
+		g_error ("Missing element(s):%s", missing->str);
+	g_string_free (missing, TRUE);
+}
+
+/* the pipeline is built right after startup from the main loop, or on
+ * demand if a dbus client is faster */
+static gboolean assert_source_pipeline(App *app)
+{
+	if (app->pipeline)
+		return TRUE;
+	if (!create_source_pipeline (app))
+	{
+		g_printerr ("Failed to create source pipeline!\n");
+		return FALSE;
+	}
+	if (app->daemon->dbus_connection && !source_set_state (app, SOURCE_STATE_SUSPENDED))
+		GST_ERROR ("Failed to bring state of source pipeline to READY");
+	startup_phase (app, "pipeline");
+	return TRUE;
+}
+
+static gboolean startup_create_pipeline(gpointer user_data)
+{
+	assert_source_pipeline (user_data);
+	return G_SOURCE_REMOVE;
+}
+
+/* startup phase timing. the report is printed once both the dbus name and
+ * the pipeline are there */
+static void startup_phase(App *app, const gchar *phase)
+{
+	if (app->startup_timer)
+		startup_phase_at (app, phase, g_timer_elapsed (app->startup_timer, NULL));
+}
+
+/* for a phase that ended before the timer was handed to app, now is when */
+static void startup_phase_at(App *app, const gchar *phase, gdouble now)
+{
+	if (!app->startup_timer)
+		return;
+	g_string_append_printf (app->startup_report, " %s %.1f ms,", phase, (now - app->startup_last) * 1000);
+	app->startup_last = now;
+	GST_INFO_OBJECT (app, "startup phase '%s' done after %.1f ms", phase, now * 1000);
+	if (app->pipeline && app->daemon->dbus_connection)
+	{
+		g_string_truncate (app->startup_report, app->startup_report->len - 1);
+		g_print ("ready to serve after %.1f ms (%s )\n", now * 1000, app->startup_report->str);
+		g_timer_destroy (app->startup_timer);
+		g_string_free (app->startup_report, TRUE);
+		app->startup_timer = NULL;
+		app->startup_report = NULL;
+	}
+}
+
+static void encoder_signal_lost (GstElement *dreamaudiosource, gpointer user_data)
+{
+	GST_INFO_OBJECT (dreamaudiosource, "lost encoder signal!");
+	g_idle_add (slate_signal_lost, user_data);
+}
+
+/* the pipeline that makes the slate, from the clip or rendered by the
+ * software encoders in the format the sources are set to */
+static gchar *slate_launch(App *app, DreamSlateStream *st)
+{
+	const gchar *file = st->video ? SLATE_VIDEO_FILE : SLATE_AUDIO_FILE;
+	gchar *launch;
+	if (g_file_test (file, G_FILE_TEST_IS_REGULAR))
+		launch = g_strdup_printf (st->video ? "filesrc location=%s ! h264parse ! video/x-h264,stream-format=byte-stream,alignment=au ! appsink name=sink sync=false" : "filesrc location=%s ! aacparse ! appsink name=sink sync=false", file);
+	else if (st->video)
+	{
+		guint32 width = 0, height = 0, framerate = 0;
+		gst_get_capsprop (app, app->vsrc, "width", &width);
+		gst_get_capsprop (app, app->vsrc, "height", &height);
+		gst_get_capsprop (app, app->vsrc, "framerate", &framerate);
+		if (!width || !height)
+			width = 1280, height = 720;
+		if (!framerate)
+			framerate = 25;
+		launch = g_strdup_printf ("videotestsrc pattern=black num-buffers=%u ! video/x-raw,width=%u,height=%u,framerate=%u/1 ! x264enc speed-preset=superfast tune=zerolatency key-int-max=%u"
+			" ! video/x-h264,stream-format=byte-stream,alignment=au ! h264parse ! appsink name=sink sync=false", framerate, width, height, framerate, framerate);
+	}
+	else
+	{
+		gint rate = 48000, channels = 2;
+		GstCaps *caps = NULL;
+		g_object_get (G_OBJECT (app->asrc), "caps", &caps, NULL);
+		if (GST_IS_CAPS (caps) && !gst_caps_is_empty (caps))
+		{
+			gst_structure_get_int (gst_caps_get_structure (caps, 0), "rate", &rate);
+			gst_structure_get_int (gst_caps_get_structure (caps, 0), "channels", &channels);
+		}
+		if (caps)
+			gst_caps_unref (caps);
+		launch = g_strdup_printf ("audiotestsrc wave=silence num-buffers=%u ! audio/x-raw,rate=%u,channels=%u ! audioconvert ! avenc_aac ! aacparse ! appsink name=sink sync=false", rate / 1024 + 1, rate, channels);
+	}
+	return launch;
+}
+
+/* runs the slate pipeline to its end and keeps the access units its appsink
+ * got. it's done in a worker thread, the stream isn't touched by anyone else
+ * until slate_loaded */
+static gboolean slate_load(App *app, DreamSlateStream *st, const gchar *launch)
+{
+	gint64 start = g_get_monotonic_time ();
+	GError *err = NULL;
+	GstElement *pipeline = gst_parse_launch (launch, &err);
+	if (!pipeline || err)
+	{
+		GST_WARNING_OBJECT (app, "can't load slate with '%s': %s", launch, err ? err->message : "unknown error");
+		g_clear_error (&err);
+		if (pipeline)
+			gst_object_unref (pipeline);
+		return FALSE;
+	}
+
+	GstElement *sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+	GstSample *sample;
+	st->buffers = g_ptr_array_new_with_free_func ((GDestroyNotify) gst_buffer_unref);
+	gst_element_set_state (pipeline, GST_STATE_PLAYING);
+	/* an error doesn't end the stream, hence the timeout */
+	while ((sample = gst_app_sink_try_pull_sample (GST_APP_SINK (sink), SLATE_LOAD_TIMEOUT)))
+	{
+		if (!st->caps)
+			st->caps = gst_caps_ref (gst_sample_get_caps (sample));
+		g_ptr_array_add (st->buffers, gst_buffer_ref (gst_sample_get_buffer (sample)));
+		gst_sample_unref (sample);
+	}
+	gst_element_set_state (pipeline, GST_STATE_NULL);
+	gst_object_unref (sink);
+	gst_object_unref (pipeline);
+
+	if (!st->buffers->len || !st->caps)
+	{
+		GST_WARNING_OBJECT (app, "slate '%s' came out empty", launch);
+		g_ptr_array_unref (st->buffers);
+		st->buffers = NULL;
+		gst_caps_replace (&st->caps, NULL);
+		return FALSE;
+	}
+
+	GstStructure *structure = gst_caps_get_structure (st->caps, 0);
+	GstBuffer *first = g_ptr_array_index (st->buffers, 0);
+	gint num = 0, den = 1, rate = 0;
+	if (GST_BUFFER_DURATION_IS_VALID (first))
+		st->duration = GST_BUFFER_DURATION (first);
+	else if (gst_structure_get_fraction (structure, "framerate", &num, &den) && num)
+		st->duration = gst_util_uint64_scale_int (GST_SECOND, den, num);
+	else if (gst_structure_get_int (structure, "rate", &rate) && rate)
+		st->duration = gst_util_uint64_scale_int (GST_SECOND, 1024, rate);
+	else
+		st->duration = 40 * GST_MSECOND;
+
+	GST_INFO_OBJECT (app, "%s slate of %u buffers %" GST_PTR_FORMAT " loaded in %" G_GINT64_FORMAT " ms", st->video ? "video" : "audio", st->buffers->len, st->caps, (g_get_monotonic_time () - start) / 1000);
+	return TRUE;
+}
+
+static void slate_load_free(DreamSlateLoad *load)
+{
+	g_free (load->video_launch);
+	g_free (load->audio_launch);
+	g_free (load);
+}
+
+static void slate_load_thread(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable)
+{
+	DreamSlateLoad *load = task_data;
+	DreamSlate *s = load->app->slate;
+	g_task_return_boolean (task, slate_load (load->app, &s->video, load->video_launch) && slate_load (load->app, &s->audio, load->audio_launch));
+}
+
+/* back in the main loop, links the slate into the pipeline that's up now */
+static void slate_loaded(GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+	App *app = user_data;
+	DreamSlate *s = app->slate;
+	s->loading = FALSE;
+	s->loaded = TRUE;
+	if (!g_task_propagate_boolean (G_TASK (res), NULL))
+		GST_WARNING_OBJECT (app, "no slate, losing the input will stop the streams");
+	if (!app->pipeline || !s->video.buffers || !s->audio.buffers)
 		return;
 
-	GST_DEBUG_OBJECT (app, "inserting tsmux");
+	slate_link (app, &s->audio, app->asel);
+	slate_link (app, &s->video, app->vsel);
+}
 
-	app->tsmux = gst_element_factory_make ("mpegtsmux", NULL);
-	gst_bin_add (GST_BIN (app->pipeline), app->tsmux);
+/* loads the slate once and links it into each new pipeline. rendering it
+ * takes seconds without the clip, so it's done in a worker thread after the
+ * pipeline is up. a failure only means that losing the input takes the
+ * pipeline down as before */
+static gboolean slate_prepare(gpointer user_data)
+{
+	App *app = user_data;
+	DreamSlate *s = app->slate;
+	s->id_prepare = 0;
+	if (!app->pipeline || s->loading)
+		return G_SOURCE_REMOVE;
 
-	GstPad *sinkpad, *srcpad;
-	GstPadLinkReturn ret;
+	if (!s->loaded)
+	{
+		DreamSlateLoad *load = g_new0 (DreamSlateLoad, 1);
+		load->app = app;
+		load->video_launch = slate_launch (app, &s->video);
+		load->audio_launch = slate_launch (app, &s->audio);
+		s->loading = TRUE;
+		GTask *task = g_task_new (NULL, NULL, slate_loaded, app);
+		g_task_set_task_data (task, load, (GDestroyNotify) slate_load_free);
+		g_task_run_in_thread (task, slate_load_thread);
+		g_object_unref (task);
+		return G_SOURCE_REMOVE;
+	}
+	if (!s->video.buffers || !s->audio.buffers)
+		return G_SOURCE_REMOVE;
 
-	srcpad = gst_element_get_static_pad (app->aq, "src");
-	sinkpad = gst_element_get_compatible_pad (app->tsmux, srcpad, NULL);
-	ret = gst_pad_link (srcpad, sinkpad);
-	if (ret != GST_PAD_LINK_OK)
-		g_error ("couldn't link %" GST_PTR_FORMAT " ! %" GST_PTR_FORMAT "", srcpad, sinkpad);
-	gst_object_unref (srcpad);
-	gst_object_unref (sinkpad);
+	slate_link (app, &s->audio, app->asel);
+	slate_link (app, &s->video, app->vsel);
+	return G_SOURCE_REMOVE;
+}
 
-	srcpad = gst_element_get_static_pad (app->vq, "src");
-	sinkpad = gst_element_get_compatible_pad (app->tsmux, srcpad, NULL);
-	ret = gst_pad_link (srcpad, sinkpad);
-	if (ret != GST_PAD_LINK_OK)
-		g_error ("couldn't link %" GST_PTR_FORMAT " ! %" GST_PTR_FORMAT "", srcpad, sinkpad);
+static void slate_link(App *app, DreamSlateStream *st, GstElement *selector)
+{
+	st->appsrc = gst_element_factory_make ("appsrc", st->video ? "vslate" : "aslate");
+	g_object_set (st->appsrc, "is-live", TRUE, "format", GST_FORMAT_TIME, "caps", st->caps, NULL);
+	gst_bin_add (GST_BIN (app->pipeline), st->appsrc);
+
+	st->slatepad = gst_element_get_request_pad (selector, "sink_%u");
+	GstPad *srcpad = gst_element_get_static_pad (st->appsrc, "src");
+	if (gst_pad_link (srcpad, st->slatepad) != GST_PAD_LINK_OK)
+		GST_WARNING_OBJECT (app, "can't link %" GST_PTR_FORMAT " to %" GST_PTR_FORMAT, st->appsrc, selector);
 	gst_object_unref (srcpad);
-	gst_object_unref (sinkpad);
-
-	if (!gst_element_link (app->tsmux, app->tstee))
-		g_error ("couldn't link %" GST_PTR_FORMAT " ! %" GST_PTR_FORMAT "", app->tsmux, app->tstee);
+	gst_element_sync_state_with_parent (st->appsrc);
 }
 
-gboolean create_source_pipeline(App *app)
+/* switches the outputs over to the slate while the sources have lost their
+ * input. it follows on from what went out last and is paced with the same
+ * lag behind the clock, so the live stream can pick up where it leaves off
+ * once its next idr comes by. with retry the sources are restarted until
+ * they deliver again */
+static gboolean slate_start(App *app, gboolean retry)
 {
-	GST_INFO_OBJECT(app, "create_source_pipeline");
-	DREAMRTSPSERVER_LOCK (app);
-	app->pipeline = gst_pipeline_new ("dreamrtspserver_source_pipeline");
-
-	GstBus *bus = gst_pipeline_get_bus (GST_PIPELINE (app->pipeline));
-	gst_bus_add_signal_watch (bus);
-	g_signal_connect (G_OBJECT (bus), "message", G_CALLBACK (message_cb), app);
-	gst_object_unref (GST_OBJECT (bus));
+	DreamSlate *s = app->slate;
+	if (!s || !s->video.appsrc || !s->audio.appsrc || app->source_state != SOURCE_STATE_RUNNING)
+		return FALSE;
 
-	app->asrc = gst_element_factory_make ("dreamaudiosource", "dreamaudiosource0");
-	app->vsrc = gst_element_factory_make ("dreamvideosource", "dreamvideosource0");
+	if (retry && !s->id_retry)
+		s->id_retry = g_timeout_add (SLATE_RETRY_INTERVAL, slate_retry, app);
+	if (s->active)
+		return TRUE;
 
-	app->aparse = gst_element_factory_make ("aacparse", NULL);
-	app->vparse = gst_element_factory_make ("h264parse", NULL);
+	GstClockTime now = gst_clock_get_time (app->clock) - gst_element_get_base_time (app->pipeline);
+	g_mutex_lock (&s->lock);
+	GstClockTime start = now;
+	if (GST_CLOCK_TIME_IS_VALID (s->video.end))
+		start = s->video.end;
+	if (GST_CLOCK_TIME_IS_VALID (s->audio.end))
+		start = GST_CLOCK_TIME_IS_VALID (s->video.end) ? MAX (start, s->audio.end) : s->audio.end;
+	s->lag = now > start ? now - start : 0;
+	s->audio.next = s->video.next = start;
+	s->audio.index = s->video.index = 0;
+	s->audio.discont = s->video.discont = TRUE;
+	s->active = TRUE;
+	g_mutex_unlock (&s->lock);
+
+	GST_INFO_OBJECT (app, "input lost, slate takes over at %" GST_TIME_FORMAT " (%" GST_TIME_FORMAT " behind the clock)", GST_TIME_ARGS (start), GST_TIME_ARGS (s->lag));
+	s->since = g_get_monotonic_time ();
+	g_atomic_int_set (&s->cut_pending, TRUE);
+	g_object_set (app->asel, "active-pad", s->audio.slatepad, NULL);
+	g_object_set (app->vsel, "active-pad", s->video.slatepad, NULL);
+	slate_tick (app);
+	s->id_tick = g_timeout_add (SLATE_TICK, slate_tick, app);
+	send_signal (app, "slateChanged", g_variant_new("(b)", TRUE));
+	return TRUE;
+}
 
-	app->atee = gst_element_factory_make ("tee", "atee");
-	app->vtee = gst_element_factory_make ("tee", "vtee");
-	app->tstee = gst_element_factory_make ("tee", "tstee");
+static gboolean slate_signal_lost(gpointer user_data)
+{
+	App *app = user_data;
+	if (app->pipeline)
+		slate_start (app, FALSE);
+	return G_SOURCE_REMOVE;
+}
 
-	app->aq = gst_element_factory_make ("queue", "aqueue");
-	app->vq = gst_element_factory_make ("queue", "vqueue");
+/* called with the slate locked */
+static void slate_push(DreamSlateStream *st, GstClockTime until)
+{
+	while (st->next <= until)
+	{
+		GstBuffer *buffer = gst_buffer_copy (g_ptr_array_index (st->buffers, st->index));
+		GST_BUFFER_PTS (buffer) = GST_BUFFER_DTS (buffer) = st->next;
+		GST_BUFFER_DURATION (buffer) = st->duration;
+		if (st->discont)
+			GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_DISCONT);
+		st->discont = FALSE;
+		gst_app_src_push_buffer (GST_APP_SRC (st->appsrc), buffer);
+		st->next += st->duration;
+		st->index = (st->index + 1) % st->buffers->len;
+	}
+}
 
-	app->tsmux = gst_element_factory_make ("mpegtsmux", NULL);
-        app->tstee = gst_element_factory_make ("tee", "tstee");
+static gboolean slate_tick(gpointer user_data)
+{
+	App *app = user_data;
+	DreamSlate *s = app->slate;
+	GstClockTime now = gst_clock_get_time (app->clock) - gst_element_get_base_time (app->pipeline);
 
-	if (!(app->asrc && app->vsrc && app->aparse && app->vparse && app->aq && app->vq && app->atee && app->vtee && app->tsmux && app->tstee))
+	g_mutex_lock (&s->lock);
+	if (s->active)
 	{
-		g_error ("Failed to create source pipeline element(s):%s%s%s%s%s%s%s%s%s", app->asrc?"":" dreamaudiosource", app->vsrc?"":" dreamvideosource", app->aparse?"":" aacparse",
-			app->vparse?"":" h264parse", app->aq?"":" aqueue", app->vq?"":" vqueue", app->atee?"":" atee", app->vtee?"":" vtee", app->tsmux?"":"  mpegtsmux");
+		slate_push (&s->video, now - s->lag);
+		slate_push (&s->audio, now - s->lag);
 	}
-	gst_object_unref(app->tsmux);
-	app->tsmux = NULL;
+	g_mutex_unlock (&s->lock);
+	return G_SOURCE_CONTINUE;
+}
 
-	if (!(app->asrc && app->vsrc && app->aparse && app->vparse))
+/* sources that failed are brought up again until they deliver */
+static gboolean slate_retry(gpointer user_data)
+{
+	App *app = user_data;
+	DreamSlate *s = app->slate;
+	if (!s->active)
 	{
-		g_error ("Failed to create source pipeline element(s):%s%s%s%s", app->asrc?"":" dreamaudiosource", app->vsrc?"":" dreamvideosource", app->aparse?"":" aacparse", app->vparse?"":" h264parse");
+		s->id_retry = 0;
+		return G_SOURCE_REMOVE;
 	}
+	GST_INFO_OBJECT (app, "retrying the sources after %" G_GINT64_FORMAT " ms on the slate", (g_get_monotonic_time () - s->since) / 1000);
+	gst_element_set_state (app->asrc, GST_STATE_NULL);
+	gst_element_set_state (app->vsrc, GST_STATE_NULL);
+	gst_element_sync_state_with_parent (app->asrc);
+	gst_element_sync_state_with_parent (app->vsrc);
+	return G_SOURCE_CONTINUE;
+}
+
+/* the live stream is back, see slate_live_probe */
+static gboolean slate_returned(gpointer user_data)
+{
+	App *app = user_data;
+	DreamSlate *s = app->slate;
+	if (s->id_tick)
+		g_source_remove (s->id_tick);
+	if (s->id_retry)
+		g_source_remove (s->id_retry);
+	s->id_tick = s->id_retry = 0;
+	GST_INFO_OBJECT (app, "input is back after %" G_GINT64_FORMAT " ms on the slate, live stream offset %" GST_STIME_FORMAT, (g_get_monotonic_time () - s->since) / 1000, GST_STIME_ARGS (s->video.offset));
+	send_signal (app, "slateChanged", g_variant_new("(b)", FALSE));
+	return G_SOURCE_REMOVE;
+}
 
-	GstElement *appsink, *appsrc, *vpay, *apay, *udpsrc;
-	appsink = gst_element_factory_make ("appsink", NULL);
-	appsrc = gst_element_factory_make ("appsrc", NULL);
-	vpay = gst_element_factory_make ("rtph264pay", NULL);
-	apay = gst_element_factory_make ("rtpmp4apay", NULL);
-	udpsrc = gst_element_factory_make ("udpsrc", NULL);
+/* gives the selectors back to the sources without waiting for an idr, for
+ * when the sources are taken down anyway */
+static void slate_stop(App *app)
+{
+	DreamSlate *s = app->slate;
+	if (!s)
+		return;
+	g_mutex_lock (&s->lock);
+	gboolean active = s->active;
+	s->active = FALSE;
+	g_mutex_unlock (&s->lock);
+	if (!active)
+		return;
+	g_object_set (app->asel, "active-pad", s->audio.livepad, NULL);
+	g_object_set (app->vsel, "active-pad", s->video.livepad, NULL);
+	slate_returned (app);
+}
 
-	if (!(appsink && appsrc && vpay && apay && udpsrc))
-		g_error ("Failed to create rtsp element(s):%s%s%s%s%s", appsink?"":" appsink", appsrc?"":" appsrc", vpay?"": "rtph264pay", apay?"":" rtpmp4apay", udpsrc?"":" udpsrc" );
-	else
+/* shifts the live streams so they follow on from the slate. while the slate
+ * runs the first live idr switches the selectors back */
+static GstPadProbeReturn slate_live_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+	DreamSlateStream *st = user_data;
+	DreamSlate *s = st->slate;
+	GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+	GstClockTime ts = GST_BUFFER_DTS_OR_PTS (buffer);
+	gboolean back = FALSE, drop = FALSE;
+
+	g_mutex_lock (&s->lock);
+	if (s->active && st->video && GST_CLOCK_TIME_IS_VALID (ts) && !GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT))
 	{
-		gst_object_unref (appsink);
-		gst_object_unref (appsrc);
-		gst_object_unref (vpay);
-		gst_object_unref (apay);
-		gst_object_unref (udpsrc);
+		s->audio.offset = s->video.offset = GST_CLOCK_DIFF (ts, st->next);
+		s->active = FALSE;
+		back = TRUE;
 	}
+	GstClockTimeDiff offset = st->offset;
+	/* audio the slate already covered */
+	if (!st->video && !s->active && GST_CLOCK_TIME_IS_VALID (ts) && (GstClockTimeDiff) ts + offset < (GstClockTimeDiff) st->next)
+		drop = TRUE;
+	g_mutex_unlock (&s->lock);
 
-	gst_bin_add_many (GST_BIN (app->pipeline), app->asrc, app->aparse, app->atee, app->aq, NULL);
-	gst_bin_add_many (GST_BIN (app->pipeline), app->vsrc, app->vparse, app->vtee, app->vq, NULL);
-	gst_bin_add (GST_BIN (app->pipeline), app->tstee);
-	gst_element_link_many (app->asrc, app->aparse, app->atee, NULL);
-	gst_element_link_many (app->vsrc, app->vparse, app->vtee, NULL);
+	if (back)
+	{
+		GST_DEBUG_OBJECT (pad, "live idr at %" GST_TIME_FORMAT ", switching back from the slate", GST_TIME_ARGS (ts));
+		g_atomic_int_set (&s->cut_pending, TRUE);
+		g_object_set (s->app->asel, "active-pad", s->audio.livepad, NULL);
+		g_object_set (s->app->vsel, "active-pad", s->video.livepad, NULL);
+		g_idle_add (slate_returned, s->app);
+	}
+	if (drop)
+		return GST_PAD_PROBE_DROP;
 
-	GstPad *teepad, *sinkpad;
-	GstPadLinkReturn ret;
+	if (offset)
+	{
+		buffer = gst_buffer_make_writable (buffer);
+		if (GST_BUFFER_PTS_IS_VALID (buffer))
+			GST_BUFFER_PTS (buffer) = MAX ((GstClockTimeDiff) GST_BUFFER_PTS (buffer) + offset, 0);
+		if (GST_BUFFER_DTS_IS_VALID (buffer))
+			GST_BUFFER_DTS (buffer) = MAX ((GstClockTimeDiff) GST_BUFFER_DTS (buffer) + offset, 0);
+		GST_PAD_PROBE_INFO_DATA (info) = buffer;
+	}
+	return GST_PAD_PROBE_OK;
+}
 
-	teepad = gst_element_get_request_pad (app->atee, "src_%u");
-	sinkpad = gst_element_get_static_pad (app->aq, "sink");
-	ret = gst_pad_link (teepad, sinkpad);
-	if (ret != GST_PAD_LINK_OK)
+/* keeps track of where the output is at and cuts the hls fragment at the
+ * first idr after each switch */
+static GstPadProbeReturn slate_out_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+	DreamSlateStream *st = user_data;
+	DreamSlate *s = st->slate;
+	GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+	GstClockTime ts = GST_BUFFER_DTS_OR_PTS (buffer);
 
-	if (ret != GST_PAD_LINK_OK)
+	if (GST_CLOCK_TIME_IS_VALID (ts))
 	{
-		GST_ERROR_OBJECT (app, "couldn't link %" GST_PTR_FORMAT " ! %" GST_PTR_FORMAT "", teepad, sinkpad);
-		return FALSE;
+		g_mutex_lock (&s->lock);
+		st->end = ts + (GST_BUFFER_DURATION_IS_VALID (buffer) ? GST_BUFFER_DURATION (buffer) : 0);
+		g_mutex_unlock (&s->lock);
 	}
-	gst_object_unref (teepad);
-	gst_object_unref (sinkpad);
-
-	teepad = gst_element_get_request_pad (app->vtee, "src_%u");
-	sinkpad = gst_element_get_static_pad (app->vq, "sink");
-	ret = gst_pad_link (teepad, sinkpad);
+	if (st->video && !GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT) && g_atomic_int_compare_and_exchange (&s->cut_pending, TRUE, FALSE))
+		video_cut (s->app, pad, buffer);
+	return GST_PAD_PROBE_OK;
+}
 
-	if (ret != GST_PAD_LINK_OK)
+/* replaces sources that failed with new ones behind the outputs, which stay
+ * as they are. the encoders can only be opened once, so the replacement is
+ * built and configured first and the old sources are taken down before it
+ * comes up. the slate covers the gap if there is one, the selectors go over
+ * to the new sources at their first idr either way */
+static gboolean source_swap_begin(App *app)
+{
+	if (!app->pipeline || app->source_state != SOURCE_STATE_RUNNING || app->source_pending)
+		return FALSE;
+	/* the replacement failed as well, keep bringing it up */
+	if (app->swap)
+		return slate_start (app, TRUE);
+
+	GstElement *asrc = create_source_element (app, DREAM_SOFT_SOURCE_AUDIO, app->channel);
+	GstElement *vsrc = create_source_element (app, DREAM_SOFT_SOURCE_VIDEO, app->channel);
+	GstElement *aparse = gst_element_factory_make ("aacparse", NULL);
+	GstElement *vparse = gst_element_factory_make ("h264parse", NULL);
+	if (!(asrc && vsrc && aparse && vparse))
 	{
-		GST_ERROR_OBJECT (app, "couldn't link %" GST_PTR_FORMAT " ! %" GST_PTR_FORMAT "", teepad, sinkpad);
+		GST_WARNING_OBJECT (app, "can't create replacement sources");
+		g_clear_object (&asrc);
+		g_clear_object (&vsrc);
+		g_clear_object (&aparse);
+		g_clear_object (&vparse);
 		return FALSE;
 	}
 
-	gst_object_unref (teepad);
-	gst_object_unref (sinkpad);
-
-	app->clock = gst_system_clock_obtain();
-	gst_pipeline_use_clock(GST_PIPELINE (app->pipeline), app->clock);
-
-	apply_source_properties(app);
+	GST_INFO_OBJECT (app, "swapping %" GST_PTR_FORMAT " and %" GST_PTR_FORMAT " for new sources", app->asrc, app->vsrc);
+	DreamSlate *s = app->slate;
+	DreamSourceSwap *swap = app->swap = g_new0 (DreamSourceSwap, 1);
+	swap->app = app;
+	swap->start = g_get_monotonic_time ();
+	swap->apad = s->audio.livepad;
+	swap->vpad = s->video.livepad;
+	slate_start (app, FALSE);
 
-	g_signal_connect (app->asrc, "signal-lost", G_CALLBACK (encoder_signal_lost), app);
+	inputMode input_mode;
+	get_source_properties (app);
+	g_object_get (G_OBJECT (app->vsrc), "input_mode", &input_mode, NULL);
 
-	GST_DEBUG_BIN_TO_DOT_FILE(GST_BIN(app->pipeline),GST_DEBUG_GRAPH_SHOW_ALL,"create_source_pipeline");
-	DREAMRTSPSERVER_UNLOCK (app);
+	GstElement *old[] = { app->asrc, app->vsrc, app->aparse, app->vparse };
+	guint i;
+	for (i = 0; i < G_N_ELEMENTS (old); i++)
+	{
+		gst_element_set_state (old[i], GST_STATE_NULL);
+		gst_bin_remove (GST_BIN (app->pipeline), old[i]);
+	}
+	/* the input switch probes went with the parsers */
+	input_switch_reset (app);
+
+	app->asrc = asrc;
+	app->vsrc = vsrc;
+	app->aparse = aparse;
+	app->vparse = vparse;
+	gst_bin_add_many (GST_BIN (app->pipeline), asrc, aparse, vsrc, vparse, NULL);
+	source_chain_link (app, asrc, aparse, app->asel, &s->audio);
+	source_chain_link (app, vsrc, vparse, app->vsel, &s->video);
+	g_object_set (G_OBJECT (asrc), "input_mode", input_mode, NULL);
+	g_object_set (G_OBJECT (vsrc), "input_mode", input_mode, NULL);
+	apply_source_properties (app);
+	g_signal_connect (asrc, "signal-lost", G_CALLBACK (encoder_signal_lost), app);
+	if (GST_IS_DREAM_SOFT_SOURCE (vsrc))
+		g_signal_connect (vsrc, "signal-lost", G_CALLBACK (encoder_signal_lost), app);
+	gst_pad_add_probe (s->video.livepad, GST_PAD_PROBE_TYPE_BUFFER, source_swap_probe, swap, NULL);
+
+	GstElement *fresh[] = { aparse, vparse, asrc, vsrc };
+	for (i = 0; i < G_N_ELEMENTS (fresh); i++)
+		if (!gst_element_sync_state_with_parent (fresh[i]))
+			GST_WARNING_OBJECT (app, "can't bring %" GST_PTR_FORMAT " up", fresh[i]);
 	return TRUE;
 }
 
-static void encoder_signal_lost (GstElement *dreamaudiosource, gpointer user_data)
+/* the first idr of the new sources. without the slate on air the selectors
+ * are switched here, with it slate_live_probe has done that already */
+static GstPadProbeReturn source_swap_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
 {
-	GST_INFO_OBJECT (dreamaudiosource, "lost encoder signal!");
+	DreamSourceSwap *swap = user_data;
+	App *app = swap->app;
+	DreamSlate *s = app->slate;
+	GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+
+	if (GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT))
+		return GST_PAD_PROBE_OK;
+
+	g_mutex_lock (&s->lock);
+	gboolean slate = s->active;
+	g_mutex_unlock (&s->lock);
+	if (!slate)
+	{
+		g_atomic_int_set (&s->cut_pending, TRUE);
+		g_object_set (app->asel, "active-pad", s->audio.livepad, NULL);
+		g_object_set (app->vsel, "active-pad", s->video.livepad, NULL);
+	}
+	g_idle_add (source_swap_done, app);
+	return GST_PAD_PROBE_REMOVE;
 }
 
-static GstPadProbeReturn inject_authorization (GstPad * sinkpad, GstPadProbeInfo * info, gpointer user_data)
+/* the old sources' selector inputs go once nothing can switch back to them */
+static gboolean source_swap_done(gpointer user_data)
 {
 	App *app = user_data;
-
-	GstBuffer *token_buf = gst_buffer_new_wrapped (app->tcp_upstream->token, TOKEN_LEN);
-	GstPad * srcpad = gst_element_get_static_pad (app->tcp_upstream->tstcpq, "src");
-
-	GST_INFO ("injecting authorization on pad %s:%s, created token_buf %" GST_PTR_FORMAT "", GST_DEBUG_PAD_NAME (sinkpad), token_buf);
-	gst_pad_remove_probe (sinkpad, info->id);
-	gst_pad_push (srcpad, gst_buffer_ref(token_buf));
-
-	return GST_PAD_PROBE_REMOVE;
+	DreamSourceSwap *swap = app->swap;
+	if (!swap)
+		return G_SOURCE_REMOVE;
+
+	gint ms = (g_get_monotonic_time () - swap->start) / 1000;
+	GST_INFO_OBJECT (app, "new sources are on air after %i ms", ms);
+	gst_element_release_request_pad (app->asel, swap->apad);
+	gst_element_release_request_pad (app->vsel, swap->vpad);
+	gst_object_unref (swap->apad);
+	gst_object_unref (swap->vpad);
+	g_free (swap);
+	app->swap = NULL;
+	send_signal (app, "sourcesSwapped", g_variant_new("(i)", ms));
+	return G_SOURCE_REMOVE;
 }
 
 gboolean enable_tcp_upstream(App *app, const gchar *upstream_host, guint32 upstream_port, const gchar *token)
@@ -1571,30 +4028,56 @@ gboolean enable_tcp_upstream(App *app, const gchar *upstream_host, guint32 upstr
 
 	if (t->state == UPSTREAM_STATE_DISABLED)
 	{
-		assert_tsmux (app);
+		create_upstream_encoder (app);
+		if (!t->encoder_bin)
+			assert_tsmux (app);
 		DREAMRTSPSERVER_LOCK (app);
 
-		t->id_signal_overrun = 0;
+		t->overrun_armed = TRUE;
 		t->id_signal_waiting = 0;
 		t->id_signal_keepalive = 0;
 		t->id_bitrate_measure = 0;
 		t->id_resume = 0;
+		g_mutex_lock (&t->idle_lock);
+		t->idle_closed = FALSE;
+		g_mutex_unlock (&t->idle_lock);
 		t->state = UPSTREAM_STATE_CONNECTING;
 		send_signal (app, "upstreamStateChanged", g_variant_new("(i)", t->state));
 
-		t->tstcpq  = gst_element_factory_make ("queue", "tstcpqueue");
-		t->tcpsink = gst_element_factory_make ("tcpclientsink", NULL);
+		t->tssrc   = branch_appsrc_new ("tstcpsrc", 0, NULL);
+		t->funnel  = gst_element_factory_make ("funnel", "tstcpfunnel");
+		t->keepalive = gst_element_factory_make ("appsrc", "tskeepalive");
+		t->tcpsink = g_object_new (GST_TYPE_DREAM_TCP_SINK, "name", "tcpupstreamsink", NULL);
+
+		if (!(t->tssrc && t->funnel && t->keepalive && t->tcpsink ))
+			g_error ("Failed to create tcp upstream element(s):%s%s%s%s", t->tssrc?"":"  ts appsrc", t->funnel?"":"  funnel", t->keepalive?"":"  appsrc", t->tcpsink?"":"  dreamtcpsink" );
 
-		if (!(t->tstcpq && t->tcpsink ))
-			g_error ("Failed to create tcp upstream element(s):%s%s", t->tstcpq?"":"  ts queue", t->tcpsink?"":"  tcpclientsink" );
+		g_object_set (G_OBJECT (t->keepalive), "is-live", TRUE, "format", GST_FORMAT_TIME, "do-timestamp", TRUE, "block", FALSE, NULL);
 
-		g_object_set (G_OBJECT (t->tstcpq), "leaky", 2, "max-size-buffers", 400, "max-size-bytes", 0, "max-size-time", G_GINT64_CONSTANT(0), NULL);
+		t->queue_max_bytes = 0;
+		t->bitrate_avg = 0;
+		get_source_properties (app);
+		t->configured = app->source_properties;
+		upstream_ladder_reset (app);
+		upstream_tune_queue (app, 0);
 
-		t->id_signal_overrun = g_signal_connect (t->tstcpq, "overrun", G_CALLBACK (queue_overrun), app);
-		GST_TRACE_OBJECT(app, "installed %" GST_PTR_FORMAT " overrun handler id=%u", t->tstcpq, t->id_signal_overrun);
+		dream_ts_dropper_init (&t->dropper);
+		t->drop_level = TS_DROP_NONE;
 
 		g_object_set (t->tcpsink, "max-lateness", G_GINT64_CONSTANT(3)*GST_SECOND, NULL);
-		g_object_set (t->tcpsink, "blocksize", BLOCK_SIZE, NULL);
+		g_object_set (t->tcpsink, "batch-size", t->batch_size, "batch-latency", UPSTREAM_BATCH_LATENCY, NULL);
+		upstream_set_pacing (app);
+		g_object_set (t->tcpsink, "spool", t->spool, "spool-limit", t->spool_limit*1024*1024, "spool-location", UPSTREAM_SPOOL_PATH, NULL);
+
+		/* the sink sends the token itself on every (re)connection */
+		if (strlen(token))
+		{
+			g_strlcpy (t->token, token, sizeof(t->token));
+			g_object_set (t->tcpsink, "handshake", t->token, NULL);
+		}
+		else
+			GST_DEBUG_OBJECT (app, "no token specified!");
+		g_signal_connect (t->tcpsink, "congested", G_CALLBACK (upstream_congested), app);
 
 		g_object_set (t->tcpsink, "host", upstream_host, NULL);
 		g_object_set (t->tcpsink, "port", upstream_port, NULL);
@@ -1619,51 +4102,44 @@ gboolean enable_tcp_upstream(App *app, const gchar *upstream_host, guint32 upstr
 		if (sret == GST_STATE_CHANGE_FAILURE)
 		{
 			GST_ERROR_OBJECT (app, "failed to set tcpsink to GST_STATE_READY. %s:%d probably refused connection", upstream_host, upstream_port);
-			gst_object_unref (t->tstcpq);
+			gst_object_unref (t->tssrc);
+			gst_object_unref (t->funnel);
+			gst_object_unref (t->keepalive);
 			gst_object_unref (t->tcpsink);
+			t->tssrc = t->funnel = t->keepalive = t->tcpsink = NULL;
 			t->state = UPSTREAM_STATE_DISABLED;
 			send_signal (app, "upstreamStateChanged", g_variant_new("(i)", t->state));
 			DREAMRTSPSERVER_UNLOCK (app);
 			return FALSE;
 		}
 
-		gst_bin_add_many (GST_BIN(app->pipeline), t->tstcpq, t->tcpsink, NULL);
-		if (!gst_element_link (t->tstcpq, t->tcpsink)) {
-			GST_ERROR_OBJECT (app, "couldn't link %" GST_PTR_FORMAT " ! %" GST_PTR_FORMAT "", t->tstcpq, t->tcpsink);
+		gst_bin_add_many (GST_BIN(app->pipeline), t->tssrc, t->funnel, t->keepalive, t->tcpsink, NULL);
+		if (!gst_element_link_many (t->tssrc, t->funnel, t->tcpsink, NULL)) {
+			GST_ERROR_OBJECT (app, "couldn't link %" GST_PTR_FORMAT " ! %" GST_PTR_FORMAT " ! %" GST_PTR_FORMAT "", t->tssrc, t->funnel, t->tcpsink);
+			goto fail;
+		}
+		if (!gst_element_link (t->keepalive, t->funnel)) {
+			GST_ERROR_OBJECT (app, "couldn't link %" GST_PTR_FORMAT " ! %" GST_PTR_FORMAT "", t->keepalive, t->funnel);
 			goto fail;
 		}
 
-// 		if (!assert_state (app, t->tcpsink, GST_STATE_PLAYING) || !assert_state (app, t->tstcpq, GST_STATE_PLAYING))
+// 		if (!assert_state (app, t->tcpsink, GST_STATE_PLAYING) || !assert_state (app, t->tssrc, GST_STATE_PLAYING))
 // 			goto fail;
 
-		GstPadLinkReturn ret;
-		GstPad *srcpad, *sinkpad;
-		srcpad = gst_element_get_request_pad (app->tstee, "src_%u");
-		sinkpad = gst_element_get_static_pad (t->tstcpq, "sink");
-		ret = gst_pad_link (srcpad, sinkpad);
-		gst_object_unref (srcpad);
-		gst_object_unref (sinkpad);
-		if (ret != GST_PAD_LINK_OK)
+		if (t->encoder_bin)
 		{
-			GST_ERROR_OBJECT (app, "couldn't link %" GST_PTR_FORMAT " ! %" GST_PTR_FORMAT "", srcpad, sinkpad);
-			goto fail;
+			if (!link_upstream_encoder (app))
+				goto fail;
 		}
-
-		if (strlen(token))
+		else if (!branch_attach (app, NULL, t->tssrc, t->keepalive, t->funnel, t->tcpsink, NULL))
 		{
-			sinkpad = gst_element_get_static_pad (t->tcpsink, "sink");
-			strcpy(t->token, token);
-			gst_pad_add_probe (sinkpad, GST_PAD_PROBE_TYPE_BUFFER|GST_PAD_PROBE_TYPE_BUFFER_LIST, (GstPadProbeCallback) inject_authorization, app, NULL);
-			gst_object_unref (sinkpad);
+			GST_ERROR_OBJECT (app, "couldn't attach TCP upstream");
+			goto fail;
 		}
-		else
-			GST_DEBUG_OBJECT (app, "no token specified!");
+		/* upstream_handover doesn't take the server lock */
+		t->consumer = dream_ring_add_consumer (t->encoder_bin ? t->tsring : app->tsring, 0, upstream_handover, app);
 
-		if (!assert_state (app, app->pipeline, GST_STATE_PLAYING))
-		{
-			GST_ERROR_OBJECT (app, "GST_STATE_CHANGE_FAILURE for TCP upstream");
-			return FALSE;
-		}
+		wake_source_pipeline (app);
 		GST_INFO_OBJECT(app, "enabled TCP upstream! upstreamState = UPSTREAM_STATE_CONNECTING");
 		DREAMRTSPSERVER_UNLOCK (app);
 		return TRUE;
@@ -1728,6 +4204,105 @@ gboolean hls_client_timeout (gpointer user_data)
 	return FALSE;
 }
 
+/* the number of the fragment hlssink is writing right now */
+static gint hls_fragment_index(DreamHLSserver *h)
+{
+	gint index = -1;
+	GValue item = G_VALUE_INIT;
+	GstIterator *iter = gst_bin_iterate_sinks (GST_BIN (h->hlssink));
+	if (gst_iterator_next (iter, &item) == GST_ITERATOR_OK)
+	{
+		g_object_get (g_value_get_object (&item), "index", &index, NULL);
+		g_value_unset (&item);
+	}
+	gst_iterator_free (iter);
+	return index;
+}
+
+/* remembers the first fragment after a video switch, see video_cut */
+static GstPadProbeReturn hls_cut_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+	App *app = user_data;
+	DreamHLSserver *h = app->hls_server;
+	GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+
+	if (GST_EVENT_TYPE (event) == GST_EVENT_CUSTOM_DOWNSTREAM && gst_event_has_name (event, "GstForceKeyUnit") && g_atomic_int_compare_and_exchange (&h->cut_pending, TRUE, FALSE))
+	{
+		gint index = hls_fragment_index (h);
+		GST_DEBUG_OBJECT (pad, "video switch cuts fragment #%i", index);
+		if (index >= 0)
+			g_atomic_int_set (&h->discont_pending, index + 1);
+	}
+	return GST_PAD_PROBE_OK;
+}
+
+static gboolean hls_fragment_is_discont(DreamHLSserver *h, const gchar *uri)
+{
+	GList *l;
+	for (l = h->discont_segments; l; l = l->next)
+	{
+		gchar *name = g_strdup_printf (HLS_FRAGMENT_NAME, GPOINTER_TO_INT (l->data));
+		gboolean match = g_str_has_suffix (uri, name);
+		g_free (name);
+		if (match)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/* hlssink knows nothing about format switches, so the playlist is served
+ * with EXT-X-DISCONTINUITY in front of each fragment that starts with one.
+ * returns NULL if there's nothing to mark */
+static gchar *hls_playlist_mark_discont(DreamHLSserver *h, const gchar *contents, gsize length)
+{
+	gint pending = g_atomic_int_get (&h->discont_pending);
+	if (pending >= 0 && g_atomic_int_compare_and_exchange (&h->discont_pending, pending, -1))
+		h->discont_segments = g_list_append (h->discont_segments, GINT_TO_POINTER (pending));
+	if (!h->discont_segments && !h->discont_sequence)
+		return NULL;
+
+	gchar *text = g_strndup (contents, length);
+	gchar **lines = g_strsplit (text, "\n", -1);
+	g_free (text);
+
+	gint64 first = -1;
+	guint i;
+	for (i = 0; lines[i]; i++)
+		if (g_str_has_prefix (lines[i], "#EXT-X-MEDIA-SEQUENCE:"))
+			first = g_ascii_strtoll (lines[i] + strlen ("#EXT-X-MEDIA-SEQUENCE:"), NULL, 10);
+
+	/* switches that slid out of the playlist are only counted */
+	while (first >= 0 && h->discont_segments && GPOINTER_TO_INT (h->discont_segments->data) < first)
+	{
+		h->discont_sequence++;
+		h->discont_segments = g_list_delete_link (h->discont_segments, h->discont_segments);
+	}
+
+	GString *out = g_string_sized_new (length + 64);
+	const gchar *extinf = NULL;
+	for (i = 0; lines[i]; i++)
+	{
+		const gchar *line = lines[i];
+		if (g_str_has_prefix (line, "#EXTINF"))
+		{
+			extinf = line;
+			continue;
+		}
+		if (line[0] && line[0] != '#' && hls_fragment_is_discont (h, line))
+			g_string_append (out, "#EXT-X-DISCONTINUITY\n");
+		if (extinf)
+			g_string_append_printf (out, "%s\n", extinf);
+		extinf = NULL;
+		g_string_append (out, line);
+		if (lines[i+1])
+			g_string_append_c (out, '\n');
+		if (h->discont_sequence && g_str_has_prefix (line, "#EXT-X-MEDIA-SEQUENCE:"))
+			g_string_append_printf (out, "#EXT-X-DISCONTINUITY-SEQUENCE:%u\n", h->discont_sequence);
+	}
+	g_strfreev (lines);
+	return g_string_free (out, FALSE);
+}
+
 static void
 soup_do_get (SoupServer *server, SoupMessage *msg, const char *path, App *app)
 {
@@ -1742,21 +4317,40 @@ soup_do_get (SoupServer *server, SoupMessage *msg, const char *path, App *app)
 		if (strlen(path) == 1)
 			status_code = SOUP_STATUS_MOVED_PERMANENTLY;
 		else
-			hlspath = g_strdup_printf ("%s%s", HLS_PATH, path);
+			hlspath = g_strdup_printf ("%s%s", app->hls_server->dir, path);
+	}
+	if (status_code == SOUP_STATUS_NONE && g_strcmp0 (path+1, HLS_MASTER_NAME) == 0)
+	{
+		gchar *master = hls_master_playlist (app);
+		GST_INFO_OBJECT (server, "client requests '%s'", path);
+		soup_message_headers_set_content_type (msg->response_headers, "application/x-mpegURL", NULL);
+		soup_message_body_append (msg->response_body, SOUP_MEMORY_TAKE, master, strlen (master));
+		soup_message_set_status (msg, SOUP_STATUS_OK);
+		g_free (hlspath);
+		return;
 	}
-	if (app->hls_server->state == HLS_STATE_IDLE && g_strcmp0 (path+1, HLS_PLAYLIST_NAME) == 0)
+	if (app->hls_server->state == HLS_STATE_IDLE && hls_is_playlist (path))
 	{
 		DREAMRTSPSERVER_LOCK (app);
-		GST_INFO_OBJECT (server, "client requested '%s' but we're idle... start pipeline!", path+1);
-		if (!start_hls_pipeline (app))
+		if (!app->hls_server->id_starting)
+			GST_INFO_OBJECT (server, "client requested '%s' but we're idle... start pipeline!", path+1);
+		if (!app->hls_server->id_starting && !start_hls_pipeline (app))
 			status_code = SOUP_STATUS_INTERNAL_SERVER_ERROR;
 		else
 		{
-			GstState state;
-			gst_element_get_state (GST_ELEMENT(app->pipeline), &state, NULL, HLS_FRAGMENT_DURATION);
-			g_usleep (G_USEC_PER_SEC * (HLS_FRAGMENT_DURATION+1));
-			app->hls_server->state = HLS_STATE_RUNNING;
-			send_signal (app, "hlsStateChanged", g_variant_new("(i)", HLS_STATE_RUNNING));
+			/* the request waits for the first fragment without holding up
+			 * the main loop, and with it the other channels */
+			DreamHLSRequest *req = g_new0 (DreamHLSRequest, 1);
+			req->server = server;
+			req->msg = g_object_ref (msg);
+			req->path = g_strdup (path);
+			soup_server_pause_message (server, msg);
+			app->hls_server->waiting = g_list_append (app->hls_server->waiting, req);
+			if (!app->hls_server->id_starting)
+				app->hls_server->id_starting = g_timeout_add_seconds (HLS_FRAGMENT_DURATION+1, hls_pipeline_started, app);
+			DREAMRTSPSERVER_UNLOCK (app);
+			g_free (hlspath);
+			return;
 		}
 		DREAMRTSPSERVER_UNLOCK (app);
 	}
@@ -1773,8 +4367,10 @@ soup_do_get (SoupServer *server, SoupMessage *msg, const char *path, App *app)
 
 	if (status_code == SOUP_STATUS_MOVED_PERMANENTLY)
 	{
-		GST_LOG_OBJECT (server, "client requested /, redirect to %s", HLS_PLAYLIST_NAME);
-		soup_message_set_redirect (msg, status_code, HLS_PLAYLIST_NAME);
+		gchar *location = g_strdup_printf ("%s/%s", app->hls_server->prefix, HLS_MASTER_NAME);
+		GST_LOG_OBJECT (server, "client requested /, redirect to %s", location);
+		soup_message_set_redirect (msg, status_code, location);
+		g_free (location);
 		return;
 	}
 	else if (status_code != SOUP_STATUS_NONE)
@@ -1801,12 +4397,10 @@ soup_do_get (SoupServer *server, SoupMessage *msg, const char *path, App *app)
 			soup_message_headers_set_content_type (msg->response_headers, "video/MP2T", NULL);
 		else
 		{
-			GstState state;
-			gst_element_get_state (app->asrc, &state, NULL, GST_MSECOND);
-			if (state != GST_STATE_PLAYING)
+			if (app->source_state != SOURCE_STATE_RUNNING)
 			{
 				assert_tsmux (app);
-				if (!assert_state (app, app->pipeline, GST_STATE_PLAYING))
+				if (!wake_source_pipeline (app))
 				{
 					soup_message_set_status (msg, SOUP_STATUS_BAD_GATEWAY);
 					g_free (hlspath);
@@ -1819,9 +4413,19 @@ soup_do_get (SoupServer *server, SoupMessage *msg, const char *path, App *app)
 			g_source_remove (app->hls_server->id_timeout);
 		app->hls_server->id_timeout = g_timeout_add_seconds (5*HLS_FRAGMENT_DURATION, (GSourceFunc) hls_client_timeout, app);
 
-		buffer = soup_buffer_new_with_owner (g_mapped_file_get_contents (mapping),
-						     g_mapped_file_get_length (mapping),
-						     mapping, (GDestroyNotify)g_mapped_file_unref);
+		/* the substream has no video switches to mark */
+		gchar *playlist = NULL;
+		if (g_strcmp0 (path+1, HLS_PLAYLIST_NAME) == 0)
+			playlist = hls_playlist_mark_discont (app->hls_server, g_mapped_file_get_contents (mapping), g_mapped_file_get_length (mapping));
+		if (playlist)
+		{
+			g_mapped_file_unref (mapping);
+			buffer = soup_buffer_new (SOUP_MEMORY_TAKE, playlist, strlen (playlist));
+		}
+		else
+			buffer = soup_buffer_new_with_owner (g_mapped_file_get_contents (mapping),
+							     g_mapped_file_get_length (mapping),
+							     mapping, (GDestroyNotify)g_mapped_file_unref);
 		soup_message_body_append_buffer (msg->response_body, buffer);
 		soup_buffer_free (buffer);
 	}
@@ -1844,62 +4448,244 @@ soup_server_auth_callback (SoupAuthDomain *domain, SoupMessage *msg, const char
 	return FALSE;
 }
 
+/* an auth domain covers the whole server, each channel's only its own paths */
+static gboolean
+soup_server_auth_filter (SoupAuthDomain *domain, SoupMessage *msg, gpointer user_data)
+{
+	App *app = (App *) user_data;
+	const gchar *rest;
+	return hls_listener_channel (app->hls_server->listener, soup_message_get_uri (msg)->path, &rest) == app;
+}
+
 static void
 soup_server_callback (SoupServer *server, SoupMessage *msg, const char *path, GHashTable *query, SoupClientContext *context, gpointer data)
 {
 	GST_TRACE_OBJECT (server, "%s %s HTTP/1.%d", msg->method, path, soup_message_get_http_version (msg));
-	if (msg->method == SOUP_METHOD_GET)
-		soup_do_get (server, msg, path, (App *) data);
+	const gchar *rest;
+	App *app = hls_listener_channel (data, path, &rest);
+	if (!app)
+		soup_message_set_status (msg, SOUP_STATUS_NOT_FOUND);
+	else if (msg->method == SOUP_METHOD_GET)
+		soup_do_get (server, msg, *rest ? rest : "/", app);
 	else
 		soup_message_set_status (msg, SOUP_STATUS_NOT_IMPLEMENTED);
 	GST_TRACE_OBJECT (server, "  -> %d %s", msg->status_code, msg->reason_phrase);
 }
 
-static GstPadProbeReturn hls_pad_probe_unlink_cb (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+/* the channel serving path on a shared soup server, rest is what's left of
+ * the path after the channel's prefix. the first channel has none */
+static App *hls_listener_channel(DreamListener *l, const gchar *path, const gchar **rest)
 {
-	App *app = user_data;
-	DreamHLSserver *h = app->hls_server;
+	App *fallback = NULL;
+	GList *it;
+	*rest = path;
+	for (it = l->channels; it; it = it->next)
+	{
+		App *app = it->data;
+		const gchar *prefix = app->hls_server->prefix;
+		gsize len = strlen (prefix);
+		if (!len)
+			fallback = app;
+		else if (strncmp (path, prefix, len) == 0 && (path[len] == '\0' || path[len] == '/'))
+		{
+			*rest = path + len;
+			return app;
+		}
+	}
+	return fallback;
+}
 
-	GstElement *element = gst_pad_get_parent_element(pad);
+static DreamListener *hls_listener_acquire(App *app, guint port)
+{
+	DreamDaemon *daemon = app->daemon;
+	DreamListener *l = NULL;
+	GList *it;
+	for (it = daemon->hls_listeners; it && !l; it = it->next)
+		if (((DreamListener *) it->data)->port == port)
+			l = it->data;
+
+	if (!l)
+	{
+		SoupServer *server;
+		l = g_new0 (DreamListener, 1);
+		l->daemon = daemon;
+		l->port = port;
+#if SOUP_CHECK_VERSION(2,48,0)
+		server = soup_server_new (SOUP_SERVER_SERVER_HEADER, "dreamhttplive", NULL);
+		soup_server_listen_all(server, port, 0, NULL);
+#else
+		server = soup_server_new (SOUP_SERVER_PORT, port, SOUP_SERVER_SERVER_HEADER, "dreamhttplive", NULL);
+		soup_server_run_async (server);
+#endif
+		soup_server_add_handler (server, NULL, soup_server_callback, l, NULL);
+		l->server = server;
+		daemon->hls_listeners = g_list_prepend (daemon->hls_listeners, l);
+	}
+	l->channels = g_list_append (l->channels, app);
+	return l;
+}
+
+static void hls_listener_release(App *app, DreamListener *l)
+{
+	l->channels = g_list_remove (l->channels, app);
+	if (l->channels)
+		return;
+	soup_server_disconnect (l->server);
+	g_object_unref (l->server);
+	l->daemon->hls_listeners = g_list_remove (l->daemon->hls_listeners, l);
+	g_free (l);
+}
+
+/* answers the playlist requests that waited for the first fragment, with
+ * status_code if the hls pipeline didn't come up */
+static void hls_requests_finish(App *app, guint status_code)
+{
+	DreamHLSserver *h = app->hls_server;
+	GList *waiting = h->waiting;
+	h->waiting = NULL;
+	while (waiting)
+	{
+		DreamHLSRequest *req = waiting->data;
+		if (status_code == SOUP_STATUS_OK)
+			soup_do_get (req->server, req->msg, req->path, app);
+		else
+			soup_message_set_status (req->msg, status_code);
+		soup_server_unpause_message (req->server, req->msg);
+		g_object_unref (req->msg);
+		g_free (req->path);
+		g_free (req);
+		waiting = g_list_delete_link (waiting, waiting);
+	}
+}
 
-	GST_DEBUG_OBJECT(pad, "unlink... %" GST_PTR_FORMAT " and %" GST_PTR_FORMAT, element, h->hlssink);
+static gboolean hls_pipeline_started(gpointer user_data)
+{
+	App *app = user_data;
+	DreamHLSserver *h = app->hls_server;
+	h->id_starting = 0;
+	h->state = HLS_STATE_RUNNING;
+	send_signal (app, "hlsStateChanged", g_variant_new("(i)", HLS_STATE_RUNNING));
+	hls_requests_finish (app, SOUP_STATUS_OK);
+	return G_SOURCE_REMOVE;
+}
 
-	GstPad *teepad;
-	teepad = gst_pad_get_peer(pad);
-	gst_pad_unlink (teepad, pad);
+/* the variant playlists, asking for either one starts the hls pipeline */
+static gboolean hls_is_playlist(const gchar *path)
+{
+	if (!path || !*path)
+		return FALSE;
+	return g_strcmp0 (path+1, HLS_PLAYLIST_NAME) == 0 || g_strcmp0 (path+1, HLS_SUBSTREAM_DIR "/" HLS_PLAYLIST_NAME) == 0;
+}
 
-	GstElement *tee = gst_pad_get_parent_element(teepad);
-	gst_element_release_request_pad (tee, teepad);
-	gst_object_unref (teepad);
-	gst_object_unref (tee);
+/* the size the encoder actually delivers, not the one it was asked for.
+ * FALSE until the parser has negotiated */
+static gboolean video_running_size(GstElement *vparse, gint *width, gint *height)
+{
+	gboolean ret = FALSE;
+	if (!GST_IS_ELEMENT (vparse))
+		return FALSE;
+	GstPad *srcpad = gst_element_get_static_pad (vparse, "src");
+	GstCaps *caps = gst_pad_get_current_caps (srcpad);
+	gst_object_unref (srcpad);
+	if (!caps)
+		return FALSE;
+	if (!gst_caps_is_empty (caps))
+	{
+		GstStructure *structure = gst_caps_get_structure (caps, 0);
+		ret = gst_structure_get_int (structure, "width", width) && gst_structure_get_int (structure, "height", height);
+	}
+	gst_caps_unref (caps);
+	return ret;
+}
 
-	gst_element_unlink (element, h->hlssink);
+/* lists the main stream and, if there is one, the substream. it's written
+ * on request as the bitrates and resolutions can change any time, the
+ * resolutions are the ones the encoders run at */
+static gchar *hls_master_playlist(App *app)
+{
+	SourceProperties *p = &app->source_properties;
+	DreamSubstream *s = app->substream;
+	gint width = 0, height = 0;
+	GString *out = g_string_new ("#EXTM3U\n#EXT-X-VERSION:3\n");
 
-	GST_DEBUG_OBJECT(pad, "remove... %" GST_PTR_FORMAT " and %" GST_PTR_FORMAT, element, h->hlssink);
+	get_source_properties (app);
+	g_string_append_printf (out, "#EXT-X-STREAM-INF:BANDWIDTH=%i", (p->videoBitrate + p->audioBitrate) * 1000);
+	if (video_running_size (app->vparse, &width, &height))
+		g_string_append_printf (out, ",RESOLUTION=%ix%i", width, height);
+	g_string_append (out, "\n" HLS_PLAYLIST_NAME "\n");
+	if (substream_available (app))
+	{
+		g_string_append_printf (out, "#EXT-X-STREAM-INF:BANDWIDTH=%i", (s->bitrate + p->audioBitrate) * 1000);
+		if (video_running_size (s->vparse, &width, &height))
+			g_string_append_printf (out, ",RESOLUTION=%ix%i", width, height);
+		g_string_append (out, "\n" HLS_SUBSTREAM_DIR "/" HLS_PLAYLIST_NAME "\n");
+	}
+	return g_string_free (out, FALSE);
+}
 
-	gst_bin_remove_many (GST_BIN (app->pipeline), element, h->hlssink, NULL);
+/* the substream's variant, hlssink writes it to a directory of its own */
+static void hls_substream_attach(App *app)
+{
+	DreamHLSserver *h = app->hls_server;
+	DreamSubstream *s = app->substream;
+	if (s->hlssink || !assert_substream (app))
+		return;
 
-	GST_DEBUG_OBJECT(pad, "set state null %" GST_PTR_FORMAT " and %" GST_PTR_FORMAT, element, h->hlssink);
+	gchar *dir = g_strdup_printf ("%s/%s", h->dir, HLS_SUBSTREAM_DIR);
+	int r = mkdir (dir, DEFFILEMODE);
+	if (r == -1 && errno != EEXIST)
+	{
+		GST_WARNING_OBJECT (app, "Failed to create HLS substream directory '%s': %s (%i)", dir, strerror(errno), errno);
+		g_free (dir);
+		release_substream (app);
+		return;
+	}
 
-	gst_element_set_state (h->hlssink, GST_STATE_NULL);
-	gst_element_set_state (element, GST_STATE_NULL);
+	s->hlssrc = branch_appsrc_new (NULL, BRANCH_APPSRC_MAX_BYTES, &s->tsring);
+	s->hlssink = gst_element_factory_make ("hlssink", NULL);
+	gchar *frag_location = g_strdup_printf ("%s/%s", dir, HLS_FRAGMENT_NAME);
+	gchar *playlist_location = g_strdup_printf ("%s/%s", dir, HLS_PLAYLIST_NAME);
+	g_object_set (G_OBJECT (s->hlssink), "target-duration", HLS_FRAGMENT_DURATION, "location", frag_location, "playlist-location", playlist_location, NULL);
+	g_free (frag_location);
+	g_free (playlist_location);
+	g_free (dir);
 
-	GST_DEBUG_OBJECT(pad, "unref.... %" GST_PTR_FORMAT " and %" GST_PTR_FORMAT, element, h->hlssink);
+	gst_bin_add_many (GST_BIN (app->pipeline), s->hlssrc, s->hlssink, NULL);
+	gst_element_link (s->hlssrc, s->hlssink);
 
-	gst_object_unref (element);
-	gst_object_unref (h->hlssink);
-	h->queue = NULL;
-	h->hlssink = NULL;
+	if (!branch_attach (app, NULL, s->hlssrc, s->hlssink, NULL))
+	{
+		GST_WARNING_OBJECT (app, "couldn't attach the hls substream branch");
+		gst_element_set_state (s->hlssink, GST_STATE_NULL);
+		gst_element_set_state (s->hlssrc, GST_STATE_NULL);
+		gst_bin_remove_many (GST_BIN (app->pipeline), s->hlssrc, s->hlssink, NULL);
+		s->hlssrc = s->hlssink = NULL;
+		release_substream (app);
+		return;
+	}
+	s->hlsconsumer = dream_ring_add_consumer (s->tsring, 0, branch_handover, s->hlssrc);
+}
 
-	if (h->id_timeout)
-		g_source_remove (h->id_timeout);
+static void hls_substream_detach(App *app)
+{
+	DreamSubstream *s = app->substream;
+	if (!s->hlssink)
+		return;
+	if (s->hlsconsumer)
+		dream_ring_remove_consumer (s->tsring, s->hlsconsumer);
+	s->hlsconsumer = NULL;
+	branch_detach (app, release_substream, s->hlssrc, s->hlssink, NULL);
+	s->hlssrc = s->hlssink = NULL;
+}
 
-	if (app->tcp_upstream->state == UPSTREAM_STATE_DISABLED && g_list_length (app->rtsp_server->clients_list) == 0)
-		halt_source_pipeline(app);
+static void hls_branch_removed (App *app)
+{
+	if (sources_unused (app))
+		idle_source_pipeline(app);
+	else
+		release_tsmux(app);
 
 	GST_INFO ("HLS server unlinked!");
-
-	return GST_PAD_PROBE_REMOVE;
 }
 
 gboolean stop_hls_pipeline(App *app)
@@ -1911,12 +4697,16 @@ gboolean stop_hls_pipeline(App *app)
 		DREAMRTSPSERVER_LOCK (app);
 		h->state = HLS_STATE_IDLE;
 		send_signal (app, "hlsStateChanged", g_variant_new("(i)", HLS_STATE_IDLE));
-		gst_object_ref (h->queue);
-		gst_object_ref (h->hlssink);
-		GstPad *sinkpad;
-		sinkpad = gst_element_get_static_pad (h->queue, "sink");
-		gst_pad_add_probe (sinkpad, GST_PAD_PROBE_TYPE_IDLE, hls_pad_probe_unlink_cb, app, NULL);
-		gst_object_unref (sinkpad);
+		if (h->id_timeout)
+			g_source_remove (h->id_timeout);
+		h->id_timeout = 0;
+		if (h->consumer)
+			dream_ring_remove_consumer (app->tsring, h->consumer);
+		h->consumer = NULL;
+		branch_detach (app, hls_branch_removed, h->hlssrc, h->hlssink, NULL);
+		h->hlssrc = NULL;
+		h->hlssink = NULL;
+		hls_substream_detach (app);
 		DREAMRTSPSERVER_UNLOCK (app);
 		GST_INFO("hls server pipeline stopped, set HLS_STATE_IDLE");
 		return TRUE;
@@ -1930,20 +4720,29 @@ gboolean disable_hls_server(App *app)
 {
 	GST_INFO_OBJECT(app, "disable_hls_server");
 	DreamHLSserver *h = app->hls_server;
+	if (h->id_starting)
+	{
+		g_source_remove (h->id_starting);
+		h->id_starting = 0;
+		hls_requests_finish (app, SOUP_STATUS_SERVICE_UNAVAILABLE);
+		h->state = HLS_STATE_RUNNING;
+	}
 	if (h->state == HLS_STATE_RUNNING)
 		stop_hls_pipeline (app);
 	if (h->state == HLS_STATE_IDLE)
 	{
 		DREAMRTSPSERVER_LOCK (app);
-		soup_server_disconnect(h->soupserver);
 		if (h->soupauthdomain)
 		{
+			soup_server_remove_auth_domain (h->soupserver, h->soupauthdomain);
 			g_object_unref (h->soupauthdomain);
 			g_free(h->hls_user);
 			g_free(h->hls_pass);
 		}
-		g_object_unref (h->soupserver);
-		GFile *tmp_dir_file = g_file_new_for_path (HLS_PATH);
+		hls_listener_release (app, h->listener);
+		h->listener = NULL;
+		h->soupserver = NULL;
+		GFile *tmp_dir_file = g_file_new_for_path (h->dir);
 		_delete_dir_recursively (tmp_dir_file, NULL);
 		g_object_unref (tmp_dir_file);
 		h->state = HLS_STATE_DISABLED;
@@ -1996,23 +4795,16 @@ gboolean enable_hls_server(App *app, guint port, const gchar *user, const gchar
 
 	if (h->state == HLS_STATE_DISABLED)
 	{
-		int r = mkdir (HLS_PATH, DEFFILEMODE);
+		int r = mkdir (h->dir, DEFFILEMODE);
 		if (r == -1 && errno != EEXIST)
 		{
-			g_error ("Failed to create HLS server directory '%s': %s (%i)", HLS_PATH, strerror(errno), errno);
+			g_error ("Failed to create HLS server directory '%s': %s (%i)", h->dir, strerror(errno), errno);
 			goto fail;
 		}
 
 		h->port = port;
-
-#if SOUP_CHECK_VERSION(2,48,0)
-		h->soupserver = soup_server_new (SOUP_SERVER_SERVER_HEADER, "dreamhttplive", NULL);
-		soup_server_listen_all(h->soupserver, port, 0, NULL);
-#else
-		h->soupserver = soup_server_new (SOUP_SERVER_PORT, h->port, SOUP_SERVER_SERVER_HEADER, "dreamhttplive", NULL);
-		soup_server_run_async (h->soupserver);
-#endif
-		soup_server_add_handler (h->soupserver, NULL, soup_server_callback, app, NULL);
+		h->listener = hls_listener_acquire (app, port);
+		h->soupserver = h->listener->server;
 
 		gchar *credentials = g_strdup("");
 		if (strlen(user)) {
@@ -2024,6 +4816,7 @@ gboolean enable_hls_server(App *app, guint port, const gchar *user, const gchar
 			SOUP_AUTH_DOMAIN_BASIC_AUTH_DATA, app,
 			SOUP_AUTH_DOMAIN_ADD_PATH, "",
 			NULL);
+			soup_auth_domain_set_filter (h->soupauthdomain, soup_server_auth_filter, app, NULL);
 			soup_server_add_auth_domain (h->soupserver, h->soupauthdomain);
 			credentials = g_strdup_printf("%s:%s@", user, pass);
 		}
@@ -2037,13 +4830,13 @@ gboolean enable_hls_server(App *app, guint port, const gchar *user, const gchar
 		GSList *uris = soup_server_get_uris(h->soupserver);
 		for (GSList *uri = uris; uri != NULL; uri = uri->next) {
 			char *str = soup_uri_to_string(uri->data, FALSE);
-			GST_INFO_OBJECT(h->soupserver, "SOUP HLS server ready at %s [/%s] (%s)", str, HLS_PLAYLIST_NAME, credentials);
+			GST_INFO_OBJECT(h->soupserver, "SOUP HLS server ready at %s [%s/%s] (%s)", str, h->prefix, HLS_PLAYLIST_NAME, credentials);
 			g_free(str);
 			soup_uri_free(uri->data);
 		}
 		g_slist_free(uris);
 #else
-		GST_INFO_OBJECT (h->soupserver, "SOUP HLS server ready at http://%s127.0.0.1:%i/%s ...", credentials, soup_server_get_port (h->soupserver), HLS_PLAYLIST_NAME);
+		GST_INFO_OBJECT (h->soupserver, "SOUP HLS server ready at http://%s127.0.0.1:%i%s/%s ...", credentials, soup_server_get_port (h->soupserver), h->prefix, HLS_PLAYLIST_NAME);
 #endif
 
 		h->state = HLS_STATE_IDLE;
@@ -2078,53 +4871,47 @@ gboolean start_hls_pipeline(App* app)
 
 	assert_tsmux (app);
 
-	h->queue = gst_element_factory_make ("queue", "hlsqueue");
-	h->hlssink = gst_element_factory_make ("hlssink", "hlssink");
-	if (!(h->hlssink && h->queue))
+	h->hlssrc = branch_appsrc_new (NULL, BRANCH_APPSRC_MAX_BYTES, &app->tsring);
+	h->hlssink = gst_element_factory_make ("hlssink", NULL);
+	if (!(h->hlssink && h->hlssrc))
 	{
-		g_error ("Failed to create HLS pipeline element(s):%s%s", h->hlssink?"":" hlssink", h->queue?"":" queue");
+		g_error ("Failed to create HLS pipeline element(s):%s%s", h->hlssink?"":" hlssink", h->hlssrc?"":" appsrc");
 		return FALSE;
 	}
 
 	gchar *frag_location, *playlist_location;
-	frag_location = g_strdup_printf ("%s/%s", HLS_PATH, HLS_FRAGMENT_NAME);
-	playlist_location = g_strdup_printf ("%s/%s", HLS_PATH, HLS_PLAYLIST_NAME);
+	frag_location = g_strdup_printf ("%s/%s", h->dir, HLS_FRAGMENT_NAME);
+	playlist_location = g_strdup_printf ("%s/%s", h->dir, HLS_PLAYLIST_NAME);
 
 	g_object_set (G_OBJECT (h->hlssink), "target-duration", HLS_FRAGMENT_DURATION, NULL);
 	g_object_set (G_OBJECT (h->hlssink), "location", frag_location, NULL);
 	g_object_set (G_OBJECT (h->hlssink), "playlist-location", playlist_location, NULL);
-	g_object_set (G_OBJECT (h->queue), "leaky", 2, "max-size-buffers", 0, "max-size-bytes", 0, "max-size-time", G_GINT64_CONSTANT(5)*GST_SECOND, NULL);
-
-	gst_bin_add_many (GST_BIN (app->pipeline), h->queue, h->hlssink,  NULL);
-	gst_element_link (h->queue, h->hlssink);
-
-	if (!assert_state (app, h->hlssink, GST_STATE_READY) || !assert_state (app, h->queue, GST_STATE_PLAYING))
-		return FALSE;
-
-	GstPad *teepad, *sinkpad;
-	GstPadLinkReturn ret;
-	teepad = gst_element_get_request_pad (app->tstee, "src_%u");
-	sinkpad = gst_element_get_static_pad (h->queue, "sink");
-	ret = gst_pad_link (teepad, sinkpad);
-	if (ret != GST_PAD_LINK_OK)
-	{
-		GST_ERROR_OBJECT (app, "couldn't link %" GST_PTR_FORMAT " ! %" GST_PTR_FORMAT "", teepad, sinkpad);
-		return FALSE;
-	}
-	gst_object_unref (teepad);
+
+	gst_bin_add_many (GST_BIN (app->pipeline), h->hlssrc, h->hlssink,  NULL);
+	gst_element_link (h->hlssrc, h->hlssink);
+
+	/* fragment numbers start over with the new hlssink */
+	g_list_free (h->discont_segments);
+	h->discont_segments = NULL;
+	h->discont_sequence = 0;
+	g_atomic_int_set (&h->cut_pending, FALSE);
+	g_atomic_int_set (&h->discont_pending, -1);
+	GstPad *sinkpad = gst_element_get_static_pad (h->hlssink, "sink");
+	gst_pad_add_probe (sinkpad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, hls_cut_probe, app, NULL);
 	gst_object_unref (sinkpad);
 
 	if (app->tcp_upstream->state == UPSTREAM_STATE_WAITING)
 		unpause_source_pipeline(app);
 
-	GstStateChangeReturn sret = gst_element_set_state (h->hlssink, GST_STATE_PLAYING);
-	GST_DEBUG_OBJECT(app, "explicitely bring hlssink to GST_STATE_PLAYING = %i", sret);
-
-	if (!assert_state (app, app->pipeline, GST_STATE_PLAYING))
+	if (!branch_attach (app, NULL, h->hlssrc, h->hlssink, NULL))
 	{
-		GST_ERROR_OBJECT (app, "GST_STATE_CHANGE_FAILURE for hls pipeline");
+		GST_ERROR_OBJECT (app, "couldn't attach hls branch");
 		return FALSE;
 	}
+	h->consumer = dream_ring_add_consumer (app->tsring, 0, branch_handover, h->hlssrc);
+	wake_source_pipeline (app);
+	if (substream_available (app))
+		hls_substream_attach (app);
 
 	GST_DEBUG_BIN_TO_DOT_FILE(GST_BIN(app->pipeline),GST_DEBUG_GRAPH_SHOW_ALL,"start_hls_server");
 	return TRUE;
@@ -2135,20 +4922,120 @@ DreamHLSserver *create_hls_server(App *app)
 	DreamHLSserver *h = malloc(sizeof(DreamHLSserver));
 	send_signal (app, "hlsStateChanged", g_variant_new("(i)", HLS_STATE_DISABLED));
 	h->state = HLS_STATE_DISABLED;
-	h->queue = NULL;
+	h->hlssrc = NULL;
 	h->hlssink = NULL;
+	h->consumer = NULL;
+	h->cut_pending = FALSE;
+	h->discont_pending = -1;
+	h->discont_segments = NULL;
+	h->discont_sequence = 0;
+	h->listener = NULL;
+	h->soupserver = NULL;
+	h->waiting = NULL;
+	h->id_starting = 0;
+	if (app->channel)
+	{
+		h->dir = g_strdup_printf ("%s%u", HLS_PATH, app->channel + 1);
+		h->prefix = g_strdup_printf ("/%u", app->channel + 1);
+	}
+	else
+	{
+		h->dir = g_strdup (HLS_PATH);
+		h->prefix = g_strdup ("");
+	}
 	return h;
 }
 
+/* the rtsp server on port, started for the first channel that serves on it */
+static DreamListener *rtsp_listener_acquire(App *app, guint port)
+{
+	DreamDaemon *daemon = app->daemon;
+	DreamListener *l = NULL;
+	GList *it;
+	for (it = daemon->rtsp_listeners; it && !l; it = it->next)
+		if (((DreamListener *) it->data)->port == port)
+			l = it->data;
+
+	if (!l)
+	{
+		l = g_new0 (DreamListener, 1);
+		l->daemon = daemon;
+		l->port = port;
+		l->server = g_object_new (GST_TYPE_DREAM_RTSP_SERVER, NULL);
+		gchar *portstr = g_strdup_printf ("%u", port);
+		gst_rtsp_server_set_service (GST_RTSP_SERVER(l->server), portstr);
+		g_free (portstr);
+		g_signal_connect (l->server, "client-connected", (GCallback) rtsp_listener_client_connected, l);
+		l->source_id = gst_rtsp_server_attach (GST_RTSP_SERVER(l->server), NULL);
+		daemon->rtsp_listeners = g_list_prepend (daemon->rtsp_listeners, l);
+		GST_INFO ("rtsp server listening on port %u", port);
+	}
+	l->channels = g_list_append (l->channels, app);
+	return l;
+}
+
+static void rtsp_listener_release(App *app, DreamListener *l)
+{
+	l->channels = g_list_remove (l->channels, app);
+	if (l->channels)
+		return;
+	GSource *source = g_main_context_find_source_by_id (g_main_context_default (), l->source_id);
+	if (source)
+		g_source_destroy (source);
+	gst_object_unref (l->server);
+	l->daemon->rtsp_listeners = g_list_remove (l->daemon->rtsp_listeners, l);
+	GST_INFO ("rtsp server on port %u stopped", l->port);
+	g_free (l);
+}
+
+/* which channel a client belongs to only shows once it asks for a mount. the
+ * post request signals come after the media got prepared, which waits for the
+ * data the client has to be bound for, so bind it before the request runs */
+static void rtsp_listener_client_connected (GstRTSPServer * server, GstRTSPClient * client, gpointer user_data)
+{
+	g_signal_connect (client, "pre-describe-request", (GCallback) rtsp_client_request, user_data);
+	g_signal_connect (client, "pre-setup-request", (GCallback) rtsp_client_request, user_data);
+}
+
+static gboolean rtsp_path_matches(const gchar *abspath, const gchar *mount)
+{
+	if (!mount)
+		return FALSE;
+	gsize len = strlen (mount);
+	return strncmp (abspath, mount, len) == 0 && (abspath[len] == '\0' || abspath[len] == '/');
+}
+
+static GstRTSPStatusCode rtsp_client_request(GstRTSPClient *client, GstRTSPContext *ctx, gpointer user_data)
+{
+	DreamListener *l = user_data;
+	GList *it;
+	if (!ctx->uri || !ctx->uri->abspath)
+		return GST_RTSP_STS_OK;
+	for (it = l->channels; it; it = it->next)
+	{
+		App *app = it->data;
+		DreamRTSPserver *r = app->rtsp_server;
+		DreamSubstream *s = app->substream;
+		gboolean matches = rtsp_path_matches (ctx->uri->abspath, r->rtsp_ts_path) || rtsp_path_matches (ctx->uri->abspath, r->rtsp_es_path);
+		matches = matches || rtsp_path_matches (ctx->uri->abspath, s->rtsp_ts_path) || rtsp_path_matches (ctx->uri->abspath, s->rtsp_es_path);
+		if (matches && !g_list_find (r->clients_list, client))
+			client_connected (GST_RTSP_SERVER(l->server), client, app);
+	}
+	return GST_RTSP_STS_OK;
+}
+
 DreamRTSPserver *create_rtsp_server(App *app)
 {
 	DreamRTSPserver *r = malloc(sizeof(DreamRTSPserver));
 	send_signal (app, "rtspStateChanged", g_variant_new("(i)", RTSP_STATE_DISABLED));
 	r->state = RTSP_STATE_DISABLED;
+	r->listener = NULL;
 	r->server = NULL;
+	r->role = r->basic = NULL;
 	r->ts_factory = r->es_factory = NULL;
 	r->ts_media = r->es_media = NULL;
 	r->ts_appsrc = r->es_aappsrc = r->es_vappsrc = NULL;
+	r->es_timeline = r->ts_timeline = NULL;
 	r->clients_list = NULL;
 	return r;
 }
@@ -2168,96 +5055,22 @@ gboolean enable_rtsp_server(App *app, const gchar *path, guint32 port, const gch
 
 	if (r->state == RTSP_STATE_DISABLED)
 	{
-		r->artspq = gst_element_factory_make ("queue", "rtspaudioqueue");
-		r->vrtspq = gst_element_factory_make ("queue", "rtspvideoqueue");
-		r->aappsink = gst_element_factory_make ("appsink", AAPPSINK);
-		r->vappsink = gst_element_factory_make ("appsink", VAPPSINK);
-
-		g_object_set (G_OBJECT (r->artspq), "leaky", 2, "max-size-buffers", 0, "max-size-bytes", 0, "max-size-time", G_GINT64_CONSTANT(5)*GST_SECOND, NULL);
-		g_object_set (G_OBJECT (r->vrtspq), "leaky", 2, "max-size-buffers", 0, "max-size-bytes", 0, "max-size-time", G_GINT64_CONSTANT(5)*GST_SECOND, NULL);
-
-		g_object_set (G_OBJECT (r->aappsink), "emit-signals", TRUE, NULL);
-		g_object_set (G_OBJECT (r->aappsink), "enable-last-sample", FALSE, NULL);
-		g_signal_connect (r->aappsink, "new-sample", G_CALLBACK (handover_payload), app);
-
-		g_object_set (G_OBJECT (r->vappsink), "emit-signals", TRUE, NULL);
-		g_object_set (G_OBJECT (r->vappsink), "enable-last-sample", FALSE, NULL);
-		g_signal_connect (r->vappsink, "new-sample", G_CALLBACK (handover_payload), app);
-
-		r->tsrtspq = gst_element_factory_make ("queue", "tsrtspqueue");
-		r->tsappsink = gst_element_factory_make ("appsink", TSAPPSINK);
-
-		g_object_set (G_OBJECT (r->tsrtspq), "leaky", 2, "max-size-buffers", 0, "max-size-bytes", 0, "max-size-time", G_GINT64_CONSTANT(5)*GST_SECOND, NULL);
-
-		g_object_set (G_OBJECT (r->tsappsink), "emit-signals", TRUE, NULL);
-		g_object_set (G_OBJECT (r->tsappsink), "enable-last-sample", FALSE, NULL);
-		g_signal_connect (r->tsappsink, "new-sample", G_CALLBACK (handover_payload), app);
-
-		gst_bin_add_many (GST_BIN (app->pipeline), r->artspq, r->vrtspq, r->aappsink, r->vappsink,  NULL);
-		gst_element_link (r->artspq, r->aappsink);
-		gst_element_link (r->vrtspq, r->vappsink);
-
-		gst_bin_add_many (GST_BIN (app->pipeline), r->tsrtspq, r->tsappsink,  NULL);
-		gst_element_link (r->tsrtspq, r->tsappsink);
-
-		GstState targetstate = GST_STATE_READY;
-
-		if (!assert_state (app, r->tsappsink, targetstate) || !assert_state (app, r->aappsink, targetstate) || !assert_state (app, r->vappsink, targetstate))
-			goto fail;
-
-		if (!assert_state (app, r->tsrtspq, targetstate) || !assert_state (app, r->artspq, targetstate) || !assert_state (app, r->vrtspq, targetstate))
-			goto fail;
-
-		GstPad *teepad, *sinkpad;
-		GstPadLinkReturn ret;
-		teepad = gst_element_get_request_pad (app->atee, "src_%u");
-		sinkpad = gst_element_get_static_pad (r->artspq, "sink");
-		ret = gst_pad_link (teepad, sinkpad);
-		if (ret != GST_PAD_LINK_OK)
-		{
-			GST_ERROR_OBJECT (app, "couldn't link %" GST_PTR_FORMAT " ! %" GST_PTR_FORMAT "", teepad, sinkpad);
-			goto fail;
-		}
-		gst_object_unref (teepad);
-		gst_object_unref (sinkpad);
-		teepad = gst_element_get_request_pad (app->vtee, "src_%u");
-		sinkpad = gst_element_get_static_pad (r->vrtspq, "sink");
-		ret = gst_pad_link (teepad, sinkpad);
-		if (ret != GST_PAD_LINK_OK)
-		{
-			GST_ERROR_OBJECT (app, "couldn't link %" GST_PTR_FORMAT " ! %" GST_PTR_FORMAT "", teepad, sinkpad);
+		/* the ring consumers are attached in media_configure once a client
+		 * asks for the media that needs them */
+		if (app->source_state < SOURCE_STATE_SUSPENDED && !source_set_state (app, SOURCE_STATE_SUSPENDED))
 			goto fail;
-		}
-		gst_object_unref (teepad);
-		gst_object_unref (sinkpad);
-		teepad = gst_element_get_request_pad (app->tstee, "src_%u");
-		sinkpad = gst_element_get_static_pad (r->tsrtspq, "sink");
-		ret = gst_pad_link (teepad, sinkpad);
-		if (ret != GST_PAD_LINK_OK)
-		{
-			GST_ERROR_OBJECT (app, "couldn't link %" GST_PTR_FORMAT " ! %" GST_PTR_FORMAT "", teepad, sinkpad);
-			goto fail;
-		}
-		gst_object_unref (teepad);
-		gst_object_unref (sinkpad);
 
-		if (app->tcp_upstream->state != UPSTREAM_STATE_DISABLED || app->hls_server->state != HLS_STATE_DISABLED)
-			targetstate = GST_STATE_PLAYING;
-
-		if (!assert_state (app, app->pipeline, targetstate))
-			goto fail;
-
-		r->server = g_object_new (GST_TYPE_DREAM_RTSP_SERVER, NULL);
-		g_signal_connect (r->server, "client-connected", (GCallback) client_connected, app);
+		r->listener = rtsp_listener_acquire (app, port ? port : DEFAULT_RTSP_PORT);
+		r->server = r->listener->server;
 
 		r->es_factory = gst_dream_rtsp_media_factory_new ();
-		gst_rtsp_media_factory_set_launch (GST_RTSP_MEDIA_FACTORY (r->es_factory), "( appsrc name=" ES_VAPPSRC " ! h264parse ! rtph264pay name=pay0 pt=96   appsrc name=" ES_AAPPSRC " ! aacparse ! rtpmp4apay name=pay1 pt=97 )");
+		gst_rtsp_media_factory_set_launch (GST_RTSP_MEDIA_FACTORY (r->es_factory), RTSP_ES_LAUNCH);
 		gst_rtsp_media_factory_set_shared (GST_RTSP_MEDIA_FACTORY (r->es_factory), TRUE);
 
 		g_signal_connect (r->es_factory, "media-configure", (GCallback) media_configure, app);
 
 		r->ts_factory = gst_dream_rtsp_media_factory_new ();
-		gst_rtsp_media_factory_set_launch (GST_RTSP_MEDIA_FACTORY (r->ts_factory), "( appsrc name=" TS_APPSRC " ! queue ! rtpmp2tpay name=pay0 pt=96 )");
+		gst_rtsp_media_factory_set_launch (GST_RTSP_MEDIA_FACTORY (r->ts_factory), RTSP_TS_LAUNCH);
 		gst_rtsp_media_factory_set_shared (GST_RTSP_MEDIA_FACTORY (r->ts_factory), TRUE);
 
 		g_signal_connect (r->ts_factory, "media-configure", (GCallback) media_configure, app);
@@ -2265,35 +5078,48 @@ gboolean enable_rtsp_server(App *app, const gchar *path, guint32 port, const gch
 
 		DREAMRTSPSERVER_UNLOCK (app);
 
+		/* the server may be shared with other channels, each one gets its
+		 * own role so credentials only open the channel they were set for */
 		gchar *credentials = g_strdup("");
+		r->role = strlen(user) ? g_strdup_printf ("channel%u", app->channel) : g_strdup (RTSP_ANONYMOUS_ROLE);
+		gst_rtsp_media_factory_add_role (GST_RTSP_MEDIA_FACTORY (r->es_factory), r->role, GST_RTSP_PERM_MEDIA_FACTORY_ACCESS, G_TYPE_BOOLEAN, TRUE, GST_RTSP_PERM_MEDIA_FACTORY_CONSTRUCT, G_TYPE_BOOLEAN, TRUE, NULL);
+		gst_rtsp_media_factory_add_role (GST_RTSP_MEDIA_FACTORY (r->ts_factory), r->role, GST_RTSP_PERM_MEDIA_FACTORY_ACCESS, G_TYPE_BOOLEAN, TRUE, GST_RTSP_PERM_MEDIA_FACTORY_CONSTRUCT, G_TYPE_BOOLEAN, TRUE, NULL);
 		if (strlen(user)) {
 			r->rtsp_user = g_strdup(user);
 			r->rtsp_pass = g_strdup(pass);
 			GstRTSPToken *token;
-			gchar *basic;
-			GstRTSPAuth *auth = gst_rtsp_auth_new ();
-			gst_rtsp_media_factory_add_role (GST_RTSP_MEDIA_FACTORY (r->es_factory), "user", GST_RTSP_PERM_MEDIA_FACTORY_ACCESS, G_TYPE_BOOLEAN, TRUE, GST_RTSP_PERM_MEDIA_FACTORY_CONSTRUCT, G_TYPE_BOOLEAN, TRUE, NULL);
-			gst_rtsp_media_factory_add_role (GST_RTSP_MEDIA_FACTORY (r->ts_factory), "user", GST_RTSP_PERM_MEDIA_FACTORY_ACCESS, G_TYPE_BOOLEAN, TRUE, GST_RTSP_PERM_MEDIA_FACTORY_CONSTRUCT, G_TYPE_BOOLEAN, TRUE, NULL);
-			token = gst_rtsp_token_new (GST_RTSP_TOKEN_MEDIA_FACTORY_ROLE, G_TYPE_STRING, "user", NULL);
-			basic = gst_rtsp_auth_make_basic (r->rtsp_user, r->rtsp_pass);
-			gst_rtsp_server_set_auth (GST_RTSP_SERVER(r->server), auth);
-			gst_rtsp_auth_add_basic (auth, basic, token);
-			g_free (basic);
+			GstRTSPAuth *auth = gst_rtsp_server_get_auth (GST_RTSP_SERVER(r->server));
+			if (!auth)
+			{
+				/* channels without credentials stay open with the default token */
+				auth = gst_rtsp_auth_new ();
+				token = gst_rtsp_token_new (GST_RTSP_TOKEN_MEDIA_FACTORY_ROLE, G_TYPE_STRING, RTSP_ANONYMOUS_ROLE, NULL);
+				gst_rtsp_auth_set_default_token (auth, token);
+				gst_rtsp_token_unref (token);
+				gst_rtsp_server_set_auth (GST_RTSP_SERVER(r->server), auth);
+			}
+			token = gst_rtsp_token_new (GST_RTSP_TOKEN_MEDIA_FACTORY_ROLE, G_TYPE_STRING, r->role, NULL);
+			r->basic = gst_rtsp_auth_make_basic (r->rtsp_user, r->rtsp_pass);
+			gst_rtsp_auth_add_basic (auth, r->basic, token);
 			gst_rtsp_token_unref (token);
+			g_object_unref (auth);
 			credentials = g_strdup_printf("%s:%s@", user, pass);
 		}
 		else
-			r->rtsp_user = r->rtsp_pass = NULL;
+			r->rtsp_user = r->rtsp_pass = r->basic = NULL;
 
 		r->rtsp_port = g_strdup_printf("%i", port ? port : DEFAULT_RTSP_PORT);
 
-		gst_rtsp_server_set_service (GST_RTSP_SERVER(r->server), r->rtsp_port);
-
 		if (strlen(path))
 		{
 			r->rtsp_ts_path = g_strdup_printf ("%s%s", path[0]=='/' ? "" : "/", path);
 			r->rtsp_es_path = g_strdup_printf ("%s%s%s", path[0]=='/' ? "" : "/", path, RTSP_ES_PATH_SUFX);
 		}
+		else if (app->channel)
+		{
+			r->rtsp_ts_path = g_strdup_printf ("%s%u", DEFAULT_RTSP_PATH, app->channel + 1);
+			r->rtsp_es_path = g_strdup_printf ("%s%u%s", DEFAULT_RTSP_PATH, app->channel + 1, RTSP_ES_PATH_SUFX);
+		}
 		else
 		{
 			r->rtsp_ts_path = g_strdup(DEFAULT_RTSP_PATH);
@@ -2304,9 +5130,9 @@ gboolean enable_rtsp_server(App *app, const gchar *path, guint32 port, const gch
 		gst_rtsp_mount_points_add_factory (r->mounts, r->rtsp_ts_path, g_object_ref(GST_RTSP_MEDIA_FACTORY (r->ts_factory)));
 		gst_rtsp_mount_points_add_factory (r->mounts, r->rtsp_es_path, g_object_ref(GST_RTSP_MEDIA_FACTORY (r->es_factory)));
 		r->state = RTSP_STATE_IDLE;
+		rtsp_substream_mount (app);
 		send_signal (app, "rtspStateChanged", g_variant_new("(i)", RTSP_STATE_IDLE));
 		GST_DEBUG ("set RTSP_STATE_IDLE");
-		r->source_id = gst_rtsp_server_attach (GST_RTSP_SERVER(r->server), NULL);
 		r->uri_parameters = NULL;
 		GST_DEBUG_BIN_TO_DOT_FILE(GST_BIN(app->pipeline),GST_DEBUG_GRAPH_SHOW_ALL,"enabled_rtsp_server");
 		g_print ("dreambox encoder stream ready at rtsp://%s127.0.0.1:%s%s\n", credentials, app->rtsp_server->rtsp_port, app->rtsp_server->rtsp_ts_path);
@@ -2335,17 +5161,14 @@ gboolean start_rtsp_pipeline(App* app)
 		return FALSE;
 	}
 
-	assert_tsmux (app);
-	if (!assert_state (app, app->pipeline, GST_STATE_PLAYING))
+	if (r->ts_media)
+		assert_tsmux (app);
+	if (!wake_source_pipeline (app))
 	{
 		GST_ERROR_OBJECT (app, "GST_STATE_CHANGE_FAILURE for rtsp pipeline");
 		return FALSE;
 	}
-	GST_INFO_OBJECT(app, "start rtsp pipeline, pipeline going into PLAYING");
-	GST_DEBUG_BIN_TO_DOT_FILE(GST_BIN(app->pipeline),GST_DEBUG_GRAPH_SHOW_ALL,"start_rtsp_pipeline");
-	GstState state;
-	gst_element_get_state (GST_ELEMENT(app->pipeline), &state, NULL, 10*GST_SECOND);
-	GST_INFO_OBJECT(app, "pipeline state=%s", gst_element_state_get_name (state));
+	GST_INFO_OBJECT(app, "start rtsp pipeline, source state=%i", app->source_state);
 	GST_DEBUG_BIN_TO_DOT_FILE(GST_BIN(app->pipeline),GST_DEBUG_GRAPH_SHOW_ALL,"started_rtsp_pipeline");
 	return TRUE;
 }
@@ -2354,6 +5177,12 @@ static GstPadProbeReturn tsmux_pad_probe_unlink_cb (GstPad * pad, GstPadProbeInf
 {
 	App *app = user_data;
 
+	if (!g_atomic_int_get (&app->source_halting))
+	{
+		GST_DEBUG_OBJECT (pad, "halt was given up on, leaving the pipeline alone");
+		return GST_PAD_PROBE_REMOVE;
+	}
+
 	GstElement *element = gst_pad_get_parent_element(pad);
 	GST_DEBUG_OBJECT(pad, "tsmux_pad_probe_unlink_cb %" GST_PTR_FORMAT, element);
 
@@ -2369,8 +5198,11 @@ static GstPadProbeReturn tsmux_pad_probe_unlink_cb (GstPad * pad, GstPadProbeInf
 		gst_element_set_state (app->tsmux, GST_STATE_NULL);
 		gst_object_unref (app->tsmux);
 		app->tsmux = NULL;
+		if (!g_atomic_int_compare_and_exchange (&app->source_halting, TRUE, FALSE))
+			return GST_PAD_PROBE_REMOVE;
 		if (gst_element_set_state (app->pipeline, GST_STATE_READY) != GST_STATE_CHANGE_SUCCESS)
 			GST_WARNING_OBJECT (pad, "error bringing pipeline back to ready");
+		g_idle_add (source_halted, app);
 //		DREAMRTSPSERVER_UNLOCK (app);
 		GST_DEBUG_OBJECT (pad, "finished unlinking and removing sources and tsmux");
 		return GST_PAD_PROBE_REMOVE;
@@ -2389,21 +5221,16 @@ static GstPadProbeReturn tsmux_pad_probe_unlink_cb (GstPad * pad, GstPadProbeInf
 	{
 		GST_DEBUG_OBJECT(pad, "srcpad %" GST_PTR_FORMAT " muxpad %" GST_PTR_FORMAT " tsmux %" GST_PTR_FORMAT, srcpad, muxpad, app->tsmux);
 		gst_pad_unlink (srcpad, muxpad);
-		gst_element_release_request_pad (app->tsmux, muxpad);
 		gst_object_unref (muxpad);
 	}
 	else
 		GST_DEBUG_OBJECT(pad, "srcpad %" GST_PTR_FORMAT "'s peer was already unreffed", srcpad);
 	gst_object_unref (srcpad);
 
-	gst_element_set_state (element, GST_STATE_READY);
-
-	GstState state;
-	gst_element_get_state (GST_ELEMENT(element), &state, NULL, 2*GST_SECOND);
-
-	if (state != GST_STATE_READY)
+	/* queues change state synchronously, there's nothing to wait for */
+	if (gst_element_set_state (element, GST_STATE_READY) == GST_STATE_CHANGE_FAILURE)
 	{
-		GST_ERROR_OBJECT (app, "%" GST_PTR_FORMAT"'s state = %s (should be GST_STATE_READY)", element, gst_element_state_get_name (state));
+		GST_ERROR_OBJECT (app, "can't set %" GST_PTR_FORMAT"'s state to GST_STATE_READY", element);
 		goto fail;
 	}
 
@@ -2418,8 +5245,18 @@ static GstPadProbeReturn tsmux_pad_probe_unlink_cb (GstPad * pad, GstPadProbeInf
 	if (element == app->vq)
 	{
 		nextelem = app->tsmux;
-		if (GST_IS_ELEMENT(nextelem))
-			sinkpad = gst_element_get_static_pad (nextelem, "src");
+		if (!GST_IS_ELEMENT(nextelem))
+		{
+			/* only es consumers ran, there's no tsmux to take down */
+			if (!g_atomic_int_compare_and_exchange (&app->source_halting, TRUE, FALSE))
+				return GST_PAD_PROBE_REMOVE;
+			if (gst_element_set_state (app->pipeline, GST_STATE_READY) != GST_STATE_CHANGE_SUCCESS)
+				GST_WARNING_OBJECT (pad, "error bringing pipeline back to ready");
+			g_idle_add (source_halted, app);
+			GST_DEBUG_OBJECT (pad, "finished unlinking sources");
+			return GST_PAD_PROBE_REMOVE;
+		}
+		sinkpad = gst_element_get_static_pad (nextelem, "src");
 	}
 	if (GST_IS_PAD(sinkpad) && GST_IS_ELEMENT(nextelem))
 	{
@@ -2439,6 +5276,7 @@ gboolean halt_source_pipeline(App* app)
 {
 	GST_INFO_OBJECT(app, "halt_source_pipeline...");
 	GST_DEBUG_BIN_TO_DOT_FILE(GST_BIN(app->pipeline),GST_DEBUG_GRAPH_SHOW_ALL,"halt_source_pipeline_pre");
+	g_atomic_int_set (&app->source_halting, TRUE);
 	GstPad *sinkpad;
 	gst_object_ref (app->aq);
 	sinkpad = gst_element_get_static_pad (app->aq, "sink");
@@ -2447,16 +5285,98 @@ gboolean halt_source_pipeline(App* app)
 	return TRUE;
 }
 
+/* whether no output takes anything from the sources anymore */
+static gboolean sources_unused(App *app)
+{
+	return !rtsp_has_media (app) && app->tcp_upstream->state == UPSTREAM_STATE_DISABLED && !hls_active (app);
+}
+
+/* called once the last consumer is gone. without standby the sources are
+ * halted, otherwise they're kept primed so the next consumer doesn't wait
+ * for the encoders to come up */
+static gboolean idle_source_pipeline(App *app)
+{
+	if (app->standby == STANDBY_OFF)
+		return source_set_state (app, SOURCE_STATE_SUSPENDED);
+
+	release_tsmux(app);
+	if (app->standby_active)
+		return TRUE;
+
+	GST_INFO_OBJECT(app, "idle_source_pipeline... keeping sources in standby mode %i", app->standby);
+	if (!source_set_state (app, app->standby == STANDBY_PAUSED ? SOURCE_STATE_PAUSED : SOURCE_STATE_RUNNING))
+	{
+		GST_WARNING_OBJECT (app, "can't prime sources, suspending instead");
+		return source_set_state (app, SOURCE_STATE_SUSPENDED);
+	}
+
+	app->standby_active = TRUE;
+	if (app->standby == STANDBY_RUNNING)
+	{
+		g_object_get (G_OBJECT (app->vsrc), "bitrate", &app->standby_vbitrate, NULL);
+		gst_set_bitrate (app, app->vsrc, STANDBY_VIDEO_BITRATE);
+	}
+	return TRUE;
+}
+
+/* brings the sources to full service for a new consumer */
+static gboolean wake_source_pipeline(App *app)
+{
+	gboolean primed = app->standby_active;
+	if (primed)
+	{
+		GST_INFO_OBJECT(app, "wake_source_pipeline... leaving standby mode %i", app->standby);
+		app->standby_active = FALSE;
+		if (app->standby == STANDBY_RUNNING && app->standby_vbitrate)
+			gst_set_bitrate (app, app->vsrc, app->standby_vbitrate);
+	}
+	if (!source_set_state (app, SOURCE_STATE_RUNNING))
+		return FALSE;
+	if (primed)
+		force_key_unit(app);
+	return TRUE;
+}
+
+/* sends an idr request with headers up through a parser's srcpad. the
+ * parser puts sps/pps in front of the idr */
+static gboolean request_key_unit(GstPad *srcpad)
+{
+	GstStructure *s = gst_structure_new ("GstForceKeyUnit",
+		"running-time", G_TYPE_UINT64, GST_CLOCK_TIME_NONE,
+		"all-headers", G_TYPE_BOOLEAN, TRUE,
+		"count", G_TYPE_UINT, 0, NULL);
+	return gst_pad_send_event (srcpad, gst_event_new_custom (GST_EVENT_CUSTOM_UPSTREAM, s));
+}
+
+/* asks the video encoder for an idr so a new consumer can start right away
+ * instead of waiting for the end of the gop */
+static void force_key_unit(App *app)
+{
+	GstPad *srcpad = gst_element_get_static_pad (app->vparse, "src");
+	if (!srcpad)
+		return;
+	if (!request_key_unit (srcpad))
+		GST_DEBUG_OBJECT (app, "%" GST_PTR_FORMAT " doesn't handle key unit requests", app->vsrc);
+	gst_object_unref (srcpad);
+}
+
+/* every idr of the main stream asks the substream's encoder for one as well,
+ * so the hls variants cut their fragments at the same points. user_data is
+ * the substream parser's srcpad */
+static GstPadProbeReturn substream_key_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+	GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+	if (!GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT))
+		request_key_unit (user_data);
+	return GST_PAD_PROBE_OK;
+}
+
 gboolean pause_source_pipeline(App* app)
 {
 	if (app->rtsp_server->state <= RTSP_STATE_IDLE && app->hls_server->state == HLS_STATE_DISABLED)
 	{
-		GST_INFO_OBJECT(app, "pause_source_pipeline... setting sources to GST_STATE_PAUSED rtsp_server->state=%i hls_server->state=%i", app->rtsp_server->state, app->hls_server->state);
-		if (gst_element_set_state (app->asrc, GST_STATE_PAUSED) != GST_STATE_CHANGE_NO_PREROLL || gst_element_set_state (app->vsrc, GST_STATE_PAUSED) != GST_STATE_CHANGE_NO_PREROLL)
-		{
-			GST_WARNING ("can't set pipeline to GST_STATE_PAUSED!");
-			return FALSE;
-		}
+		GST_INFO_OBJECT(app, "pause_source_pipeline... rtsp_server->state=%i hls_server->state=%i", app->rtsp_server->state, app->hls_server->state);
+		return source_set_state (app, SOURCE_STATE_PAUSED);
 	}
 	else
 		GST_DEBUG ("not pausing pipeline because rtsp_server->state=%i hls_server->state=%i", app->rtsp_server->state, app->hls_server->state);
@@ -2465,15 +5385,127 @@ gboolean pause_source_pipeline(App* app)
 
 gboolean unpause_source_pipeline(App* app)
 {
-	GST_INFO_OBJECT(app, "unpause_source_pipeline... setting sources to GST_STATE_PLAYING");
-	if (gst_element_set_state (app->asrc, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE || gst_element_set_state (app->vsrc, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
+	GST_INFO_OBJECT(app, "unpause_source_pipeline...");
+	return source_set_state (app, SOURCE_STATE_RUNNING);
+}
+
+/* the one place the sources change their lifecycle state. suspending from a
+ * running pipeline takes the sources and the muxer down in IDLE probes and
+ * finishes asynchronously, everything else is done on return. a target that
+ * comes in while a transition is pending is taken up once it's finished. a
+ * transition that isn't done after SOURCE_TRANSITION_TIMEOUT is forced */
+static gboolean source_set_state(App *app, sourceState target)
+{
+	if (!app->pipeline)
+		return FALSE;
+
+	app->source_target = target;
+	if (app->source_pending)
+	{
+		GST_DEBUG_OBJECT (app, "source state %i pending, going on to %i afterwards", app->source_state, target);
+		return TRUE;
+	}
+	if (target == app->source_state)
+		return TRUE;
+
+	sourceState from = app->source_state;
+	GST_INFO_OBJECT (app, "source state %i -> %i", from, target);
+	if (target < SOURCE_STATE_RUNNING)
+		slate_stop (app);
+	app->source_transition_start = g_get_monotonic_time ();
+
+	gboolean ret = TRUE;
+	switch (target)
 	{
-		GST_WARNING("can't set sources to GST_STATE_PLAYING!");
+		case SOURCE_STATE_RUNNING:
+			if (from == SOURCE_STATE_PAUSED)
+				ret = gst_element_set_state (app->asrc, GST_STATE_PLAYING) != GST_STATE_CHANGE_FAILURE && gst_element_set_state (app->vsrc, GST_STATE_PLAYING) != GST_STATE_CHANGE_FAILURE;
+			else
+				ret = assert_state (app, app->pipeline, GST_STATE_PLAYING);
+			break;
+		case SOURCE_STATE_PAUSED:
+			/* the encoders have to be up before they can be held */
+			if (from < SOURCE_STATE_PAUSED)
+				ret = assert_state (app, app->pipeline, GST_STATE_PLAYING);
+			if (ret)
+				ret = gst_element_set_state (app->asrc, GST_STATE_PAUSED) != GST_STATE_CHANGE_FAILURE && gst_element_set_state (app->vsrc, GST_STATE_PAUSED) != GST_STATE_CHANGE_FAILURE;
+			break;
+		case SOURCE_STATE_SUSPENDED:
+			if (from > SOURCE_STATE_SUSPENDED)
+			{
+				app->source_pending = TRUE;
+				app->id_source_transition_timeout = g_timeout_add (SOURCE_TRANSITION_TIMEOUT, source_transition_timeout, app);
+				return halt_source_pipeline(app);
+			}
+			ret = gst_element_set_state (app->pipeline, GST_STATE_READY) == GST_STATE_CHANGE_SUCCESS;
+			break;
+		case SOURCE_STATE_STOPPED:
+			ret = gst_element_set_state (app->pipeline, GST_STATE_NULL) != GST_STATE_CHANGE_FAILURE;
+			break;
+	}
+
+	if (!ret)
+	{
+		GST_WARNING_OBJECT (app, "source state %i -> %i failed after %" G_GINT64_FORMAT " ms", from, target, (g_get_monotonic_time () - app->source_transition_start) / 1000);
+		app->source_target = from;
 		return FALSE;
 	}
+	source_state_reached (app, target);
 	return TRUE;
 }
 
+static void source_state_reached(App *app, sourceState state)
+{
+	if (app->id_source_transition_timeout)
+		g_source_remove (app->id_source_transition_timeout);
+	app->id_source_transition_timeout = 0;
+	app->source_pending = FALSE;
+
+	sourceState from = app->source_state;
+	app->source_state = state;
+	app->source_transition_ms = (g_get_monotonic_time () - app->source_transition_start) / 1000;
+	GST_INFO_OBJECT (app, "source state %i -> %i took %i ms", from, state, app->source_transition_ms);
+	send_signal (app, "sourceStateChanged", g_variant_new("(i)", state));
+	send_signal (app, "sourceTransition", g_variant_new("(iii)", from, state, app->source_transition_ms));
+
+	/* a ts consumer that came in while the halt was pending found the muxer
+	 * still in place, and the halt probes took it down after that */
+	if (state > SOURCE_STATE_SUSPENDED && !app->tsmux && tsmux_needed (app))
+	{
+		GST_DEBUG_OBJECT (app, "muxer went away with the halt, bringing it back");
+		assert_tsmux (app);
+	}
+
+	if (app->source_target != state)
+		source_set_state (app, app->source_target);
+}
+
+static gboolean source_transition_timeout(gpointer user_data)
+{
+	App *app = user_data;
+	app->id_source_transition_timeout = 0;
+
+	/* the halt got stuck in a probe that never came, forget about it and
+	 * take the whole pipeline down instead */
+	if (g_atomic_int_compare_and_exchange (&app->source_halting, TRUE, FALSE))
+	{
+		GST_WARNING_OBJECT (app, "suspending the sources took longer than %i ms, forcing it", SOURCE_TRANSITION_TIMEOUT);
+		if (gst_element_set_state (app->pipeline, GST_STATE_READY) == GST_STATE_CHANGE_FAILURE)
+			GST_ERROR_OBJECT (app, "can't bring pipeline back to ready");
+		source_state_reached (app, SOURCE_STATE_SUSPENDED);
+	}
+	return G_SOURCE_REMOVE;
+}
+
+/* the halt probes are done, back in the main loop */
+static gboolean source_halted(gpointer user_data)
+{
+	App *app = user_data;
+	if (app->source_pending)
+		source_state_reached (app, SOURCE_STATE_SUSPENDED);
+	return G_SOURCE_REMOVE;
+}
+
 GstRTSPFilterResult remove_media_filter_func (GstRTSPSession * sess, GstRTSPSessionMedia * session_media, gpointer user_data)
 {
 	App *app = user_data;
@@ -2481,7 +5513,7 @@ GstRTSPFilterResult remove_media_filter_func (GstRTSPSession * sess, GstRTSPSess
 	GstRTSPMedia *media;
 	media = gst_rtsp_session_media_get_media (session_media);
 // 	DREAMRTSPSERVER_LOCK (app);
-	if (media == app->rtsp_server->es_media || media == app->rtsp_server->ts_media) {
+	if (media == app->rtsp_server->es_media || media == app->rtsp_server->ts_media || media == app->substream->es_media || media == app->substream->ts_media) {
 		GST_DEBUG_OBJECT (app, "matching RTSP media %p in filter, removing...", media);
 		res = GST_RTSP_FILTER_REMOVE;
 	}
@@ -2519,57 +5551,71 @@ GstRTSPFilterResult remove_client_filter_func (GstRTSPServer *server, GstRTSPCli
 	return res;
 }
 
-static GstPadProbeReturn rtsp_pad_probe_unlink_cb (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+static void rtsp_attach_consumer(App *app, DreamRing *ring, DreamRingConsumer **consumer)
 {
-	App *app = user_data;
-	DreamRTSPserver *r = app->rtsp_server;
-
-	GstElement *element = gst_pad_get_parent_element(pad);
-	GstElement *appsink = NULL;
-	if (element == r->vrtspq)
-		appsink = r->vappsink;
-	else if (element == r->artspq)
-		appsink = r->aappsink;
-	else if (element == r->tsrtspq)
-		appsink = r->tsappsink;
-
-	GST_DEBUG_OBJECT(pad, "unlink... %" GST_PTR_FORMAT " and %" GST_PTR_FORMAT, element, appsink);
-
-	GstPad *teepad;
-	teepad = gst_pad_get_peer(pad);
-	gst_pad_unlink (teepad, pad);
-
-	GstElement *tee = gst_pad_get_parent_element(teepad);
-	gst_element_release_request_pad (tee, teepad);
-	gst_object_unref (teepad);
-	gst_object_unref (tee);
+	if (*consumer)
+		return;
+	*consumer = dream_ring_add_consumer (ring, RTSP_MAX_LAG, handover_payload, app);
+}
 
-	gst_element_unlink (element, appsink);
+static void rtsp_detach_consumer(App *app, DreamRing *ring, DreamRingConsumer **consumer)
+{
+	DreamRingConsumer *c = *consumer;
+	if (!c)
+		return;
+	*consumer = NULL;
+	dream_ring_remove_consumer (ring, c);
+}
 
-	GST_DEBUG_OBJECT(pad, "remove... %" GST_PTR_FORMAT " and %" GST_PTR_FORMAT, element, appsink);
+static gboolean rtsp_has_media(App *app)
+{
+	DreamRTSPserver *r = app->rtsp_server;
+	DreamSubstream *s = app->substream;
+	return r->es_media || r->ts_media || s->es_media || s->ts_media;
+}
 
-	gst_bin_remove_many (GST_BIN (app->pipeline), element, appsink, NULL);
+/* the substream's mounts next to the main ones, open to the same role */
+static void rtsp_substream_mount(App *app)
+{
+	DreamRTSPserver *r = app->rtsp_server;
+	DreamSubstream *s = app->substream;
+	if (s->ts_factory || r->state == RTSP_STATE_DISABLED || !substream_available (app))
+		return;
 
-	GST_DEBUG_OBJECT(pad, "set state null %" GST_PTR_FORMAT " and %" GST_PTR_FORMAT, element, appsink);
+	s->es_factory = gst_dream_rtsp_media_factory_new ();
+	gst_rtsp_media_factory_set_launch (GST_RTSP_MEDIA_FACTORY (s->es_factory), RTSP_ES_LAUNCH);
+	gst_rtsp_media_factory_set_shared (GST_RTSP_MEDIA_FACTORY (s->es_factory), TRUE);
+	g_signal_connect (s->es_factory, "media-configure", (GCallback) media_configure, app);
 
-	gst_element_set_state (appsink, GST_STATE_NULL);
-	gst_element_set_state (element, GST_STATE_NULL);
+	s->ts_factory = gst_dream_rtsp_media_factory_new ();
+	gst_rtsp_media_factory_set_launch (GST_RTSP_MEDIA_FACTORY (s->ts_factory), RTSP_TS_LAUNCH);
+	gst_rtsp_media_factory_set_shared (GST_RTSP_MEDIA_FACTORY (s->ts_factory), TRUE);
+	g_signal_connect (s->ts_factory, "media-configure", (GCallback) media_configure, app);
 
-	GST_DEBUG_OBJECT(pad, "unref.... %" GST_PTR_FORMAT " and %" GST_PTR_FORMAT, element, appsink);
+	gst_rtsp_media_factory_add_role (GST_RTSP_MEDIA_FACTORY (s->es_factory), r->role, GST_RTSP_PERM_MEDIA_FACTORY_ACCESS, G_TYPE_BOOLEAN, TRUE, GST_RTSP_PERM_MEDIA_FACTORY_CONSTRUCT, G_TYPE_BOOLEAN, TRUE, NULL);
+	gst_rtsp_media_factory_add_role (GST_RTSP_MEDIA_FACTORY (s->ts_factory), r->role, GST_RTSP_PERM_MEDIA_FACTORY_ACCESS, G_TYPE_BOOLEAN, TRUE, GST_RTSP_PERM_MEDIA_FACTORY_CONSTRUCT, G_TYPE_BOOLEAN, TRUE, NULL);
 
-	gst_object_unref (element);
-	gst_object_unref (appsink);
-	element = NULL;
-	appsink = NULL;
+	s->rtsp_ts_path = g_strdup_printf ("%s%s", r->rtsp_ts_path, RTSP_SUBSTREAM_PATH_SUFX);
+	s->rtsp_es_path = g_strdup_printf ("%s%s%s", r->rtsp_ts_path, RTSP_SUBSTREAM_PATH_SUFX, RTSP_ES_PATH_SUFX);
+	gst_rtsp_mount_points_add_factory (r->mounts, s->rtsp_ts_path, g_object_ref(GST_RTSP_MEDIA_FACTORY (s->ts_factory)));
+	gst_rtsp_mount_points_add_factory (r->mounts, s->rtsp_es_path, g_object_ref(GST_RTSP_MEDIA_FACTORY (s->es_factory)));
+	GST_INFO_OBJECT (app, "substream mounted at %s and %s", s->rtsp_ts_path, s->rtsp_es_path);
+}
 
-	if (!r->tsappsink && !r->aappsink && !r->vappsink)
-	{
-		GST_INFO("!r->tsappsink && !r->aappsink && !r->vappsink");
-		if (app->tcp_upstream->state == UPSTREAM_STATE_DISABLED && app->hls_server->state == HLS_STATE_DISABLED)
-			halt_source_pipeline(app);
-		GST_INFO("local rtsp server disabled!");
-	}
-	return GST_PAD_PROBE_REMOVE;
+static void rtsp_substream_unmount(App *app)
+{
+	DreamRTSPserver *r = app->rtsp_server;
+	DreamSubstream *s = app->substream;
+	if (!s->ts_factory)
+		return;
+	gst_rtsp_mount_points_remove_factory (r->mounts, s->rtsp_es_path);
+	gst_rtsp_mount_points_remove_factory (r->mounts, s->rtsp_ts_path);
+	g_object_unref (s->es_factory);
+	g_object_unref (s->ts_factory);
+	s->es_factory = s->ts_factory = NULL;
+	g_free (s->rtsp_ts_path);
+	g_free (s->rtsp_es_path);
+	s->rtsp_ts_path = s->rtsp_es_path = NULL;
 }
 
 gboolean disable_rtsp_server(App *app)
@@ -2578,19 +5624,29 @@ gboolean disable_rtsp_server(App *app)
 	GST_DEBUG("disable_rtsp_server %p", r->server);
 	if (r->state >= RTSP_STATE_IDLE)
 	{
-		if (app->rtsp_server->es_media)
+		if (rtsp_has_media (app))
 			gst_rtsp_server_client_filter(GST_RTSP_SERVER(app->rtsp_server->server), (GstRTSPServerClientFilterFunc) remove_client_filter_func, app);
 		DREAMRTSPSERVER_LOCK (app);
 		gst_rtsp_mount_points_remove_factory (app->rtsp_server->mounts, app->rtsp_server->rtsp_es_path);
 		gst_rtsp_mount_points_remove_factory (app->rtsp_server->mounts, app->rtsp_server->rtsp_ts_path);
-		GSource *source = g_main_context_find_source_by_id (g_main_context_default (), r->source_id);
-		g_source_destroy(source);
-// 		g_source_unref(source);
-// 		GST_DEBUG("disable_rtsp_server source unreffed");
+		rtsp_substream_unmount (app);
+		if (r->basic)
+		{
+			GstRTSPAuth *auth = gst_rtsp_server_get_auth (GST_RTSP_SERVER(r->server));
+			if (auth)
+			{
+				gst_rtsp_auth_remove_basic (auth, r->basic);
+				g_object_unref (auth);
+			}
+		}
 		if (r->mounts)
 			g_object_unref(r->mounts);
-		if (r->server)
-			gst_object_unref(r->server);
+		rtsp_listener_release (app, r->listener);
+		r->listener = NULL;
+		r->server = NULL;
+		g_free(r->role);
+		g_free(r->basic);
+		r->role = r->basic = NULL;
 		g_free(r->rtsp_user);
 		g_free(r->rtsp_pass);
 		g_free(r->rtsp_port);
@@ -2600,77 +5656,35 @@ gboolean disable_rtsp_server(App *app)
 		send_signal (app, "rtspStateChanged", g_variant_new("(i)", RTSP_STATE_DISABLED));
 		r->state = RTSP_STATE_DISABLED;
 
-		gst_object_ref (r->tsrtspq);
-		gst_object_ref (r->artspq);
-		gst_object_ref (r->vrtspq);
-		gst_object_ref (r->tsappsink);
-		gst_object_ref (r->aappsink);
-		gst_object_ref (r->vappsink);
-
-		GstPad *sinkpad;
-		sinkpad = gst_element_get_static_pad (r->tsrtspq, "sink");
-		gst_pad_add_probe (sinkpad, GST_PAD_PROBE_TYPE_IDLE, rtsp_pad_probe_unlink_cb, app, NULL);
-		gst_object_unref (sinkpad);
-		sinkpad = gst_element_get_static_pad (r->artspq, "sink");
-		gst_pad_add_probe (sinkpad, GST_PAD_PROBE_TYPE_IDLE, rtsp_pad_probe_unlink_cb, app, NULL);
-		gst_object_unref (sinkpad);
-		sinkpad = gst_element_get_static_pad (r->vrtspq, "sink");
-		gst_pad_add_probe (sinkpad, GST_PAD_PROBE_TYPE_IDLE, rtsp_pad_probe_unlink_cb, app, NULL);
-		gst_object_unref (sinkpad);
-
 		DREAMRTSPSERVER_UNLOCK (app);
+
+		rtsp_detach_consumer (app, app->tsring, &r->tsconsumer);
+		rtsp_detach_consumer (app, app->aring, &r->aconsumer);
+		rtsp_detach_consumer (app, app->vring, &r->vconsumer);
 		GST_INFO("rtsp_server disabled! set RTSP_STATE_DISABLED");
 		return TRUE;
 	}
 	return FALSE;
 }
 
-static GstPadProbeReturn upstream_pad_probe_unlink_cb (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+static void upstream_branch_removed (App *app)
 {
-	App *app = user_data;
 	DreamTCPupstream *t = app->tcp_upstream;
 
-	GstElement *element = gst_pad_get_parent_element(pad);
-
-	GST_DEBUG_OBJECT (pad, "upstream_pad_probe_unlink_cb %" GST_PTR_FORMAT, element);
-
-	if ((GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_IDLE) && element && element == t->tstcpq)
-	{
-		GstPad *teepad;
-		teepad = gst_pad_get_peer(pad);
-		if (!teepad)
-		{
-			GST_ERROR_OBJECT (pad, "has no peer! tstcpq=%" GST_PTR_FORMAT", tcpsink=%" GST_PTR_FORMAT", tee=%" GST_PTR_FORMAT,t->tstcpq, t->tcpsink, app->tstee);
-			return GST_PAD_PROBE_REMOVE;
-		}
-		GST_DEBUG_OBJECT (pad, "GST_PAD_PROBE_TYPE_IDLE -> unlink and remove tcpsink");
-		gst_pad_unlink (teepad, pad);
-
-		GstElement *tee = gst_pad_get_parent_element(teepad);
-		gst_element_release_request_pad (tee, teepad);
-		gst_object_unref (teepad);
-		gst_object_unref (tee);
-
-		gst_object_ref (t->tcpsink);
-		gst_element_unlink (t->tstcpq, t->tcpsink);
-		gst_bin_remove_many (GST_BIN (app->pipeline), t->tstcpq, t->tcpsink, NULL);
-
-		gst_element_set_state (t->tcpsink, GST_STATE_NULL);
-		gst_element_set_state (t->tstcpq, GST_STATE_NULL);
-
-		gst_object_unref (t->tstcpq);
-		gst_object_unref (t->tcpsink);
-		t->tstcpq = NULL;
-		t->tcpsink = NULL;
-
-		if (app->rtsp_server->state < RTSP_STATE_RUNNING && app->hls_server->state == HLS_STATE_DISABLED)
-			halt_source_pipeline(app);
-		GST_INFO("tcp_upstream disabled!");
-		t->state = UPSTREAM_STATE_DISABLED;
-		send_signal (app, "upstreamStateChanged", g_variant_new("(i)", t->state));
-	}
-	GST_DEBUG_OBJECT (pad, "upstream_pad_probe_unlink_cb returns GST_PAD_PROBE_REMOVE");
-	return GST_PAD_PROBE_REMOVE;
+	if (t->encoder_bin && GST_OBJECT_PARENT (t->encoder_bin))
+		remove_upstream_encoder (app);
+	t->tssrc = NULL;
+	t->funnel = NULL;
+	t->keepalive = NULL;
+	t->tcpsink = NULL;
+
+	GST_INFO("tcp_upstream disabled!");
+	t->state = UPSTREAM_STATE_DISABLED;
+	send_signal (app, "upstreamStateChanged", g_variant_new("(i)", t->state));
+	if (sources_unused (app))
+		idle_source_pipeline(app);
+	else
+		release_tsmux(app);
 }
 
 gboolean disable_tcp_upstream(App *app)
@@ -2682,6 +5696,10 @@ gboolean disable_tcp_upstream(App *app)
 	if (t->state >= UPSTREAM_STATE_CONNECTING)
 	{
 		GstPad *sinkpad;
+		upstream_ladder_reset (app);
+		if (t->id_signal_keepalive)
+			g_source_remove (t->id_signal_keepalive);
+		t->id_signal_keepalive = 0;
 		if (t->id_bitrate_measure)
 		{
 			sinkpad = gst_element_get_static_pad (t->tcpsink, "sink");
@@ -2689,11 +5707,11 @@ gboolean disable_tcp_upstream(App *app)
 			t->id_bitrate_measure = 0;
 			gst_object_unref (sinkpad);
 		}
-		gst_object_ref (t->tstcpq);
-		sinkpad = gst_element_get_static_pad (t->tstcpq, "sink");
-		gulong probe_id = gst_pad_add_probe (sinkpad, GST_PAD_PROBE_TYPE_IDLE, upstream_pad_probe_unlink_cb, app, NULL);
-		GST_DEBUG("added upstream_pad_probe_unlink_cb with probe_id = %lu on %" GST_PTR_FORMAT"", probe_id, sinkpad);
-		gst_object_unref (sinkpad);
+		upstream_idle_remove (app);
+		if (t->consumer)
+			dream_ring_remove_consumer (t->encoder_bin ? t->tsring : app->tsring, t->consumer);
+		t->consumer = NULL;
+		branch_detach (app, upstream_branch_removed, t->tssrc, t->keepalive, t->funnel, t->tcpsink, NULL);
 		return TRUE;
 	}
 	return FALSE;
@@ -2705,6 +5723,18 @@ gboolean destroy_pipeline(App *app)
 	if (app->pipeline)
 	{
 		get_source_properties (app);
+		DreamTCPupstream *t = app->tcp_upstream;
+		if (t->id_encoder_remove)
+			g_source_remove (t->id_encoder_remove);
+		t->id_encoder_remove = 0;
+		if (app->id_source_transition_timeout)
+			g_source_remove (app->id_source_transition_timeout);
+		app->id_source_transition_timeout = 0;
+		g_atomic_int_set (&app->source_halting, FALSE);
+		app->source_pending = FALSE;
+		app->source_target = SOURCE_STATE_STOPPED;
+		app->source_transition_start = g_get_monotonic_time ();
+		slate_stop (app);
 		GstStateChangeReturn sret = gst_element_set_state (app->pipeline, GST_STATE_NULL);
 		if (sret == GST_STATE_CHANGE_ASYNC)
 		{
@@ -2713,8 +5743,64 @@ gboolean destroy_pipeline(App *app)
 			if (state != GST_STATE_NULL)
 				GST_INFO_OBJECT(app, "%" GST_PTR_FORMAT"'s state=%s", app->pipeline, gst_element_state_get_name (state));
 		}
+		source_state_reached (app, SOURCE_STATE_STOPPED);
+		dream_ring_free (app->aring);
+		dream_ring_free (app->vring);
+		dream_ring_free (app->tsring);
+		app->aring = app->vring = app->tsring = NULL;
+		app->standby_active = FALSE;
+		input_switch_reset (app);
+		if (app->swap)
+		{
+			g_clear_object (&app->swap->apad);
+			g_clear_object (&app->swap->vpad);
+			g_free (app->swap);
+			app->swap = NULL;
+		}
+		if (app->slate)
+		{
+			/* the slate's elements go with the pipeline, its buffers are kept */
+			DreamSlate *s = app->slate;
+			if (s->id_prepare)
+				g_source_remove (s->id_prepare);
+			s->id_prepare = 0;
+			g_clear_object (&s->audio.livepad);
+			g_clear_object (&s->audio.slatepad);
+			g_clear_object (&s->video.livepad);
+			g_clear_object (&s->video.slatepad);
+			s->audio.appsrc = s->video.appsrc = NULL;
+			s->audio.next = s->video.next = 0;
+			s->audio.end = s->video.end = GST_CLOCK_TIME_NONE;
+			s->audio.offset = s->video.offset = 0;
+		}
+		app->rtsp_server->aconsumer = app->rtsp_server->vconsumer = app->rtsp_server->tsconsumer = NULL;
+		app->hls_server->consumer = NULL;
+		t->consumer = NULL;
+		{
+			/* the substream's elements go with the pipeline as well */
+			DreamSubstream *s = app->substream;
+			dream_ring_free (s->vring);
+			dream_ring_free (s->tsring);
+			s->vring = s->tsring = NULL;
+			s->vsrc = s->vparse = s->vtee = s->vq = s->aq = s->tsmux = s->tstee = NULL;
+			s->hlssrc = s->hlssink = NULL;
+			s->aconsumer = s->vconsumer = s->tsconsumer = s->hlsconsumer = NULL;
+			s->id_key_probe = 0;
+			s->removing = FALSE;
+		}
 		gst_object_unref (app->pipeline);
 		gst_object_unref (app->clock);
+		if (t->encoder_bin)
+		{
+			gst_element_set_state (t->encoder_bin, GST_STATE_NULL);
+			gst_object_unref (t->encoder_bin);
+		}
+		dream_ring_free (t->tsring);
+		t->tsring = NULL;
+		g_clear_object (&t->encoder_apad);
+		g_clear_object (&t->encoder_vpad);
+		t->encoder_bin = t->encoder_atarget = t->encoder_vtarget = NULL;
+		t->encoder_active = UPSTREAM_ENCODER_SHARED;
 		GST_INFO_OBJECT(app, "source pipeline destroyed");
 		app->pipeline = NULL;
 		return TRUE;
@@ -2726,10 +5812,10 @@ gboolean destroy_pipeline(App *app)
 
 gboolean watchdog_ping(gpointer user_data)
 {
-	App *app = user_data;
-	GST_TRACE_OBJECT(app, "sending watchdog ping!");
-	if (app->dbus_connection)
-		g_dbus_connection_emit_signal (app->dbus_connection, NULL, object_name, service, "ping", NULL, NULL);
+	DreamDaemon *daemon = user_data;
+	GST_TRACE("sending watchdog ping!");
+	if (daemon->dbus_connection)
+		g_dbus_connection_emit_signal (daemon->dbus_connection, NULL, object_name, service, "ping", NULL, NULL);
 	return TRUE;
 }
 
@@ -2742,35 +5828,173 @@ gboolean quit_signal(gpointer loop)
 
 gboolean get_dot_graph (gpointer user_data)
 {
-	App *app = user_data;
-	GST_INFO_OBJECT(app, "caught SIGUSR1, saving pipeline graph...");
-	GST_DEBUG_BIN_TO_DOT_FILE_WITH_TS (GST_BIN (app->pipeline), GST_DEBUG_GRAPH_SHOW_ALL, "dreamrtspserver-sigusr");
+	DreamDaemon *daemon = user_data;
+	guint i;
+	GST_INFO("caught SIGUSR1, saving pipeline graphs...");
+	for (i = 0; i < daemon->n_channels; i++)
+		if (daemon->channels[i]->pipeline)
+			GST_DEBUG_BIN_TO_DOT_FILE_WITH_TS (GST_BIN (daemon->channels[i]->pipeline), GST_DEBUG_GRAPH_SHOW_ALL, "dreamrtspserver-sigusr");
 	return TRUE;
 }
 
+static App *create_channel(DreamDaemon *daemon, guint channel, const gchar *source)
+{
+	App *app = g_new0 (App, 1);
+	app->daemon = daemon;
+	app->channel = channel;
+	if (channel)
+		app->object_path = g_strdup_printf ("%s/%u", object_name, channel + 1);
+	else
+		app->object_path = g_strdup (object_name);
+
+	app->source_properties.gopLength = 0; //auto
+	app->source_properties.gopOnSceneChange = FALSE;
+	app->source_properties.openGop = FALSE;
+	app->source_properties.bFrames = 2; //default
+	app->source_properties.pFrames = 1; //default
+	app->source_properties.profile = 0; //main
+	if (!parse_source_backend (app, source))
+	{
+		g_free (app->object_path);
+		g_free (app);
+		return NULL;
+	}
+	g_mutex_init (&app->rtsp_mutex);
+
+	app->source_state = app->source_target = SOURCE_STATE_STOPPED;
+	app->standby = DEFAULT_STANDBY;
+
+	app->tcp_upstream = malloc(sizeof(DreamTCPupstream));
+	app->tcp_upstream->state = UPSTREAM_STATE_DISABLED;
+	app->tcp_upstream->auto_bitrate = AUTO_BITRATE;
+	app->tcp_upstream->latency = DEFAULT_UPSTREAM_LATENCY;
+	app->tcp_upstream->queue_max_bytes = 0;
+	app->tcp_upstream->batch_size = DEFAULT_UPSTREAM_BATCH_SIZE;
+	app->tcp_upstream->pace_burst = DEFAULT_UPSTREAM_PACE_BURST;
+	app->tcp_upstream->spool = DEFAULT_UPSTREAM_SPOOL;
+	app->tcp_upstream->spool_limit = DEFAULT_UPSTREAM_SPOOL_LIMIT;
+	app->tcp_upstream->tssrc = app->tcp_upstream->tcpsink = NULL;
+	app->tcp_upstream->tsring = NULL;
+	app->tcp_upstream->consumer = NULL;
+	app->tcp_upstream->funnel = app->tcp_upstream->keepalive = NULL;
+	app->tcp_upstream->id_signal_keepalive = 0;
+	g_mutex_init (&app->tcp_upstream->idle_lock);
+	app->tcp_upstream->idle_closed = FALSE;
+	app->tcp_upstream->id_gop_dropped = app->tcp_upstream->id_overrun = app->tcp_upstream->id_congested = 0;
+	app->tcp_upstream->id_decongested = app->tcp_upstream->id_ladder_climb = 0;
+	app->tcp_upstream->encoder = app->tcp_upstream->encoder_active = DEFAULT_UPSTREAM_ENCODER;
+	app->tcp_upstream->encoder_bin = app->tcp_upstream->encoder_atarget = app->tcp_upstream->encoder_vtarget = NULL;
+	app->tcp_upstream->encoder_apad = app->tcp_upstream->encoder_vpad = NULL;
+	app->tcp_upstream->id_encoder_remove = 0;
+	app->tcp_upstream->ladder_spec = NULL;
+	upstream_ladder_parse (app->tcp_upstream, DEFAULT_UPSTREAM_LADDER);
+	app->tcp_upstream->rung = app->tcp_upstream->link_samples = 0;
+	app->tcp_upstream->audio_only = FALSE;
+
+	app->hls_server = create_hls_server(app);
+
+	app->rtsp_server = create_rtsp_server(app);
+
+	app->substream = create_substream(app);
+
+	/* owning the name goes on in the background while the pipeline is built */
+	g_idle_add (startup_create_pipeline, app);
+
+	return app;
+}
+
+static void free_channel(App *app)
+{
+	if (app->tcp_upstream->state > UPSTREAM_STATE_DISABLED)
+		disable_tcp_upstream(app);
+	if (app->rtsp_server->state >= RTSP_STATE_IDLE)
+		disable_rtsp_server(app);
+	if (app->rtsp_server->clients_list)
+		g_list_free (app->rtsp_server->clients_list);
+
+	if (app->hls_server->state >= HLS_STATE_IDLE)
+		disable_hls_server(app);
+
+	destroy_pipeline(app);
+
+	g_free(app->hls_server->dir);
+	g_free(app->hls_server->prefix);
+	free(app->hls_server);
+	free(app->rtsp_server);
+	g_free(app->substream);
+	g_free(app->tcp_upstream->ladder_spec);
+	g_mutex_clear (&app->tcp_upstream->idle_lock);
+	free(app->tcp_upstream);
+	g_free(app->source_location);
+
+	g_mutex_clear (&app->rtsp_mutex);
+	g_free (app->object_path);
+	g_free (app);
+}
+
 int main (int argc, char *argv[])
 {
-	App app;
-	guint owner_id;
+	DreamDaemon daemon;
+	guint owner_id, i;
+	GTimer *timer = g_timer_new ();
+	gchar *source = NULL;
+	gint channels = DEFAULT_CHANNELS;
+	GError *err = NULL;
+	GOptionContext *context;
+	GOptionEntry entries[] = {
+		{ "source", 's', 0, G_OPTION_ARG_STRING, &source, "Where audio and video come from: dream (the hardware encoder, default), test (software encoded test signal) or file:<path> (replay of a TS or ES capture)", "BACKEND" },
+		{ "channels", 'c', 0, G_OPTION_ARG_INT, &channels, "Number of independent encoder channels, each with its own source, RTSP mount, HLS path and D-Bus object (default 1)", "N" },
+		{ NULL }
+	};
 
-	gst_init (0, NULL);
+	context = g_option_context_new ("- Dreambox RTSP server daemon");
+	g_option_context_add_main_entries (context, entries, NULL);
+	g_option_context_add_group (context, gst_init_get_option_group ());
+	/* parsing with the gstreamer option group is what initializes gstreamer,
+	 * so the parse is timed as the gst_init phase */
+	if (!g_option_context_parse (context, &argc, &argv, &err))
+	{
+		g_printerr ("%s\n", err->message);
+		g_clear_error (&err);
+		return 1;
+	}
+	gdouble gst_init_done = g_timer_elapsed (timer, NULL);
+	g_option_context_free (context);
+	if (channels < 1 || channels > MAX_CHANNELS)
+	{
+		g_printerr ("invalid number of channels %d, expected 1 to %d\n", channels, MAX_CHANNELS);
+		return 1;
+	}
 
 	GST_DEBUG_CATEGORY_INIT (dreamrtspserver_debug, "dreamrtspserver",
 			GST_DEBUG_BOLD | GST_DEBUG_FG_YELLOW | GST_DEBUG_BG_BLUE,
 			"Dreambox RTSP server daemon");
 
-	memset (&app, 0, sizeof(app));
-	memset (&app.source_properties, 0, sizeof(SourceProperties));
-	app.source_properties.gopLength = 0; //auto
-	app.source_properties.gopOnSceneChange = FALSE;
-	app.source_properties.openGop = FALSE;
-	app.source_properties.bFrames = 2; //default
-	app.source_properties.pFrames = 1; //default
-	app.source_properties.profile = 0; //main
-	g_mutex_init (&app.rtsp_mutex);
+	memset (&daemon, 0, sizeof(daemon));
+	for (i = 0; i < (guint) channels; i++)
+	{
+		daemon.channels[i] = create_channel (&daemon, i, source);
+		if (!daemon.channels[i])
+		{
+			g_printerr ("invalid source '%s', expected dream, test or file:<existing file>\n", source);
+			return 1;
+		}
+		daemon.n_channels++;
+	}
+	g_free (source);
+
+	/* startup is timed and reported for the first channel */
+	App *first = daemon.channels[0];
+	first->startup_timer = timer;
+	first->startup_report = g_string_new (NULL);
+	startup_phase_at (first, "gst_init", gst_init_done);
+	startup_phase (first, "channels");
+
+	check_plugins (first);
+	startup_phase (first, "registry");
 
 	introspection_data = g_dbus_node_info_new_for_xml (introspection_xml, NULL);
-	app.dbus_connection = NULL;
+	daemon.dbus_connection = NULL;
 
 	owner_id = g_bus_own_name (G_BUS_TYPE_SYSTEM,
 				   service,
@@ -2778,49 +6002,23 @@ int main (int argc, char *argv[])
 			    on_bus_acquired,
 			    on_name_acquired,
 			    on_name_lost,
-			    &app,
+			    &daemon,
 			    NULL);
 
-	if (!create_source_pipeline(&app))
-		g_print ("Failed to create source pipeline!");
-
 #if WATCHDOG_TIMEOUT > 0
-	g_timeout_add_seconds (WATCHDOG_TIMEOUT, watchdog_ping, &app);
+	g_timeout_add_seconds (WATCHDOG_TIMEOUT, watchdog_ping, &daemon);
 #endif
 
-	app.tcp_upstream = malloc(sizeof(DreamTCPupstream));
-	app.tcp_upstream->state = UPSTREAM_STATE_DISABLED;
-	app.tcp_upstream->auto_bitrate = AUTO_BITRATE;
-
-	app.hls_server = create_hls_server(&app);
-
-	app.rtsp_server = create_rtsp_server(&app);
-
-	app.loop = g_main_loop_new (NULL, FALSE);
-	g_unix_signal_add (SIGINT, quit_signal, app.loop);
-	g_unix_signal_add (SIGUSR1, (GSourceFunc) get_dot_graph, &app);
-
-	g_main_loop_run (app.loop);
-
-	if (app.tcp_upstream->state > UPSTREAM_STATE_DISABLED)
-		disable_tcp_upstream(&app);
-	if (app.rtsp_server->state >= RTSP_STATE_IDLE)
-		disable_rtsp_server(&app);
-	if (app.rtsp_server->clients_list)
-		g_list_free (app.rtsp_server->clients_list);
-
-	if (app.hls_server->state >= HLS_STATE_IDLE)
-		disable_hls_server(&app);
-
-	free(app.hls_server);
-	free(app.rtsp_server);
-	free(app.tcp_upstream);
+	daemon.loop = g_main_loop_new (NULL, FALSE);
+	g_unix_signal_add (SIGINT, quit_signal, daemon.loop);
+	g_unix_signal_add (SIGUSR1, (GSourceFunc) get_dot_graph, &daemon);
 
-	destroy_pipeline(&app);
+	g_main_loop_run (daemon.loop);
 
-	g_main_loop_unref (app.loop);
+	for (i = 0; i < daemon.n_channels; i++)
+		free_channel (daemon.channels[i]);
 
-	g_mutex_clear (&app.rtsp_mutex);
+	g_main_loop_unref (daemon.loop);
 
 	g_bus_unown_name (owner_id);
 	g_dbus_node_info_unref (introspection_data);
@@ -30,6 +30,10 @@
 #include <gst/rtsp-server/rtsp-server.h>
 #include <libsoup/soup.h>
 #include "gstdreamrtsp.h"
+#include "dreamts.h"
+#include "dreamring.h"
+#include "gstdreamtcpsink.h"
+#include "gstdreamsoftsource.h"
 
 GST_DEBUG_CATEGORY (dreamrtspserver_debug);
 #define GST_CAT_DEFAULT dreamrtspserver_debug
@@ -37,37 +41,121 @@ GST_DEBUG_CATEGORY (dreamrtspserver_debug);
 #define DEFAULT_RTSP_PORT 554
 #define DEFAULT_RTSP_PATH "/stream"
 #define RTSP_ES_PATH_SUFX "-es"
+#define RTSP_ANONYMOUS_ROLE "anonymous"
 
 #define HLS_PATH "/tmp/hls"
 #define HLS_FRAGMENT_DURATION 2
 #define HLS_FRAGMENT_NAME "segment%05d.ts"
 #define HLS_PLAYLIST_NAME "dream.m3u8"
+#define HLS_MASTER_NAME "master.m3u8"
 
 #define TOKEN_LEN 36
 
-#define AAPPSINK "aappsink"
-#define VAPPSINK "vappsink"
-#define TSAPPSINK "tsappsink"
-
 #define ES_AAPPSRC "es_aappsrc"
 #define ES_VAPPSRC "es_vappsrc"
 #define TS_APPSRC "ts_appsrc"
 
-#define TS_PACK_SIZE 188
-#define TS_PER_FRAME 7
+#define RTSP_ES_LAUNCH "( appsrc name=" ES_VAPPSRC " ! h264parse ! rtph264pay name=pay0 pt=96   appsrc name=" ES_AAPPSRC " ! aacparse ! rtpmp4apay name=pay1 pt=97 )"
+#define RTSP_TS_LAUNCH "( appsrc name=" TS_APPSRC " ! queue ! rtpmp2tpay name=pay0 pt=96 )"
+
+/* outputs share one ring per stream instead of a leaky queue each. sized
+ * for RING_MAX_LAG at ~50 es frames/s and ~20 Mbit/s of ts */
+#define ES_RING_SIZE 512
+#define TS_RING_SIZE 16384
+#define RING_MAX_LAG G_GINT64_CONSTANT(5)*GST_SECOND
+#define RTSP_MAX_LAG RING_MAX_LAG
+/* the hls branches' appsrcs only hand over to their streaming threads, the
+ * backlog stays in the ring */
+#define BRANCH_APPSRC_MAX_BYTES 1024*1024
+
+/* an rtsp media's timestamp offset follows the drift of the encoder clock
+ * against the media's pipeline clock, averaged over this many buffers and
+ * moved in steps of TIMELINE_DRIFT_STEP. a deviation beyond RTSP_MAX_LAG is
+ * a jump of the stream time, the offset follows it at once */
+#define TIMELINE_DRIFT_SMOOTHING 1024
+#define TIMELINE_DRIFT_STEP GST_MSECOND
+
 #define BLOCK_SIZE   TS_PER_FRAME*188
 #define TOKEN_LEN    36
 
+#define DROP_NONREF_LEVEL 50
+#define DROP_GOP_LEVEL 80
+#define DROP_RESUME_LEVEL 30
+
 #define MAX_OVERRUNS 5
 #define OVERRUN_TIME G_GINT64_CONSTANT(15)*GST_SECOND
 #define BITRATE_AVG_PERIOD G_GINT64_CONSTANT(6)*GST_SECOND
 
+#define DEFAULT_UPSTREAM_LATENCY 2000
+#define MIN_UPSTREAM_QUEUE_BYTES 64*BLOCK_SIZE
+
+#define DEFAULT_UPSTREAM_BATCH_SIZE 48*BLOCK_SIZE
+#define UPSTREAM_BATCH_LATENCY G_GINT64_CONSTANT(20)*GST_MSECOND
+
+/* burst allowance of the upstream pacer in KiB, 0 sends as fast as the socket takes it */
+#define DEFAULT_UPSTREAM_PACE_BURST 0
+#define MAX_UPSTREAM_PACE_BURST 4096
+
+#define DEFAULT_UPSTREAM_ENCODER UPSTREAM_ENCODER_SHARED
+
+#define DEFAULT_UPSTREAM_LADDER "1920x1080@30:4000,1280x720@30:2500,1280x720@25:1800,1024x576@25:1000,audio"
+#define MAX_LADDER_RUNGS 8
+#define LADDER_HOLD G_GINT64_CONSTANT(30)*GST_SECOND
+#define LADDER_HOLD_MAX G_GINT64_CONSTANT(480)*GST_SECOND
+#define LADDER_CLIMB_MARGIN 1.2
+
+#define DEFAULT_UPSTREAM_SPOOL DREAM_TCP_SINK_SPOOL_NONE
+#define DEFAULT_UPSTREAM_SPOOL_LIMIT 64
+#define UPSTREAM_SPOOL_PATH "/media/hdd"
+
+#define KEEPALIVE_INTERVAL 5
+#define KEEPALIVE_PACKETS 1
+
 #define RESUME_DELAY 20
 
 #define AUTO_BITRATE TRUE
 
+/* how long a source state transition may take before it's forced (ms) */
+#define SOURCE_TRANSITION_TIMEOUT 2000
+
+/* a timestamp step bigger than this after an input switch is smoothed over,
+ * and the switch gives up waiting for the step and the idr after the timeout */
+#define INPUT_SWITCH_MAX_JUMP (500*GST_MSECOND)
+#define INPUT_SWITCH_TIMEOUT 2000
+
+/* a video format change gives up waiting for the new caps and the idr after
+ * this long (ms), so a lost one doesn't hold back the switches after it */
+#define VIDEO_SWITCH_TIMEOUT 2000
+
+/* what the sources do while nobody consumes them, see standbyMode */
+#define DEFAULT_STANDBY STANDBY_OFF
+#define STANDBY_VIDEO_BITRATE 200
+
+/* what goes out while the encoders have lost their input. the clips are
+ * looped, the video one has to start with an idr. without them a second of
+ * black and silence is rendered once with the software encoders */
+#define SLATE_VIDEO_FILE "/usr/share/dreamrtspserver/slate.h264"
+#define SLATE_AUDIO_FILE "/usr/share/dreamrtspserver/slate.aac"
+#define SLATE_LOAD_TIMEOUT G_GINT64_CONSTANT(5)*GST_SECOND
+#define SLATE_TICK 20
+#define SLATE_RETRY_INTERVAL 2000
+
+/* a low resolution rendition for viewers on slow links, encoded next to the
+ * main stream by a second encoder instance. it's served at <path>-low and
+ * <path>-low-es and as HLS_SUBSTREAM_DIR variant of the hls master playlist */
+#define DEFAULT_SUBSTREAM_WIDTH 640
+#define DEFAULT_SUBSTREAM_HEIGHT 360
+#define DEFAULT_SUBSTREAM_BITRATE 600
+#define RTSP_SUBSTREAM_PATH_SUFX "-low"
+#define HLS_SUBSTREAM_DIR "low"
+
 #define WATCHDOG_TIMEOUT 5
 
+/* independent encoder channels in one daemon. channel n > 0 is served at
+ * DEFAULT_RTSP_PATH<n+1>, HLS_PATH<n+1> and object_name/<n+1> */
+#define DEFAULT_CHANNELS 1
+#define MAX_CHANNELS 8
+
 #if HAVE_UPSTREAM
 	#pragma message("building with mediator upstream feature")
 #else
@@ -99,6 +187,30 @@ typedef enum {
         INPUT_MODE_BACKGROUND = 2
 } inputMode;
 
+/* lifecycle of the sources, numbered like the GstState of the pipeline.
+ * suspended has the encoders closed, paused keeps them open but stopped */
+typedef enum {
+	SOURCE_STATE_STOPPED = 1,
+	SOURCE_STATE_SUSPENDED = 2,
+	SOURCE_STATE_PAUSED = 3,
+	SOURCE_STATE_RUNNING = 4
+} sourceState;
+
+/* off halts the sources with the last consumer, paused keeps the encoders
+ * initialized but stopped and running keeps them encoding at
+ * STANDBY_VIDEO_BITRATE into tees that have nothing linked */
+typedef enum {
+	STANDBY_OFF = 0,
+	STANDBY_PAUSED = 1,
+	STANDBY_RUNNING = 2
+} standbyMode;
+
+typedef enum {
+	SOURCE_BACKEND_DREAM = 0,
+	SOURCE_BACKEND_TEST = 1,
+	SOURCE_BACKEND_FILE = 2
+} sourceBackend;
+
 typedef enum {
         UPSTREAM_STATE_DISABLED = 0,
         UPSTREAM_STATE_CONNECTING = 1,
@@ -109,6 +221,12 @@ typedef enum {
 	UPSTREAM_STATE_FAILED = 9
 } upstreamState;
 
+typedef enum {
+	UPSTREAM_ENCODER_SHARED = 0,
+	UPSTREAM_ENCODER_DEDICATED = 1,
+	UPSTREAM_ENCODER_SOFTWARE = 2
+} upstreamEncoder;
+
 typedef enum {
         RTSP_STATE_DISABLED = 0,
         RTSP_STATE_IDLE = 1,
@@ -122,29 +240,98 @@ typedef enum {
 } hlsState;
 
 typedef struct {
-	GstElement *tstcpq, *tcpsink;
+	gint32 audioBitrate, videoBitrate, gopLength, bFrames, pFrames, slices;
+	guint framerate, width, height, profile, level;
+	gboolean gopOnSceneChange, openGop;
+} SourceProperties;
+
+/* one step of the upstream quality ladder. kbps is the bandwidth the rung
+ * needs, the audio only rung has none */
+typedef struct {
+	guint width, height, framerate;
+	gint kbps;
+} UpstreamRung;
+
+typedef struct {
+	GstElement *tssrc, *tcpsink;
+	GstElement *funnel, *keepalive;
+	/* tssrc reads off the local tsmux' ring or tsring of the encoder bin */
+	DreamRing *tsring;
+	DreamRingConsumer *consumer;
 	char token[TOKEN_LEN+1];
 	upstreamState state;
 	guint overrun_counter;
 	GstClockTime overrun_period, measure_start;
-	guint id_signal_overrun, id_signal_waiting, id_signal_keepalive;
+	gboolean overrun_armed;
+	guint id_signal_waiting, id_signal_keepalive;
 	gulong id_resume, id_bitrate_measure;
+	/* main loop work queued from the streaming threads, see upstream_idle_add */
+	GMutex idle_lock;
+	gboolean idle_closed;
+	guint id_gop_dropped, id_overrun, id_congested, id_decongested, id_ladder_climb;
 	gsize bitrate_sum;
 	gint bitrate_avg;
 	gboolean auto_bitrate;
+	guint latency, queue_max_bytes;
+	guint batch_size;
+	guint pace_burst;
+	GstDreamTCPSinkSpool spool;
+	guint spool_limit;
+	upstreamEncoder encoder, encoder_active;
+	GstElement *encoder_bin, *encoder_atarget, *encoder_vtarget;
+	GstPad *encoder_apad, *encoder_vpad;
+	guint id_encoder_remove;
+	UpstreamRung ladder[MAX_LADDER_RUNGS];
+	guint ladder_len, rung, link_samples;
+	gchar *ladder_spec;
+	gboolean audio_only, rung_climbed;
+	GstClockTime rung_time, overload_time, ladder_hold;
+	SourceProperties configured;
+	DreamTSDropper dropper;
+	tsDropLevel drop_level;
 } DreamTCPupstream;
 
+typedef struct _DreamDaemon DreamDaemon;
+
+/* a server on a port, shared by the channels serving on it */
+typedef struct {
+	DreamDaemon *daemon;
+	guint port;
+	gpointer server;
+	guint source_id;
+	GList *channels;
+} DreamListener;
+
+typedef struct {
+	GstElement *appsrc;
+	GstPad *pad;
+	GstClockTimeDiff last;
+} DreamTimelineStream;
+
+/* maps the stream time of one rtsp media's appsrcs onto the running time of
+ * its pipeline with a single pad offset, see timeline_map. the first stream
+ * leads: the media starts at its first keyframe and its drift is tracked */
+typedef struct {
+	GMutex lock;
+	DreamTimelineStream streams[2];
+	guint n_streams;
+	GstClockTime base;
+	gboolean clocked;
+	GstClockTimeDiff origin, drift, correction;
+} DreamTimeline;
+
 typedef struct {
+	DreamListener *listener;
 	GstDreamRTSPServer *server;
 	GstRTSPMountPoints *mounts;
 	GstDreamRTSPMediaFactory *es_factory, *ts_factory;
 	GstRTSPMedia *es_media, *ts_media;
-	GstElement *artspq, *vrtspq, *tsrtspq;
 	GstElement *es_aappsrc, *es_vappsrc;
 	GstElement *ts_appsrc;
-	GstElement *aappsink, *vappsink, *tsappsink;
-	GstClockTime rtsp_start_pts, rtsp_start_dts;
+	DreamRingConsumer *aconsumer, *vconsumer, *tsconsumer;
+	DreamTimeline *es_timeline, *ts_timeline;
 	gchar *rtsp_user, *rtsp_pass;
+	gchar *role, *basic;
 	GList *clients_list;
 	gchar *rtsp_port;
 	gchar *rtsp_ts_path, *rtsp_es_path;
@@ -153,39 +340,189 @@ typedef struct {
 	gchar *uri_parameters;
 } DreamRTSPserver;
 
+/* a playlist request paused until the first fragment is there */
 typedef struct {
-	gint32 audioBitrate, videoBitrate, gopLength, bFrames, pFrames, slices;
-	guint framerate, width, height, profile, level;
-	gboolean gopOnSceneChange, openGop;
-} SourceProperties;
+	SoupServer *server;
+	SoupMessage *msg;
+	gchar *path;
+} DreamHLSRequest;
 
 typedef struct {
-	GstElement *queue;
+	GstElement *hlssrc;
 	GstElement *hlssink;
+	DreamRingConsumer *consumer;
 	hlsState state;
+	DreamListener *listener;
 	SoupServer *soupserver;
 	SoupAuthDomain *soupauthdomain;
+	gchar *dir, *prefix;
 	guint port;
 	gchar *hls_user, *hls_pass;
-	guint id_timeout;
+	guint id_timeout, id_starting;
+	GList *waiting;
+	gint cut_pending, discont_pending;
+	GList *discont_segments;
+	guint discont_sequence;
 } DreamHLSserver;
 
+/* the substream's elements sit in the channel's pipeline and come and go
+ * with its consumers like the tsmux does. its audio is the main stream's */
 typedef struct {
-	GDBusConnection *dbus_connection;
-	GMainLoop *loop;
+	gboolean enabled;
+	gint width, height, bitrate;
+	GstElement *vsrc, *vparse, *vtee, *vq, *aq, *tsmux, *tstee;
+	DreamRing *vring, *tsring;
+	GstDreamRTSPMediaFactory *es_factory, *ts_factory;
+	GstRTSPMedia *es_media, *ts_media;
+	GstElement *es_aappsrc, *es_vappsrc;
+	GstElement *ts_appsrc;
+	DreamRingConsumer *aconsumer, *vconsumer, *tsconsumer;
+	DreamTimeline *es_timeline, *ts_timeline;
+	gchar *rtsp_ts_path, *rtsp_es_path;
+	GstElement *hlssrc, *hlssink;
+	DreamRingConsumer *hlsconsumer;
+	gulong id_key_probe;
+	gboolean removing;
+} DreamSubstream;
+
+typedef struct {
+	DreamDaemon *daemon;
+	guint channel;
+	gchar *object_path;
 	GstElement *pipeline;
 	GstElement *asrc, *vsrc, *aparse, *vparse;
 	GstElement *tsmux, *tstee;
 	GstElement *aq, *vq;
 	GstElement *atee, *vtee;
+	GstElement *asel, *vsel;
+	DreamRing *aring, *vring, *tsring;
 	DreamTCPupstream *tcp_upstream;
 	DreamRTSPserver *rtsp_server;
 	DreamHLSserver *hls_server;
+	DreamSubstream *substream;
 	GMutex rtsp_mutex;
 	GstClock *clock;
 	SourceProperties source_properties;
+	sourceBackend source_backend;
+	gchar *source_location;
+	GTimer *startup_timer;
+	GString *startup_report;
+	gdouble startup_last;
+	sourceState source_state, source_target;
+	gboolean source_pending;
+	gint source_halting;
+	gint64 source_transition_start;
+	gint source_transition_ms;
+	guint id_source_transition_timeout;
+	standbyMode standby;
+	gboolean standby_active;
+	gint32 standby_vbitrate;
+	gulong id_video_switch;
+	gint64 video_switch_start;
+	struct _DreamInputSwitch *input_switch;
+	struct _DreamSlate *slate;
+	struct _DreamSourceSwap *swap;
 } App;
 
+/* what the channels share: the main loop, the dbus name and the servers */
+struct _DreamDaemon {
+	GMainLoop *loop;
+	GDBusConnection *dbus_connection;
+	App *channels[MAX_CHANNELS];
+	guint n_channels;
+	GList *rtsp_listeners, *hls_listeners;
+};
+
+typedef void (*BranchDoneFunc) (App *app);
+
+/* an output branch on its way out of the pipeline */
+typedef struct {
+	App *app;
+	GList *elements;
+	BranchDoneFunc done;
+} DreamBranch;
+
+/* a format switch of the video source on its way through the parser. the
+ * outputs get the old format until the new caps come by and nothing after
+ * those up to the first idr */
+typedef struct {
+	App *app;
+	GstCaps *caps;
+	gboolean switched;
+	gint64 start;
+	guint dropped;
+} DreamVideoSwitch;
+
+typedef struct _DreamInputSwitch DreamInputSwitch;
+
+/* one elementary stream behind its parser as seen by the input switch */
+typedef struct {
+	DreamInputSwitch *sw;
+	gboolean video;
+	gulong probe_id;
+	GstClockTimeDiff offset;
+	GstClockTime last, duration;
+	gboolean armed, wait_idr;
+} DreamInputStream;
+
+/* keeps the streams continuous over input mode switches of the sources. a
+ * switch arms both streams, the first one to step in time after it sets the
+ * offset that both apply from then on, so they stay in sync */
+struct _DreamInputSwitch {
+	App *app;
+	GMutex lock;
+	DreamInputStream audio, video;
+	inputMode mode;
+	gint64 start;
+	gboolean jump_known;
+	GstClockTimeDiff jump_offset;
+	gint switch_ms;
+};
+
+typedef struct _DreamSlate DreamSlate;
+
+/* one stream of the slate, looped from memory into the second input of its
+ * selector. next is where the slate goes on, end where the output is at and
+ * offset what the live stream is shifted by to follow on from the slate */
+typedef struct {
+	DreamSlate *slate;
+	gboolean video;
+	GstElement *appsrc;
+	GstPad *livepad, *slatepad;
+	GstCaps *caps;
+	GPtrArray *buffers;
+	guint index;
+	GstClockTime duration, next, end;
+	GstClockTimeDiff offset;
+	gboolean discont;
+} DreamSlateStream;
+
+/* stands in for the sources while they've lost their input, see slate_start */
+struct _DreamSlate {
+	App *app;
+	GMutex lock;
+	DreamSlateStream audio, video;
+	gboolean loading, loaded, active;
+	gint cut_pending;
+	GstClockTime lag;
+	gint64 since;
+	guint id_prepare, id_tick, id_retry;
+};
+
+/* what the slate's worker thread renders, see slate_prepare */
+typedef struct _DreamSlateLoad {
+	App *app;
+	gchar *video_launch, *audio_launch;
+} DreamSlateLoad;
+
+/* new sources on their way in for failed ones, see source_swap_begin. the
+ * pads are the old sources' selector inputs */
+typedef struct _DreamSourceSwap {
+	App *app;
+	GstPad *apad, *vpad;
+	gint64 start;
+} DreamSourceSwap;
+
 static const gchar service[] = "com.dreambox.RTSPserver";
 static const gchar object_name[] = "/com/dreambox/RTSPserver";
 static GDBusNodeInfo *introspection_data = NULL;
@@ -198,6 +535,12 @@ static const gchar introspection_xml[] =
   "      <arg type='i' name='state' direction='out'/>"
   "    </signal>"
   "    <property type='i' name='sourceState' access='read'/>"
+  "    <signal name='sourceTransition'>"
+  "      <arg type='i' name='from' direction='out'/>"
+  "      <arg type='i' name='to' direction='out'/>"
+  "      <arg type='i' name='milliseconds' direction='out'/>"
+  "    </signal>"
+  "    <property type='i' name='sourceTransitionTime' access='read'/>"
   "    <property type='i' name='audioBitrate' access='readwrite'/>"
   "    <property type='i' name='videoBitrate' access='readwrite'/>"
   "    <property type='i' name='gopLength' access='readwrite'/>"
@@ -208,6 +551,11 @@ static const gchar introspection_xml[] =
   "    <property type='i' name='slices' access='readwrite'/>"
   "    <property type='i' name='framerate' access='readwrite'/>"
   "    <property type='i' name='inputMode' access='readwrite'/>"
+  "    <signal name='inputModeChanged'>"
+  "      <arg type='i' name='mode' direction='out'/>"
+  "      <arg type='i' name='milliseconds' direction='out'/>"
+  "    </signal>"
+  "    <property type='i' name='inputSwitchTime' access='read'/>"
   "    <property type='i' name='profile' access='readwrite'/>"
   "    <property type='i' name='level' access='readwrite'/>"
   "    <property type='i' name='width' access='read'/>"
@@ -239,6 +587,17 @@ static const gchar introspection_xml[] =
   "      <arg type='i' name='state' direction='out'/>"
   "    </signal>"
   "    <property type='i' name='upstreamState' access='read'/>"
+  "    <property type='i' name='upstreamLatency' access='readwrite'/>"
+  "    <property type='i' name='upstreamBatchSize' access='readwrite'/>"
+  "    <property type='i' name='upstreamPaceBurst' access='readwrite'/>"
+  "    <property type='i' name='upstreamSpool' access='readwrite'/>"
+  "    <property type='i' name='upstreamEncoder' access='readwrite'/>"
+  "    <property type='s' name='upstreamLadder' access='readwrite'/>"
+  "    <property type='i' name='upstreamRung' access='read'/>"
+  "    <signal name='upstreamRungChanged'>"
+  "      <arg type='i' name='rung' direction='out'/>"
+  "    </signal>"
+  "    <property type='i' name='upstreamSpoolLimit' access='readwrite'/>"
   "    <signal name='tcpBitrate'>"
   "      <arg type='i' name='kbps' direction='out'/>"
   "    </signal>"
@@ -265,15 +624,40 @@ static const gchar introspection_xml[] =
   "    <property type='i' name='rtspState' access='read'/>"
   "    <property type='s' name='uriParameters' access='read'/>"
   "    <property type='b' name='autoBitrate' access='readwrite'/>"
+  "    <property type='i' name='standby' access='readwrite'/>"
+  "    <signal name='slateChanged'>"
+  "      <arg type='b' name='active' direction='out'/>"
+  "    </signal>"
+  "    <property type='b' name='slate' access='read'/>"
+  "    <signal name='sourcesSwapped'>"
+  "      <arg type='i' name='milliseconds' direction='out'/>"
+  "    </signal>"
+  "    <property type='i' name='channels' access='read'/>"
+  "    <property type='b' name='substream' access='readwrite'/>"
+  "    <property type='i' name='substreamBitrate' access='readwrite'/>"
+  "    <property type='i' name='substreamWidth' access='read'/>"
+  "    <property type='i' name='substreamHeight' access='read'/>"
+  "    <method name='setSubstreamResolution'>"
+  "      <arg type='i' name='width' direction='in'/>"
+  "      <arg type='i' name='height' direction='in'/>"
+  "    </method>"
   "    <signal name='encoderError'/>"
   "  </interface>"
   "</node>";
 
 static gboolean gst_get_capsprop(App *app, GstElement *element, const gchar* prop_name, guint32 *value);
 static gboolean gst_set_inputmode(App *app, inputMode input_mode);
-static gboolean gst_set_framerate(App *app, int value);
-static gboolean gst_set_resolution(App *app, int width, int height);
+static void input_switch_begin(App *app, inputMode input_mode);
+static void input_switch_reset(App *app);
+static void input_switch_done(DreamInputSwitch *sw);
+static GstPadProbeReturn input_switch_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data);
+static gboolean gst_set_framerate(App *app, GstElement *source, int value);
+static gboolean gst_set_resolution(App *app, GstElement *source, int width, int height);
 static gboolean gst_set_bitrate (App *app, GstElement *source, gint32 value);
+static void video_switch_begin(App *app, GstElement *source, gint width, gint height, gint framerate);
+static GstPadProbeReturn video_switch_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data);
+static void video_switch_free (gpointer user_data);
+static void video_cut(App *app, GstPad *pad, GstBuffer *buffer);
 static void get_source_properties (App *app);
 static void apply_source_properties (App *app);
 
@@ -283,24 +667,87 @@ static void on_name_lost (GDBusConnection *connection, const gchar *name, gpoint
 static GVariant *handle_get_property (GDBusConnection *, const gchar *, const gchar *, const gchar *, const gchar *, GError **, gpointer);
 static gboolean handle_set_property (GDBusConnection *, const gchar *, const gchar *, const gchar *, const gchar *, GVariant *, GError **, gpointer);
 static void handle_method_call (GDBusConnection *, const gchar *, const gchar *, const gchar *, const gchar *, GVariant *, GDBusMethodInvocation *, gpointer);
+static App *create_channel(DreamDaemon *daemon, guint channel, const gchar *source);
+static void free_channel(App *app);
 static void send_signal (App *app, const gchar *signal_name, GVariant *parameters);
 
 void assert_tsmux(App *app);
+void release_tsmux(App *app);
+static gboolean tsmux_needed(App *app);
+static gboolean tee_link_branch(App *app, GstElement *tee, GstElement *element);
+static gboolean pipeline_running(App *app);
+static gboolean branch_link(App *app, GstPad *srcpad, GstPad *sinkpad);
+static void branch_set_sync(GstElement *element);
+static gboolean branch_attach(App *app, GstPad *srcpad, GstElement *head, ...) G_GNUC_NULL_TERMINATED;
+static void branch_detach(App *app, BranchDoneFunc done, GstElement *head, ...) G_GNUC_NULL_TERMINATED;
+static GstElement *branch_appsrc_new(const gchar *name, guint64 max_bytes, DreamRing **ring);
+static void branch_appsrc_push(GstAppSrc *appsrc, GstSample *sample, GstBuffer *buffer);
+static gboolean branch_handover (DreamRingConsumer *consumer, GstSample *sample, gpointer user_data);
+static GstPadProbeReturn branch_upstream_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data);
 gboolean assert_state(App *app, GstElement *element, GstState targetstate);
 
+DreamSubstream *create_substream(App *app);
+static gboolean substream_available(App *app);
+static gboolean substream_needed(App *app);
+static gboolean substream_set_enabled(App *app, gboolean enabled);
+static gboolean assert_substream(App *app);
+void release_substream(App *app);
+static void substream_removed(App *app);
+static void substream_serve(App *app);
+
 static gboolean message_cb (GstBus * bus, GstMessage * message, gpointer user_data);
 static GstPadProbeReturn cancel_waiting_probe (GstPad * sinkpad, GstPadProbeInfo * info, gpointer user_data);
 static GstPadProbeReturn bitrate_measure_probe (GstPad * sinkpad, GstPadProbeInfo * info, gpointer user_data);
+static GstBuffer *upstream_drop_frames(App *app, GstBuffer *buffer);
+static gboolean upstream_handover (DreamRingConsumer *consumer, GstSample *sample, gpointer user_data);
+static void upstream_need_data (GstElement *, guint, gpointer);
 gboolean upstream_keep_alive(App *app);
 gboolean upstream_set_waiting(App *app);
 gboolean upstream_resume_transmitting(App *app);
-static GstPadProbeReturn inject_authorization (GstPad * sinkpad, GstPadProbeInfo * info, gpointer user_data);
 static void queue_underrun (GstElement *, gpointer);
 static void queue_overrun (GstElement *, gpointer);
+static void upstream_idle_add(App *app, guint *id, GSourceFunc func);
+static void upstream_idle_done(App *app, guint *id);
+static void upstream_idle_remove(App *app);
+static gboolean upstream_gop_dropped(App *app);
+static gboolean upstream_overrun_idle(App *app);
+static void upstream_congested (GstElement *, gpointer);
+static void upstream_decongested (GstElement *, gpointer);
 static void auto_adjust_bitrate(App *app);
-
+static void upstream_tune_queue(App *app, gint bitrate);
+static void upstream_set_pacing(App *app);
+static gboolean tsmux_link(GstElement *aq, GstElement *vq, GstElement *tsmux);
+static gboolean hls_active(App *app);
+static gboolean create_upstream_encoder(App *app);
+static gboolean link_upstream_encoder(App *app);
+static gboolean remove_upstream_encoder(App *app);
+static gboolean upstream_ladder_parse(DreamTCPupstream *t, const gchar *spec);
+static void upstream_ladder_apply(App *app, guint rung, GstClockTime now);
+static void upstream_ladder_reset(App *app);
+static gboolean upstream_ladder_headroom(App *app);
+static void upstream_ladder_climb(App *app, GstClockTime now);
+static gboolean upstream_ladder_climb_idle(App *app);
+
+static gboolean parse_source_backend(App *app, const gchar *source);
+static GstElement *create_source_element(App *app, GstDreamSoftSourceKind kind, guint instance);
+static void source_chain_link(App *app, GstElement *source, GstElement *parser, GstElement *selector, DreamSlateStream *st);
 gboolean create_source_pipeline(App *app);
+static void check_plugins(App *app);
+static gboolean assert_source_pipeline(App *app);
+static void startup_phase(App *app, const gchar *phase);
+static void startup_phase_at(App *app, const gchar *phase, gdouble now);
+static gboolean source_set_state(App *app, sourceState target);
+static void source_state_reached(App *app, sourceState state);
+static gboolean source_transition_timeout(gpointer user_data);
+static gboolean source_halted(gpointer user_data);
 gboolean halt_source_pipeline(App *app);
+static gboolean sources_unused(App *app);
+static gboolean idle_source_pipeline(App *app);
+static gboolean wake_source_pipeline(App *app);
+static gboolean request_key_unit(GstPad *srcpad);
+static void force_key_unit(App *app);
+static GstPadProbeReturn substream_key_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data);
+static gboolean video_running_size(GstElement *vparse, gint *width, gint *height);
 gboolean pause_source_pipeline(App *app);
 gboolean unpause_source_pipeline(App *app);
 gboolean destroy_pipeline(App *app);
@@ -314,8 +761,22 @@ gboolean start_hls_pipeline(App *app);
 gboolean stop_hls_pipeline(App *app);
 gboolean disable_hls_server(App *app);
 gboolean hls_client_timeout (gpointer user_data);
+static gint hls_fragment_index(DreamHLSserver *h);
+static gboolean hls_fragment_is_discont(DreamHLSserver *h, const gchar *uri);
+static GstPadProbeReturn hls_cut_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data);
+static gchar *hls_playlist_mark_discont(DreamHLSserver *h, const gchar *contents, gsize length);
 static void soup_do_get (SoupServer *server, SoupMessage *msg, const char *path, App *app);
+static gboolean soup_server_auth_filter (SoupAuthDomain *domain, SoupMessage *msg, gpointer user_data);
 static void soup_server_callback (SoupServer *server, SoupMessage *msg, const char *path, GHashTable *query, SoupClientContext *context, gpointer data);
+static App *hls_listener_channel(DreamListener *l, const gchar *path, const gchar **rest);
+static DreamListener *hls_listener_acquire(App *app, guint port);
+static void hls_listener_release(App *app, DreamListener *l);
+static void hls_requests_finish(App *app, guint status_code);
+static gboolean hls_pipeline_started(gpointer user_data);
+static gboolean hls_is_playlist(const gchar *path);
+static gchar *hls_master_playlist(App *app);
+static void hls_substream_attach(App *app);
+static void hls_substream_detach(App *app);
 
 gboolean enable_tcp_upstream(App *app, const gchar *upstream_host, guint32 upstream_port, const gchar *token);
 gboolean disable_tcp_upstream(App *app);
@@ -324,8 +785,40 @@ DreamRTSPserver *create_rtsp_server(App *app);
 gboolean enable_rtsp_server(App *app, const gchar *path, guint32 port, const gchar *user, const gchar *pass);
 gboolean disable_rtsp_server(App *app);
 gboolean start_rtsp_pipeline(App *app);
+static DreamListener *rtsp_listener_acquire(App *app, guint port);
+static void rtsp_listener_release(App *app, DreamListener *l);
+static void rtsp_listener_client_connected (GstRTSPServer * server, GstRTSPClient * client, gpointer user_data);
+static gboolean rtsp_path_matches(const gchar *abspath, const gchar *mount);
+static GstRTSPStatusCode rtsp_client_request(GstRTSPClient *client, GstRTSPContext *ctx, gpointer user_data);
+static DreamTimeline *timeline_new(GstElement *leader, GstElement *follower);
+static void timeline_free(DreamTimeline **tl);
+static GstBuffer *timeline_map(DreamTimeline *tl, GstElement *appsrc, GstBuffer *buffer);
+static void rtsp_attach_consumer(App *app, DreamRing *ring, DreamRingConsumer **consumer);
+static void rtsp_detach_consumer(App *app, DreamRing *ring, DreamRingConsumer **consumer);
+static gboolean rtsp_has_media(App *app);
+static void rtsp_substream_mount(App *app);
+static void rtsp_substream_unmount(App *app);
 
 static void encoder_signal_lost(GstElement *, gpointer user_data);
+static gchar *slate_launch(App *app, DreamSlateStream *st);
+static gboolean slate_load(App *app, DreamSlateStream *st, const gchar *launch);
+static void slate_load_free(DreamSlateLoad *load);
+static void slate_load_thread(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable);
+static void slate_loaded(GObject *source_object, GAsyncResult *res, gpointer user_data);
+static gboolean slate_prepare(gpointer user_data);
+static void slate_link(App *app, DreamSlateStream *st, GstElement *selector);
+static gboolean slate_start(App *app, gboolean retry);
+static gboolean slate_signal_lost(gpointer user_data);
+static void slate_push(DreamSlateStream *st, GstClockTime until);
+static gboolean slate_tick(gpointer user_data);
+static gboolean slate_retry(gpointer user_data);
+static gboolean slate_returned(gpointer user_data);
+static void slate_stop(App *app);
+static GstPadProbeReturn slate_live_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data);
+static GstPadProbeReturn slate_out_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data);
+static gboolean source_swap_begin(App *app);
+static GstPadProbeReturn source_swap_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data);
+static gboolean source_swap_done(gpointer user_data);
 
 G_END_DECLS
 
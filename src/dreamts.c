@@ -0,0 +1,269 @@
+/*
+ * GStreamer dreamrtspserver
+ * Copyright 2015-2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * Alternatively, this program may be distributed and executed on
+ * hardware which is licensed by Dream Property GmbH.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#include <string.h>
+
+#include "dreamts.h"
+
+GST_DEBUG_CATEGORY_EXTERN (dreamrtspserver_debug);
+#define GST_CAT_DEFAULT dreamrtspserver_debug
+
+#define TS_PID(p)          ((((p)[1] & 0x1F) << 8) | (p)[2])
+#define TS_PUSI(p)         ((p)[1] & 0x40)
+#define TS_AFC(p)          (((p)[3] >> 4) & 0x3)
+#define TS_CC(p)           ((p)[3] & 0x0F)
+#define TS_HAS_PAYLOAD(p)  (TS_AFC(p) & 0x1)
+#define TS_HAS_ADAPT(p)    (TS_AFC(p) & 0x2)
+#define TS_HAS_PCR(p)      (TS_HAS_ADAPT(p) && (p)[4] > 0 && ((p)[5] & 0x10))
+
+static guint _ts_payload_offset (const guint8 *p)
+{
+	guint offset = 4;
+	if (TS_HAS_ADAPT(p))
+		offset += 1 + p[4];
+	return offset;
+}
+
+static void _ts_parse_pat (DreamTSDropper *d, const guint8 *p)
+{
+	guint offset = _ts_payload_offset (p);
+	if (offset >= TS_PACK_SIZE)
+		return;
+	offset += 1 + p[offset];
+	if (offset + 8 > TS_PACK_SIZE || p[offset] != 0x00)
+		return;
+	guint section_end = offset + 3 + (((p[offset+1] & 0x0F) << 8) | p[offset+2]) - 4;
+	section_end = MIN (section_end, TS_PACK_SIZE);
+	for (offset += 8; offset + 4 <= section_end; offset += 4)
+	{
+		guint16 program = (p[offset] << 8) | p[offset+1];
+		if (program == 0)
+			continue;
+		guint16 pid = ((p[offset+2] & 0x1F) << 8) | p[offset+3];
+		if (pid != d->pmt_pid)
+			GST_DEBUG ("PAT: program %u on pmt pid 0x%04x", program, pid);
+		d->pmt_pid = pid;
+		break;
+	}
+}
+
+static void _ts_parse_pmt (DreamTSDropper *d, const guint8 *p)
+{
+	guint offset = _ts_payload_offset (p);
+	if (offset >= TS_PACK_SIZE)
+		return;
+	offset += 1 + p[offset];
+	if (offset + 12 > TS_PACK_SIZE || p[offset] != 0x02)
+		return;
+	guint section_end = offset + 3 + (((p[offset+1] & 0x0F) << 8) | p[offset+2]) - 4;
+	section_end = MIN (section_end, TS_PACK_SIZE);
+	guint program_info_length = ((p[offset+10] & 0x0F) << 8) | p[offset+11];
+	for (offset += 12 + program_info_length; offset + 5 <= section_end; )
+	{
+		guint8 stream_type = p[offset];
+		guint16 pid = ((p[offset+1] & 0x1F) << 8) | p[offset+2];
+		if (stream_type == TS_STREAM_TYPE_H264)
+		{
+			if (pid != d->video_pid)
+				GST_DEBUG ("PMT: h264 video on pid 0x%04x", pid);
+			d->video_pid = pid;
+			return;
+		}
+		offset += 5 + (((p[offset+3] & 0x0F) << 8) | p[offset+4]);
+	}
+}
+
+/* classifies the video frame starting in this PUSI packet by looking at the
+ * first VCL NAL unit of the PES payload. falls back to the adaptation field's
+ * random_access_indicator if the slice header isn't in the first packet */
+static tsFrameType _ts_video_frame_type (const guint8 *p)
+{
+	gboolean random_access = TS_HAS_ADAPT(p) && p[4] > 0 && (p[5] & 0x40);
+	guint offset = _ts_payload_offset (p);
+	guint i;
+
+	if (offset + 9 <= TS_PACK_SIZE && p[offset] == 0x00 && p[offset+1] == 0x00 && p[offset+2] == 0x01)
+	{
+		offset += 9 + p[offset+8];
+		for (i = offset; i + 3 < TS_PACK_SIZE; i++)
+		{
+			if (p[i] == 0x00 && p[i+1] == 0x00 && p[i+2] == 0x01)
+			{
+				guint8 nal_type = p[i+3] & 0x1F;
+				if (nal_type == 5)
+					return TS_FRAME_IDR;
+				if (nal_type == 1)
+					return (p[i+3] & 0x60) ? TS_FRAME_REF : TS_FRAME_NONREF;
+				i += 2;
+			}
+		}
+	}
+	return random_access ? TS_FRAME_IDR : TS_FRAME_UNKNOWN;
+}
+
+/* turns a dropped video packet which carried a PCR into an adaptation field
+ * only packet, so the receiver's clock recovery doesn't starve */
+static void _ts_make_pcr_only (guint8 *p, guint8 cc)
+{
+	p[3] = (p[3] & 0xC0) | 0x20 | (cc & 0x0F);
+	p[4] = TS_PACK_SIZE - 5;
+	p[5] = 0x10;
+	memset (p + 12, 0xFF, TS_PACK_SIZE - 12);
+}
+
+GstBuffer *dream_ts_null_packets_new (guint count)
+{
+	gsize size = count * TS_PACK_SIZE;
+	guint8 *data = g_malloc (size);
+	guint8 *p;
+
+	for (p = data; p < data + size; p += TS_PACK_SIZE)
+	{
+		p[0] = TS_SYNC_BYTE;
+		p[1] = (TS_PID_NULL >> 8) & 0x1F;
+		p[2] = TS_PID_NULL & 0xFF;
+		p[3] = 0x10;
+		memset (p + 4, 0xFF, TS_PACK_SIZE - 4);
+	}
+	return gst_buffer_new_wrapped (data, size);
+}
+
+/* returns the pid if the packet carries a PCR (in 27 MHz units), TS_PID_NONE otherwise */
+guint16 dream_ts_get_pcr (const guint8 *p, guint64 *pcr)
+{
+	if (p[0] != TS_SYNC_BYTE || !TS_HAS_PCR(p))
+		return TS_PID_NONE;
+	guint64 base = ((guint64) p[6] << 25) | (p[7] << 17) | (p[8] << 9) | (p[9] << 1) | (p[10] >> 7);
+	*pcr = base * 300 + (((p[10] & 0x01) << 8) | p[11]);
+	return TS_PID(p);
+}
+
+void dream_ts_dropper_init (DreamTSDropper *d)
+{
+	memset (d, 0, sizeof(DreamTSDropper));
+	d->pmt_pid = d->video_pid = TS_PID_NONE;
+}
+
+/* returns the buffer itself if nothing had to be touched, NULL if all packets
+ * were dropped or a new buffer with the remaining packets. the input buffer
+ * is never modified because it's still shared with the other tee branches */
+GstBuffer *dream_ts_dropper_process (DreamTSDropper *d, GstBuffer *buffer, tsDropLevel level, gboolean *gop_dropped)
+{
+	GstMapInfo map;
+	guint8 *out = NULL;
+	gsize offset, outsize = 0;
+
+	if (!gst_buffer_map (buffer, &map, GST_MAP_READ))
+		return buffer;
+
+	if (!map.size || map.size % TS_PACK_SIZE || map.data[0] != TS_SYNC_BYTE)
+	{
+		GST_LOG ("%" GST_PTR_FORMAT " isn't aligned to transport stream packets, pass through", buffer);
+		gst_buffer_unmap (buffer, &map);
+		return buffer;
+	}
+
+	for (offset = 0; offset < map.size; offset += TS_PACK_SIZE)
+	{
+		const guint8 *p = map.data + offset;
+		guint16 pid = TS_PID(p);
+		gboolean keep = TRUE, pcr_only = FALSE;
+
+		if (pid == TS_PID_PAT && TS_PUSI(p))
+			_ts_parse_pat (d, p);
+		else if (pid == d->pmt_pid && TS_PUSI(p))
+			_ts_parse_pmt (d, p);
+		else if (pid == d->video_pid && TS_HAS_PAYLOAD(p))
+		{
+			if (TS_PUSI(p))
+			{
+				tsFrameType type = _ts_video_frame_type (p);
+				if (level >= TS_DROP_VIDEO)
+				{
+					if (!d->dropping_video)
+						GST_DEBUG ("audio only, drop all video frames");
+					d->dropping_video = TRUE;
+					d->dropping_gop = FALSE;
+				}
+				else if (type == TS_FRAME_IDR || type == TS_FRAME_UNKNOWN)
+				{
+					/* an unknown frame may well be the key frame, never throw that away */
+					if (d->dropping_gop || d->dropping_video)
+						GST_DEBUG ("%s frame arrived, stop dropping GOP (dropped %" G_GUINT64_FORMAT " frames so far)", type == TS_FRAME_IDR ? "IDR" : "unknown", d->dropped_frames);
+					d->dropping_gop = d->dropping_video = FALSE;
+				}
+				else if (d->dropping_video)
+				{
+					/* the decoder has no reference frames left, video resumes with the next IDR */
+					d->dropping_video = FALSE;
+					d->dropping_gop = TRUE;
+				}
+				else if (level >= TS_DROP_GOP && !d->dropping_gop && d->in_frame)
+				{
+					GST_DEBUG ("drop remaining frames of this GOP");
+					d->dropping_gop = TRUE;
+					d->dropped_gops++;
+					if (gop_dropped)
+						*gop_dropped = TRUE;
+				}
+				d->in_frame = TRUE;
+				d->dropping_frame = d->dropping_video || d->dropping_gop || (level >= TS_DROP_NONREF && type == TS_FRAME_NONREF);
+				if (d->dropping_frame)
+					d->dropped_frames++;
+			}
+			if (d->dropping_frame)
+			{
+				d->dropped_packets++;
+				d->cc_offset = (d->cc_offset + 1) & 0x0F;
+				keep = FALSE;
+				pcr_only = TS_HAS_PCR(p);
+			}
+		}
+
+		if (!out && (!keep || (pid == d->video_pid && d->cc_offset)))
+		{
+			out = g_malloc (map.size);
+			memcpy (out, map.data, offset);
+			outsize = offset;
+		}
+		if (!out || (!keep && !pcr_only))
+			continue;
+
+		memcpy (out + outsize, p, TS_PACK_SIZE);
+		/* adaptation field only packets repeat the previous counter, which has moved as well */
+		if (pcr_only)
+			_ts_make_pcr_only (out + outsize, TS_CC(p) - d->cc_offset);
+		else if (pid == d->video_pid)
+			out[outsize+3] = (p[3] & 0xF0) | ((TS_CC(p) - d->cc_offset) & 0x0F);
+		outsize += TS_PACK_SIZE;
+	}
+	gst_buffer_unmap (buffer, &map);
+
+	if (!out)
+		return buffer;
+
+	if (outsize == 0)
+	{
+		g_free (out);
+		return NULL;
+	}
+
+	GstBuffer *outbuf = gst_buffer_new_wrapped (out, outsize);
+	gst_buffer_copy_into (outbuf, buffer, GST_BUFFER_COPY_METADATA, 0, -1);
+	return outbuf;
+}
@@ -0,0 +1,71 @@
+/*
+ * GStreamer dreamrtspserver
+ * Copyright 2015-2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * Alternatively, this program may be distributed and executed on
+ * hardware which is licensed by Dream Property GmbH.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifndef __DREAMTS_H__
+#define __DREAMTS_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+#define TS_PACK_SIZE 188
+#define TS_PER_FRAME 7
+
+#define TS_SYNC_BYTE 0x47
+#define TS_PID_PAT   0x0000
+#define TS_PID_NULL  0x1FFF
+#define TS_PID_NONE  0xFFFF
+
+#define TS_STREAM_TYPE_AAC  0x0F
+#define TS_STREAM_TYPE_H264 0x1B
+
+typedef enum {
+        TS_DROP_NONE = 0,        /* pass everything */
+        TS_DROP_NONREF = 1,      /* drop whole non-reference video frames */
+        TS_DROP_GOP = 2,         /* drop the remaining video frames until the next IDR */
+        TS_DROP_VIDEO = 3        /* drop all video frames, audio only */
+} tsDropLevel;
+
+typedef enum {
+        TS_FRAME_UNKNOWN = 0,
+        TS_FRAME_IDR = 1,
+        TS_FRAME_REF = 2,
+        TS_FRAME_NONREF = 3
+} tsFrameType;
+
+/* drop stage state for a single program transport stream. only packets of the
+ * h264 video pid are ever dropped, and only in units of whole PES packets
+ * (= whole frames), so PAT/PMT and audio always arrive intact. IDR frames are
+ * only dropped when the stream is reduced to audio only. frames which can't
+ * be classified are kept and treated like an IDR */
+typedef struct {
+	guint16 pmt_pid, video_pid;
+	gboolean in_frame, dropping_frame, dropping_gop, dropping_video;
+	guint8 cc_offset;
+	guint64 dropped_frames, dropped_gops, dropped_packets;
+} DreamTSDropper;
+
+GstBuffer *dream_ts_null_packets_new (guint count);
+guint16 dream_ts_get_pcr (const guint8 *p, guint64 *pcr);
+
+void dream_ts_dropper_init (DreamTSDropper *d);
+GstBuffer *dream_ts_dropper_process (DreamTSDropper *d, GstBuffer *buffer, tsDropLevel level, gboolean *gop_dropped);
+
+G_END_DECLS
+
+#endif /* __DREAMTS_H__ */
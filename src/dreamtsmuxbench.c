@@ -0,0 +1,244 @@
+/*
+ * GStreamer dreamrtspserver
+ * Copyright 2015-2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * Alternatively, this program may be distributed and executed on
+ * hardware which is licensed by Dream Property GmbH.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+/* measures how many TS packets per second and per core dreamtsmux and
+ * mpegtsmux get through. a clip is encoded once up front, then both muxers
+ * are fed from memory as fast as they take it, so the process' cpu time is
+ * mostly the muxer's. the appsrc and fakesink overhead is the same for both.
+ *
+ *   make dreamtsmuxbench && ./dreamtsmuxbench --seconds 30 --rounds 20 */
+
+#include <string.h>
+#include <time.h>
+#include <gst/gst.h>
+#include <gst/app/app.h>
+#include "gstdreamtsmux.h"
+#include "dreamts.h"
+
+typedef struct {
+	GPtrArray *buffers;
+	GstCaps *caps;
+	GstClockTime duration;
+} BenchClip;
+
+static gint seconds = 30;
+static gint rounds = 20;
+static gint bitrate = 4000;
+
+static GOptionEntry options[] = {
+	{ "seconds", 's', 0, G_OPTION_ARG_INT, &seconds, "Length of the encoded clip", "S" },
+	{ "rounds", 'r', 0, G_OPTION_ARG_INT, &rounds, "How often the clip is muxed", "N" },
+	{ "bitrate", 'b', 0, G_OPTION_ARG_INT, &bitrate, "Video bitrate in kbit/s", "KBPS" },
+	{ NULL }
+};
+
+static gdouble cpu_seconds (void)
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static gboolean bench_encode (const gchar *description, BenchClip *clip)
+{
+	GError *err = NULL;
+	GstElement *pipeline = gst_parse_launch (description, &err);
+	GstElement *sink;
+	GstSample *sample;
+
+	if (!pipeline)
+	{
+		g_printerr ("couldn't create '%s': %s\n", description, err->message);
+		g_error_free (err);
+		return FALSE;
+	}
+	clip->buffers = g_ptr_array_new_with_free_func ((GDestroyNotify) gst_buffer_unref);
+	sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+	gst_element_set_state (pipeline, GST_STATE_PLAYING);
+	while ((sample = gst_app_sink_pull_sample (GST_APP_SINK (sink))))
+	{
+		GstBuffer *buffer = gst_sample_get_buffer (sample);
+		if (!clip->caps)
+			clip->caps = gst_caps_ref (gst_sample_get_caps (sample));
+		if (GST_BUFFER_PTS_IS_VALID (buffer))
+			clip->duration = MAX (clip->duration, GST_BUFFER_PTS (buffer) + (GST_BUFFER_DURATION_IS_VALID (buffer) ? GST_BUFFER_DURATION (buffer) : 0));
+		g_ptr_array_add (clip->buffers, gst_buffer_ref (buffer));
+		gst_sample_unref (sample);
+	}
+	gst_element_set_state (pipeline, GST_STATE_NULL);
+	gst_object_unref (sink);
+	gst_object_unref (pipeline);
+	return clip->buffers->len > 0;
+}
+
+static GstPadProbeReturn bench_count_probe (GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+	guint64 *bytes = user_data;
+	if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER)
+		*bytes += gst_buffer_get_size (GST_PAD_PROBE_INFO_BUFFER (info));
+	else
+		*bytes += gst_buffer_list_calculate_size (GST_PAD_PROBE_INFO_BUFFER_LIST (info));
+	return GST_PAD_PROBE_OK;
+}
+
+static void bench_push (GstElement *src, GstBuffer *buffer, GstClockTime offset)
+{
+	buffer = gst_buffer_copy (buffer);
+	if (GST_BUFFER_PTS_IS_VALID (buffer))
+		GST_BUFFER_PTS (buffer) += offset;
+	if (GST_BUFFER_DTS_IS_VALID (buffer))
+		GST_BUFFER_DTS (buffer) += offset;
+	gst_app_src_push_buffer (GST_APP_SRC (src), buffer);
+}
+
+/* returns packets per cpu second, 0 on failure */
+static gdouble bench_run (const gchar *name, GstElement *mux, const gchar *apad, const gchar *vpad, BenchClip *audio, BenchClip *video)
+{
+	GstElement *pipeline = gst_pipeline_new (NULL);
+	GstElement *asrc = gst_element_factory_make ("appsrc", NULL);
+	GstElement *vsrc = gst_element_factory_make ("appsrc", NULL);
+	GstElement *sink = gst_element_factory_make ("fakesink", NULL);
+	GstClockTime period = MAX (audio->duration, video->duration);
+	guint64 bytes = 0, packets;
+	gdouble cpu, wall;
+	GstMessage *msg;
+	GstPad *pad;
+	gint r;
+
+	g_object_set (asrc, "caps", audio->caps, "format", GST_FORMAT_TIME, "max-bytes", G_GUINT64_CONSTANT (0), NULL);
+	g_object_set (vsrc, "caps", video->caps, "format", GST_FORMAT_TIME, "max-bytes", G_GUINT64_CONSTANT (0), NULL);
+	g_object_set (sink, "sync", FALSE, NULL);
+	gst_bin_add_many (GST_BIN (pipeline), asrc, vsrc, mux, sink, NULL);
+	if (!gst_element_link_pads (asrc, "src", mux, apad) || !gst_element_link_pads (vsrc, "src", mux, vpad) || !gst_element_link (mux, sink))
+	{
+		g_printerr ("%s: couldn't link the pipeline\n", name);
+		gst_object_unref (pipeline);
+		return 0;
+	}
+	pad = gst_element_get_static_pad (sink, "sink");
+	gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST, bench_count_probe, &bytes, NULL);
+	gst_object_unref (pad);
+
+	cpu = cpu_seconds ();
+	wall = g_get_monotonic_time () / 1e6;
+	gst_element_set_state (pipeline, GST_STATE_PLAYING);
+	for (r = 0; r < rounds; r++)
+	{
+		guint a = 0, v = 0;
+		/* interleaved in decode order like the encoder delivers them */
+		while (a < audio->buffers->len || v < video->buffers->len)
+		{
+			GstBuffer *ab = a < audio->buffers->len ? g_ptr_array_index (audio->buffers, a) : NULL;
+			GstBuffer *vb = v < video->buffers->len ? g_ptr_array_index (video->buffers, v) : NULL;
+			if (ab && (!vb || GST_BUFFER_DTS_OR_PTS (ab) <= GST_BUFFER_DTS_OR_PTS (vb)))
+			{
+				bench_push (asrc, ab, r * period);
+				a++;
+			}
+			else
+			{
+				bench_push (vsrc, vb, r * period);
+				v++;
+			}
+		}
+	}
+	gst_app_src_end_of_stream (GST_APP_SRC (asrc));
+	gst_app_src_end_of_stream (GST_APP_SRC (vsrc));
+
+	msg = gst_bus_timed_pop_filtered (GST_ELEMENT_BUS (pipeline), GST_CLOCK_TIME_NONE, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+	cpu = cpu_seconds () - cpu;
+	wall = g_get_monotonic_time () / 1e6 - wall;
+	gst_element_set_state (pipeline, GST_STATE_NULL);
+	gst_object_unref (pipeline);
+
+	if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR)
+	{
+		GError *err;
+		gst_message_parse_error (msg, &err, NULL);
+		g_printerr ("%s: %s\n", name, err->message);
+		g_error_free (err);
+		gst_message_unref (msg);
+		return 0;
+	}
+	gst_message_unref (msg);
+
+	packets = bytes / TS_PACK_SIZE;
+	g_print ("%-12s %12" G_GUINT64_FORMAT " packets %9.3f s cpu %9.3f s wall %14.0f packets/s/core\n", name, packets, cpu, wall, packets / cpu);
+	return packets / cpu;
+}
+
+int main (int argc, char *argv[])
+{
+	static const gchar *aacencs[] = { "avenc_aac", "fdkaacenc", "voaacenc", "faac", NULL };
+	GOptionContext *context = g_option_context_new ("- TS muxer benchmark");
+	BenchClip audio = { 0, }, video = { 0, };
+	GError *err = NULL;
+	GstElement *mpegtsmux;
+	const gchar *aacenc = NULL;
+	gdouble dream, mpeg;
+	gchar *description;
+	gint i;
+
+	g_option_context_add_main_entries (context, options, NULL);
+	g_option_context_add_group (context, gst_init_get_option_group ());
+	if (!g_option_context_parse (context, &argc, &argv, &err))
+	{
+		g_printerr ("%s\n", err->message);
+		return 1;
+	}
+	g_option_context_free (context);
+
+	for (i = 0; aacencs[i] && !aacenc; i++)
+		if (gst_registry_check_feature_version (gst_registry_get (), aacencs[i], 1, 0, 0))
+			aacenc = aacencs[i];
+	if (!aacenc)
+	{
+		g_printerr ("no aac encoder found\n");
+		return 1;
+	}
+
+	g_print ("encoding a %i s clip at %i kbit/s...\n", seconds, bitrate);
+	description = g_strdup_printf ("videotestsrc num-buffers=%i pattern=ball ! video/x-raw,width=1280,height=720,framerate=25/1 ! "
+		"x264enc bitrate=%i key-int-max=50 bframes=2 speed-preset=ultrafast ! h264parse ! "
+		"video/x-h264,stream-format=byte-stream,alignment=au ! appsink name=sink sync=false", seconds * 25, bitrate);
+	if (!bench_encode (description, &video))
+		return 1;
+	g_free (description);
+	description = g_strdup_printf ("audiotestsrc num-buffers=%i samplesperbuffer=1024 ! audio/x-raw,rate=48000,channels=2 ! audioconvert ! "
+		"%s ! aacparse ! audio/mpeg,stream-format=adts ! appsink name=sink sync=false", seconds * 48000 / 1024, aacenc);
+	if (!bench_encode (description, &audio))
+		return 1;
+	g_free (description);
+
+	dream = bench_run ("dreamtsmux", g_object_new (GST_TYPE_DREAM_TS_MUX, "alignment", TS_PER_FRAME, NULL), "audio", "video", &audio, &video);
+	if (!(mpegtsmux = gst_element_factory_make ("mpegtsmux", NULL)))
+	{
+		g_printerr ("mpegtsmux isn't available, nothing to compare against\n");
+		return dream > 0 ? 0 : 1;
+	}
+	g_object_set (mpegtsmux, "alignment", TS_PER_FRAME, NULL);
+	mpeg = bench_run ("mpegtsmux", mpegtsmux, NULL, NULL, &audio, &video);
+	if (dream > 0 && mpeg > 0)
+		g_print ("dreamtsmux does %.2fx the packets per core of mpegtsmux\n", dream / mpeg);
+
+	g_ptr_array_unref (audio.buffers);
+	g_ptr_array_unref (video.buffers);
+	gst_caps_unref (audio.caps);
+	gst_caps_unref (video.caps);
+	return dream > 0 && mpeg > 0 ? 0 : 1;
+}
@@ -0,0 +1,554 @@
+/*
+ * GStreamer dreamrtspserver
+ * Copyright 2015-2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * Alternatively, this program may be distributed and executed on
+ * hardware which is licensed by Dream Property GmbH.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+/* stand-in for dreamaudiosource/dreamvideosource on machines without the
+ * hardware encoder. without a location it encodes a live test pattern or
+ * tone in software, with one it replays the elementary stream of a recorded
+ * TS or ES capture in realtime and loops it. it has the properties the
+ * daemon sets on the hardware sources; bitrate, gop-length, bframes and the
+ * caps reach the software encoder, the rest is only stored. a replayed file
+ * keeps the bitrate it was recorded with */
+
+#include <string.h>
+
+#include "gstdreamsoftsource.h"
+
+GST_DEBUG_CATEGORY_STATIC (dream_soft_source_debug);
+#define GST_CAT_DEFAULT dream_soft_source_debug
+
+enum
+{
+	PROP_0,
+	PROP_KIND,
+	PROP_LOCATION,
+	PROP_CAPS,
+	PROP_BITRATE,
+	PROP_INPUT_MODE,
+	PROP_GOP_LENGTH,
+	PROP_GOP_SCENE,
+	PROP_OPEN_GOP,
+	PROP_BFRAMES,
+	PROP_PFRAMES,
+	PROP_SLICES,
+	PROP_LEVEL
+};
+
+enum
+{
+	SIGNAL_SIGNAL_LOST,
+	LAST_SIGNAL
+};
+
+static guint gst_dream_soft_source_signals[LAST_SIGNAL] = { 0 };
+
+/* test patterns per input mode (live, hdmi-in, background), so switching
+ * the input is visible and audible in the output */
+static const gint video_patterns[] = { 0 /* smpte */, 18 /* ball */, 2 /* black */ };
+static const gint audio_waves[] = { 0 /* sine */, 8 /* ticks */, 4 /* silence */ };
+
+static GstStaticPadTemplate srctemplate = GST_STATIC_PAD_TEMPLATE ("src",
+		GST_PAD_SRC,
+		GST_PAD_ALWAYS,
+		GST_STATIC_CAPS ("video/x-h264; audio/mpeg"));
+
+GType gst_dream_soft_source_kind_get_type (void)
+{
+	static GType kind_type = 0;
+	static const GEnumValue kinds[] = {
+		{DREAM_SOFT_SOURCE_AUDIO, "AAC audio", "audio"},
+		{DREAM_SOFT_SOURCE_VIDEO, "H.264 video", "video"},
+		{0, NULL, NULL}
+	};
+	if (!kind_type)
+		kind_type = g_enum_register_static ("GstDreamSoftSourceKind", kinds);
+	return kind_type;
+}
+
+#define gst_dream_soft_source_parent_class parent_class
+G_DEFINE_TYPE (GstDreamSoftSource, gst_dream_soft_source, GST_TYPE_BIN);
+
+static void gst_dream_soft_source_finalize (GObject * object);
+static void gst_dream_soft_source_set_property (GObject * object, guint prop_id, const GValue * value, GParamSpec * pspec);
+static void gst_dream_soft_source_get_property (GObject * object, guint prop_id, GValue * value, GParamSpec * pspec);
+static GstStateChangeReturn gst_dream_soft_source_change_state (GstElement * element, GstStateChange transition);
+static void gst_dream_soft_source_handle_message (GstBin * bin, GstMessage * message);
+
+static void gst_dream_soft_source_class_init (GstDreamSoftSourceClass * klass)
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+	GstElementClass *gstelement_class = GST_ELEMENT_CLASS (klass);
+	GstBinClass *gstbin_class = GST_BIN_CLASS (klass);
+
+	gobject_class->finalize = gst_dream_soft_source_finalize;
+	gobject_class->set_property = gst_dream_soft_source_set_property;
+	gobject_class->get_property = gst_dream_soft_source_get_property;
+
+	g_object_class_install_property (gobject_class, PROP_KIND,
+		g_param_spec_enum ("kind", "Kind", "Whether this stands in for the audio or the video source",
+			gst_dream_soft_source_kind_get_type (), DREAM_SOFT_SOURCE_VIDEO, G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_LOCATION,
+		g_param_spec_string ("location", "Location", "TS or ES capture to replay (NULL = encode a test signal)",
+			NULL, G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_CAPS,
+		g_param_spec_boxed ("caps", "Caps", "Encoded caps: resolution, framerate and profile, or sample rate and channels",
+			GST_TYPE_CAPS, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_BITRATE,
+		g_param_spec_int ("bitrate", "Bitrate", "Encoder bitrate in kbit/s",
+			1, G_MAXINT, DEFAULT_SOFT_VIDEO_BITRATE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_INPUT_MODE,
+		g_param_spec_int ("input_mode", "Input mode", "Live, HDMI-in or background, selects the test signal",
+			0, G_N_ELEMENTS (video_patterns) - 1, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_GOP_LENGTH,
+		g_param_spec_int ("gop-length", "GOP length", "Frames between keyframes (0 = auto)",
+			0, G_MAXINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_GOP_SCENE,
+		g_param_spec_boolean ("gop-scene", "GOP on scene change", "Start a new GOP on scene changes",
+			FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_OPEN_GOP,
+		g_param_spec_boolean ("open-gop", "Open GOP", "Allow open GOPs",
+			FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_BFRAMES,
+		g_param_spec_int ("bframes", "B-frames", "B-frames between references",
+			0, 16, 2, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_PFRAMES,
+		g_param_spec_int ("pframes", "P-frames", "P-frames between I-frames",
+			0, G_MAXINT, 1, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_SLICES,
+		g_param_spec_int ("slices", "Slices", "Slices per frame",
+			0, G_MAXINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_LEVEL,
+		g_param_spec_int ("level", "Level", "H.264 level",
+			0, G_MAXINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	gst_dream_soft_source_signals[SIGNAL_SIGNAL_LOST] =
+		g_signal_new ("signal-lost", G_TYPE_FROM_CLASS (klass), G_SIGNAL_RUN_LAST,
+			G_STRUCT_OFFSET (GstDreamSoftSourceClass, signal_lost), NULL, NULL, NULL, G_TYPE_NONE, 0);
+
+	gst_element_class_add_static_pad_template (gstelement_class, &srctemplate);
+	gst_element_class_set_static_metadata (gstelement_class,
+		"Dreambox software source", "Source/Audio/Video",
+		"Test signal or file replay standing in for the hardware encoder",
+		"Andreas Frisch <fraxinas@opendreambox.org>");
+
+	gstelement_class->change_state = GST_DEBUG_FUNCPTR (gst_dream_soft_source_change_state);
+	gstbin_class->handle_message = GST_DEBUG_FUNCPTR (gst_dream_soft_source_handle_message);
+
+	GST_DEBUG_CATEGORY_INIT (dream_soft_source_debug, "dreamsoftsource", 0, "Dreambox software source");
+}
+
+static void gst_dream_soft_source_init (GstDreamSoftSource * self)
+{
+	self->kind = DREAM_SOFT_SOURCE_VIDEO;
+	self->bitrate = DEFAULT_SOFT_VIDEO_BITRATE;
+	self->bframes = 2;
+	self->pframes = 1;
+	self->loop_first = self->loop_end = GST_CLOCK_TIME_NONE;
+	self->loop_offset = 0;
+}
+
+static void gst_dream_soft_source_finalize (GObject * object)
+{
+	GstDreamSoftSource *self = GST_DREAM_SOFT_SOURCE (object);
+	g_free (self->location);
+	gst_caps_replace (&self->caps, NULL);
+	G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+/* lets GValue transformation cover elements whose property is an int64 or uint */
+static void gst_dream_soft_source_set_int (GstElement *element, const gchar *name, gint value)
+{
+	GValue v = G_VALUE_INIT;
+	if (!element || !g_object_class_find_property (G_OBJECT_GET_CLASS (element), name))
+		return;
+	g_value_init (&v, G_TYPE_INT);
+	g_value_set_int (&v, value);
+	g_object_set_property (G_OBJECT (element), name, &v);
+	g_value_unset (&v);
+}
+
+/* pushes the current properties into the elements of the encoding chain */
+static void gst_dream_soft_source_apply (GstDreamSoftSource *self)
+{
+	const GstStructure *s;
+	GstCaps *caps;
+	const gchar *profile;
+	gint width, height, fps_n, fps_d, rate, channels;
+
+	if (!self->caps || gst_caps_is_empty (self->caps))
+		return;
+	s = gst_caps_get_structure (self->caps, 0);
+
+	if (self->kind == DREAM_SOFT_SOURCE_VIDEO)
+	{
+		caps = gst_caps_new_empty_simple ("video/x-raw");
+		if (gst_structure_get_int (s, "width", &width) && gst_structure_get_int (s, "height", &height))
+			gst_caps_set_simple (caps, "width", G_TYPE_INT, width, "height", G_TYPE_INT, height, NULL);
+		if (gst_structure_get_fraction (s, "framerate", &fps_n, &fps_d))
+			gst_caps_set_simple (caps, "framerate", GST_TYPE_FRACTION, fps_n, fps_d, NULL);
+		if (self->rawfilter)
+			g_object_set (self->rawfilter, "caps", caps, NULL);
+		gst_caps_unref (caps);
+
+		caps = gst_caps_new_simple ("video/x-h264", "stream-format", G_TYPE_STRING, "byte-stream", "alignment", G_TYPE_STRING, "au", NULL);
+		if ((profile = gst_structure_get_string (s, "profile")))
+			gst_caps_set_simple (caps, "profile", G_TYPE_STRING, profile, NULL);
+		if (self->encfilter)
+			g_object_set (self->encfilter, "caps", caps, NULL);
+		gst_caps_unref (caps);
+
+		gst_dream_soft_source_set_int (self->encoder, "bitrate", self->bitrate);
+		gst_dream_soft_source_set_int (self->encoder, "key-int-max", self->gop_length);
+		gst_dream_soft_source_set_int (self->encoder, "bframes", self->bframes);
+		if (self->src && !self->location)
+			gst_dream_soft_source_set_int (self->src, "pattern", video_patterns[self->input_mode]);
+	}
+	else
+	{
+		caps = gst_caps_new_empty_simple ("audio/x-raw");
+		if (gst_structure_get_int (s, "rate", &rate))
+			gst_caps_set_simple (caps, "rate", G_TYPE_INT, rate, NULL);
+		if (gst_structure_get_int (s, "channels", &channels))
+			gst_caps_set_simple (caps, "channels", G_TYPE_INT, channels, NULL);
+		if (self->rawfilter)
+			g_object_set (self->rawfilter, "caps", caps, NULL);
+		gst_caps_unref (caps);
+
+		gst_dream_soft_source_set_int (self->encoder, "bitrate", self->bitrate * 1000);
+		if (self->src && !self->location)
+			gst_dream_soft_source_set_int (self->src, "wave", audio_waves[self->input_mode]);
+	}
+}
+
+static void gst_dream_soft_source_set_property (GObject * object, guint prop_id, const GValue * value, GParamSpec * pspec)
+{
+	GstDreamSoftSource *self = GST_DREAM_SOFT_SOURCE (object);
+
+	switch (prop_id) {
+		case PROP_KIND:
+			self->kind = g_value_get_enum (value);
+			break;
+		case PROP_LOCATION:
+			g_free (self->location);
+			self->location = g_value_dup_string (value);
+			break;
+		case PROP_CAPS:
+			gst_caps_replace (&self->caps, (GstCaps *) gst_value_get_caps (value));
+			break;
+		case PROP_BITRATE:
+			self->bitrate = g_value_get_int (value);
+			break;
+		case PROP_INPUT_MODE:
+			self->input_mode = g_value_get_int (value);
+			break;
+		case PROP_GOP_LENGTH:
+			self->gop_length = g_value_get_int (value);
+			break;
+		case PROP_GOP_SCENE:
+			self->gop_scene = g_value_get_boolean (value);
+			break;
+		case PROP_OPEN_GOP:
+			self->open_gop = g_value_get_boolean (value);
+			break;
+		case PROP_BFRAMES:
+			self->bframes = g_value_get_int (value);
+			break;
+		case PROP_PFRAMES:
+			self->pframes = g_value_get_int (value);
+			break;
+		case PROP_SLICES:
+			self->slices = g_value_get_int (value);
+			break;
+		case PROP_LEVEL:
+			self->level = g_value_get_int (value);
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+			return;
+	}
+	gst_dream_soft_source_apply (self);
+}
+
+static void gst_dream_soft_source_get_property (GObject * object, guint prop_id, GValue * value, GParamSpec * pspec)
+{
+	GstDreamSoftSource *self = GST_DREAM_SOFT_SOURCE (object);
+
+	switch (prop_id) {
+		case PROP_KIND:
+			g_value_set_enum (value, self->kind);
+			break;
+		case PROP_LOCATION:
+			g_value_set_string (value, self->location);
+			break;
+		case PROP_CAPS:
+			gst_value_set_caps (value, self->caps);
+			break;
+		case PROP_BITRATE:
+			g_value_set_int (value, self->bitrate);
+			break;
+		case PROP_INPUT_MODE:
+			g_value_set_int (value, self->input_mode);
+			break;
+		case PROP_GOP_LENGTH:
+			g_value_set_int (value, self->gop_length);
+			break;
+		case PROP_GOP_SCENE:
+			g_value_set_boolean (value, self->gop_scene);
+			break;
+		case PROP_OPEN_GOP:
+			g_value_set_boolean (value, self->open_gop);
+			break;
+		case PROP_BFRAMES:
+			g_value_set_int (value, self->bframes);
+			break;
+		case PROP_PFRAMES:
+			g_value_set_int (value, self->pframes);
+			break;
+		case PROP_SLICES:
+			g_value_set_int (value, self->slices);
+			break;
+		case PROP_LEVEL:
+			g_value_set_int (value, self->level);
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+			break;
+	}
+}
+
+/* like the hardware sources this never prerolls, a replayed file is paced
+ * against the clock instead */
+static GstStateChangeReturn gst_dream_soft_source_change_state (GstElement * element, GstStateChange transition)
+{
+	GstStateChangeReturn ret = GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+	if (ret == GST_STATE_CHANGE_SUCCESS && (transition == GST_STATE_CHANGE_READY_TO_PAUSED || transition == GST_STATE_CHANGE_PLAYING_TO_PAUSED))
+		ret = GST_STATE_CHANGE_NO_PREROLL;
+	return ret;
+}
+
+static GstElement *gst_dream_soft_source_element (GstDreamSoftSource *self, const gchar *factory)
+{
+	GstElement *element = gst_element_factory_make (factory, NULL);
+	if (element)
+		gst_bin_add (GST_BIN (self), element);
+	else
+		GST_WARNING_OBJECT (self, "couldn't create %s", factory);
+	return element;
+}
+
+/* tsdemux exposes every stream of the capture, only the first one of our kind is used */
+static void gst_dream_soft_source_demux_pad_added (GstElement *demux, GstPad *pad, gpointer user_data)
+{
+	GstDreamSoftSource *self = user_data;
+	GstPad *sinkpad = gst_element_get_static_pad (self->parser, "sink");
+	GstCaps *caps = gst_pad_get_current_caps (pad);
+	const gchar *wanted = self->kind == DREAM_SOFT_SOURCE_VIDEO ? "video/x-h264" : "audio/mpeg";
+
+	if (!caps)
+		caps = gst_pad_query_caps (pad, NULL);
+	if (!gst_pad_is_linked (sinkpad) && gst_structure_has_name (gst_caps_get_structure (caps, 0), wanted))
+	{
+		GST_DEBUG_OBJECT (self, "replaying %" GST_PTR_FORMAT " with %" GST_PTR_FORMAT, pad, caps);
+		if (gst_pad_link (pad, sinkpad) != GST_PAD_LINK_OK)
+			GST_WARNING_OBJECT (self, "couldn't link %" GST_PTR_FORMAT, pad);
+	}
+	gst_caps_unref (caps);
+	gst_object_unref (sinkpad);
+}
+
+/* restarts the file from the top. the chain is cycled through READY, which
+ * is simpler than a seek and doesn't flush the rest of the pipeline */
+static void gst_dream_soft_source_loop (GstElement *element, gpointer user_data)
+{
+	GstDreamSoftSource *self = GST_DREAM_SOFT_SOURCE (element);
+	GstIterator *it = gst_bin_iterate_sorted (GST_BIN (self));
+	GValue item = G_VALUE_INIT;
+
+	GST_INFO_OBJECT (self, "end of %s, looping with an offset of %" GST_TIME_FORMAT, self->location, GST_TIME_ARGS (self->loop_offset));
+	while (gst_iterator_next (it, &item) == GST_ITERATOR_OK)
+	{
+		GstElement *child = g_value_get_object (&item);
+		gst_element_set_state (child, GST_STATE_READY);
+		g_value_reset (&item);
+	}
+	g_value_unset (&item);
+	gst_iterator_free (it);
+	gst_bin_sync_children_states (GST_BIN (self));
+}
+
+/* a replay that can't be read or decoded any further is what a lost input
+ * is to the hardware sources. the daemon covers it with the slate and brings
+ * the source up again, so the error isn't passed on. the end of the file is
+ * no loss, gst_dream_soft_source_loop carries on from there */
+static void gst_dream_soft_source_handle_message (GstBin * bin, GstMessage * message)
+{
+	GstDreamSoftSource *self = GST_DREAM_SOFT_SOURCE (bin);
+
+	if (GST_MESSAGE_TYPE (message) == GST_MESSAGE_ERROR && self->location)
+	{
+		GError *err = NULL;
+		gboolean lost;
+		gst_message_parse_error (message, &err, NULL);
+		lost = (err->domain == GST_RESOURCE_ERROR && err->code == GST_RESOURCE_ERROR_READ) || err->domain == GST_STREAM_ERROR;
+		if (lost)
+			GST_WARNING_OBJECT (self, "replay of %s failed: %s", self->location, err->message);
+		g_error_free (err);
+		if (lost)
+		{
+			gst_message_unref (message);
+			g_signal_emit (self, gst_dream_soft_source_signals[SIGNAL_SIGNAL_LOST], 0);
+			return;
+		}
+	}
+	GST_BIN_CLASS (parent_class)->handle_message (bin, message);
+}
+
+/* keeps the timeline going across loops: the replay restarts at running
+ * time zero, so the parser's pad gets the length played so far as offset */
+static GstPadProbeReturn gst_dream_soft_source_loop_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+	GstDreamSoftSource *self = user_data;
+
+	if (info->type & GST_PAD_PROBE_TYPE_BUFFER)
+	{
+		GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+		GstClockTime ts = GST_BUFFER_DTS_OR_PTS (buffer);
+		if (GST_CLOCK_TIME_IS_VALID (ts))
+		{
+			if (!GST_CLOCK_TIME_IS_VALID (self->loop_first))
+				self->loop_first = ts;
+			if (GST_BUFFER_DURATION_IS_VALID (buffer))
+				ts += GST_BUFFER_DURATION (buffer);
+			if (!GST_CLOCK_TIME_IS_VALID (self->loop_end) || ts > self->loop_end)
+				self->loop_end = ts;
+		}
+		return GST_PAD_PROBE_OK;
+	}
+
+	if (GST_EVENT_TYPE (GST_PAD_PROBE_INFO_EVENT (info)) != GST_EVENT_EOS)
+		return GST_PAD_PROBE_OK;
+
+	if (GST_CLOCK_TIME_IS_VALID (self->loop_first) && self->loop_end > self->loop_first)
+		self->loop_offset += self->loop_end - self->loop_first;
+	else
+		self->loop_offset += GST_SECOND;
+	self->loop_first = self->loop_end = GST_CLOCK_TIME_NONE;
+	gst_pad_set_offset (pad, self->loop_offset);
+	gst_element_call_async (GST_ELEMENT (self), gst_dream_soft_source_loop, NULL, NULL);
+	return GST_PAD_PROBE_DROP;
+}
+
+/* both builders return the last element of the chain, NULL if a plugin is missing */
+static GstElement *gst_dream_soft_source_build_test (GstDreamSoftSource *self)
+{
+	gboolean video = self->kind == DREAM_SOFT_SOURCE_VIDEO;
+	GstElement *convert;
+
+	self->src = gst_dream_soft_source_element (self, video ? "videotestsrc" : "audiotestsrc");
+	convert = gst_dream_soft_source_element (self, video ? "videoconvert" : "audioconvert");
+	self->rawfilter = gst_dream_soft_source_element (self, "capsfilter");
+	self->encoder = gst_dream_soft_source_element (self, video ? "x264enc" : "avenc_aac");
+	if (video)
+		self->encfilter = gst_dream_soft_source_element (self, "capsfilter");
+	if (!(self->src && convert && self->rawfilter && self->encoder && (self->encfilter || !video)))
+		return NULL;
+
+	g_object_set (self->src, "is-live", TRUE, NULL);
+	if (video)
+	{
+		/* fast enough for a small box, but keeps b-frames unlike tune=zerolatency */
+		gst_util_set_object_arg (G_OBJECT (self->encoder), "speed-preset", "superfast");
+		gst_dream_soft_source_set_int (self->encoder, "rc-lookahead", 5);
+		return gst_element_link_many (self->src, convert, self->rawfilter, self->encoder, self->encfilter, NULL) ? self->encfilter : NULL;
+	}
+	return gst_element_link_many (self->src, convert, self->rawfilter, self->encoder, NULL) ? self->encoder : NULL;
+}
+
+static GstElement *gst_dream_soft_source_build_file (GstDreamSoftSource *self)
+{
+	gboolean video = self->kind == DREAM_SOFT_SOURCE_VIDEO;
+	gchar *lower = g_ascii_strdown (self->location, -1);
+	gboolean ts = g_str_has_suffix (lower, ".ts") || g_str_has_suffix (lower, ".m2ts") || g_str_has_suffix (lower, ".mts") || g_str_has_suffix (lower, ".trp");
+	GstElement *demux = NULL, *esfilter = NULL, *sync;
+	GstPad *pad;
+	g_free (lower);
+
+	self->src = gst_dream_soft_source_element (self, "filesrc");
+	if (ts)
+		demux = gst_dream_soft_source_element (self, "tsdemux");
+	else if (video)
+		esfilter = gst_dream_soft_source_element (self, "capsfilter");
+	self->parser = gst_dream_soft_source_element (self, video ? "h264parse" : "aacparse");
+	sync = gst_dream_soft_source_element (self, "identity");
+	if (!(self->src && self->parser && sync && (demux || esfilter || !video)))
+		return NULL;
+
+	g_object_set (self->src, "location", self->location, NULL);
+	g_object_set (sync, "sync", TRUE, NULL);
+	if (demux)
+	{
+		g_signal_connect (demux, "pad-added", G_CALLBACK (gst_dream_soft_source_demux_pad_added), self);
+		if (!gst_element_link (self->src, demux))
+			return NULL;
+	}
+	else if (esfilter)
+	{
+		/* a raw ES has no timestamps, h264parse derives them from the framerate */
+		gint fps_n = 25, fps_d = 1;
+		GstCaps *caps;
+		if (self->caps && !gst_caps_is_empty (self->caps))
+			gst_structure_get_fraction (gst_caps_get_structure (self->caps, 0), "framerate", &fps_n, &fps_d);
+		caps = gst_caps_new_simple ("video/x-h264", "stream-format", G_TYPE_STRING, "byte-stream", "framerate", GST_TYPE_FRACTION, fps_n, fps_d, NULL);
+		g_object_set (esfilter, "caps", caps, NULL);
+		gst_caps_unref (caps);
+		if (!gst_element_link_many (self->src, esfilter, self->parser, NULL))
+			return NULL;
+	}
+	else if (!gst_element_link (self->src, self->parser))
+		return NULL;
+
+	pad = gst_element_get_static_pad (self->parser, "src");
+	gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, gst_dream_soft_source_loop_probe, self, NULL);
+	gst_object_unref (pad);
+	return gst_element_link (self->parser, sync) ? sync : NULL;
+}
+
+GstElement *gst_dream_soft_source_new (GstDreamSoftSourceKind kind, const gchar *name, const gchar *location)
+{
+	GstDreamSoftSource *self = g_object_new (GST_TYPE_DREAM_SOFT_SOURCE, "name", name, "kind", kind, "location", location, NULL);
+	GstElement *last;
+	GstPad *pad;
+
+	self->caps = gst_caps_from_string (kind == DREAM_SOFT_SOURCE_VIDEO ? DEFAULT_SOFT_VIDEO_CAPS : DEFAULT_SOFT_AUDIO_CAPS);
+	if (kind == DREAM_SOFT_SOURCE_AUDIO)
+		self->bitrate = DEFAULT_SOFT_AUDIO_BITRATE;
+
+	last = location ? gst_dream_soft_source_build_file (self) : gst_dream_soft_source_build_test (self);
+	if (!last)
+	{
+		GST_WARNING_OBJECT (self, "couldn't build the %s %s source", kind == DREAM_SOFT_SOURCE_VIDEO ? "video" : "audio", location ? "replay" : "test");
+		gst_object_unref (gst_object_ref_sink (self));
+		return NULL;
+	}
+
+	pad = gst_element_get_static_pad (last, "src");
+	gst_element_add_pad (GST_ELEMENT (self), gst_ghost_pad_new ("src", pad));
+	gst_object_unref (pad);
+
+	gst_dream_soft_source_apply (self);
+	return GST_ELEMENT (self);
+}
@@ -0,0 +1,74 @@
+/*
+ * GStreamer dreamrtspserver
+ * Copyright 2015-2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * Alternatively, this program may be distributed and executed on
+ * hardware which is licensed by Dream Property GmbH.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifndef __GSTDREAMSOFTSOURCE_H__
+#define __GSTDREAMSOFTSOURCE_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_DREAM_SOFT_SOURCE              (gst_dream_soft_source_get_type ())
+#define GST_IS_DREAM_SOFT_SOURCE(obj)           (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GST_TYPE_DREAM_SOFT_SOURCE))
+#define GST_DREAM_SOFT_SOURCE(obj)              (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_DREAM_SOFT_SOURCE, GstDreamSoftSource))
+#define GST_DREAM_SOFT_SOURCE_CAST(obj)         ((GstDreamSoftSource*)(obj))
+
+typedef enum {
+	DREAM_SOFT_SOURCE_AUDIO = 0,
+	DREAM_SOFT_SOURCE_VIDEO = 1
+} GstDreamSoftSourceKind;
+
+#define DEFAULT_SOFT_VIDEO_CAPS  "video/x-h264, width=(int)1280, height=(int)720, framerate=(fraction)25/1, profile=(string)main"
+#define DEFAULT_SOFT_AUDIO_CAPS  "audio/mpeg, mpegversion=(int)4, rate=(int)48000, channels=(int)2"
+#define DEFAULT_SOFT_VIDEO_BITRATE 2000
+#define DEFAULT_SOFT_AUDIO_BITRATE 128
+
+typedef struct _GstDreamSoftSource GstDreamSoftSource;
+typedef struct _GstDreamSoftSourceClass GstDreamSoftSourceClass;
+
+struct _GstDreamSoftSource {
+	GstBin parent;
+
+	/* properties, named like the ones of dreamaudiosource/dreamvideosource */
+	GstDreamSoftSourceKind kind;
+	gchar *location;
+	GstCaps *caps;
+	gint bitrate, input_mode;
+	gint gop_length, bframes, pframes, slices, level;
+	gboolean gop_scene, open_gop;
+
+	/*< private >*/
+	GstElement *src, *rawfilter, *encoder, *encfilter, *parser;
+	GstClockTime loop_first, loop_end, loop_offset;
+};
+
+struct _GstDreamSoftSourceClass {
+	GstBinClass parent_class;
+
+	/* signals */
+	void (*signal_lost) (GstElement *source);
+};
+
+GType gst_dream_soft_source_get_type (void);
+GType gst_dream_soft_source_kind_get_type (void);
+
+GstElement *gst_dream_soft_source_new (GstDreamSoftSourceKind kind, const gchar *name, const gchar *location);
+
+G_END_DECLS
+
+#endif /* __GSTDREAMSOFTSOURCE_H__ */
@@ -0,0 +1,1365 @@
+/*
+ * GStreamer dreamrtspserver
+ * Copyright 2015-2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * Alternatively, this program may be distributed and executed on
+ * hardware which is licensed by Dream Property GmbH.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+/* tcp client sink for the mediator upstream. unlike tcpclientsink it never
+ * blocks inside write(): the socket is non-blocking and the streaming thread
+ * waits for writability on a cancellable, so flushing and state changes can
+ * always interrupt it. the kernel's send queue is watched with SIOCOUTQNSD and
+ * crossing the thresholds emits "congested" / "decongested", which is what the
+ * upstream state machine reacts on instead of guessing from queue overruns.
+ * in spool mode it never blocks at all: while the connection is congested or
+ * down the stream goes into a bounded journal, the connection is re-established
+ * in the background and the journal is drained faster than realtime */
+
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <limits.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+#ifdef __linux__
+#include <linux/sockios.h>
+#include <linux/errqueue.h>
+#endif
+
+#include "gstdreamtcpsink.h"
+#include "dreamts.h"
+
+GST_DEBUG_CATEGORY_STATIC (dream_tcp_sink_debug);
+#define GST_CAT_DEFAULT dream_tcp_sink_debug
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+#define HAVE_MSG_ZEROCOPY 1
+#endif
+
+enum
+{
+	PROP_0,
+	PROP_HOST,
+	PROP_PORT,
+	PROP_CONGESTION_THRESHOLD,
+	PROP_DECONGESTION_THRESHOLD,
+	PROP_ZEROCOPY,
+	PROP_BATCH_SIZE,
+	PROP_BATCH_LATENCY,
+	PROP_HANDSHAKE,
+	PROP_SPOOL,
+	PROP_SPOOL_LIMIT,
+	PROP_SPOOL_LOCATION,
+	PROP_PACE,
+	PROP_PACE_BURST,
+	PROP_PACE_BITRATE,
+	PROP_UNSENT_BYTES,
+	PROP_SPOOLED_BYTES,
+	PROP_BYTES_SENT,
+	PROP_LINK_RATE
+};
+
+enum
+{
+	SIGNAL_CONGESTED,
+	SIGNAL_DECONGESTED,
+	LAST_SIGNAL
+};
+
+static guint gst_dream_tcp_sink_signals[LAST_SIGNAL] = { 0 };
+
+/* a buffer queued for sending. it stays mapped until the kernel is done with it */
+typedef struct {
+	GstBuffer *buffer;
+	GstMapInfo map;
+	gsize offset;
+	gboolean zerocopy;
+	guint32 zerocopy_id;
+} SinkEntry;
+
+static GstStaticPadTemplate sinktemplate = GST_STATIC_PAD_TEMPLATE ("sink",
+		GST_PAD_SINK,
+		GST_PAD_ALWAYS,
+		GST_STATIC_CAPS_ANY);
+
+GType gst_dream_tcp_sink_spool_get_type (void)
+{
+	static GType spool_type = 0;
+	static const GEnumValue spool_modes[] = {
+		{DREAM_TCP_SINK_SPOOL_NONE, "Block while congested", "none"},
+		{DREAM_TCP_SINK_SPOOL_MEMORY, "Spool to memory", "memory"},
+		{DREAM_TCP_SINK_SPOOL_DISK, "Spool to a file", "disk"},
+		{0, NULL, NULL}
+	};
+	if (!spool_type)
+		spool_type = g_enum_register_static ("GstDreamTCPSinkSpool", spool_modes);
+	return spool_type;
+}
+
+#define gst_dream_tcp_sink_parent_class parent_class
+G_DEFINE_TYPE (GstDreamTCPSink, gst_dream_tcp_sink, GST_TYPE_BASE_SINK);
+
+static void gst_dream_tcp_sink_finalize (GObject * object);
+static void gst_dream_tcp_sink_set_property (GObject * object, guint prop_id, const GValue * value, GParamSpec * pspec);
+static void gst_dream_tcp_sink_get_property (GObject * object, guint prop_id, GValue * value, GParamSpec * pspec);
+static gboolean gst_dream_tcp_sink_start (GstBaseSink * bsink);
+static gboolean gst_dream_tcp_sink_stop (GstBaseSink * bsink);
+static gboolean gst_dream_tcp_sink_unlock (GstBaseSink * bsink);
+static gboolean gst_dream_tcp_sink_unlock_stop (GstBaseSink * bsink);
+static GstFlowReturn gst_dream_tcp_sink_render (GstBaseSink * bsink, GstBuffer * buffer);
+static GstFlowReturn gst_dream_tcp_sink_render_list (GstBaseSink * bsink, GstBufferList * list);
+static gboolean gst_dream_tcp_sink_event (GstBaseSink * bsink, GstEvent * event);
+
+static void gst_dream_tcp_sink_class_init (GstDreamTCPSinkClass * klass)
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+	GstElementClass *gstelement_class = GST_ELEMENT_CLASS (klass);
+	GstBaseSinkClass *gstbasesink_class = GST_BASE_SINK_CLASS (klass);
+
+	gobject_class->finalize = gst_dream_tcp_sink_finalize;
+	gobject_class->set_property = gst_dream_tcp_sink_set_property;
+	gobject_class->get_property = gst_dream_tcp_sink_get_property;
+
+	g_object_class_install_property (gobject_class, PROP_HOST,
+		g_param_spec_string ("host", "Host", "The host/IP to send the packets to",
+			"localhost", G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_PORT,
+		g_param_spec_int ("port", "Port", "The port to send the packets to",
+			0, 65535, 4953, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_CONGESTION_THRESHOLD,
+		g_param_spec_uint ("congestion-threshold", "Congestion threshold", "Unsent bytes in the socket send queue which signal congestion",
+			1, G_MAXUINT, DEFAULT_CONGESTION_THRESHOLD, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_DECONGESTION_THRESHOLD,
+		g_param_spec_uint ("decongestion-threshold", "Decongestion threshold", "Unsent bytes in the socket send queue below which the congestion is over",
+			0, G_MAXUINT, DEFAULT_DECONGESTION_THRESHOLD, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_ZEROCOPY,
+		g_param_spec_boolean ("zerocopy", "Zerocopy", "Send large writes with MSG_ZEROCOPY if the kernel supports it",
+			TRUE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_BATCH_SIZE,
+		g_param_spec_uint ("batch-size", "Batch size", "Collect this many bytes before writing them to the socket in one go (0 = write every buffer)",
+			0, G_MAXUINT, DEFAULT_BATCH_SIZE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_BATCH_LATENCY,
+		g_param_spec_uint64 ("batch-latency", "Batch latency", "Maximum time data may wait for the batch to fill up (in nanoseconds)",
+			0, G_MAXUINT64, DEFAULT_BATCH_LATENCY, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_HANDSHAKE,
+		g_param_spec_string ("handshake", "Handshake", "Sent first on every (re)connection, e.g. the mediator's authorization token",
+			NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_SPOOL,
+		g_param_spec_enum ("spool", "Spool", "Where to keep the stream while the connection is congested or down",
+			GST_TYPE_DREAM_TCP_SINK_SPOOL, DREAM_TCP_SINK_SPOOL_NONE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_SPOOL_LIMIT,
+		g_param_spec_uint ("spool-limit", "Spool limit", "Maximum size of the spool in bytes",
+			SPOOL_CHUNK_SIZE*2, G_MAXUINT, DEFAULT_SPOOL_LIMIT, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_SPOOL_LOCATION,
+		g_param_spec_string ("spool-location", "Spool location", "Directory for the disk spool file",
+			DEFAULT_SPOOL_LOCATION, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_PACE,
+		g_param_spec_boolean ("pace", "Pace", "Spread the stream over time at its PCR rate instead of sending bursts as they come",
+			FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_PACE_BURST,
+		g_param_spec_uint ("pace-burst", "Pace burst", "Bytes the pacer may send ahead of the stream rate",
+			TS_PACK_SIZE*TS_PER_FRAME, G_MAXUINT, DEFAULT_PACE_BURST, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_PACE_BITRATE,
+		g_param_spec_uint ("pace-bitrate", "Pace bitrate", "Pacing rate in kbit/s (0 = measure from the PCRs)",
+			0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_UNSENT_BYTES,
+		g_param_spec_uint ("unsent-bytes", "Unsent bytes", "Bytes in the batch and the socket send queue which haven't been sent yet",
+			0, G_MAXUINT, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_SPOOLED_BYTES,
+		g_param_spec_uint ("spooled-bytes", "Spooled bytes", "Bytes currently waiting in the spool",
+			0, G_MAXUINT, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_BYTES_SENT,
+		g_param_spec_uint64 ("bytes-sent", "Bytes sent", "Total bytes handed to the socket",
+			0, G_MAXUINT64, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_LINK_RATE,
+		g_param_spec_uint ("link-rate", "Link rate", "What the connection carried in kbit/s while the send queue was backed up (0 = not measured yet)",
+			0, G_MAXUINT, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+	gst_dream_tcp_sink_signals[SIGNAL_CONGESTED] =
+		g_signal_new ("congested", G_TYPE_FROM_CLASS (klass), G_SIGNAL_RUN_LAST,
+			G_STRUCT_OFFSET (GstDreamTCPSinkClass, congested), NULL, NULL, NULL, G_TYPE_NONE, 0);
+	gst_dream_tcp_sink_signals[SIGNAL_DECONGESTED] =
+		g_signal_new ("decongested", G_TYPE_FROM_CLASS (klass), G_SIGNAL_RUN_LAST,
+			G_STRUCT_OFFSET (GstDreamTCPSinkClass, decongested), NULL, NULL, NULL, G_TYPE_NONE, 0);
+
+	gst_element_class_add_static_pad_template (gstelement_class, &sinktemplate);
+	gst_element_class_set_static_metadata (gstelement_class,
+		"Dreambox TCP upstream sink", "Sink/Network",
+		"Non-blocking TCP client sink with congestion signalling",
+		"Andreas Frisch <fraxinas@opendreambox.org>");
+
+	gstbasesink_class->start = GST_DEBUG_FUNCPTR (gst_dream_tcp_sink_start);
+	gstbasesink_class->stop = GST_DEBUG_FUNCPTR (gst_dream_tcp_sink_stop);
+	gstbasesink_class->unlock = GST_DEBUG_FUNCPTR (gst_dream_tcp_sink_unlock);
+	gstbasesink_class->unlock_stop = GST_DEBUG_FUNCPTR (gst_dream_tcp_sink_unlock_stop);
+	gstbasesink_class->render = GST_DEBUG_FUNCPTR (gst_dream_tcp_sink_render);
+	gstbasesink_class->render_list = GST_DEBUG_FUNCPTR (gst_dream_tcp_sink_render_list);
+	gstbasesink_class->event = GST_DEBUG_FUNCPTR (gst_dream_tcp_sink_event);
+
+	GST_DEBUG_CATEGORY_INIT (dream_tcp_sink_debug, "dreamtcpsink", 0, "Dreambox TCP upstream sink");
+}
+
+static void gst_dream_tcp_sink_init (GstDreamTCPSink * sink)
+{
+	sink->host = g_strdup ("localhost");
+	sink->port = 4953;
+	sink->congestion_threshold = DEFAULT_CONGESTION_THRESHOLD;
+	sink->decongestion_threshold = DEFAULT_DECONGESTION_THRESHOLD;
+	sink->zerocopy = TRUE;
+	sink->batch_size = DEFAULT_BATCH_SIZE;
+	sink->batch_latency = DEFAULT_BATCH_LATENCY;
+	sink->spool = DREAM_TCP_SINK_SPOOL_NONE;
+	sink->spool_limit = DEFAULT_SPOOL_LIMIT;
+	sink->spool_location = g_strdup (DEFAULT_SPOOL_LOCATION);
+	sink->spool_fd = -1;
+	sink->pace_burst = DEFAULT_PACE_BURST;
+	sink->cancellable = g_cancellable_new ();
+	sink->clock = gst_system_clock_obtain ();
+	g_mutex_init (&sink->batch_lock);
+	g_mutex_init (&sink->timeout_lock);
+	g_queue_init (&sink->batch);
+	g_queue_init (&sink->spool_queue);
+	g_queue_init (&sink->zerocopy_pending);
+}
+
+static void gst_dream_tcp_sink_finalize (GObject * object)
+{
+	GstDreamTCPSink *sink = GST_DREAM_TCP_SINK (object);
+	g_free (sink->host);
+	g_free (sink->handshake);
+	g_free (sink->spool_location);
+	g_clear_object (&sink->reconnection);
+	g_clear_object (&sink->cancellable);
+	gst_object_unref (sink->clock);
+	g_mutex_clear (&sink->batch_lock);
+	g_mutex_clear (&sink->timeout_lock);
+	G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static void gst_dream_tcp_sink_set_property (GObject * object, guint prop_id, const GValue * value, GParamSpec * pspec)
+{
+	GstDreamTCPSink *sink = GST_DREAM_TCP_SINK (object);
+
+	GST_OBJECT_LOCK (sink);
+	switch (prop_id) {
+		case PROP_HOST:
+			g_free (sink->host);
+			sink->host = g_value_dup_string (value);
+			break;
+		case PROP_PORT:
+			sink->port = g_value_get_int (value);
+			break;
+		case PROP_CONGESTION_THRESHOLD:
+			sink->congestion_threshold = g_value_get_uint (value);
+			break;
+		case PROP_DECONGESTION_THRESHOLD:
+			sink->decongestion_threshold = g_value_get_uint (value);
+			break;
+		case PROP_ZEROCOPY:
+			sink->zerocopy = g_value_get_boolean (value);
+			break;
+		case PROP_BATCH_SIZE:
+			sink->batch_size = g_value_get_uint (value);
+			break;
+		case PROP_BATCH_LATENCY:
+			sink->batch_latency = g_value_get_uint64 (value);
+			break;
+		case PROP_HANDSHAKE:
+			g_free (sink->handshake);
+			sink->handshake = g_value_dup_string (value);
+			break;
+		case PROP_SPOOL:
+			sink->spool = g_value_get_enum (value);
+			break;
+		case PROP_SPOOL_LIMIT:
+			sink->spool_limit = g_value_get_uint (value);
+			break;
+		case PROP_SPOOL_LOCATION:
+			g_free (sink->spool_location);
+			sink->spool_location = g_value_dup_string (value);
+			break;
+		case PROP_PACE:
+			sink->pace = g_value_get_boolean (value);
+			break;
+		case PROP_PACE_BURST:
+			sink->pace_burst = g_value_get_uint (value);
+			break;
+		case PROP_PACE_BITRATE:
+			sink->pace_bitrate = g_value_get_uint (value);
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+			break;
+	}
+	GST_OBJECT_UNLOCK (sink);
+}
+
+static void gst_dream_tcp_sink_get_property (GObject * object, guint prop_id, GValue * value, GParamSpec * pspec)
+{
+	GstDreamTCPSink *sink = GST_DREAM_TCP_SINK (object);
+
+	switch (prop_id) {
+		case PROP_HOST:
+			GST_OBJECT_LOCK (sink);
+			g_value_set_string (value, sink->host);
+			GST_OBJECT_UNLOCK (sink);
+			break;
+		case PROP_PORT:
+			g_value_set_int (value, sink->port);
+			break;
+		case PROP_CONGESTION_THRESHOLD:
+			g_value_set_uint (value, sink->congestion_threshold);
+			break;
+		case PROP_DECONGESTION_THRESHOLD:
+			g_value_set_uint (value, sink->decongestion_threshold);
+			break;
+		case PROP_ZEROCOPY:
+			g_value_set_boolean (value, sink->zerocopy);
+			break;
+		case PROP_BATCH_SIZE:
+			g_value_set_uint (value, sink->batch_size);
+			break;
+		case PROP_BATCH_LATENCY:
+			g_value_set_uint64 (value, sink->batch_latency);
+			break;
+		case PROP_HANDSHAKE:
+			GST_OBJECT_LOCK (sink);
+			g_value_set_string (value, sink->handshake);
+			GST_OBJECT_UNLOCK (sink);
+			break;
+		case PROP_SPOOL:
+			g_value_set_enum (value, sink->spool);
+			break;
+		case PROP_SPOOL_LIMIT:
+			g_value_set_uint (value, sink->spool_limit);
+			break;
+		case PROP_SPOOL_LOCATION:
+			GST_OBJECT_LOCK (sink);
+			g_value_set_string (value, sink->spool_location);
+			GST_OBJECT_UNLOCK (sink);
+			break;
+		case PROP_PACE:
+			g_value_set_boolean (value, sink->pace);
+			break;
+		case PROP_PACE_BURST:
+			g_value_set_uint (value, sink->pace_burst);
+			break;
+		case PROP_PACE_BITRATE:
+			g_value_set_uint (value, sink->pace_bitrate);
+			break;
+		case PROP_SPOOLED_BYTES:
+			g_value_set_uint (value, g_atomic_int_get (&sink->spooled_bytes));
+			break;
+		case PROP_UNSENT_BYTES:
+			g_value_set_uint (value, gst_dream_tcp_sink_get_unsent_bytes (sink));
+			break;
+		case PROP_BYTES_SENT:
+			g_value_set_uint64 (value, sink->bytes_sent);
+			break;
+		case PROP_LINK_RATE:
+			g_value_set_uint (value, gst_dream_tcp_sink_get_link_rate (sink, NULL));
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+			break;
+	}
+}
+
+static guint gst_dream_tcp_sink_socket_unsent (GstDreamTCPSink *sink)
+{
+	gint unsent = 0;
+	GST_OBJECT_LOCK (sink);
+	if (sink->socket)
+	{
+		gint fd = g_socket_get_fd (sink->socket);
+#if defined(SIOCOUTQNSD)
+		if (ioctl (fd, SIOCOUTQNSD, &unsent) < 0)
+#endif
+#if defined(SIOCOUTQ)
+		if (ioctl (fd, SIOCOUTQ, &unsent) < 0)
+#endif
+			unsent = 0;
+	}
+	GST_OBJECT_UNLOCK (sink);
+	return MAX (unsent, 0);
+}
+
+/* with batch_lock held */
+static guint gst_dream_tcp_sink_unsent (GstDreamTCPSink *sink)
+{
+	return gst_dream_tcp_sink_socket_unsent (sink) + sink->batch_bytes + sink->spool_size;
+}
+
+/* callable from any thread, sees the queues as of the last batch_unlock */
+guint gst_dream_tcp_sink_get_unsent_bytes (GstDreamTCPSink *sink)
+{
+	return gst_dream_tcp_sink_socket_unsent (sink) + g_atomic_int_get (&sink->queued_bytes);
+}
+
+/* samples counts the measurements, so a caller can tell whether there were new ones */
+guint gst_dream_tcp_sink_get_link_rate (GstDreamTCPSink *sink, guint *samples)
+{
+	guint rate;
+	GST_OBJECT_LOCK (sink);
+	rate = sink->link_rate;
+	if (samples)
+		*samples = sink->link_samples;
+	GST_OBJECT_UNLOCK (sink);
+	return rate;
+}
+
+/* with batch_lock held. only while there's data waiting in the kernel at
+ * both looks the link sets the pace, otherwise all it shows is the stream's
+ * rate. key frame bursts back the queue up often enough on a link that's
+ * anywhere near its limit */
+static void gst_dream_tcp_sink_measure_link (GstDreamTCPSink *sink, GstClockTime now)
+{
+	guint unsent;
+
+	if (GST_CLOCK_TIME_IS_VALID (sink->link_time) && now < sink->link_time + LINK_SAMPLE_INTERVAL)
+		return;
+	unsent = gst_dream_tcp_sink_socket_unsent (sink);
+	if (GST_CLOCK_TIME_IS_VALID (sink->link_time) && sink->link_unsent && unsent)
+	{
+		guint64 queued = sink->link_unsent + (sink->bytes_sent - sink->link_sent);
+		guint64 drained = queued - MIN (unsent, queued);
+		guint rate = gst_util_uint64_scale (drained * 8, GST_MSECOND, now - sink->link_time);
+		GST_OBJECT_LOCK (sink);
+		sink->link_rate = sink->link_rate ? (3 * sink->link_rate + rate) / 4 : rate;
+		sink->link_samples++;
+		GST_OBJECT_UNLOCK (sink);
+		GST_LOG_OBJECT (sink, "link drained %" G_GUINT64_FORMAT " bytes at %u kbit/s, estimate %u kbit/s", drained, rate, sink->link_rate);
+	}
+	sink->link_time = now;
+	sink->link_sent = sink->bytes_sent;
+	sink->link_unsent = unsent;
+}
+
+static void gst_dream_tcp_sink_batch_unlock (GstDreamTCPSink *sink)
+{
+	g_atomic_int_set (&sink->queued_bytes, sink->batch_bytes + sink->spool_size);
+	g_atomic_int_set (&sink->spooled_bytes, sink->spool_size);
+	g_mutex_unlock (&sink->batch_lock);
+}
+
+static void gst_dream_tcp_sink_set_congested (GstDreamTCPSink *sink, gboolean congested, guint unsent)
+{
+	if (sink->congested == congested)
+		return;
+	sink->congested = congested;
+	GST_DEBUG_OBJECT (sink, "%s with %u unsent bytes", congested ? "congested" : "decongested", unsent);
+	g_signal_emit (sink, gst_dream_tcp_sink_signals[congested ? SIGNAL_CONGESTED : SIGNAL_DECONGESTED], 0);
+}
+
+static void gst_dream_tcp_sink_entry_free (SinkEntry *entry)
+{
+	gst_buffer_unmap (entry->buffer, &entry->map);
+	gst_buffer_unref (entry->buffer);
+	g_slice_free (SinkEntry, entry);
+}
+
+static void gst_dream_tcp_sink_clear_queue (GQueue *queue)
+{
+	SinkEntry *entry;
+	while ((entry = g_queue_pop_head (queue)))
+		gst_dream_tcp_sink_entry_free (entry);
+}
+
+/* the kernel still reads from the pages of an entry that went out with
+ * MSG_ZEROCOPY, even partly, so it's only freed once the completion arrives.
+ * gst_dream_tcp_sink_close drops them all with the socket */
+static void gst_dream_tcp_sink_entry_release (GstDreamTCPSink *sink, SinkEntry *entry)
+{
+	if (entry->zerocopy && sink->socket)
+		g_queue_push_tail (&sink->zerocopy_pending, entry);
+	else
+		gst_dream_tcp_sink_entry_free (entry);
+}
+
+/* collects the MSG_ZEROCOPY completion notifications from the socket's error
+ * queue and releases every buffer the kernel doesn't reference anymore */
+static void gst_dream_tcp_sink_reap_zerocopy (GstDreamTCPSink *sink)
+{
+#ifdef HAVE_MSG_ZEROCOPY
+	gint fd = g_socket_get_fd (sink->socket);
+	while (!g_queue_is_empty (&sink->zerocopy_pending))
+	{
+		guint8 control[CMSG_SPACE (sizeof (struct sock_extended_err) + sizeof (struct sockaddr_in6))];
+		struct msghdr msg;
+		struct cmsghdr *cm;
+
+		memset (&msg, 0, sizeof (msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof (control);
+		if (recvmsg (fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+			break;
+
+		for (cm = CMSG_FIRSTHDR (&msg); cm; cm = CMSG_NXTHDR (&msg, cm))
+		{
+			struct sock_extended_err *serr;
+			if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) || (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+				continue;
+			serr = (struct sock_extended_err *) CMSG_DATA (cm);
+			if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+				continue;
+			if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+			{
+				sink->zerocopy_copied++;
+				if (sink->zerocopy_active)
+					GST_INFO_OBJECT (sink, "kernel had to copy zerocopy sends anyway (loopback or no scatter/gather?), disable MSG_ZEROCOPY");
+				sink->zerocopy_active = FALSE;
+			}
+			while (!g_queue_is_empty (&sink->zerocopy_pending))
+			{
+				SinkEntry *entry = g_queue_peek_head (&sink->zerocopy_pending);
+				if ((gint32) (entry->zerocopy_id - serr->ee_data) > 0)
+					break;
+				gst_dream_tcp_sink_entry_free (g_queue_pop_head (&sink->zerocopy_pending));
+			}
+		}
+	}
+#endif
+}
+
+/* takes over a freshly connected socket and switches it to non-blocking mode.
+ * the reconnect path runs with batch_lock held, so the handshake mustn't block
+ * either. an empty send buffer takes it in one go, anything else is a failed
+ * connect and gets retried */
+static gboolean gst_dream_tcp_sink_adopt (GstDreamTCPSink *sink, GSocketConnection *connection)
+{
+	GSocket *socket = g_socket_connection_get_socket (connection);
+	GError *err = NULL;
+
+	g_socket_set_blocking (socket, FALSE);
+	if (sink->handshake && *sink->handshake)
+	{
+		gsize len = strlen (sink->handshake);
+		if (g_socket_send (socket, sink->handshake, len, NULL, &err) != (gssize) len)
+		{
+			GST_WARNING_OBJECT (sink, "failed to send handshake: %s", err ? err->message : "short write");
+			g_clear_error (&err);
+			return FALSE;
+		}
+		GST_DEBUG_OBJECT (sink, "sent %" G_GSIZE_FORMAT " bytes handshake", len);
+	}
+
+	sink->zerocopy_active = FALSE;
+#ifdef HAVE_MSG_ZEROCOPY
+	if (sink->zerocopy)
+	{
+		gint one = 1;
+		if (setsockopt (g_socket_get_fd (socket), SOL_SOCKET, SO_ZEROCOPY, &one, sizeof (one)) == 0)
+			sink->zerocopy_active = TRUE;
+		else
+			GST_INFO_OBJECT (sink, "SO_ZEROCOPY not supported: %s", g_strerror (errno));
+	}
+#endif
+	sink->zerocopy_next_id = 0;
+	sink->packet_offset = 0;
+
+	GST_OBJECT_LOCK (sink);
+	sink->connection = connection;
+	sink->socket = g_object_ref (socket);
+	GST_OBJECT_UNLOCK (sink);
+	sink->connected = TRUE;
+	return TRUE;
+}
+
+static void gst_dream_tcp_sink_close (GstDreamTCPSink *sink)
+{
+	GSocketConnection *connection;
+	GSocket *socket;
+
+	gst_dream_tcp_sink_clear_queue (&sink->zerocopy_pending);
+
+	GST_OBJECT_LOCK (sink);
+	connection = sink->connection;
+	socket = sink->socket;
+	sink->connection = NULL;
+	sink->socket = NULL;
+	GST_OBJECT_UNLOCK (sink);
+
+	if (connection)
+		g_io_stream_close (G_IO_STREAM (connection), NULL, NULL);
+	g_clear_object (&socket);
+	g_clear_object (&connection);
+	sink->connected = FALSE;
+}
+
+static void gst_dream_tcp_sink_spool_open (GstDreamTCPSink *sink)
+{
+	sink->spool_active = sink->spool;
+	sink->spool_read = sink->spool_size = 0;
+	sink->spool_capacity = sink->spool_limit;
+	sink->spool_dropped = 0;
+	if (sink->spool_active == DREAM_TCP_SINK_SPOOL_DISK)
+	{
+		gchar *path = g_build_filename (sink->spool_location, "dreamtcpsink-XXXXXX", NULL);
+		sink->spool_ring = sink->spool_capacity = sink->spool_limit - sink->spool_limit % SPOOL_ALIGN;
+		sink->spool_fd = g_mkstemp (path);
+		if (sink->spool_fd < 0)
+		{
+			/* a disk sized backlog doesn't fit into a receiver's RAM */
+			sink->spool_active = DREAM_TCP_SINK_SPOOL_MEMORY;
+			sink->spool_capacity = MIN (sink->spool_limit, SPOOL_MEMORY_FALLBACK);
+			GST_WARNING_OBJECT (sink, "can't create spool file %s (%s), spooling at most %" G_GSIZE_FORMAT " bytes to memory instead", path, g_strerror (errno), sink->spool_capacity);
+		}
+		else
+		{
+			g_unlink (path);
+			sink->spool_scratch = g_malloc (SPOOL_CHUNK_SIZE);
+		}
+		g_free (path);
+	}
+	if (sink->spool_active != DREAM_TCP_SINK_SPOOL_NONE)
+		GST_INFO_OBJECT (sink, "spooling to %s, limit %" G_GSIZE_FORMAT " bytes", sink->spool_active == DREAM_TCP_SINK_SPOOL_DISK ? sink->spool_location : "memory", sink->spool_capacity);
+}
+
+static void gst_dream_tcp_sink_spool_close (GstDreamTCPSink *sink)
+{
+	if (sink->spool_fd >= 0)
+		close (sink->spool_fd);
+	sink->spool_fd = -1;
+	g_free (sink->spool_scratch);
+	sink->spool_scratch = NULL;
+	gst_dream_tcp_sink_clear_queue (&sink->spool_queue);
+	sink->spool_read = sink->spool_size = 0;
+	sink->spool_active = DREAM_TCP_SINK_SPOOL_NONE;
+}
+
+static gboolean gst_dream_tcp_sink_start (GstBaseSink * bsink)
+{
+	GstDreamTCPSink *sink = GST_DREAM_TCP_SINK (bsink);
+	GSocketClient *client;
+	GSocketConnection *connection;
+	GError *err = NULL;
+	gchar *host;
+	gint port;
+
+	GST_OBJECT_LOCK (sink);
+	host = g_strdup (sink->host);
+	port = sink->port;
+	GST_OBJECT_UNLOCK (sink);
+
+	client = g_socket_client_new ();
+	connection = g_socket_client_connect_to_host (client, host, port, sink->cancellable, &err);
+	g_object_unref (client);
+	if (!connection || !gst_dream_tcp_sink_adopt (sink, connection))
+	{
+		GST_ELEMENT_ERROR (sink, RESOURCE, OPEN_READ_WRITE, (NULL), ("Failed to connect to %s:%d: %s", host, port, err ? err->message : "handshake failed"));
+		g_clear_error (&err);
+		g_clear_object (&connection);
+		g_free (host);
+		return FALSE;
+	}
+
+	sink->bytes_sent = sink->zerocopy_sends = sink->zerocopy_copied = 0;
+	sink->congested = FALSE;
+	sink->reconnecting = FALSE;
+	sink->pace_pcr_pid = TS_PID_NONE;
+	sink->pace_pcr = sink->pace_last = GST_CLOCK_TIME_NONE;
+	sink->pace_wait = 0;
+	sink->pace_pcr_bytes = sink->pace_bytes = sink->pace_measured = 0;
+	sink->pace_tokens = sink->pace_burst;
+	sink->link_time = GST_CLOCK_TIME_NONE;
+	sink->link_sent = 0;
+	sink->link_unsent = sink->link_rate = sink->link_samples = 0;
+	gst_dream_tcp_sink_spool_open (sink);
+
+	GST_INFO_OBJECT (sink, "connected to %s:%d (zerocopy %s)", host, port, sink->zerocopy_active ? "enabled" : "disabled");
+	g_free (host);
+	return TRUE;
+}
+
+static gboolean gst_dream_tcp_sink_stop (GstBaseSink * bsink)
+{
+	GstDreamTCPSink *sink = GST_DREAM_TCP_SINK (bsink);
+
+	GST_DEBUG_OBJECT (sink, "closing connection. sent %" G_GUINT64_FORMAT " bytes, %" G_GUINT64_FORMAT " zerocopy sends (%" G_GUINT64_FORMAT " copied), %" G_GSIZE_FORMAT " bytes left in spool, %" G_GUINT64_FORMAT " dropped",
+			  sink->bytes_sent, sink->zerocopy_sends, sink->zerocopy_copied, sink->spool_size, sink->spool_dropped);
+
+	g_mutex_lock (&sink->batch_lock);
+	g_mutex_lock (&sink->timeout_lock);
+	if (sink->batch_timeout)
+	{
+		gst_clock_id_unschedule (sink->batch_timeout);
+		gst_clock_id_unref (sink->batch_timeout);
+		sink->batch_timeout = NULL;
+	}
+	g_mutex_unlock (&sink->timeout_lock);
+	if (sink->socket)
+		gst_dream_tcp_sink_reap_zerocopy (sink);
+	gst_dream_tcp_sink_clear_queue (&sink->batch);
+	sink->batch_bytes = 0;
+	gst_dream_tcp_sink_spool_close (sink);
+	gst_dream_tcp_sink_close (sink);
+	g_clear_object (&sink->reconnection);
+	gst_dream_tcp_sink_batch_unlock (sink);
+	return TRUE;
+}
+
+static gboolean gst_dream_tcp_sink_unlock (GstBaseSink * bsink)
+{
+	GstDreamTCPSink *sink = GST_DREAM_TCP_SINK (bsink);
+	GST_DEBUG_OBJECT (sink, "unlock");
+	g_cancellable_cancel (sink->cancellable);
+	return TRUE;
+}
+
+static gboolean gst_dream_tcp_sink_unlock_stop (GstBaseSink * bsink)
+{
+	GstDreamTCPSink *sink = GST_DREAM_TCP_SINK (bsink);
+	GST_DEBUG_OBJECT (sink, "unlock stop");
+	g_cancellable_reset (sink->cancellable);
+	return TRUE;
+}
+
+/* blocks until the socket reports the given condition or the timeout expires.
+ * returns FALSE when we got unlocked or the socket broke */
+static gboolean gst_dream_tcp_sink_wait (GstDreamTCPSink *sink, GIOCondition condition, gint64 timeout)
+{
+	GError *err = NULL;
+	if (g_socket_condition_timed_wait (sink->socket, condition, timeout, sink->cancellable, &err))
+		return TRUE;
+	if (g_error_matches (err, G_IO_ERROR, G_IO_ERROR_TIMED_OUT))
+	{
+		g_clear_error (&err);
+		return TRUE;
+	}
+	if (!g_error_matches (err, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+		GST_WARNING_OBJECT (sink, "waiting for socket failed: %s", err->message);
+	g_clear_error (&err);
+	return FALSE;
+}
+
+/* POLLERR is also raised for zerocopy completions, so a real socket error has
+ * to be told apart explicitly, otherwise the drain loop would spin on it */
+static gboolean gst_dream_tcp_sink_check_socket (GstDreamTCPSink *sink)
+{
+	gint sockerr = 0;
+	if (g_socket_condition_check (sink->socket, G_IO_HUP) || (g_socket_get_option (sink->socket, SOL_SOCKET, SO_ERROR, &sockerr, NULL) && sockerr))
+	{
+		GST_ELEMENT_ERROR (sink, RESOURCE, WRITE, (NULL), ("Connection to \"%s:%d\" broke: %s", sink->host, sink->port, sockerr ? g_strerror (sockerr) : "hung up"));
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* measures the stream rate from the PCRs of the first pid that carries them.
+ * the mux delivers whole packets, so the buffers are packet aligned */
+static void gst_dream_tcp_sink_pace_scan (GstDreamTCPSink *sink, const guint8 *data, gsize size)
+{
+	gsize offset;
+	for (offset = 0; offset + TS_PACK_SIZE <= size; offset += TS_PACK_SIZE)
+	{
+		guint64 pcr, bytes = sink->pace_bytes + offset;
+		GstClockTime pcr_time;
+		guint16 pid = dream_ts_get_pcr (data + offset, &pcr);
+		if (pid == TS_PID_NONE)
+			continue;
+		if (sink->pace_pcr_pid == TS_PID_NONE)
+			sink->pace_pcr_pid = pid;
+		if (pid != sink->pace_pcr_pid)
+			continue;
+		pcr_time = gst_util_uint64_scale (pcr, 1000, 27);
+		/* first pcr, wrap-around or discontinuity */
+		if (!GST_CLOCK_TIME_IS_VALID (sink->pace_pcr) || pcr_time < sink->pace_pcr || pcr_time > sink->pace_pcr + 4 * PACE_WINDOW)
+		{
+			sink->pace_pcr = pcr_time;
+			sink->pace_pcr_bytes = bytes;
+		}
+		else if (pcr_time >= sink->pace_pcr + PACE_WINDOW)
+		{
+			guint64 rate = gst_util_uint64_scale (bytes - sink->pace_pcr_bytes, GST_SECOND, pcr_time - sink->pace_pcr);
+			sink->pace_measured = sink->pace_measured ? (3 * sink->pace_measured + rate) / 4 : rate;
+			GST_LOG_OBJECT (sink, "pcr pid 0x%04x: %" G_GUINT64_FORMAT " bytes/s, pacing at %" G_GUINT64_FORMAT, pid, rate, sink->pace_measured);
+			sink->pace_pcr = pcr_time;
+			sink->pace_pcr_bytes = bytes;
+		}
+	}
+	sink->pace_bytes += size;
+}
+
+/* how many bytes of the batch the pacer lets through right now. if that's
+ * too few to be worth a syscall, pace_wait is set to when it will be. spool
+ * drains aren't paced, catching up faster than realtime is their purpose */
+static gsize gst_dream_tcp_sink_pace_allowance (GstDreamTCPSink *sink, GQueue *queue, gsize pending)
+{
+	guint64 rate = sink->pace_bitrate ? sink->pace_bitrate * G_GUINT64_CONSTANT(1000) / 8 : sink->pace_measured * 11 / 10;
+	GstClockTime now;
+	gsize need;
+
+	sink->pace_wait = 0;
+	if (!sink->pace || !rate || queue != &sink->batch)
+		return G_MAXSIZE;
+
+	now = gst_clock_get_time (sink->clock);
+	if (GST_CLOCK_TIME_IS_VALID (sink->pace_last) && now > sink->pace_last)
+		sink->pace_tokens = MIN (sink->pace_tokens + gst_util_uint64_scale (now - sink->pace_last, rate, GST_SECOND), sink->pace_burst);
+	sink->pace_last = now;
+
+	/* don't dribble out single packets */
+	need = MIN (pending, TS_PACK_SIZE*TS_PER_FRAME);
+	if (sink->pace_tokens >= need)
+		return sink->pace_tokens;
+	sink->pace_wait = now + gst_util_uint64_scale (need - sink->pace_tokens, GST_SECOND, rate);
+	return 0;
+}
+
+static void gst_dream_tcp_sink_append (GstDreamTCPSink *sink, GstBuffer *buffer)
+{
+	SinkEntry *entry = g_slice_new0 (SinkEntry);
+	if (!gst_buffer_map (buffer, &entry->map, GST_MAP_READ))
+	{
+		GST_WARNING_OBJECT (sink, "failed to map %" GST_PTR_FORMAT ", skipping it", buffer);
+		g_slice_free (SinkEntry, entry);
+		return;
+	}
+	entry->buffer = gst_buffer_ref (buffer);
+	if (sink->pace)
+		gst_dream_tcp_sink_pace_scan (sink, entry->map.data, entry->map.size);
+	if (g_queue_is_empty (&sink->batch))
+		sink->batch_start = gst_clock_get_time (sink->clock);
+	g_queue_push_tail (&sink->batch, entry);
+	sink->batch_bytes += entry->map.size;
+}
+
+static void gst_dream_tcp_sink_write_error (GstDreamTCPSink *sink)
+{
+	GST_ELEMENT_ERROR (sink, RESOURCE, WRITE, (NULL), ("Error while sending data to \"%s:%d\": %s", sink->host, sink->port, g_strerror (sink->write_errno)));
+}
+
+/* writes out a queue of entries (the batch or the memory spool) with as few
+ * sendmsg() calls as possible. if wait is FALSE it gives up as soon as the
+ * socket would block and leaves the rest for the next call. errors are only
+ * remembered in write_errno, since spool mode survives them by reconnecting.
+ * must be called with the batch lock held */
+static GstFlowReturn gst_dream_tcp_sink_send_queue (GstDreamTCPSink *sink, GQueue *queue, gsize *bytes, gboolean wait)
+{
+	struct iovec iov[IOV_MAX];
+	gint fd = g_socket_get_fd (sink->socket);
+	gboolean zerocopy_allowed = TRUE;
+
+	if (sink->zerocopy_active)
+		gst_dream_tcp_sink_reap_zerocopy (sink);
+
+	while (!g_queue_is_empty (queue))
+	{
+		struct msghdr msg;
+		gssize written;
+		gsize total = 0;
+		guint n = 0;
+		gint flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+		gsize allowance = gst_dream_tcp_sink_pace_allowance (sink, queue, *bytes);
+		gboolean zerocopy;
+		GList *l;
+
+		if (!allowance)
+		{
+			gint sockerr = 0;
+			if (!wait)
+				return GST_FLOW_OK;
+			if (!gst_dream_tcp_sink_wait (sink, G_IO_ERR | G_IO_HUP, (sink->pace_wait - sink->pace_last) / GST_USECOND))
+				return GST_FLOW_FLUSHING;
+			if (sink->zerocopy_active)
+				gst_dream_tcp_sink_reap_zerocopy (sink);
+			/* a broken connection would wake us up right away every time */
+			if (g_socket_condition_check (sink->socket, G_IO_HUP) || (g_socket_get_option (sink->socket, SOL_SOCKET, SO_ERROR, &sockerr, NULL) && sockerr))
+			{
+				sink->write_errno = sockerr ? sockerr : EPIPE;
+				return GST_FLOW_ERROR;
+			}
+			continue;
+		}
+
+		for (l = queue->head; l && n < IOV_MAX && total < allowance; l = l->next, n++)
+		{
+			SinkEntry *entry = l->data;
+			iov[n].iov_base = entry->map.data + entry->offset;
+			iov[n].iov_len = MIN (entry->map.size - entry->offset, allowance - total);
+			total += iov[n].iov_len;
+		}
+
+		zerocopy = zerocopy_allowed && sink->zerocopy_active && total >= ZEROCOPY_MIN_SIZE && g_queue_get_length (&sink->zerocopy_pending) < ZEROCOPY_MAX_PENDING;
+#ifdef HAVE_MSG_ZEROCOPY
+		if (zerocopy)
+			flags |= MSG_ZEROCOPY;
+#endif
+		memset (&msg, 0, sizeof (msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = n;
+		written = sendmsg (fd, &msg, flags);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				gst_dream_tcp_sink_set_congested (sink, TRUE, gst_dream_tcp_sink_unsent (sink));
+				if (!wait)
+					return GST_FLOW_OK;
+				if (!gst_dream_tcp_sink_wait (sink, G_IO_OUT, -1))
+					return GST_FLOW_FLUSHING;
+				gst_dream_tcp_sink_reap_zerocopy (sink);
+				continue;
+			}
+			if (errno == ENOBUFS && zerocopy)
+			{
+				GST_DEBUG_OBJECT (sink, "out of option memory for zerocopy notifications, fall back to copying");
+				zerocopy_allowed = FALSE;
+				continue;
+			}
+			sink->write_errno = errno;
+			return GST_FLOW_ERROR;
+		}
+
+		GST_LOG_OBJECT (sink, "wrote %" G_GSSIZE_FORMAT " of %" G_GSIZE_FORMAT " bytes from %u buffers%s", written, total, n, zerocopy ? " (zerocopy)" : "");
+		if (zerocopy)
+			sink->zerocopy_sends++;
+		sink->bytes_sent += written;
+		sink->packet_offset = (sink->packet_offset + written) % SPOOL_ALIGN;
+		*bytes -= written;
+		if (allowance != G_MAXSIZE)
+			sink->pace_tokens -= MIN (sink->pace_tokens, (guint64) written);
+
+		while (written > 0)
+		{
+			SinkEntry *entry = g_queue_peek_head (queue);
+			gsize chunk = MIN ((gsize) written, entry->map.size - entry->offset);
+			entry->offset += chunk;
+			written -= chunk;
+			if (zerocopy)
+			{
+				entry->zerocopy = TRUE;
+				entry->zerocopy_id = sink->zerocopy_next_id;
+			}
+			if (entry->offset < entry->map.size)
+				break;
+			g_queue_pop_head (queue);
+			gst_dream_tcp_sink_entry_release (sink, entry);
+		}
+		if (zerocopy)
+			sink->zerocopy_next_id++;
+	}
+	return GST_FLOW_OK;
+}
+
+/* holds back the stream while the connection is congested, so that the
+ * backlog piles up in the upstream queue where it can be dropped sensibly */
+static GstFlowReturn gst_dream_tcp_sink_drain (GstDreamTCPSink *sink)
+{
+	guint unsent = gst_dream_tcp_sink_unsent (sink);
+	if (unsent >= sink->congestion_threshold)
+		gst_dream_tcp_sink_set_congested (sink, TRUE, unsent);
+	while (sink->congested)
+	{
+		if (unsent <= sink->decongestion_threshold)
+		{
+			gst_dream_tcp_sink_set_congested (sink, FALSE, unsent);
+			break;
+		}
+		if (!gst_dream_tcp_sink_wait (sink, G_IO_ERR | G_IO_HUP, DRAIN_POLL_INTERVAL))
+			return GST_FLOW_FLUSHING;
+		gst_dream_tcp_sink_reap_zerocopy (sink);
+		if (!gst_dream_tcp_sink_check_socket (sink))
+			return GST_FLOW_ERROR;
+		unsent = gst_dream_tcp_sink_unsent (sink);
+	}
+	return GST_FLOW_OK;
+}
+
+static GstFlowReturn gst_dream_tcp_sink_flush (GstDreamTCPSink *sink, gboolean wait)
+{
+	GstFlowReturn ret = gst_dream_tcp_sink_send_queue (sink, &sink->batch, &sink->batch_bytes, wait);
+	if (ret == GST_FLOW_ERROR)
+		gst_dream_tcp_sink_write_error (sink);
+	return ret;
+}
+
+/* the disk spool is a ring file, so reads and writes may wrap around its end */
+static gboolean gst_dream_tcp_sink_ring_io (GstDreamTCPSink *sink, guint8 *data, gsize size, gsize pos, gboolean write)
+{
+	while (size)
+	{
+		gsize chunk = MIN (size, sink->spool_ring - pos);
+		gssize ret = write ? pwrite (sink->spool_fd, data, chunk, pos) : pread (sink->spool_fd, data, chunk, pos);
+		if (ret <= 0)
+		{
+			if (ret < 0 && errno == EINTR)
+				continue;
+			GST_WARNING_OBJECT (sink, "spool file %s failed: %s", write ? "write" : "read", ret ? g_strerror (errno) : "short read");
+			return FALSE;
+		}
+		data += ret;
+		size -= ret;
+		pos = (pos + ret) % sink->spool_ring;
+	}
+	return TRUE;
+}
+
+/* appends what's left of an entry to the journal. when it's full the newest
+ * data gets dropped, never what's already queued, so the receiver gets a
+ * gap instead of torn packets. a partially sent entry is always taken since
+ * dropping it would leave half a packet on the wire */
+static void gst_dream_tcp_sink_spool_push (GstDreamTCPSink *sink, SinkEntry *entry)
+{
+	gsize size = entry->map.size - entry->offset;
+	gsize limit = sink->spool_capacity;
+	gboolean keep = sink->spool_size + size <= limit - SPOOL_CHUNK_SIZE || (entry->offset && sink->spool_size + size <= limit);
+
+	if (keep && sink->spool_active == DREAM_TCP_SINK_SPOOL_DISK)
+	{
+		keep = gst_dream_tcp_sink_ring_io (sink, entry->map.data + entry->offset, size, (sink->spool_read + sink->spool_size) % sink->spool_ring, TRUE);
+		gst_dream_tcp_sink_entry_release (sink, entry);
+	}
+	else if (keep)
+		g_queue_push_tail (&sink->spool_queue, entry);
+	else
+		gst_dream_tcp_sink_entry_release (sink, entry);
+
+	if (keep)
+		sink->spool_size += size;
+	else
+		sink->spool_dropped += size;
+}
+
+/* sends as much of the journal as the socket takes without blocking */
+static GstFlowReturn gst_dream_tcp_sink_spool_drain (GstDreamTCPSink *sink)
+{
+	gint fd = g_socket_get_fd (sink->socket);
+
+	if (sink->spool_active == DREAM_TCP_SINK_SPOOL_MEMORY)
+		return gst_dream_tcp_sink_send_queue (sink, &sink->spool_queue, &sink->spool_size, FALSE);
+
+	while (sink->spool_size)
+	{
+		gsize chunk = MIN (sink->spool_size, SPOOL_CHUNK_SIZE);
+		gssize written;
+
+		if (!gst_dream_tcp_sink_ring_io (sink, sink->spool_scratch, chunk, sink->spool_read, FALSE))
+		{
+			sink->spool_dropped += sink->spool_size;
+			sink->spool_read = sink->spool_size = 0;
+			return GST_FLOW_OK;
+		}
+		written = send (fd, sink->spool_scratch, chunk, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return GST_FLOW_OK;
+			sink->write_errno = errno;
+			return GST_FLOW_ERROR;
+		}
+		sink->bytes_sent += written;
+		sink->packet_offset = (sink->packet_offset + written) % SPOOL_ALIGN;
+		sink->spool_read = (sink->spool_read + written) % sink->spool_ring;
+		sink->spool_size -= written;
+	}
+	return GST_FLOW_OK;
+}
+
+/* discards bytes from the head of the pending stream, journal first */
+static void gst_dream_tcp_sink_skip (GstDreamTCPSink *sink, gsize skip)
+{
+	gsize chunk;
+
+	if (sink->spool_active == DREAM_TCP_SINK_SPOOL_DISK && sink->spool_size)
+	{
+		chunk = MIN (skip, sink->spool_size);
+		sink->spool_read = (sink->spool_read + chunk) % sink->spool_ring;
+		sink->spool_size -= chunk;
+		skip -= chunk;
+	}
+	while (skip && !g_queue_is_empty (&sink->spool_queue))
+	{
+		SinkEntry *entry = g_queue_peek_head (&sink->spool_queue);
+		chunk = MIN (skip, entry->map.size - entry->offset);
+		entry->offset += chunk;
+		sink->spool_size -= chunk;
+		skip -= chunk;
+		if (entry->offset == entry->map.size)
+			gst_dream_tcp_sink_entry_release (sink, g_queue_pop_head (&sink->spool_queue));
+	}
+	while (skip && !g_queue_is_empty (&sink->batch))
+	{
+		SinkEntry *entry = g_queue_peek_head (&sink->batch);
+		chunk = MIN (skip, entry->map.size - entry->offset);
+		entry->offset += chunk;
+		sink->batch_bytes -= chunk;
+		skip -= chunk;
+		if (entry->offset == entry->map.size)
+			gst_dream_tcp_sink_entry_release (sink, g_queue_pop_head (&sink->batch));
+	}
+}
+
+/* a new connection must start at a packet boundary, so the rest of a packet
+ * that was cut off by the broken one is skipped */
+static void gst_dream_tcp_sink_disconnect (GstDreamTCPSink *sink, GstClockTime now)
+{
+	GST_WARNING_OBJECT (sink, "lost connection to %s:%d (%s), spooling until it's back", sink->host, sink->port, g_strerror (sink->write_errno));
+	gst_dream_tcp_sink_close (sink);
+	if (sink->packet_offset)
+		gst_dream_tcp_sink_skip (sink, SPOOL_ALIGN - sink->packet_offset);
+	sink->packet_offset = 0;
+	sink->reconnect_time = now;
+}
+
+static void gst_dream_tcp_sink_reconnected (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	GstDreamTCPSink *sink = user_data;
+	GError *err = NULL;
+	GSocketConnection *connection = g_socket_client_connect_to_host_finish (G_SOCKET_CLIENT (source), res, &err);
+
+	g_mutex_lock (&sink->batch_lock);
+	sink->reconnecting = FALSE;
+	sink->reconnect_time = gst_clock_get_time (sink->clock);
+	if (!connection)
+	{
+		GST_DEBUG_OBJECT (sink, "reconnect failed: %s", err->message);
+		g_clear_error (&err);
+	}
+	else if (sink->spool_active == DREAM_TCP_SINK_SPOOL_NONE)
+	{
+		/* stopped in the meantime */
+		g_io_stream_close (G_IO_STREAM (connection), NULL, NULL);
+		g_object_unref (connection);
+	}
+	else
+		sink->reconnection = connection;
+	gst_dream_tcp_sink_batch_unlock (sink);
+	g_object_unref (source);
+	gst_object_unref (sink);
+}
+
+/* the connect runs asynchronously on the default main context, the streaming
+ * thread picks up the result on its next pass */
+static void gst_dream_tcp_sink_reconnect (GstDreamTCPSink *sink, GstClockTime now)
+{
+	if (sink->reconnection)
+	{
+		GSocketConnection *connection = sink->reconnection;
+		sink->reconnection = NULL;
+		if (gst_dream_tcp_sink_adopt (sink, connection))
+			GST_INFO_OBJECT (sink, "reconnected to %s:%d, %" G_GSIZE_FORMAT " bytes spooled", sink->host, sink->port, sink->spool_size);
+		else
+		{
+			g_io_stream_close (G_IO_STREAM (connection), NULL, NULL);
+			g_object_unref (connection);
+			sink->reconnect_time = now;
+		}
+	}
+	else if (!sink->reconnecting && now >= sink->reconnect_time + RECONNECT_INTERVAL)
+	{
+		GST_DEBUG_OBJECT (sink, "reconnecting to %s:%d", sink->host, sink->port);
+		sink->reconnecting = TRUE;
+		g_socket_client_connect_to_host_async (g_socket_client_new (), sink->host, sink->port, NULL, gst_dream_tcp_sink_reconnected, gst_object_ref (sink));
+	}
+}
+
+static gboolean gst_dream_tcp_sink_batch_timeout (GstClock *clock, GstClockTime time, GstClockID id, gpointer user_data);
+
+/* with timeout_lock held */
+static void gst_dream_tcp_sink_arm (GstDreamTCPSink *sink, GstClockTime time)
+{
+	sink->batch_timeout = gst_clock_new_single_shot_id (sink->clock, time);
+	gst_clock_id_wait_async (sink->batch_timeout, gst_dream_tcp_sink_batch_timeout, gst_object_ref (sink), (GDestroyNotify) gst_object_unref);
+}
+
+static void gst_dream_tcp_sink_schedule (GstDreamTCPSink *sink, GstClockTime time)
+{
+	g_mutex_lock (&sink->timeout_lock);
+	if (!sink->batch_timeout)
+		gst_dream_tcp_sink_arm (sink, time);
+	g_mutex_unlock (&sink->timeout_lock);
+}
+
+/* spool mode: never blocks. new data only goes straight to the socket while
+ * the journal is empty, otherwise it lines up behind it to keep the order */
+static GstFlowReturn gst_dream_tcp_sink_commit_spooled (GstDreamTCPSink *sink)
+{
+	GstClockTime now = gst_clock_get_time (sink->clock);
+	guint64 dropped = sink->spool_dropped;
+	gboolean spool_batch;
+	SinkEntry *entry;
+	guint unsent;
+
+	sink->pace_wait = 0;
+
+	if (!sink->connected)
+		gst_dream_tcp_sink_reconnect (sink, now);
+
+	if (sink->connected && sink->spool_size && gst_dream_tcp_sink_spool_drain (sink) == GST_FLOW_ERROR)
+		gst_dream_tcp_sink_disconnect (sink, now);
+
+	spool_batch = !sink->connected || sink->spool_size;
+	if (!spool_batch && (sink->batch_bytes >= sink->batch_size || now >= sink->batch_start + sink->batch_latency))
+	{
+		if (gst_dream_tcp_sink_send_queue (sink, &sink->batch, &sink->batch_bytes, FALSE) == GST_FLOW_ERROR)
+			gst_dream_tcp_sink_disconnect (sink, now);
+		/* what the pacer holds back isn't congestion, it stays in the batch */
+		spool_batch = !g_queue_is_empty (&sink->batch) && !sink->pace_wait;
+	}
+	if (spool_batch)
+	{
+		while ((entry = g_queue_pop_head (&sink->batch)))
+			gst_dream_tcp_sink_spool_push (sink, entry);
+		sink->batch_bytes = 0;
+	}
+
+	unsent = gst_dream_tcp_sink_unsent (sink);
+	if (!sink->connected || sink->spool_size || unsent >= sink->congestion_threshold)
+		gst_dream_tcp_sink_set_congested (sink, TRUE, unsent);
+	else if (unsent <= sink->decongestion_threshold)
+		gst_dream_tcp_sink_set_congested (sink, FALSE, unsent);
+
+	if (sink->spool_dropped > dropped)
+	{
+		if (!sink->connected)
+		{
+			GST_ELEMENT_ERROR (sink, RESOURCE, WRITE, (NULL), ("Connection to \"%s:%d\" lost and spool is full", sink->host, sink->port));
+			return GST_FLOW_ERROR;
+		}
+		GST_WARNING_OBJECT (sink, "spool full, dropped %" G_GUINT64_FORMAT " bytes so far", sink->spool_dropped);
+	}
+
+	/* keep draining and reconnecting even if the stream is held back upstream */
+	if (!sink->connected || sink->spool_size)
+		gst_dream_tcp_sink_schedule (sink, now + (sink->batch_latency ? sink->batch_latency : DRAIN_POLL_INTERVAL * GST_USECOND));
+	else if (!g_queue_is_empty (&sink->batch))
+		gst_dream_tcp_sink_schedule (sink, sink->pace_wait ? sink->pace_wait : sink->batch_start + sink->batch_latency);
+	return GST_FLOW_OK;
+}
+
+static gboolean gst_dream_tcp_sink_batch_timeout (GstClock *clock, GstClockTime time, GstClockID id, gpointer user_data)
+{
+	GstDreamTCPSink *sink = user_data;
+
+	g_mutex_lock (&sink->timeout_lock);
+	if (sink->batch_timeout != id)
+	{
+		g_mutex_unlock (&sink->timeout_lock);
+		return TRUE;
+	}
+	gst_clock_id_unref (sink->batch_timeout);
+	sink->batch_timeout = NULL;
+	/* the streaming thread may be blocked on the socket with batch_lock held,
+	 * and it doesn't schedule anything then. so poll until we get the lock */
+	if (!g_mutex_trylock (&sink->batch_lock))
+	{
+		gst_dream_tcp_sink_arm (sink, gst_clock_get_time (clock) + DRAIN_POLL_INTERVAL * GST_USECOND);
+		g_mutex_unlock (&sink->timeout_lock);
+		return TRUE;
+	}
+	g_mutex_unlock (&sink->timeout_lock);
+
+	if (sink->spool_active != DREAM_TCP_SINK_SPOOL_NONE)
+		gst_dream_tcp_sink_commit_spooled (sink);
+	else if (sink->socket && !g_queue_is_empty (&sink->batch))
+	{
+		GST_LOG_OBJECT (sink, "batch latency expired, flushing %" G_GSIZE_FORMAT " bytes", sink->batch_bytes);
+		/* whatever the pacer or a full socket held back goes out without waiting for the next buffer */
+		if (gst_dream_tcp_sink_flush (sink, FALSE) == GST_FLOW_OK && !g_queue_is_empty (&sink->batch))
+			gst_dream_tcp_sink_schedule (sink, sink->pace_wait ? sink->pace_wait : gst_clock_get_time (clock) + DRAIN_POLL_INTERVAL * GST_USECOND);
+	}
+	gst_dream_tcp_sink_batch_unlock (sink);
+	return TRUE;
+}
+
+static GstFlowReturn gst_dream_tcp_sink_commit (GstDreamTCPSink *sink)
+{
+	GstFlowReturn ret = GST_FLOW_OK;
+	GstClockTime now = gst_clock_get_time (sink->clock);
+
+	gst_dream_tcp_sink_measure_link (sink, now);
+	if (sink->spool_active != DREAM_TCP_SINK_SPOOL_NONE)
+		return gst_dream_tcp_sink_commit_spooled (sink);
+
+	if (sink->batch_bytes >= sink->batch_size || now >= sink->batch_start + sink->batch_latency)
+	{
+		ret = gst_dream_tcp_sink_flush (sink, TRUE);
+		if (ret == GST_FLOW_OK)
+			ret = gst_dream_tcp_sink_drain (sink);
+	}
+	else
+		gst_dream_tcp_sink_schedule (sink, sink->batch_start + sink->batch_latency);
+	return ret;
+}
+
+static GstFlowReturn gst_dream_tcp_sink_render (GstBaseSink * bsink, GstBuffer * buffer)
+{
+	GstDreamTCPSink *sink = GST_DREAM_TCP_SINK (bsink);
+	GstFlowReturn ret;
+
+	g_mutex_lock (&sink->batch_lock);
+	gst_dream_tcp_sink_append (sink, buffer);
+	ret = gst_dream_tcp_sink_commit (sink);
+	gst_dream_tcp_sink_batch_unlock (sink);
+	return ret;
+}
+
+static GstFlowReturn gst_dream_tcp_sink_render_list (GstBaseSink * bsink, GstBufferList * list)
+{
+	GstDreamTCPSink *sink = GST_DREAM_TCP_SINK (bsink);
+	guint i, n = gst_buffer_list_length (list);
+	GstFlowReturn ret;
+
+	g_mutex_lock (&sink->batch_lock);
+	for (i = 0; i < n; i++)
+		gst_dream_tcp_sink_append (sink, gst_buffer_list_get (list, i));
+	ret = gst_dream_tcp_sink_commit (sink);
+	gst_dream_tcp_sink_batch_unlock (sink);
+	return ret;
+}
+
+static gboolean gst_dream_tcp_sink_event (GstBaseSink * bsink, GstEvent * event)
+{
+	GstDreamTCPSink *sink = GST_DREAM_TCP_SINK (bsink);
+
+	switch (GST_EVENT_TYPE (event)) {
+		case GST_EVENT_EOS:
+			g_mutex_lock (&sink->batch_lock);
+			if (sink->spool_active != DREAM_TCP_SINK_SPOOL_NONE)
+				gst_dream_tcp_sink_commit_spooled (sink);
+			else if (sink->socket)
+				gst_dream_tcp_sink_flush (sink, TRUE);
+			gst_dream_tcp_sink_batch_unlock (sink);
+			break;
+		case GST_EVENT_FLUSH_STOP:
+		{
+			SinkEntry *entry;
+			g_mutex_lock (&sink->batch_lock);
+			while ((entry = g_queue_pop_head (&sink->batch)))
+				gst_dream_tcp_sink_entry_release (sink, entry);
+			sink->batch_bytes = 0;
+			gst_dream_tcp_sink_batch_unlock (sink);
+			break;
+		}
+		default:
+			break;
+	}
+	return GST_BASE_SINK_CLASS (parent_class)->event (bsink, event);
+}
@@ -0,0 +1,155 @@
+/*
+ * GStreamer dreamrtspserver
+ * Copyright 2015-2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * Alternatively, this program may be distributed and executed on
+ * hardware which is licensed by Dream Property GmbH.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifndef __GSTDREAMTCPSINK_H__
+#define __GSTDREAMTCPSINK_H__
+
+#include <gst/gst.h>
+#include <gst/base/gstbasesink.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_DREAM_TCP_SINK              (gst_dream_tcp_sink_get_type ())
+#define GST_IS_DREAM_TCP_SINK(obj)           (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GST_TYPE_DREAM_TCP_SINK))
+#define GST_IS_DREAM_TCP_SINK_CLASS(klass)   (G_TYPE_CHECK_CLASS_TYPE ((klass), GST_TYPE_DREAM_TCP_SINK))
+#define GST_DREAM_TCP_SINK_GET_CLASS(obj)    (G_TYPE_INSTANCE_GET_CLASS ((obj), GST_TYPE_DREAM_TCP_SINK, GstDreamTCPSinkClass))
+#define GST_DREAM_TCP_SINK(obj)              (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_DREAM_TCP_SINK, GstDreamTCPSink))
+#define GST_DREAM_TCP_SINK_CLASS(klass)      (G_TYPE_CHECK_CLASS_CAST ((klass), GST_TYPE_DREAM_TCP_SINK, GstDreamTCPSinkClass))
+#define GST_DREAM_TCP_SINK_CAST(obj)         ((GstDreamTCPSink*)(obj))
+
+#define GST_TYPE_DREAM_TCP_SINK_SPOOL        (gst_dream_tcp_sink_spool_get_type ())
+
+typedef enum {
+	DREAM_TCP_SINK_SPOOL_NONE = 0,     /* block and signal congestion */
+	DREAM_TCP_SINK_SPOOL_MEMORY = 1,   /* keep the backlog in RAM */
+	DREAM_TCP_SINK_SPOOL_DISK = 2      /* keep the backlog in a ring file */
+} GstDreamTCPSinkSpool;
+
+#define DEFAULT_CONGESTION_THRESHOLD    (512*1024)
+#define DEFAULT_DECONGESTION_THRESHOLD  (64*1024)
+#define DEFAULT_BATCH_SIZE              (48*7*188)
+#define DEFAULT_BATCH_LATENCY           (20*GST_MSECOND)
+#define ZEROCOPY_MIN_SIZE               (16*1024)
+#define ZEROCOPY_MAX_PENDING            256
+#define DRAIN_POLL_INTERVAL             (10*G_TIME_SPAN_MILLISECOND)
+#define DEFAULT_SPOOL_LIMIT             (64*1024*1024)
+#define DEFAULT_SPOOL_LOCATION          "/tmp"
+#define SPOOL_ALIGN                     188
+#define SPOOL_CHUNK_SIZE                (48*7*188)
+#define SPOOL_MEMORY_FALLBACK           (4*1024*1024)
+#define RECONNECT_INTERVAL              (2*GST_SECOND)
+#define DEFAULT_PACE_BURST              (64*1024)
+#define PACE_WINDOW                     (1*GST_SECOND)
+#define LINK_SAMPLE_INTERVAL            (50*GST_MSECOND)
+
+typedef struct _GstDreamTCPSink GstDreamTCPSink;
+typedef struct _GstDreamTCPSinkClass GstDreamTCPSinkClass;
+
+struct _GstDreamTCPSink {
+	GstBaseSink parent;
+
+	/* properties */
+	gchar *host;
+	gint port;
+	guint congestion_threshold, decongestion_threshold;
+	gboolean zerocopy;
+	guint batch_size;
+	GstClockTime batch_latency;
+	gchar *handshake;
+	GstDreamTCPSinkSpool spool;
+	guint spool_limit;
+	gchar *spool_location;
+	gboolean pace;
+	guint pace_burst, pace_bitrate;
+
+	/*< private >*/
+	GSocketConnection *connection;
+	GSocket *socket;
+	GCancellable *cancellable;
+	gboolean congested, zerocopy_active;
+	GstClock *clock;
+
+	/* buffers collected for the next sendmsg(). protected by batch_lock, which
+	 * the streaming thread and the latency timeout both take. batch_timeout
+	 * has its own timeout_lock, taken after batch_lock */
+	GMutex batch_lock, timeout_lock;
+	GQueue batch;
+	gsize batch_bytes;
+	GstClockTime batch_start;
+	GstClockID batch_timeout;
+
+	/* queue sizes published on every batch_unlock for readers without the lock */
+	gint queued_bytes, spooled_bytes;
+
+	/* store-and-forward journal. the stream goes through it whenever the
+	 * connection is congested or down, and it's drained as fast as the
+	 * socket takes it. memory mode queues buffers, disk mode keeps a ring
+	 * file of spool_limit bytes. spool_capacity is what the journal takes,
+	 * it's much less than spool_limit when the ring file couldn't be created
+	 * and the backlog has to fall back to RAM. also protected by batch_lock */
+	GstDreamTCPSinkSpool spool_active;
+	gboolean connected, reconnecting;
+	GSocketConnection *reconnection;
+	GstClockTime reconnect_time;
+	GQueue spool_queue;
+	gint spool_fd;
+	gsize spool_read, spool_size, spool_ring, spool_capacity;
+	guint8 *spool_scratch;
+	guint64 spool_dropped;
+	guint packet_offset;
+	gint write_errno;
+
+	/* pacer: a token bucket holding at most pace_burst bytes, refilled at the
+	 * stream's rate as measured between PCRs over PACE_WINDOW (plus 10%
+	 * headroom) or at pace_bitrate if that's set */
+	guint16 pace_pcr_pid;
+	GstClockTime pace_pcr, pace_last, pace_wait;
+	guint64 pace_pcr_bytes, pace_bytes, pace_measured, pace_tokens;
+
+	/* link rate: how fast the socket send queue drains while it stays filled
+	 * between two looks LINK_SAMPLE_INTERVAL apart. the streaming thread
+	 * samples, link_rate and link_samples are read with the object lock */
+	GstClockTime link_time;
+	guint64 link_sent;
+	guint link_unsent, link_rate, link_samples;
+
+	/* buffers the kernel still references because they were sent with MSG_ZEROCOPY */
+	GQueue zerocopy_pending;
+	guint32 zerocopy_next_id;
+
+	guint64 bytes_sent, zerocopy_sends, zerocopy_copied;
+};
+
+struct _GstDreamTCPSinkClass {
+	GstBaseSinkClass parent_class;
+
+	/* signals */
+	void (*congested)   (GstElement *sink);
+	void (*decongested) (GstElement *sink);
+};
+
+GType gst_dream_tcp_sink_get_type (void);
+GType gst_dream_tcp_sink_spool_get_type (void);
+
+guint gst_dream_tcp_sink_get_unsent_bytes (GstDreamTCPSink *sink);
+guint gst_dream_tcp_sink_get_link_rate (GstDreamTCPSink *sink, guint *samples);
+
+G_END_DECLS
+
+#endif /* __GSTDREAMTCPSINK_H__ */
@@ -0,0 +1,848 @@
+/*
+ * GStreamer dreamrtspserver
+ * Copyright 2015-2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * Alternatively, this program may be distributed and executed on
+ * hardware which is licensed by Dream Property GmbH.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+/* single program MPEG-TS muxer for exactly one H.264 and one AAC stream, which
+ * is all the encoder ever delivers. unlike mpegtsmux it doesn't collect the
+ * pads: every access unit is packetized and pushed right away in the streaming
+ * thread it arrived in, so the muxer adds no delay beyond the few packets it
+ * holds back to keep the output aligned. packets are written straight into
+ * pooled buffers, PAT/PMT go out before every IDR and on a timer, the PCR
+ * rides on the video pid */
+
+#include <string.h>
+
+#include "gstdreamtsmux.h"
+#include "dreamts.h"
+
+GST_DEBUG_CATEGORY_STATIC (dream_ts_mux_debug);
+#define GST_CAT_DEFAULT dream_ts_mux_debug
+
+/* packets per pooled buffer, in units of the output alignment */
+#define TS_MUX_CHUNK_UNITS 8
+
+/* timestamps are written as running time plus this, so the dts of frames
+ * which are reordered ahead of the segment start stays positive */
+#define TS_MUX_CLOCK_BASE GST_SECOND
+
+/* what decoders get between a packet's PCR and the decode time of its data.
+ * the PCR trails the leading stream by at most this much, so the other
+ * stream's frames are on time as long as the A/V skew stays below twice it */
+#define TS_MUX_DELAY (100 * GST_MSECOND)
+
+#define TS_MUX_TO_90KHZ(t) (gst_util_uint64_scale ((t), 9, 100000) & G_GUINT64_CONSTANT (0x1FFFFFFFF))
+
+/* pes header with pts and dts plus an adts header */
+#define TS_MUX_PES_HEADER_MAX (19 + 7)
+
+enum
+{
+	PROP_0,
+	PROP_ALIGNMENT,
+	PROP_PCR_INTERVAL,
+	PROP_PSI_INTERVAL,
+	PROP_PACKETS
+};
+
+static GstStaticPadTemplate audiotemplate = GST_STATIC_PAD_TEMPLATE ("audio",
+		GST_PAD_SINK,
+		GST_PAD_ALWAYS,
+		GST_STATIC_CAPS ("audio/mpeg, mpegversion=(int)4, stream-format=(string){ adts, raw }"));
+
+static GstStaticPadTemplate videotemplate = GST_STATIC_PAD_TEMPLATE ("video",
+		GST_PAD_SINK,
+		GST_PAD_ALWAYS,
+		GST_STATIC_CAPS ("video/x-h264, stream-format=(string)byte-stream, alignment=(string)au"));
+
+static GstStaticPadTemplate srctemplate = GST_STATIC_PAD_TEMPLATE ("src",
+		GST_PAD_SRC,
+		GST_PAD_ALWAYS,
+		GST_STATIC_CAPS ("video/mpegts, systemstream=(boolean)true, packetsize=(int)188"));
+
+#define gst_dream_ts_mux_parent_class parent_class
+G_DEFINE_TYPE (GstDreamTSMux, gst_dream_ts_mux, GST_TYPE_ELEMENT);
+
+static void gst_dream_ts_mux_finalize (GObject * object);
+static void gst_dream_ts_mux_set_property (GObject * object, guint prop_id, const GValue * value, GParamSpec * pspec);
+static void gst_dream_ts_mux_get_property (GObject * object, guint prop_id, GValue * value, GParamSpec * pspec);
+static GstStateChangeReturn gst_dream_ts_mux_change_state (GstElement * element, GstStateChange transition);
+static GstFlowReturn gst_dream_ts_mux_chain (GstPad * pad, GstObject * parent, GstBuffer * buffer);
+static gboolean gst_dream_ts_mux_sink_event (GstPad * pad, GstObject * parent, GstEvent * event);
+static gboolean gst_dream_ts_mux_src_event (GstPad * pad, GstObject * parent, GstEvent * event);
+
+static void gst_dream_ts_mux_class_init (GstDreamTSMuxClass * klass)
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+	GstElementClass *gstelement_class = GST_ELEMENT_CLASS (klass);
+
+	gobject_class->finalize = gst_dream_ts_mux_finalize;
+	gobject_class->set_property = gst_dream_ts_mux_set_property;
+	gobject_class->get_property = gst_dream_ts_mux_get_property;
+
+	g_object_class_install_property (gobject_class, PROP_ALIGNMENT,
+		g_param_spec_uint ("alignment", "Alignment", "Number of packets every output buffer is a multiple of",
+			1, 64, TS_PER_FRAME, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_PCR_INTERVAL,
+		g_param_spec_uint ("pcr-interval", "PCR interval", "Maximum time between two PCRs (in ms)",
+			1, 100, DEFAULT_TS_MUX_PCR_INTERVAL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_PSI_INTERVAL,
+		g_param_spec_uint ("psi-interval", "PSI interval", "Maximum time between two PAT/PMT repetitions (in ms), they also precede every IDR",
+			1, 10000, DEFAULT_TS_MUX_PSI_INTERVAL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property (gobject_class, PROP_PACKETS,
+		g_param_spec_uint64 ("packets", "Packets", "Total TS packets muxed",
+			0, G_MAXUINT64, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+	gst_element_class_add_static_pad_template (gstelement_class, &audiotemplate);
+	gst_element_class_add_static_pad_template (gstelement_class, &videotemplate);
+	gst_element_class_add_static_pad_template (gstelement_class, &srctemplate);
+
+	gst_element_class_set_static_metadata (gstelement_class,
+		"Dreambox TS muxer", "Codec/Muxer",
+		"Low latency single program MPEG-TS muxer for H.264 and AAC",
+		"Andreas Frisch <fraxinas@opendreambox.org>");
+
+	gstelement_class->change_state = GST_DEBUG_FUNCPTR (gst_dream_ts_mux_change_state);
+
+	GST_DEBUG_CATEGORY_INIT (dream_ts_mux_debug, "dreamtsmux", 0, "Dreambox TS muxer");
+}
+
+static void gst_dream_ts_mux_stream_init (GstDreamTSMux *mux, GstDreamTSMuxStream *st, GstStaticPadTemplate *templ, guint16 pid, guint8 stream_id)
+{
+	st->pad = gst_pad_new_from_static_template (templ, templ->name_template);
+	gst_pad_set_chain_function (st->pad, GST_DEBUG_FUNCPTR (gst_dream_ts_mux_chain));
+	gst_pad_set_event_function (st->pad, GST_DEBUG_FUNCPTR (gst_dream_ts_mux_sink_event));
+	gst_element_add_pad (GST_ELEMENT (mux), st->pad);
+	st->pid = pid;
+	st->stream_id = stream_id;
+}
+
+static void gst_dream_ts_mux_init (GstDreamTSMux * mux)
+{
+	gst_dream_ts_mux_stream_init (mux, &mux->audio, &audiotemplate, TS_MUX_AUDIO_PID, 0xC0);
+	gst_dream_ts_mux_stream_init (mux, &mux->video, &videotemplate, TS_MUX_VIDEO_PID, 0xE0);
+
+	mux->srcpad = gst_pad_new_from_static_template (&srctemplate, "src");
+	gst_pad_set_event_function (mux->srcpad, GST_DEBUG_FUNCPTR (gst_dream_ts_mux_src_event));
+	gst_pad_use_fixed_caps (mux->srcpad);
+	gst_element_add_pad (GST_ELEMENT (mux), mux->srcpad);
+
+	mux->alignment = TS_PER_FRAME;
+	mux->pcr_interval = DEFAULT_TS_MUX_PCR_INTERVAL;
+	mux->psi_interval = DEFAULT_TS_MUX_PSI_INTERVAL;
+	g_mutex_init (&mux->lock);
+	g_mutex_init (&mux->push_lock);
+}
+
+static void gst_dream_ts_mux_finalize (GObject * object)
+{
+	GstDreamTSMux *mux = GST_DREAM_TS_MUX (object);
+	g_mutex_clear (&mux->lock);
+	g_mutex_clear (&mux->push_lock);
+	G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static void gst_dream_ts_mux_set_property (GObject * object, guint prop_id, const GValue * value, GParamSpec * pspec)
+{
+	GstDreamTSMux *mux = GST_DREAM_TS_MUX (object);
+
+	g_mutex_lock (&mux->lock);
+	switch (prop_id) {
+		case PROP_ALIGNMENT:
+			/* the pool is sized for it */
+			if (mux->pool)
+				GST_WARNING_OBJECT (mux, "alignment can't be changed while running");
+			else
+				mux->alignment = g_value_get_uint (value);
+			break;
+		case PROP_PCR_INTERVAL:
+			mux->pcr_interval = g_value_get_uint (value);
+			break;
+		case PROP_PSI_INTERVAL:
+			mux->psi_interval = g_value_get_uint (value);
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+			break;
+	}
+	g_mutex_unlock (&mux->lock);
+}
+
+static void gst_dream_ts_mux_get_property (GObject * object, guint prop_id, GValue * value, GParamSpec * pspec)
+{
+	GstDreamTSMux *mux = GST_DREAM_TS_MUX (object);
+
+	g_mutex_lock (&mux->lock);
+	switch (prop_id) {
+		case PROP_ALIGNMENT:
+			g_value_set_uint (value, mux->alignment);
+			break;
+		case PROP_PCR_INTERVAL:
+			g_value_set_uint (value, mux->pcr_interval);
+			break;
+		case PROP_PSI_INTERVAL:
+			g_value_set_uint (value, mux->psi_interval);
+			break;
+		case PROP_PACKETS:
+			g_value_set_uint64 (value, mux->packets);
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+			break;
+	}
+	g_mutex_unlock (&mux->lock);
+}
+
+static guint32 _ts_mux_crc32 (const guint8 *data, guint size)
+{
+	guint32 crc = 0xFFFFFFFF;
+	guint i, bit;
+	for (i = 0; i < size; i++)
+	{
+		crc ^= (guint32) data[i] << 24;
+		for (bit = 0; bit < 8; bit++)
+			crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+	}
+	return crc;
+}
+
+static void _ts_mux_put_ts (guint8 *p, guint8 prefix, guint64 ts)
+{
+	p[0] = (prefix << 4) | ((ts >> 29) & 0x0E) | 1;
+	p[1] = (ts >> 22) & 0xFF;
+	p[2] = ((ts >> 14) & 0xFE) | 1;
+	p[3] = (ts >> 7) & 0xFF;
+	p[4] = ((ts << 1) & 0xFE) | 1;
+}
+
+static void _ts_mux_put_pcr (guint8 *p, guint64 base)
+{
+	p[0] = (base >> 25) & 0xFF;
+	p[1] = (base >> 17) & 0xFF;
+	p[2] = (base >> 9) & 0xFF;
+	p[3] = (base >> 1) & 0xFF;
+	p[4] = ((base & 1) << 7) | 0x7E;
+	p[5] = 0;
+}
+
+/* running time on the mux clock, see TS_MUX_CLOCK_BASE */
+static GstClockTime _ts_mux_time (GstDreamTSMuxStream *st, GstClockTime ts)
+{
+	guint64 rt;
+	gint sign;
+
+	if (!GST_CLOCK_TIME_IS_VALID (ts))
+		return GST_CLOCK_TIME_NONE;
+	sign = gst_segment_to_running_time_full (&st->segment, GST_FORMAT_TIME, ts, &rt);
+	if (sign > 0)
+		return TS_MUX_CLOCK_BASE + rt;
+	if (sign < 0 && rt < TS_MUX_CLOCK_BASE)
+		return TS_MUX_CLOCK_BASE - rt;
+	return GST_CLOCK_TIME_NONE;
+}
+
+static void _ts_mux_open_chunk (GstDreamTSMux *mux)
+{
+	if (gst_buffer_pool_acquire_buffer (mux->pool, &mux->chunk, NULL) != GST_FLOW_OK)
+		mux->chunk = gst_buffer_new_allocate (NULL, mux->chunk_packets * TS_PACK_SIZE, NULL);
+	gst_buffer_map (mux->chunk, &mux->map, GST_MAP_WRITE);
+	memcpy (mux->map.data, mux->leftover, mux->n_leftover * TS_PACK_SIZE);
+	mux->fill = mux->n_leftover;
+	mux->n_leftover = 0;
+}
+
+/* moves the chunk to the output list, except for its last keep packets which
+ * are carried over into the next one */
+static void _ts_mux_close_chunk (GstDreamTSMux *mux, guint keep)
+{
+	guint n = mux->fill - keep;
+
+	memcpy (mux->leftover, mux->map.data + n * TS_PACK_SIZE, keep * TS_PACK_SIZE);
+	mux->n_leftover = keep;
+	gst_buffer_unmap (mux->chunk, &mux->map);
+
+	if (n)
+	{
+		GST_BUFFER_PTS (mux->chunk) = GST_BUFFER_DTS (mux->chunk) = mux->last_out;
+		if (!mux->chunk_key)
+			GST_BUFFER_FLAG_SET (mux->chunk, GST_BUFFER_FLAG_DELTA_UNIT);
+		gst_buffer_resize (mux->chunk, 0, n * TS_PACK_SIZE);
+		gst_buffer_list_add (mux->out, mux->chunk);
+		mux->chunk_key = FALSE;
+	}
+	else
+		gst_buffer_unref (mux->chunk);
+	mux->chunk = NULL;
+}
+
+static guint8 *_ts_mux_packet (GstDreamTSMux *mux)
+{
+	if (mux->chunk && mux->fill == mux->chunk_packets)
+		_ts_mux_close_chunk (mux, 0);
+	if (!mux->chunk)
+		_ts_mux_open_chunk (mux);
+	mux->packets++;
+	return mux->map.data + mux->fill++ * TS_PACK_SIZE;
+}
+
+static void _ts_mux_write_psi (GstDreamTSMux *mux)
+{
+	guint8 *p;
+	guint32 crc;
+
+	p = _ts_mux_packet (mux);
+	p[0] = TS_SYNC_BYTE;
+	p[1] = 0x40 | (TS_PID_PAT >> 8);
+	p[2] = TS_PID_PAT & 0xFF;
+	p[3] = 0x10 | (mux->pat_cc++ & 0x0F);
+	p[4] = 0;
+	p[5] = 0x00;
+	p[6] = 0xB0;
+	p[7] = 13;
+	p[8] = 0;
+	p[9] = 1;
+	p[10] = 0xC1;
+	p[11] = 0;
+	p[12] = 0;
+	p[13] = TS_MUX_PROGRAM >> 8;
+	p[14] = TS_MUX_PROGRAM & 0xFF;
+	p[15] = 0xE0 | (TS_MUX_PMT_PID >> 8);
+	p[16] = TS_MUX_PMT_PID & 0xFF;
+	crc = _ts_mux_crc32 (p + 5, 12);
+	GST_WRITE_UINT32_BE (p + 17, crc);
+	memset (p + 21, 0xFF, TS_PACK_SIZE - 21);
+
+	p = _ts_mux_packet (mux);
+	p[0] = TS_SYNC_BYTE;
+	p[1] = 0x40 | (TS_MUX_PMT_PID >> 8);
+	p[2] = TS_MUX_PMT_PID & 0xFF;
+	p[3] = 0x10 | (mux->pmt_cc++ & 0x0F);
+	p[4] = 0;
+	p[5] = 0x02;
+	p[6] = 0xB0;
+	p[7] = 23;
+	p[8] = TS_MUX_PROGRAM >> 8;
+	p[9] = TS_MUX_PROGRAM & 0xFF;
+	p[10] = 0xC1;
+	p[11] = 0;
+	p[12] = 0;
+	p[13] = 0xE0 | (TS_MUX_VIDEO_PID >> 8);
+	p[14] = TS_MUX_VIDEO_PID & 0xFF;
+	p[15] = 0xF0;
+	p[16] = 0;
+	p[17] = TS_STREAM_TYPE_H264;
+	p[18] = 0xE0 | (TS_MUX_VIDEO_PID >> 8);
+	p[19] = TS_MUX_VIDEO_PID & 0xFF;
+	p[20] = 0xF0;
+	p[21] = 0;
+	p[22] = TS_STREAM_TYPE_AAC;
+	p[23] = 0xE0 | (TS_MUX_AUDIO_PID >> 8);
+	p[24] = TS_MUX_AUDIO_PID & 0xFF;
+	p[25] = 0xF0;
+	p[26] = 0;
+	crc = _ts_mux_crc32 (p + 5, 22);
+	GST_WRITE_UINT32_BE (p + 27, crc);
+	memset (p + 31, 0xFF, TS_PACK_SIZE - 31);
+}
+
+/* an adaptation field only packet, for when the PCR is due between two frames */
+static void _ts_mux_write_pcr (GstDreamTSMux *mux, GstClockTime pcr)
+{
+	guint8 *p = _ts_mux_packet (mux);
+	p[0] = TS_SYNC_BYTE;
+	p[1] = TS_MUX_VIDEO_PID >> 8;
+	p[2] = TS_MUX_VIDEO_PID & 0xFF;
+	/* no payload, so the continuity counter repeats the last packet's */
+	p[3] = 0x20 | ((mux->video.cc - 1) & 0x0F);
+	p[4] = TS_PACK_SIZE - 5;
+	p[5] = 0x10;
+	_ts_mux_put_pcr (p + 6, TS_MUX_TO_90KHZ (pcr));
+	memset (p + 12, 0xFF, TS_PACK_SIZE - 12);
+}
+
+static void _ts_mux_write_nulls (GstDreamTSMux *mux, guint count)
+{
+	while (count--)
+	{
+		guint8 *p = _ts_mux_packet (mux);
+		p[0] = TS_SYNC_BYTE;
+		p[1] = TS_PID_NULL >> 8;
+		p[2] = TS_PID_NULL & 0xFF;
+		p[3] = 0x10;
+		memset (p + 4, 0xFF, TS_PACK_SIZE - 4);
+	}
+}
+
+static guint _ts_mux_pes_header (guint8 *h, guint8 stream_id, gsize payload, guint64 pts, guint64 dts)
+{
+	gboolean with_dts = dts != pts;
+	guint size = with_dts ? 10 : 5;
+	/* video pes are unbounded */
+	gsize length = (stream_id & 0xF0) == 0xE0 ? 0 : payload + 3 + size;
+
+	if (length > 0xFFFF)
+		length = 0;
+	h[0] = 0;
+	h[1] = 0;
+	h[2] = 1;
+	h[3] = stream_id;
+	h[4] = length >> 8;
+	h[5] = length & 0xFF;
+	h[6] = 0x84;
+	h[7] = with_dts ? 0xC0 : 0x80;
+	h[8] = size;
+	_ts_mux_put_ts (h + 9, with_dts ? 0x3 : 0x2, pts);
+	if (with_dts)
+		_ts_mux_put_ts (h + 14, 0x1, dts);
+	return 9 + size;
+}
+
+/* packetizes hdr followed by data into the pid of st. the first packet gets
+ * the PCR and the random access indicator, the last one is padded with
+ * adaptation field stuffing */
+static void _ts_mux_write_pes (GstDreamTSMux *mux, GstDreamTSMuxStream *st, const guint8 *hdr, guint hdr_size, const guint8 *data, gsize size, gboolean random_access, GstClockTime pcr)
+{
+	gsize total = hdr_size + size, done = 0;
+	gboolean first = TRUE;
+
+	while (done < total)
+	{
+		guint8 *p = _ts_mux_packet (mux);
+		guint8 flags = 0;
+		guint af = 0;
+		gsize payload, n;
+
+		if (first && random_access)
+			flags |= 0x40;
+		if (first && GST_CLOCK_TIME_IS_VALID (pcr))
+			flags |= 0x10;
+		if (flags)
+			af = (flags & 0x10) ? 8 : 2;
+		payload = MIN (total - done, TS_PACK_SIZE - 4 - af);
+		af = TS_PACK_SIZE - 4 - payload;
+
+		p[0] = TS_SYNC_BYTE;
+		p[1] = (first ? 0x40 : 0) | (st->pid >> 8);
+		p[2] = st->pid & 0xFF;
+		p[3] = (af ? 0x30 : 0x10) | (st->cc++ & 0x0F);
+		if (af)
+		{
+			p[4] = af - 1;
+			if (af > 1)
+			{
+				guint8 *q = p + 6;
+				p[5] = flags;
+				if (flags & 0x10)
+				{
+					_ts_mux_put_pcr (q, TS_MUX_TO_90KHZ (pcr));
+					q += 6;
+				}
+				memset (q, 0xFF, p + 4 + af - q);
+			}
+		}
+
+		p += 4 + af;
+		if (done < hdr_size)
+		{
+			n = MIN (payload, hdr_size - done);
+			memcpy (p, hdr + done, n);
+			p += n;
+			done += n;
+			payload -= n;
+		}
+		memcpy (p, data + done - hdr_size, payload);
+		done += payload;
+		first = FALSE;
+	}
+}
+
+/* called with lock, swaps the output for an empty list and takes push_lock.
+ * the caller releases lock, pushes what's returned (may be NULL) with
+ * _ts_mux_push and then releases push_lock */
+static GstBufferList *_ts_mux_take_out (GstDreamTSMux *mux)
+{
+	GstBufferList *out = NULL;
+
+	if (mux->out && gst_buffer_list_length (mux->out))
+	{
+		out = mux->out;
+		mux->out = gst_buffer_list_new ();
+	}
+	g_mutex_lock (&mux->push_lock);
+	return out;
+}
+
+static GstFlowReturn _ts_mux_push (GstDreamTSMux *mux, GstBufferList *out)
+{
+	if (!out)
+		return GST_FLOW_OK;
+	return gst_pad_push_list (mux->srcpad, out);
+}
+
+/* pads what's held back for the alignment with null packets, so the output
+ * ends exactly at the current access unit */
+static void _ts_mux_flush (GstDreamTSMux *mux)
+{
+	if (!mux->n_leftover)
+		return;
+	_ts_mux_open_chunk (mux);
+	_ts_mux_write_nulls (mux, mux->alignment - mux->fill % mux->alignment);
+	_ts_mux_close_chunk (mux, 0);
+}
+
+static void _ts_mux_start (GstDreamTSMux *mux)
+{
+	gchar *stream_id = gst_pad_create_stream_id (mux->srcpad, GST_ELEMENT_CAST (mux), NULL);
+	GstCaps *caps = gst_caps_new_simple ("video/mpegts", "systemstream", G_TYPE_BOOLEAN, TRUE, "packetsize", G_TYPE_INT, TS_PACK_SIZE, NULL);
+	GstSegment segment;
+
+	gst_pad_push_event (mux->srcpad, gst_event_new_stream_start (stream_id));
+	gst_pad_push_event (mux->srcpad, gst_event_new_caps (caps));
+	gst_segment_init (&segment, GST_FORMAT_TIME);
+	gst_pad_push_event (mux->srcpad, gst_event_new_segment (&segment));
+	gst_caps_unref (caps);
+	g_free (stream_id);
+}
+
+static gboolean _ts_mux_is_eos (GstDreamTSMuxStream *st)
+{
+	return st->eos || !gst_pad_is_linked (st->pad);
+}
+
+/* the PCR follows the stream that's furthest behind, so neither stream's data
+ * shows up after its decode time. streams that haven't started or are done
+ * aren't waited for, and one that stalls holds the clock back by TS_MUX_DELAY
+ * at most */
+static GstClockTime _ts_mux_pcr_clock (GstDreamTSMux *mux)
+{
+	GstDreamTSMuxStream *streams[] = { &mux->audio, &mux->video };
+	GstClockTime lead = GST_CLOCK_TIME_NONE, trail = GST_CLOCK_TIME_NONE;
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (streams); i++)
+	{
+		GstClockTime dts = streams[i]->last_dts;
+		if (!GST_CLOCK_TIME_IS_VALID (dts) || _ts_mux_is_eos (streams[i]))
+			continue;
+		if (!GST_CLOCK_TIME_IS_VALID (lead) || dts > lead)
+			lead = dts;
+		if (!GST_CLOCK_TIME_IS_VALID (trail) || dts < trail)
+			trail = dts;
+	}
+	if (GST_CLOCK_TIME_IS_VALID (lead) && lead > trail + TS_MUX_DELAY)
+		return lead - TS_MUX_DELAY;
+	return trail;
+}
+
+static GstFlowReturn gst_dream_ts_mux_chain (GstPad * pad, GstObject * parent, GstBuffer * buffer)
+{
+	GstDreamTSMux *mux = GST_DREAM_TS_MUX (parent);
+	GstDreamTSMuxStream *st = pad == mux->video.pad ? &mux->video : &mux->audio;
+	gboolean key = st == &mux->video && !GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+	GstClockTime pts, dts, out, clock, pcr = GST_CLOCK_TIME_NONE;
+	guint8 hdr[TS_MUX_PES_HEADER_MAX];
+	guint hdr_size;
+	GstMapInfo map;
+	GstBufferList *list;
+	gboolean start;
+	GstFlowReturn ret;
+
+	pts = _ts_mux_time (st, GST_BUFFER_PTS (buffer));
+	dts = _ts_mux_time (st, GST_BUFFER_DTS (buffer));
+	if (!GST_CLOCK_TIME_IS_VALID (pts))
+	{
+		GST_DEBUG_OBJECT (pad, "dropping buffer without timestamp");
+		gst_buffer_unref (buffer);
+		return GST_FLOW_OK;
+	}
+	if (!GST_CLOCK_TIME_IS_VALID (dts) || dts > pts)
+		dts = pts;
+	if (!gst_buffer_map (buffer, &map, GST_MAP_READ))
+	{
+		gst_buffer_unref (buffer);
+		return GST_FLOW_ERROR;
+	}
+
+	g_mutex_lock (&mux->lock);
+	start = !mux->started;
+	mux->started = TRUE;
+	/* the output is stamped with running time, kept monotonic across the streams */
+	out = dts > TS_MUX_CLOCK_BASE ? dts - TS_MUX_CLOCK_BASE : 0;
+	if (!GST_CLOCK_TIME_IS_VALID (mux->last_out) || out > mux->last_out)
+		mux->last_out = out;
+
+	if (key)
+		mux->chunk_key = TRUE;
+	if (key || !GST_CLOCK_TIME_IS_VALID (mux->last_psi) || dts >= mux->last_psi + mux->psi_interval * GST_MSECOND)
+	{
+		_ts_mux_write_psi (mux);
+		mux->last_psi = dts;
+	}
+	if (!GST_CLOCK_TIME_IS_VALID (st->last_dts) || dts > st->last_dts)
+		st->last_dts = dts;
+	clock = _ts_mux_pcr_clock (mux);
+	if (!GST_CLOCK_TIME_IS_VALID (mux->last_pcr) || (clock > mux->last_pcr && (key || clock >= mux->last_pcr + mux->pcr_interval * GST_MSECOND)))
+	{
+		/* a PCR only packet repeats the video continuity counter, so until
+		 * video has been muxed the PCR waits for the first frame */
+		if (st == &mux->video)
+			pcr = mux->last_pcr = clock;
+		else if (GST_CLOCK_TIME_IS_VALID (mux->video.last_dts))
+		{
+			_ts_mux_write_pcr (mux, clock);
+			mux->last_pcr = clock;
+		}
+	}
+
+	hdr_size = _ts_mux_pes_header (hdr, st->stream_id, map.size + (st->adts ? 7 : 0), TS_MUX_TO_90KHZ (pts + TS_MUX_DELAY), TS_MUX_TO_90KHZ (dts + TS_MUX_DELAY));
+	if (st->adts)
+	{
+		guint8 *h = hdr + hdr_size;
+		gsize length = map.size + 7;
+		memcpy (h, st->adts_header, 7);
+		h[3] |= (length >> 11) & 0x03;
+		h[4] = (length >> 3) & 0xFF;
+		h[5] = ((length & 0x07) << 5) | 0x1F;
+		hdr_size += 7;
+	}
+	_ts_mux_write_pes (mux, st, hdr, hdr_size, map.data, map.size, key, pcr);
+
+	_ts_mux_close_chunk (mux, mux->fill % mux->alignment);
+	list = _ts_mux_take_out (mux);
+	g_mutex_unlock (&mux->lock);
+
+	if (start)
+		_ts_mux_start (mux);
+	ret = _ts_mux_push (mux, list);
+	g_mutex_unlock (&mux->push_lock);
+
+	gst_buffer_unmap (buffer, &map);
+	gst_buffer_unref (buffer);
+	return ret;
+}
+
+/* raw aac is turned into adts, the header is built from the AudioSpecificConfig */
+static gboolean _ts_mux_audio_caps (GstDreamTSMux *mux, GstCaps *caps)
+{
+	GstStructure *s = gst_caps_get_structure (caps, 0);
+	const GValue *codec_data = gst_structure_get_value (s, "codec_data");
+	guint8 *h = mux->audio.adts_header;
+	guint8 profile, rate, channels;
+	GstMapInfo map;
+
+	mux->audio.adts = FALSE;
+	if (g_strcmp0 (gst_structure_get_string (s, "stream-format"), "raw"))
+		return TRUE;
+
+	if (!codec_data || !GST_VALUE_HOLDS_BUFFER (codec_data) || !gst_buffer_map (gst_value_get_buffer (codec_data), &map, GST_MAP_READ))
+	{
+		GST_WARNING_OBJECT (mux, "raw aac without codec_data");
+		return FALSE;
+	}
+	profile = map.size >= 2 ? map.data[0] >> 3 : 0;
+	rate = map.size >= 2 ? ((map.data[0] & 0x07) << 1) | (map.data[1] >> 7) : 0;
+	channels = map.size >= 2 ? (map.data[1] >> 3) & 0x0F : 0;
+	gst_buffer_unmap (gst_value_get_buffer (codec_data), &map);
+	if (profile < 1 || profile > 4 || rate > 12 || channels > 7)
+	{
+		GST_WARNING_OBJECT (mux, "unsupported aac config (profile %u, rate index %u, channels %u)", profile, rate, channels);
+		return FALSE;
+	}
+
+	h[0] = 0xFF;
+	h[1] = 0xF1;
+	h[2] = ((profile - 1) << 6) | (rate << 2) | (channels >> 2);
+	h[3] = (channels & 0x03) << 6;
+	h[4] = 0;
+	h[5] = 0x1F;
+	h[6] = 0xFC;
+	mux->audio.adts = TRUE;
+	return TRUE;
+}
+
+
+static gboolean gst_dream_ts_mux_sink_event (GstPad * pad, GstObject * parent, GstEvent * event)
+{
+	GstDreamTSMux *mux = GST_DREAM_TS_MUX (parent);
+	GstDreamTSMuxStream *st = pad == mux->video.pad ? &mux->video : &mux->audio;
+	gboolean ret = TRUE;
+
+	switch (GST_EVENT_TYPE (event)) {
+		case GST_EVENT_CAPS:
+		{
+			GstCaps *caps;
+			gst_event_parse_caps (event, &caps);
+			if (st == &mux->audio)
+				ret = _ts_mux_audio_caps (mux, caps);
+			break;
+		}
+		case GST_EVENT_SEGMENT:
+		{
+			const GstSegment *segment;
+			gst_event_parse_segment (event, &segment);
+			if (segment->format != GST_FORMAT_TIME)
+			{
+				GST_WARNING_OBJECT (pad, "need a TIME segment");
+				ret = FALSE;
+				break;
+			}
+			g_mutex_lock (&mux->lock);
+			gst_segment_copy_into (segment, &st->segment);
+			g_mutex_unlock (&mux->lock);
+			break;
+		}
+		case GST_EVENT_EOS:
+			g_mutex_lock (&mux->lock);
+			st->eos = TRUE;
+			if (_ts_mux_is_eos (&mux->audio) && _ts_mux_is_eos (&mux->video))
+			{
+				GST_DEBUG_OBJECT (mux, "all streams ended after %" G_GUINT64_FORMAT " packets", mux->packets);
+				_ts_mux_flush (mux);
+				GstBufferList *out = _ts_mux_take_out (mux);
+				g_mutex_unlock (&mux->lock);
+				_ts_mux_push (mux, out);
+				gst_pad_push_event (mux->srcpad, gst_event_new_eos ());
+				g_mutex_unlock (&mux->push_lock);
+				break;
+			}
+			g_mutex_unlock (&mux->lock);
+			break;
+		case GST_EVENT_FLUSH_START:
+			if (st == &mux->video)
+				return gst_pad_push_event (mux->srcpad, event);
+			break;
+		case GST_EVENT_FLUSH_STOP:
+			g_mutex_lock (&mux->lock);
+			gst_segment_init (&st->segment, GST_FORMAT_TIME);
+			st->eos = FALSE;
+			mux->n_leftover = 0;
+			/* out only exists between READY and PAUSED */
+			if (mux->out)
+			{
+				gst_buffer_list_unref (mux->out);
+				mux->out = gst_buffer_list_new ();
+			}
+			g_mutex_unlock (&mux->lock);
+			if (st == &mux->video)
+				return gst_pad_push_event (mux->srcpad, event);
+			break;
+		case GST_EVENT_CUSTOM_DOWNSTREAM:
+			/* h264parse sends it right before the requested IDR. the output
+			 * is cut here so the next segment (e.g. of hlssink) starts clean */
+			if (st == &mux->video && gst_event_has_name (event, "GstForceKeyUnit"))
+			{
+				g_mutex_lock (&mux->lock);
+				if (mux->started)
+				{
+					_ts_mux_flush (mux);
+					GstBufferList *out = _ts_mux_take_out (mux);
+					g_mutex_unlock (&mux->lock);
+					_ts_mux_push (mux, out);
+					ret = gst_pad_push_event (mux->srcpad, event);
+					g_mutex_unlock (&mux->push_lock);
+					return ret;
+				}
+				g_mutex_unlock (&mux->lock);
+			}
+			break;
+		default:
+			break;
+	}
+
+	/* the output's own stream-start, caps and segment are sent with the first buffer */
+	gst_event_unref (event);
+	return ret;
+}
+
+static gboolean gst_dream_ts_mux_src_event (GstPad * pad, GstObject * parent, GstEvent * event)
+{
+	GstDreamTSMux *mux = GST_DREAM_TS_MUX (parent);
+
+	if (GST_EVENT_TYPE (event) == GST_EVENT_CUSTOM_UPSTREAM && gst_event_has_name (event, "GstForceKeyUnit"))
+		return gst_pad_push_event (mux->video.pad, event);
+	return gst_pad_event_default (pad, parent, event);
+}
+
+static void _ts_mux_reset (GstDreamTSMux *mux)
+{
+	GstDreamTSMuxStream *streams[] = { &mux->audio, &mux->video };
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (streams); i++)
+	{
+		gst_segment_init (&streams[i]->segment, GST_FORMAT_TIME);
+		streams[i]->eos = FALSE;
+		streams[i]->cc = 0;
+		streams[i]->last_dts = GST_CLOCK_TIME_NONE;
+	}
+	mux->pat_cc = mux->pmt_cc = 0;
+	mux->last_pcr = mux->last_psi = mux->last_out = GST_CLOCK_TIME_NONE;
+	mux->chunk_key = FALSE;
+	mux->n_leftover = 0;
+	mux->started = FALSE;
+	mux->packets = 0;
+}
+
+static void _ts_mux_setup (GstDreamTSMux *mux)
+{
+	GstStructure *config;
+
+	g_mutex_lock (&mux->lock);
+	_ts_mux_reset (mux);
+	mux->chunk_packets = mux->alignment * TS_MUX_CHUNK_UNITS;
+	mux->leftover = g_malloc (mux->alignment * TS_PACK_SIZE);
+	mux->out = gst_buffer_list_new ();
+	mux->pool = gst_buffer_pool_new ();
+	config = gst_buffer_pool_get_config (mux->pool);
+	gst_buffer_pool_config_set_params (config, NULL, mux->chunk_packets * TS_PACK_SIZE, 4, 0);
+	gst_buffer_pool_set_config (mux->pool, config);
+	gst_buffer_pool_set_active (mux->pool, TRUE);
+	g_mutex_unlock (&mux->lock);
+}
+
+static void _ts_mux_teardown (GstDreamTSMux *mux)
+{
+	g_mutex_lock (&mux->lock);
+	if (mux->chunk)
+	{
+		gst_buffer_unmap (mux->chunk, &mux->map);
+		gst_buffer_unref (mux->chunk);
+		mux->chunk = NULL;
+	}
+	gst_buffer_list_unref (mux->out);
+	mux->out = NULL;
+	gst_buffer_pool_set_active (mux->pool, FALSE);
+	gst_object_unref (mux->pool);
+	mux->pool = NULL;
+	g_free (mux->leftover);
+	mux->leftover = NULL;
+	g_mutex_unlock (&mux->lock);
+}
+
+static GstStateChangeReturn gst_dream_ts_mux_change_state (GstElement * element, GstStateChange transition)
+{
+	GstDreamTSMux *mux = GST_DREAM_TS_MUX (element);
+	GstStateChangeReturn ret;
+
+	if (transition == GST_STATE_CHANGE_READY_TO_PAUSED)
+		_ts_mux_setup (mux);
+
+	ret = GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+
+	if (transition == GST_STATE_CHANGE_PAUSED_TO_READY)
+		_ts_mux_teardown (mux);
+	return ret;
+}
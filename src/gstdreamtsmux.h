@@ -0,0 +1,91 @@
+/*
+ * GStreamer dreamrtspserver
+ * Copyright 2015-2016 Andreas Frisch <fraxinas@opendreambox.org>
+ *
+ * This program is licensed under the Creative Commons
+ * Attribution-NonCommercial-ShareAlike 3.0 Unported
+ * License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-nc-sa/3.0/ or send a letter to
+ * Creative Commons,559 Nathan Abbott Way,Stanford,California 94305,USA.
+ *
+ * Alternatively, this program may be distributed and executed on
+ * hardware which is licensed by Dream Property GmbH.
+ *
+ * This program is NOT free software. It is open source, you are allowed
+ * to modify it (if you keep the license), but it may not be commercially
+ * distributed other than under the conditions noted above.
+ */
+
+#ifndef __GSTDREAMTSMUX_H__
+#define __GSTDREAMTSMUX_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_DREAM_TS_MUX              (gst_dream_ts_mux_get_type ())
+#define GST_IS_DREAM_TS_MUX(obj)           (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GST_TYPE_DREAM_TS_MUX))
+#define GST_DREAM_TS_MUX(obj)              (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_DREAM_TS_MUX, GstDreamTSMux))
+#define GST_DREAM_TS_MUX_CAST(obj)         ((GstDreamTSMux*)(obj))
+
+#define DEFAULT_TS_MUX_PCR_INTERVAL 40   /* ms */
+#define DEFAULT_TS_MUX_PSI_INTERVAL 100  /* ms */
+
+#define TS_MUX_PMT_PID   0x0020
+#define TS_MUX_VIDEO_PID 0x0041
+#define TS_MUX_AUDIO_PID 0x0042
+#define TS_MUX_PROGRAM   1
+
+typedef struct _GstDreamTSMux GstDreamTSMux;
+typedef struct _GstDreamTSMuxClass GstDreamTSMuxClass;
+
+typedef struct {
+	GstPad *pad;
+	guint16 pid;
+	guint8 stream_id, cc;
+	GstSegment segment;
+	GstClockTime last_dts;
+	gboolean eos;
+	/* raw aac gets this adts header in front of every frame */
+	gboolean adts;
+	guint8 adts_header[7];
+} GstDreamTSMuxStream;
+
+struct _GstDreamTSMux {
+	GstElement parent;
+
+	GstPad *srcpad;
+	GstDreamTSMuxStream audio, video;
+
+	/* properties */
+	guint alignment, pcr_interval, psi_interval;
+
+	/*< private >*/
+	GMutex lock;
+	/* held from taking the output until it's pushed, so the streams' lists
+	 * leave in the order they were muxed without holding lock downstream */
+	GMutex push_lock;
+	GstBufferPool *pool;
+	guint chunk_packets;
+	GstBuffer *chunk;
+	GstMapInfo map;
+	guint fill;
+	gboolean chunk_key;
+	GstBufferList *out;
+	guint8 *leftover;
+	guint n_leftover;
+	guint8 pat_cc, pmt_cc;
+	GstClockTime last_pcr, last_psi, last_out;
+	gboolean started;
+	guint64 packets;
+};
+
+struct _GstDreamTSMuxClass {
+	GstElementClass parent_class;
+};
+
+GType gst_dream_ts_mux_get_type (void);
+
+G_END_DECLS
+
+#endif /* __GSTDREAMTSMUX_H__ */
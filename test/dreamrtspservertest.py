@@ -1,5 +1,11 @@
 #!/usr/bin/python
 import dbus
+import socket
+import time
+try:
+	from urllib2 import urlopen
+except ImportError:
+	from urllib.request import urlopen
 
 class StreamServerControl(object):
 	INTERFACE = 'com.dreambox.RTSPserver'
@@ -13,6 +19,24 @@ class StreamServerControl(object):
 	PROP_RTSP_STATE = 'rtspState'
 	PROP_UPSTREAM_STATE = 'upstreamState'
 	PROP_AUTO_BITRATE = 'autoBitrate'
+	PROP_UPSTREAM_LATENCY = 'upstreamLatency'
+	PROP_UPSTREAM_BATCH_SIZE = 'upstreamBatchSize'
+	PROP_UPSTREAM_PACE_BURST = 'upstreamPaceBurst'
+	PROP_UPSTREAM_SPOOL = 'upstreamSpool'
+	PROP_UPSTREAM_SPOOL_LIMIT = 'upstreamSpoolLimit'
+	PROP_UPSTREAM_ENCODER = 'upstreamEncoder'
+	PROP_UPSTREAM_LADDER = 'upstreamLadder'
+	PROP_UPSTREAM_RUNG = 'upstreamRung'
+	PROP_STANDBY = 'standby'
+	PROP_SOURCE_STATE = 'sourceState'
+	PROP_SOURCE_TRANSITION_TIME = 'sourceTransitionTime'
+	PROP_INPUT_SWITCH_TIME = 'inputSwitchTime'
+	PROP_SLATE = 'slate'
+	PROP_CHANNELS = 'channels'
+	PROP_SUBSTREAM = 'substream'
+	PROP_SUBSTREAM_BITRATE = 'substreamBitrate'
+	PROP_SUBSTREAM_WIDTH = 'substreamWidth'
+	PROP_SUBSTREAM_HEIGHT = 'substreamHeight'
 
 	FRAME_RATE_25 = 25
 	FRAME_RATE_30 = 30
@@ -27,8 +51,12 @@ class StreamServerControl(object):
 	[HLS_STATE_DISABLED, HLS_STATE_IDLE, HLS_STATE_RUNNING] = range(3)
 	[RTSP_STATE_DISABLED, RTSP_STATE_IDLE, RTSP_STATE_RUNNING] = range(3)
 	[UPSTREAM_STATE_DISABLED, UPSTREAM_STATE_CONNECTING, UPSTREAM_STATE_WAITING, UPSTREAM_STATE_TRANSMITTING, UPSTREAM_STATE_OVERLOAD] = range(5)
+	[STANDBY_OFF, STANDBY_PAUSED, STANDBY_RUNNING] = range(3)
+	[SOURCE_STATE_STOPPED, SOURCE_STATE_SUSPENDED, SOURCE_STATE_PAUSED, SOURCE_STATE_RUNNING] = range(1, 5)
 
-	def __init__(self):
+	def __init__(self, channel=0):
+		if channel:
+			self.OBJECT = '%s/%d' % (self.OBJECT, channel + 1)
 		self.reconnect()
 
 	def reconnect(self):
@@ -51,6 +79,44 @@ class StreamServerControl(object):
 	def getUpstreamState(self):
 		return self._getProperty(self.PROP_UPSTREAM_STATE)
 
+	def getSourceState(self):
+		return self._getProperty(self.PROP_SOURCE_STATE)
+
+	def getSourceTransitionTime(self):
+		return self._getProperty(self.PROP_SOURCE_TRANSITION_TIME)
+
+	def getInputSwitchTime(self):
+		return self._getProperty(self.PROP_INPUT_SWITCH_TIME)
+
+	def getSlate(self):
+		return self._getProperty(self.PROP_SLATE)
+
+	def getChannels(self):
+		return self._getProperty(self.PROP_CHANNELS)
+
+	def getSubstream(self):
+		return self._getProperty(self.PROP_SUBSTREAM)
+
+	def setSubstream(self, enabled):
+		self._setProperty(self.PROP_SUBSTREAM, enabled)
+	substream = property(getSubstream, setSubstream)
+
+	def getSubstreamBitrate(self):
+		return self._getProperty(self.PROP_SUBSTREAM_BITRATE)
+
+	def setSubstreamBitrate(self, kbps):
+		self._setProperty(self.PROP_SUBSTREAM_BITRATE, kbps)
+	substreamBitrate = property(getSubstreamBitrate, setSubstreamBitrate)
+
+	def getSubstreamResolution(self):
+		x = self._getProperty(self.PROP_SUBSTREAM_WIDTH)
+		y = self._getProperty(self.PROP_SUBSTREAM_HEIGHT)
+		return x, y
+
+	def setSubstreamResolution(self, xres, yres):
+		self._interface.setSubstreamResolution(xres, yres)
+	substreamResolution = property(getSubstreamResolution, setSubstreamResolution)
+
 	def getInputMode(self):
 		return self._getProperty(self.PROP_INPUT_MODE)
 
@@ -95,11 +161,150 @@ class StreamServerControl(object):
 		self._setProperty(self.PROP_AUTO_BITRATE, enable)
 	autoBitrate = property(getAutoBitrate, setAutoBitrate)
 
+	def getStandby(self):
+		return self._getProperty(self.PROP_STANDBY)
+
+	def setStandby(self, mode):
+		self._setProperty(self.PROP_STANDBY, mode)
+	standby = property(getStandby, setStandby)
+
+	def getUpstreamLatency(self):
+		return self._getProperty(self.PROP_UPSTREAM_LATENCY)
+
+	def setUpstreamLatency(self, ms):
+		self._setProperty(self.PROP_UPSTREAM_LATENCY, ms)
+	upstreamLatency = property(getUpstreamLatency, setUpstreamLatency)
+
+	def getUpstreamBatchSize(self):
+		return self._getProperty(self.PROP_UPSTREAM_BATCH_SIZE)
+
+	def setUpstreamBatchSize(self, size):
+		self._setProperty(self.PROP_UPSTREAM_BATCH_SIZE, size)
+	upstreamBatchSize = property(getUpstreamBatchSize, setUpstreamBatchSize)
+
+	def getUpstreamPaceBurst(self):
+		return self._getProperty(self.PROP_UPSTREAM_PACE_BURST)
+
+	def setUpstreamPaceBurst(self, kilobytes):
+		self._setProperty(self.PROP_UPSTREAM_PACE_BURST, kilobytes)
+	upstreamPaceBurst = property(getUpstreamPaceBurst, setUpstreamPaceBurst)
+
+	def getUpstreamSpool(self):
+		return self._getProperty(self.PROP_UPSTREAM_SPOOL)
+
+	def setUpstreamSpool(self, spool):
+		self._setProperty(self.PROP_UPSTREAM_SPOOL, spool)
+	upstreamSpool = property(getUpstreamSpool, setUpstreamSpool)
+
+	def getUpstreamSpoolLimit(self):
+		return self._getProperty(self.PROP_UPSTREAM_SPOOL_LIMIT)
+
+	def setUpstreamSpoolLimit(self, megabytes):
+		self._setProperty(self.PROP_UPSTREAM_SPOOL_LIMIT, megabytes)
+	upstreamSpoolLimit = property(getUpstreamSpoolLimit, setUpstreamSpoolLimit)
+
+	def getUpstreamEncoder(self):
+		return self._getProperty(self.PROP_UPSTREAM_ENCODER)
+
+	def setUpstreamEncoder(self, encoder):
+		self._setProperty(self.PROP_UPSTREAM_ENCODER, encoder)
+	upstreamEncoder = property(getUpstreamEncoder, setUpstreamEncoder)
+
+	def getUpstreamLadder(self):
+		return self._getProperty(self.PROP_UPSTREAM_LADDER)
+
+	def setUpstreamLadder(self, ladder):
+		self._setProperty(self.PROP_UPSTREAM_LADDER, ladder)
+	upstreamLadder = property(getUpstreamLadder, setUpstreamLadder)
+
+	def getUpstreamRung(self):
+		return self._getProperty(self.PROP_UPSTREAM_RUNG)
+	upstreamRung = property(getUpstreamRung)
+
 	def _getProperty(self, prop):
 		return self._proxy.Get(self.INTERFACE, prop, dbus_interface=dbus.PROPERTIES_IFACE)
 
 	def _setProperty(self, prop, val):
 		self._proxy.Set(self.INTERFACE, prop, val, dbus_interface=dbus.PROPERTIES_IFACE)
 
+# the checks below run against a daemon started with --channels 2 on a box
+# with a running source. each raises AssertionError on a failure
+
+HOST = '127.0.0.1'
+RTSP_PORT = 8554
+HLS_PORT = 8080
+HLS_FRAGMENT_DURATION = 2
+
+def rtspDescribe(path, port=RTSP_PORT):
+	s = socket.create_connection((HOST, port), 10)
+	s.sendall(('DESCRIBE rtsp://%s:%d%s RTSP/1.0\r\nCSeq: 1\r\nAccept: application/sdp\r\n\r\n' % (HOST, port, path)).encode())
+	reply = s.recv(4096).decode('latin-1')
+	s.close()
+	return reply
+
+def httpGet(path, port=HLS_PORT):
+	return urlopen('http://%s:%d%s' % (HOST, port, path), timeout=3 * HLS_FRAGMENT_DURATION + 5).read().decode('latin-1')
+
+def checkSharedListeners():
+	"""both channels are served from one rtsp and one hls listener"""
+	ctrls = [StreamServerControl(0), StreamServerControl(1)]
+	for c in ctrls:
+		assert c.enableRTSP(True, '', RTSP_PORT)
+		assert c.enableHLS(True, HLS_PORT)
+	for path in ('/stream', '/stream2'):
+		reply = rtspDescribe(path)
+		assert reply.startswith('RTSP/1.0 200'), (path, reply)
+	for prefix in ('', '/2'):
+		assert httpGet(prefix + '/master.m3u8').startswith('#EXTM3U'), prefix
+	# the listener stays up for the channel still using it
+	assert ctrls[1].enableRTSP(False)
+	reply = rtspDescribe('/stream')
+	assert reply.startswith('RTSP/1.0 200'), reply
+	for c in ctrls:
+		c.enableRTSP(False)
+		c.enableHLS(False)
+
+def checkSubstream():
+	"""the substream is served as rtsp mounts and as second hls variant"""
+	c = StreamServerControl()
+	assert c.enableRTSP(True, '', RTSP_PORT)
+	assert c.enableHLS(True, HLS_PORT)
+	c.substream = True
+	for path in ('/stream-low', '/stream-low-es'):
+		reply = rtspDescribe(path)
+		assert reply.startswith('RTSP/1.0 200'), (path, reply)
+	master = httpGet('/master.m3u8')
+	assert master.count('#EXT-X-STREAM-INF:') == 2, master
+	assert '\ndream.m3u8\n' in master and '\nlow/dream.m3u8\n' in master, master
+	assert httpGet('/low/dream.m3u8').startswith('#EXTM3U')
+	c.substream = False
+	assert httpGet('/master.m3u8').count('#EXT-X-STREAM-INF:') == 1
+	c.enableRTSP(False)
+	c.enableHLS(False)
+
+def checkDiscontinuity():
+	"""a resolution switch marks the fragment after it as discontinuous"""
+	c = StreamServerControl()
+	assert c.enableHLS(True, HLS_PORT)
+	xres, yres = c.resolution
+	assert '#EXT-X-DISCONTINUITY\n' not in httpGet('/dream.m3u8')
+	c.setResolution(*(c.RES_720 if xres != 1280 else c.RES_PAL))
+	time.sleep(3 * HLS_FRAGMENT_DURATION)
+	playlist = httpGet('/dream.m3u8')
+	assert '#EXT-X-DISCONTINUITY\n' in playlist, playlist
+	c.setResolution(xres, yres)
+	c.enableHLS(False)
+
+def checkRtspReprepare():
+	"""a mount comes back after its last client left and its media was unprepared"""
+	c = StreamServerControl()
+	assert c.enableRTSP(True, '', RTSP_PORT)
+	for i in range(3):
+		for path in ('/stream', '/stream-es'):
+			reply = rtspDescribe(path)
+			assert reply.startswith('RTSP/1.0 200'), (i, path, reply)
+		time.sleep(1)
+	c.enableRTSP(False)
+
 ctrl = StreamServerControl()
 #ctrl.enableRTSP(True, "stream", 8554)
\ No newline at end of file
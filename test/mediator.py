@@ -0,0 +1,343 @@
+#!/usr/bin/python
+# stands in for the mediator on loopback so the upstream state machine and the
+# bitrate adaptation can be exercised without the real service. it accepts the
+# token, consumes the TS through a scripted bandwidth profile and records the
+# upstream state changes and tcpBitrate signals of the running dreamrtspserver.
+#
+# a profile is a comma separated list of steps seconds:kbit/s[:delay ms].
+# 0 kbit/s stalls the connection, 'inf' doesn't limit it. the delay is
+# emulated in the mediator: received data sits in a delay line and at most
+# one bandwidth-delay product of it is held before reading stops, so the
+# sender sees the same backpressure it would on a long link.
+#
+# usage: mediator.py [--profile 20:inf,30:2000,10:0,30:inf] [--log events.csv]
+#        [--set upstreamPaceBurst=128] [--check]
+#        mediator.py --listen-only --port 9000
+
+from __future__ import print_function
+
+import argparse
+import collections
+import socket
+import sys
+import threading
+import time
+
+import dbus
+from dbus.mainloop.glib import DBusGMainLoop
+try:
+	from gi.repository import GLib
+except ImportError:
+	import gobject as GLib
+
+INTERFACE = 'com.dreambox.RTSPserver'
+OBJECT = '/com/dreambox/RTSPserver'
+TOKEN_LEN = 36
+TS_PACK_SIZE = 188
+TICK = 0.01
+MIN_WINDOW = 64 * 1024
+
+UPSTREAM_STATES = {0: 'DISABLED', 1: 'CONNECTING', 2: 'WAITING', 3: 'TRANSMITTING', 4: 'OVERLOAD', 5: 'ADJUSTING', 9: 'FAILED'}
+
+Step = collections.namedtuple('Step', 'duration kbps delay')
+
+def parse_profile(spec):
+	steps = []
+	for item in spec.replace('\n', ',').split(','):
+		item = item.split('#')[0].strip()
+		if not item:
+			continue
+		fields = item.split(':')
+		if len(fields) not in (2, 3):
+			raise ValueError('bad profile step %r, expected seconds:kbit/s[:delay ms]' % item)
+		kbps = None if fields[1] in ('inf', '-') else int(fields[1])
+		delay = int(fields[2]) / 1000.0 if len(fields) == 3 else 0.0
+		steps.append(Step(float(fields[0]), kbps, delay))
+	if not steps:
+		raise ValueError('empty profile')
+	return steps
+
+class Profile(object):
+	def __init__(self, steps):
+		self.steps = steps
+		self.start = None
+		self.duration = sum(s.duration for s in steps)
+
+	def begin(self):
+		self.start = time.time()
+
+	def current(self, now=None):
+		"""returns (index, step) for the given time, the last step holds once the profile is through"""
+		if self.start is None:
+			return 0, self.steps[0]
+		elapsed = (now or time.time()) - self.start
+		for i, step in enumerate(self.steps):
+			if elapsed < step.duration:
+				return i, step
+			elapsed -= step.duration
+		return len(self.steps) - 1, self.steps[-1]
+
+class Mediator(threading.Thread):
+	def __init__(self, profile, port=0, rcvbuf=64 * 1024, token=None):
+		threading.Thread.__init__(self)
+		self.daemon = True
+		self.profile = profile
+		self.expected_token = token
+		self.sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+		self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+		# a small receive buffer lets the shaping reach the sender quickly
+		self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, rcvbuf)
+		self.sock.bind(('127.0.0.1', port))
+		self.sock.listen(1)
+		self.port = self.sock.getsockname()[1]
+		self.lock = threading.Lock()
+		self.connections = 0
+		self.bad_tokens = 0
+		self.received = 0
+		self.delivered = 0
+		self.sync_errors = 0
+
+	def run(self):
+		while True:
+			conn, addr = self.sock.accept()
+			with self.lock:
+				self.connections += 1
+			try:
+				if self.read_token(conn):
+					self.consume(conn)
+			except socket.error as e:
+				print('mediator: connection from %s:%d broke: %s' % (addr[0], addr[1], e), file=sys.stderr)
+			conn.close()
+
+	def read_token(self, conn):
+		conn.settimeout(10)
+		token = b''
+		while len(token) < TOKEN_LEN:
+			data = conn.recv(TOKEN_LEN - len(token))
+			if not data:
+				return False
+			token += data
+		conn.settimeout(None)
+		if self.expected_token and token.decode('ascii', 'replace') != self.expected_token:
+			with self.lock:
+				self.bad_tokens += 1
+			print('mediator: rejecting bad token %r' % token, file=sys.stderr)
+			return False
+		return True
+
+	def consume(self, conn):
+		conn.setblocking(False)
+		line = collections.deque()
+		held = offset = 0
+		allowance = 0.0
+		last = time.time()
+		while True:
+			time.sleep(TICK)
+			now = time.time()
+			step = self.profile.current(now)[1]
+			while line and line[0][0] <= now:
+				with self.lock:
+					self.delivered += line[0][1]
+				held -= line.popleft()[1]
+
+			if step.kbps is None:
+				budget = 1 << 20
+			else:
+				# don't bank bandwidth across a stall, the bucket holds two ticks at most
+				allowance = min(allowance + step.kbps * 125.0 * (now - last), max(step.kbps * 125.0 * 2 * TICK, TS_PACK_SIZE))
+				budget = int(allowance)
+			last = now
+			if step.delay:
+				window = max(MIN_WINDOW, (step.kbps or 0) * 125 * step.delay) if step.kbps is not None else 1 << 24
+				budget = min(budget, int(window - held))
+
+			while budget > 0:
+				try:
+					data = conn.recv(min(budget, 256 * 1024))
+				except socket.error:
+					break
+				if not data:
+					return
+				budget -= len(data)
+				if step.kbps is not None:
+					allowance -= len(data)
+				offset = self.check_sync(data, offset)
+				with self.lock:
+					self.received += len(data)
+				if step.delay:
+					line.append((now + step.delay, len(data)))
+					held += len(data)
+				else:
+					with self.lock:
+						self.delivered += len(data)
+
+	def check_sync(self, data, offset):
+		"""offset is where the next packet starts relative to data, returns it for the following chunk"""
+		pos = offset
+		while pos < len(data):
+			if data[pos:pos + 1] != b'\x47':
+				with self.lock:
+					self.sync_errors += 1
+				# resync on the next sync byte
+				nxt = data.find(b'\x47', pos + 1)
+				if nxt < 0:
+					return 0
+				pos = nxt
+			pos += TS_PACK_SIZE
+		return pos - len(data)
+
+class Recorder(object):
+	def __init__(self, bus, mediator, profile, log=None):
+		self.mediator = mediator
+		self.profile = profile
+		self.events = []
+		self.state = None
+		self.log = open(log, 'w') if log else None
+		if self.log:
+			print('time,event,value,step,limit_kbps', file=self.log)
+		self.start = time.time()
+		self.last_delivered = 0
+		for signal in ('upstreamStateChanged', 'tcpBitrate', 'upstreamRungChanged', 'encoderError'):
+			bus.add_signal_receiver(self.make_handler(signal), signal_name=signal, dbus_interface=INTERFACE, path=OBJECT)
+
+	def make_handler(self, signal):
+		return lambda *args: self.record(signal, int(args[0]) if args else 0)
+
+	def record(self, event, value):
+		now = time.time()
+		index, step = self.profile.current(now)
+		if event == 'upstreamStateChanged':
+			self.state = value
+			print('%7.2f upstream %s' % (now - self.start, UPSTREAM_STATES.get(value, value)))
+		self.events.append((now - self.start, event, value, index))
+		if self.log:
+			print('%.3f,%s,%d,%d,%s' % (now - self.start, event, value, index, step.kbps if step.kbps is not None else ''), file=self.log)
+			self.log.flush()
+
+	def sample(self):
+		with self.mediator.lock:
+			delivered = self.mediator.delivered
+		self.record('mediatorKbps', (delivered - self.last_delivered) * 8 // 1000)
+		self.last_delivered = delivered
+		return True
+
+	def summary(self, end):
+		states = collections.defaultdict(float)
+		last_t, last_state = 0.0, None
+		for t, event, value, index in self.events:
+			if event != 'upstreamStateChanged':
+				continue
+			if last_state is not None:
+				states[last_state] += t - last_t
+			last_t, last_state = t, value
+		if last_state is not None:
+			states[last_state] += end - last_t
+		transitions = [e for e in self.events if e[1] == 'upstreamStateChanged']
+
+		print()
+		print('state transitions: %d' % len(transitions))
+		for state, secs in sorted(states.items()):
+			print('  %-12s %7.1f s' % (UPSTREAM_STATES.get(state, state), secs))
+		print('%4s %8s %8s %10s %10s %10s' % ('step', 'secs', 'limit', 'tcpBitrate', 'delivered', 'overloads'))
+		for i, step in enumerate(self.profile.steps):
+			print('%4d %8.1f %8s %10s %10s %10d' % (i, step.duration, step.kbps if step.kbps is not None else 'inf',
+				self.step_mean(i, 'tcpBitrate') or '-', self.step_mean(i, 'mediatorKbps') or '-',
+				len([e for e in transitions if e[3] == i and e[2] == 4])))
+		print('connections %d, bad tokens %d, sync errors %d, %d bytes received' % (self.mediator.connections,
+			self.mediator.bad_tokens, self.mediator.sync_errors, self.mediator.received))
+
+	def step_mean(self, index, event, tail=1.0):
+		"""mean of an event's values over the last tail fraction of a profile step"""
+		values = [e for e in self.events if e[1] == event and e[3] == index]
+		if not values:
+			return None
+		values = values[int(len(values) * (1.0 - tail)):]
+		return sum(e[2] for e in values) // len(values)
+
+	def check(self, settle):
+		"""regression checks: the stream got through, stayed packet aligned and the
+		reported bitrate settled below every limit that lasted long enough"""
+		failures = []
+		if not any(e[1] == 'upstreamStateChanged' and e[2] == 3 for e in self.events):
+			failures.append('upstream never reached TRANSMITTING')
+		if self.mediator.bad_tokens:
+			failures.append('%d connections with a bad token' % self.mediator.bad_tokens)
+		if self.mediator.sync_errors:
+			failures.append('%d TS sync errors' % self.mediator.sync_errors)
+		for i, step in enumerate(self.profile.steps):
+			if not step.kbps or step.duration <= 2 * settle:
+				continue
+			tail = 1.0 - settle / step.duration
+			mean = self.step_mean(i, 'tcpBitrate', tail)
+			if mean is not None and mean > step.kbps * 1.1:
+				failures.append('step %d: tcpBitrate %d kbit/s still above the %d kbit/s limit after %d s' % (i, mean, step.kbps, settle))
+		return failures
+
+def parse_value(text):
+	if text.lower() in ('true', 'false'):
+		return dbus.Boolean(text.lower() == 'true')
+	try:
+		return dbus.Int32(int(text))
+	except ValueError:
+		return dbus.String(text)
+
+def main():
+	parser = argparse.ArgumentParser()
+	parser.add_argument('--profile', default='20:inf,30:2000,10:0,30:inf', help='seconds:kbit/s[:delay ms],... (see top of file)')
+	parser.add_argument('--profile-file', help='read the profile from a file, one step per line')
+	parser.add_argument('--port', type=int, default=0, help='port to listen on (default: any)')
+	parser.add_argument('--rcvbuf', type=int, default=64 * 1024, help='receive buffer of the mediator socket')
+	parser.add_argument('--token', default='B' * TOKEN_LEN, help='token to hand to enableUpstream and expect')
+	parser.add_argument('--set', action='append', default=[], metavar='PROP=VALUE', help='set a D-Bus property before enabling the upstream')
+	parser.add_argument('--log', help='write all events as csv')
+	parser.add_argument('--listen-only', action='store_true', help="don't touch the server, just be a mediator")
+	parser.add_argument('--check', action='store_true', help='fail unless the adaptation behaved (see Recorder.check)')
+	parser.add_argument('--settle', type=int, default=15, help='seconds the bitrate may take to settle below a limit')
+	args = parser.parse_args()
+
+	steps = parse_profile(open(args.profile_file).read() if args.profile_file else args.profile)
+	profile = Profile(steps)
+	mediator = Mediator(profile, args.port, args.rcvbuf, args.token)
+	mediator.start()
+	print('mediator listening on 127.0.0.1:%d, profile runs %d s' % (mediator.port, profile.duration))
+
+	if args.listen_only:
+		profile.begin()
+		try:
+			while True:
+				time.sleep(1)
+		except KeyboardInterrupt:
+			pass
+		return 0
+
+	DBusGMainLoop(set_as_default=True)
+	bus = dbus.SystemBus()
+	proxy = bus.get_object(INTERFACE, OBJECT)
+	iface = dbus.Interface(proxy, INTERFACE)
+	for assignment in args.set:
+		prop, value = assignment.split('=', 1)
+		proxy.Set(INTERFACE, prop, parse_value(value), dbus_interface=dbus.PROPERTIES_IFACE)
+
+	loop = GLib.MainLoop()
+	recorder = Recorder(bus, mediator, profile, args.log)
+	profile.begin()
+	iface.enableUpstream(True, '127.0.0.1', dbus.UInt32(mediator.port), args.token)
+	GLib.timeout_add_seconds(1, recorder.sample)
+	GLib.timeout_add(int(profile.duration * 1000), loop.quit)
+	try:
+		loop.run()
+	except KeyboardInterrupt:
+		pass
+	end = time.time() - recorder.start
+	iface.enableUpstream(False, '', dbus.UInt32(0), '')
+
+	recorder.summary(end)
+	if args.check:
+		failures = recorder.check(args.settle)
+		for failure in failures:
+			print('FAIL: %s' % failure)
+		return 1 if failures else 0
+	return 0
+
+if __name__ == '__main__':
+	sys.exit(main())
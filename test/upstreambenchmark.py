@@ -0,0 +1,110 @@
+#!/usr/bin/python
+# measures write syscalls per second and CPU load of the dreamrtspserver process
+# while it streams to a local dummy mediator at several bitrates, once with
+# the upstream sink writing every buffer and once with batched writes.
+# packets/call is how many 188 byte TS packets went out per write syscall.
+#
+# needs root (strace -p) and a dreamrtspserver built with --with-upstream.
+# usage: upstreambenchmark.py [--duration 20] [--bitrates 2000,5000,10000,20000]
+
+from __future__ import print_function
+
+import argparse
+import os
+import re
+import signal
+import socket
+import subprocess
+import threading
+import time
+
+import dbus
+
+INTERFACE = 'com.dreambox.RTSPserver'
+OBJECT = '/com/dreambox/RTSPserver'
+TOKEN = 'B' * 36
+TS_PACKET = 188
+WRITE_SYSCALLS = ('write', 'writev', 'sendmsg', 'sendto')
+
+class DummyMediator(threading.Thread):
+	def __init__(self):
+		threading.Thread.__init__(self)
+		self.daemon = True
+		self.sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+		self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+		self.sock.bind(('127.0.0.1', 0))
+		self.sock.listen(1)
+		self.port = self.sock.getsockname()[1]
+		self.received = 0
+
+	def run(self):
+		while True:
+			conn, addr = self.sock.accept()
+			while True:
+				data = conn.recv(256 * 1024)
+				if not data:
+					break
+				self.received += len(data)
+			conn.close()
+
+def server_pid():
+	out = subprocess.check_output(['pidof', 'dreamrtspserver']).split()
+	return int(out[0])
+
+def cpu_seconds(pid):
+	with open('/proc/%d/stat' % pid) as f:
+		fields = f.read().rsplit(')', 1)[1].split()
+	# utime and stime are fields 14 and 15, counted from the pid
+	return (int(fields[11]) + int(fields[12])) / float(os.sysconf('SC_CLK_TCK'))
+
+def count_syscalls(pid, duration):
+	proc = subprocess.Popen(['strace', '-f', '-c', '-e', 'trace=' + ','.join(WRITE_SYSCALLS), '-p', str(pid)],
+		stdout=subprocess.PIPE, stderr=subprocess.PIPE, universal_newlines=True)
+	time.sleep(duration)
+	proc.send_signal(signal.SIGINT)
+	err = proc.communicate()[1]
+	calls = {}
+	for line in err.splitlines():
+		m = re.match(r'\s*[\d.]+\s+[\d.]+\s+\d+\s+(\d+)\s+(?:\d+\s+)?(\w+)$', line)
+		if m and m.group(2) in WRITE_SYSCALLS:
+			calls[m.group(2)] = int(m.group(1))
+	return calls
+
+def main():
+	parser = argparse.ArgumentParser()
+	parser.add_argument('--duration', type=int, default=20, help='seconds to measure per run')
+	parser.add_argument('--warmup', type=int, default=10, help='seconds to wait after enabling upstream')
+	parser.add_argument('--bitrates', default='2000,5000,10000,20000', help='video bitrates in kbit/s')
+	parser.add_argument('--batch', type=int, default=48 * 7 * 188, help='batched write size in bytes')
+	args = parser.parse_args()
+
+	bus = dbus.SystemBus()
+	proxy = bus.get_object(INTERFACE, OBJECT)
+	iface = dbus.Interface(proxy, INTERFACE)
+	setprop = lambda prop, val: proxy.Set(INTERFACE, prop, val, dbus_interface=dbus.PROPERTIES_IFACE)
+
+	mediator = DummyMediator()
+	mediator.start()
+	pid = server_pid()
+	setprop('autoBitrate', False)
+
+	print('%8s %8s %10s %10s %12s %8s' % ('kbit/s', 'batch', 'syscalls/s', 'kbyte/s', 'packets/call', 'cpu %'))
+	for bitrate in [int(b) for b in args.bitrates.split(',')]:
+		setprop('videoBitrate', dbus.Int32(bitrate))
+		for batch in (0, args.batch):
+			setprop('upstreamBatchSize', dbus.Int32(batch))
+			iface.enableUpstream(True, '127.0.0.1', dbus.UInt32(mediator.port), TOKEN)
+			time.sleep(args.warmup)
+			# cpu is sampled before attaching strace, which slows the process down
+			received, cpu = mediator.received, cpu_seconds(pid)
+			time.sleep(args.duration)
+			received, cpu = mediator.received - received, cpu_seconds(pid) - cpu
+			calls = count_syscalls(pid, args.duration)
+			iface.enableUpstream(False, '', dbus.UInt32(0), '')
+			syscalls = sum(calls.values())
+			print('%8d %8d %10.1f %10.1f %12.1f %8.1f' % (bitrate, batch, syscalls / float(args.duration),
+				received / 1024.0 / args.duration, received / float(TS_PACKET) / max(syscalls, 1), 100.0 * cpu / args.duration))
+			time.sleep(2)
+
+if __name__ == '__main__':
+	main()